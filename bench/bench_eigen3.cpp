@@ -0,0 +1,105 @@
+///   @file bench_eigen3.cpp
+///   @brief  Compare the speed of the two ways to diagonalize many 3x3
+///           symmetric matrices (eg. the Hessian at every voxel):
+///           DiagonalizeFlatSym3() (one matrix at a time), and
+///           DiagonalizeFlatSym3Batch() (many matrices at a time).
+///   Usage:  bench_eigen3 [num_matrices]
+
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+using namespace std;
+
+#include <eigen3_simple.hpp>
+using namespace visfd;
+using namespace visfd::selfadjoint_eigen3;
+
+
+
+int main(int argc, char **argv) {
+  size_t n = 4000000;
+  if (argc > 1)
+    n = atol(argv[1]);
+
+  // Generate some random symmetric matrices (stored in both formats).
+  // A few of them have degenerate eigenvalues.
+  mt19937 rand_gen(1);
+  normal_distribution<float> gauss(0.0, 1.0);
+  vector<float> vFlat(6*n);    // one matrix after another
+  vector<float> vSoA[6];       // "structure of arrays" format
+  for (int k = 0; k < 6; k++)
+    vSoA[k].resize(n);
+  for (size_t i = 0; i < n; i++) {
+    for (int k = 0; k < 6; k++)
+      vFlat[6*i + k] = gauss(rand_gen);
+    if (i % 100 == 0) {
+      vFlat[6*i + 1] = vFlat[6*i + 0];
+      vFlat[6*i + 3] = vFlat[6*i + 4] = vFlat[6*i + 5] = 0.0;
+    }
+    for (int k = 0; k < 6; k++)
+      vSoA[k][i] = vFlat[6*i + k];
+  }
+
+  // Method 1: one matrix at a time
+  vector<float> vDiag(6*n);
+  auto t0 = chrono::steady_clock::now();
+  #pragma omp parallel for
+  for (size_t i = 0; i < n; i++)
+    DiagonalizeFlatSym3(&vFlat[6*i], &vDiag[6*i]);
+  auto t1 = chrono::steady_clock::now();
+
+  // Method 2: many matrices at a time
+  float const *aSource[6];
+  for (int k = 0; k < 6; k++)
+    aSource[k] = vSoA[k].data();
+  vector<float> vEivals[3];
+  vector<float> vEivects[3][3];
+  float *aEivals[3];
+  float *aaEivects[3][3];
+  for (int d = 0; d < 3; d++) {
+    vEivals[d].resize(n);
+    aEivals[d] = vEivals[d].data();
+    for (int e = 0; e < 3; e++) {
+      vEivects[e][d].resize(n);
+      aaEivects[e][d] = vEivects[e][d].data();
+    }
+  }
+  const size_t CHUNK = 4096;
+  auto t2 = chrono::steady_clock::now();
+  #pragma omp parallel for
+  for (size_t i_begin = 0; i_begin < n; i_begin += CHUNK) {
+    size_t m = std::min(CHUNK, n - i_begin);
+    float const *aSourceChunk[6];
+    float *aEivalsChunk[3];
+    float *aaEivectsChunk[3][3];
+    for (int k = 0; k < 6; k++)
+      aSourceChunk[k] = aSource[k] + i_begin;
+    for (int d = 0; d < 3; d++) {
+      aEivalsChunk[d] = aEivals[d] + i_begin;
+      for (int e = 0; e < 3; e++)
+        aaEivectsChunk[e][d] = aaEivects[e][d] + i_begin;
+    }
+    DiagonalizeFlatSym3Batch(m, aSourceChunk, aEivalsChunk, aaEivectsChunk);
+  }
+  auto t3 = chrono::steady_clock::now();
+
+  // Check that both methods agree
+  double max_diff = 0.0;
+  for (size_t i = 0; i < n; i++)
+    for (int d = 0; d < 3; d++)
+      max_diff = std::max(max_diff,
+                          std::abs(double(vDiag[6*i + d]) - vEivals[d][i]));
+
+  double time_scalar = chrono::duration<double>(t1 - t0).count();
+  double time_batch = chrono::duration<double>(t3 - t2).count();
+  cout << "number of matrices:              " << n << "\n"
+       << "DiagonalizeFlatSym3() time:      " << time_scalar << " s\n"
+       << "DiagonalizeFlatSym3Batch() time: " << time_batch << " s\n"
+       << "speedup:                         " << time_scalar / time_batch << "\n"
+       << "max eigenvalue difference:       " << max_diff << endl;
+  return 0;
+}
@@ -0,0 +1,351 @@
+///   @file bench_kernels.cpp
+///   @brief  Measure the speed of the major visfd kernels on an artificial
+///           tomogram (see synthetic_volume.hpp), using 1, 2, 4, ... threads.
+///           Each kernel is run several times (after a few warm-up runs).
+///           The results are printed in JSON format, so that they can be
+///           compared with earlier results (to detect regressions).
+///
+///   Usage:  bench_kernels [-size N] [-reps R] [-warmup W]
+///                         [-max-threads T] [-only KERNEL_NAME] [-json FILE]
+///
+///   The "gigabytes_per_second" reported for each kernel is the (nominal)
+///   size of the images it reads and writes, divided by the time.  It is a
+///   lower bound on the memory bandwidth used (because most kernels read
+///   their input more than once).
+
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <array>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <limits>
+using namespace std;
+
+#ifndef DISABLE_OPENMP
+#include <omp.h>       // (OpenMP-specific)
+#endif
+
+#include <visfd.hpp>
+using namespace visfd;
+#include "synthetic_volume.hpp"
+
+
+
+/// @brief  A kernel to be timed, and the amount of work it performs
+struct Kernel {
+  string name;
+  double num_voxels;        //!< number of voxels processed (0 if N/A)
+  double num_bytes;         //!< nominal bytes read and written (0 if N/A)
+  function<void()> run;     //!< invoke the kernel once
+};
+
+
+
+/// @brief  Run a kernel (num_warmup + num_reps) times.
+///         Return the times of the last num_reps runs (sorted).
+static vector<double>
+TimeKernel(const Kernel &kernel, int num_warmup, int num_reps)
+{
+  for (int i = 0; i < num_warmup; i++)
+    kernel.run();
+  vector<double> times;
+  for (int i = 0; i < num_reps; i++) {
+    auto t0 = chrono::steady_clock::now();
+    kernel.run();
+    auto t1 = chrono::steady_clock::now();
+    times.push_back(chrono::duration<double>(t1 - t0).count());
+  }
+  sort(times.begin(), times.end());
+  return times;
+}
+
+
+
+static string
+JsonNumberOrNull(double x) {
+  if ((x <= 0.0) || std::isinf(x) || std::isnan(x))
+    return "null";
+  stringstream ss;
+  ss.precision(6);
+  ss << x;
+  return ss.str();
+}
+
+
+
+int main(int argc, char **argv) {
+  int width = 128;
+  int num_reps = 3;
+  int num_warmup = 1;
+  int max_threads = 1;
+  #ifndef DISABLE_OPENMP
+  max_threads = omp_get_max_threads();
+  #endif
+  string only_kernel = "";
+  string json_file_name = "";
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (i+1 >= argc) {
+      cerr << "Error: The \"" << arg << "\" argument is missing a value.\n";
+      return 1;
+    }
+    if (arg == "-size")
+      width = atoi(argv[++i]);
+    else if (arg == "-reps")
+      num_reps = atoi(argv[++i]);
+    else if (arg == "-warmup")
+      num_warmup = atoi(argv[++i]);
+    else if (arg == "-max-threads")
+      max_threads = atoi(argv[++i]);
+    else if (arg == "-only")
+      only_kernel = argv[++i];
+    else if (arg == "-json")
+      json_file_name = argv[++i];
+    else {
+      cerr << "Error: Unrecognized argument: \"" << arg << "\"\n";
+      return 1;
+    }
+  }
+  if ((width < 8) || (num_reps < 1) || (num_warmup < 0) || (max_threads < 1)) {
+    cerr << "Error: invalid argument value.\n";
+    return 1;
+  }
+
+  int image_size[3] = {width, width, width};
+  double N = double(width) * width * width;
+  const float SIGMA = 2.0;
+  float const *const *const *NO_MASK = nullptr;
+
+  // ---- Prepare the input images ----
+  cerr << "generating a " << width << "^3 synthetic tomogram..." << endl;
+  float *afSource;
+  float ***aaafSource;
+  Alloc3D(image_size, &afSource, &aaafSource);
+  SyntheticVolumeParams params;
+  params.num_blobs = static_cast<int>(N / 10000) + 1;
+  GenerateSyntheticVolume(image_size, aaafSource, params);
+
+  // (scratch arrays used for storing the output of the kernels)
+  float *afOut;
+  float ***aaafOut;
+  Alloc3D(image_size, &afOut, &aaafOut);
+  int *aiLabels;
+  int ***aaaiLabels;
+  Alloc3D(image_size, &aiLabels, &aaaiLabels);
+  CompactMultiChannelImage3D<float> tensors(6, image_size);
+
+  // Some kernels need a blurred image, or the "saliency" of each voxel
+  // (its planar ridge score) and the direction of the ridge.
+  float *afBlurred;
+  float ***aaafBlurred;
+  Alloc3D(image_size, &afBlurred, &aaafBlurred);
+  ApplyGauss(image_size, aaafSource, aaafBlurred, NO_MASK, SIGMA, 2.5f);
+  float *afSaliency;
+  float ***aaafSaliency;
+  Alloc3D(image_size, &afSaliency, &aaafSaliency);
+  array<float,3> *aafDirection;
+  array<float,3> ***aaaafDirection;
+  Alloc3D(image_size, &aafDirection, &aaaafDirection);
+  CalcHessianPlanarScore(image_size,
+                         aaafSource,
+                         aaafSaliency,
+                         aaaafDirection,
+                         static_cast<float ****>(nullptr),
+                         NO_MASK,
+                         SIGMA);
+  // Only the most salient 5% of the voxels cast votes (or form clusters)
+  vector<float> vSaliency(afSaliency, afSaliency + size_t(N));
+  size_t i_threshold = static_cast<size_t>(0.95 * (vSaliency.size() - 1));
+  nth_element(vSaliency.begin(), vSaliency.begin() + i_threshold,
+              vSaliency.end());
+  float saliency_threshold = vSaliency[i_threshold];
+  vSaliency.clear();
+  vSaliency.shrink_to_fit();
+
+  // BlobDog() results (used as the input for DiscardOverlappingBlobs())
+  vector<float> blob_sigmas;
+  for (float s = 1.5; s <= 4.0; s *= 1.15)
+    blob_sigmas.push_back(s);
+  vector<array<float,3> > blob_crds;
+  vector<float> blob_diameters;
+  vector<float> blob_scores;
+  // (Keep every local minimum.  Thresholds are disabled.)
+  auto RunBlobDog = [&](vector<array<float,3> > &crds,
+                        vector<float> &sigmas,
+                        vector<float> &scores) {
+    vector<array<float,3> > maxima_crds;
+    vector<float> maxima_sigmas;
+    vector<float> maxima_scores;
+    BlobDog(image_size, aaafSource, NO_MASK, blob_sigmas,
+            &crds, &maxima_crds,
+            &sigmas, &maxima_sigmas,
+            &scores, &maxima_scores,
+            0.02f,  // delta_sigma_over_sigma
+            2.8f,   // truncate_ratio
+            std::numeric_limits<float>::infinity(),  // minima_threshold
+            -std::numeric_limits<float>::infinity(), // maxima_threshold
+            false); // use_threshold_ratios
+  };
+  RunBlobDog(blob_crds, blob_diameters, blob_scores);
+  for (size_t i = 0; i < blob_diameters.size(); i++)
+    blob_diameters[i] *= 2.0*sqrt(3.0); // (convert from σ to diameter)
+
+  // ---- Define the kernels ----
+  vector<Kernel> kernels;
+
+  kernels.push_back(Kernel{"ApplyGauss", N, 8*N, [&]() {
+        ApplyGauss(image_size, aaafSource, aaafOut, NO_MASK, SIGMA, 2.5f);
+      }});
+
+  Filter1D<float, int> aFilter1D[3];
+  for (int d = 0; d < 3; d++)
+    aFilter1D[d] = GenFilterGauss1D(SIGMA, static_cast<int>(2.5*SIGMA));
+  kernels.push_back(Kernel{"ApplySeparable", N, 8*N, [&]() {
+        ApplySeparable(image_size, aaafSource, aaafOut, NO_MASK, aFilter1D);
+      }});
+
+  float filter3d_width[3] = {1.0, 1.0, 1.0};
+  Filter3D<float, int> filter3d = GenFilterGenGauss3D(filter3d_width, 2.0f,
+                                                      2.5f);
+  filter3d.convolve_method = CONVOLVE_DIRECT;
+  kernels.push_back(Kernel{"Filter3D::Apply", N, 8*N, [&]() {
+        filter3d.Apply(image_size, aaafSource, aaafOut, NO_MASK, false);
+      }});
+
+  kernels.push_back(Kernel{"BlobDog", N, 4*N, [&]() {
+        vector<array<float,3> > crds;
+        vector<float> sigmas;
+        vector<float> scores;
+        RunBlobDog(crds, sigmas, scores);
+      }});
+
+  kernels.push_back(Kernel{"CalcHessian", N, (4 + 6*4)*N, [&]() {
+        CalcHessian(image_size,
+                    aaafSource,
+                    static_cast<float ****>(nullptr),
+                    tensors.aaaafI,
+                    NO_MASK,
+                    SIGMA);
+      }});
+
+  TV3D<float, int, array<float,3>, float*> tv(SIGMA, 4);
+  kernels.push_back(Kernel{"TV3D", N, (4 + 12 + 6*4)*N, [&]() {
+        tv.TVDenseStick(image_size,
+                        aaafSaliency,
+                        aaaafDirection,
+                        tensors.aaaafI,
+                        NO_MASK,
+                        NO_MASK,
+                        false,  // (detect surfaces, not curves)
+                        saliency_threshold,
+                        true,   // (normalize near the image boundaries)
+                        false); // (don't diagonalize the tensors)
+      }});
+
+  kernels.push_back(Kernel{"Watershed", N, 8*N, [&]() {
+        Watershed<float, int, int>(image_size,
+                                   aaafBlurred,
+                                   aaaiLabels,
+                                   NO_MASK);
+      }});
+
+  kernels.push_back(Kernel{"ClusterConnected", N, (4 + 12 + 4)*N, [&]() {
+        ClusterConnected<float, int, int, array<float,3>, float*>
+          (image_size,
+           aaafSaliency,
+           aaaiLabels,
+           NO_MASK,
+           saliency_threshold,
+           0,      // label_undefined
+           false,  // undefined_label_is_max
+           aaaafDirection,
+           -std::numeric_limits<float>::infinity(),
+           0.707,  // threshold_vector_neighbor
+           false); // consider_dot_product_sign
+      }});
+
+  kernels.push_back(Kernel{"DiscardOverlappingBlobs", 0.0, 0.0, [&]() {
+        vector<array<float,3> > crds = blob_crds;
+        vector<float> diameters = blob_diameters;
+        vector<float> scores = blob_scores;
+        DiscardOverlappingBlobs(crds, diameters, scores, 1.0f);
+      }});
+
+  // ---- Run them ----
+  vector<int> thread_counts;
+  for (int t = 1; t < max_threads; t *= 2)
+    thread_counts.push_back(t);
+  thread_counts.push_back(max_threads);
+
+  stringstream json;
+  json << "{\n"
+       << "  \"benchmark\": \"bench_kernels\",\n"
+       << "  \"image_size\": [" << width << ", " << width << ", " << width
+       << "],\n"
+       << "  \"num_blobs_for_discard\": " << blob_crds.size() << ",\n"
+       << "  \"warmup\": " << num_warmup << ",\n"
+       << "  \"reps\": " << num_reps << ",\n"
+       << "  \"results\": [";
+  bool first_result = true;
+
+  for (size_t k = 0; k < kernels.size(); k++) {
+    if ((only_kernel != "") && (kernels[k].name != only_kernel))
+      continue;
+    double time_1_thread = 0.0;
+    for (size_t j = 0; j < thread_counts.size(); j++) {
+      int num_threads = thread_counts[j];
+      #ifndef DISABLE_OPENMP
+      omp_set_num_threads(num_threads);
+      #endif
+      cerr << "  " << kernels[k].name << ", " << num_threads
+           << " threads..." << flush;
+      vector<double> times = TimeKernel(kernels[k], num_warmup, num_reps);
+      double t_min = times.front();
+      double t_median = times[times.size() / 2];
+      if (j == 0)
+        time_1_thread = t_median;
+      cerr << " " << t_median << " s" << endl;
+
+      json << (first_result ? "\n" : ",\n")
+           << "    {\"kernel\": \"" << kernels[k].name << "\""
+           << ", \"threads\": " << num_threads
+           << ", \"time_min_s\": " << JsonNumberOrNull(t_min)
+           << ", \"time_median_s\": " << JsonNumberOrNull(t_median)
+           << ", \"voxels_per_second\": "
+           << JsonNumberOrNull(kernels[k].num_voxels / t_median)
+           << ", \"gigabytes_per_second\": "
+           << JsonNumberOrNull(kernels[k].num_bytes / t_median * 1.0e-9)
+           << ", \"speedup\": " << JsonNumberOrNull(time_1_thread / t_median)
+           << "}";
+      first_result = false;
+    }
+  }
+  json << "\n  ]\n}\n";
+
+  if (json_file_name != "") {
+    ofstream json_file(json_file_name.c_str());
+    if (! json_file) {
+      cerr << "Error: unable to open \"" << json_file_name << "\"\n";
+      return 1;
+    }
+    json_file << json.str();
+  }
+  else
+    cout << json.str();
+
+  Dealloc3D(image_size, &afSource, &aaafSource);
+  Dealloc3D(image_size, &afOut, &aaafOut);
+  Dealloc3D(image_size, &aiLabels, &aaaiLabels);
+  Dealloc3D(image_size, &afBlurred, &aaafBlurred);
+  Dealloc3D(image_size, &afSaliency, &aaafSaliency);
+  Dealloc3D(image_size, &aafDirection, &aaaafDirection);
+  return 0;
+}
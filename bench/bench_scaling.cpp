@@ -0,0 +1,125 @@
+///   @file bench_scaling.cpp
+///   @brief  Measure how the speed of two full-volume filters, ApplyGauss()
+///           and CalcHessianPlanarScore(), scales with the number of threads
+///           (1, 2, 4, ... up to max_threads).  For each thread count, the
+///           images are allocated (and first touched) again using that many
+///           threads, as they would be by a program running with that many
+///           threads.  On NUMA machines, run this with OMP_PROC_BIND=close
+///           (and OMP_PLACES=cores) so that threads do not migrate.
+///   Usage:  bench_scaling [image_width] [max_threads]
+
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <algorithm>
+using namespace std;
+
+#ifndef DISABLE_OPENMP
+#include <omp.h>       // (OpenMP-specific)
+#endif
+
+#include <alloc3d.hpp>
+#include <volume_arena.hpp>
+#include <filter3d.hpp>
+#include <feature.hpp>
+using namespace visfd;
+
+
+
+// Run both filters once.  Return the time spent in each of them (in seconds).
+static void
+RunFilters(int const image_size[3],
+           float const *const *const *aaafSource,
+           double &time_gauss,
+           double &time_hessian)
+{
+  float *afDest;
+  float ***aaafDest;
+  Alloc3D(image_size, &afDest, &aaafDest);
+
+  auto t0 = chrono::steady_clock::now();
+  ApplyGauss(image_size,
+             aaafSource,
+             aaafDest,
+             static_cast<float const *const *const *>(nullptr),
+             2.0f);
+  auto t1 = chrono::steady_clock::now();
+  CalcHessianPlanarScore(image_size,
+                         aaafSource,
+                         aaafDest,
+                         static_cast<float ****>(nullptr),
+                         static_cast<float ****>(nullptr),
+                         static_cast<float const *const *const *>(nullptr),
+                         2.0f);
+  auto t2 = chrono::steady_clock::now();
+
+  Dealloc3D(image_size, &afDest, &aaafDest);
+  time_gauss = chrono::duration<double>(t1 - t0).count();
+  time_hessian = chrono::duration<double>(t2 - t1).count();
+}
+
+
+
+int main(int argc, char **argv) {
+  int width = 256;
+  int max_threads = 128;
+  if (argc > 1)
+    width = atoi(argv[1]);
+  if (argc > 2)
+    max_threads = atoi(argv[2]);
+  int image_size[3] = {width, width, width};
+  double num_voxels = double(width) * width * width;
+
+  cout << "image size: " << width << "^3 voxels\n"
+       << " threads   ApplyGauss(s)  speedup  (Mvoxels/s)   CalcHessianPlanarScore(s)  speedup\n";
+
+  double time_gauss_1 = 0.0;
+  double time_hessian_1 = 0.0;
+  for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    #ifndef DISABLE_OPENMP
+    omp_set_num_threads(num_threads);
+    #else
+    if (num_threads > 1)
+      break;
+    #endif
+
+    // Return all of the memory from the previous round to the system, so
+    // that the new images are first touched by this many threads.
+    VolumeArena::Global().Trim(0);
+
+    // Fill the source image with noise
+    float *afSource;
+    float ***aaafSource;
+    Alloc3D(image_size, &afSource, &aaafSource);
+    #pragma omp parallel for collapse(2)
+    for (int iz = 0; iz < image_size[2]; iz++) {
+      for (int iy = 0; iy < image_size[1]; iy++) {
+        mt19937 rand_gen(iz*image_size[1] + iy);
+        normal_distribution<float> gauss(0.0, 1.0);
+        for (int ix = 0; ix < image_size[0]; ix++)
+          aaafSource[iz][iy][ix] = gauss(rand_gen);
+      }
+    }
+
+    double time_gauss, time_hessian;
+    RunFilters(image_size, aaafSource, time_gauss, time_hessian); // warm-up
+    RunFilters(image_size, aaafSource, time_gauss, time_hessian);
+    Dealloc3D(image_size, &afSource, &aaafSource);
+
+    if (num_threads == 1) {
+      time_gauss_1 = time_gauss;
+      time_hessian_1 = time_hessian;
+    }
+    cout << setw(8) << num_threads
+         << setw(15) << time_gauss
+         << setw(9) << time_gauss_1 / time_gauss
+         << setw(13) << num_voxels / time_gauss * 1.0e-6
+         << setw(28) << time_hessian
+         << setw(9) << time_hessian_1 / time_hessian
+         << endl;
+  }
+  return 0;
+}
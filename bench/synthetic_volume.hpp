@@ -0,0 +1,137 @@
+///   @file synthetic_volume.hpp
+///   @brief  Generate simple artificial tomograms (containing blobs,
+///           membranes, and noise) of any size, for benchmarking.
+
+#ifndef _SYNTHETIC_VOLUME_HPP
+#define _SYNTHETIC_VOLUME_HPP
+
+#include <cmath>
+#include <vector>
+#include <array>
+#include <random>
+#include <algorithm>
+using namespace std;
+
+
+
+/// @brief  The contents of the image created by GenerateSyntheticVolume().
+///         Distances are in voxels.  Blobs and membranes are dark (negative),
+///         as they are in most cryo-EM tomograms.
+
+struct SyntheticVolumeParams {
+  int num_blobs;             //!< number of (spherical) blobs
+  float blob_radius_min;     //!< range of blob radii
+  float blob_radius_max;
+  int num_membranes;         //!< number of closed (spherical) membranes
+  float membrane_thickness;  //!< width (σ) of the membrane cross section
+  float noise;               //!< standard deviation of the noise
+  unsigned int seed;         //!< random number seed
+
+  SyntheticVolumeParams():
+    num_blobs(200),
+    blob_radius_min(2.0),
+    blob_radius_max(6.0),
+    num_membranes(3),
+    membrane_thickness(1.5),
+    noise(0.5),
+    seed(1)
+  { }
+};
+
+
+
+/// @brief  Fill aaafDest with an artificial image.  The result only depends
+///         on the image size and the parameters (not the number of threads).
+///         The locations and radii of the blobs are returned (if requested).
+
+inline void
+GenerateSyntheticVolume(int const image_size[3], //!< #voxels in xyz
+                        float ***aaafDest, //!< store the image here
+                        const SyntheticVolumeParams &params,
+                        vector<array<float,3> > *pBlobCrds = nullptr, //!< optional: blob locations
+                        vector<float> *pBlobRadii = nullptr //!< optional: blob radii
+                        )
+{
+  mt19937 rand_gen(params.seed);
+  uniform_real_distribution<float> uniform(0.0, 1.0);
+
+  vector<array<float,3> > blob_crds(params.num_blobs);
+  vector<float> blob_radii(params.num_blobs);
+  for (int i = 0; i < params.num_blobs; i++) {
+    for (int d = 0; d < 3; d++)
+      blob_crds[i][d] = uniform(rand_gen) * image_size[d];
+    blob_radii[i] = (params.blob_radius_min +
+                     uniform(rand_gen) * (params.blob_radius_max -
+                                          params.blob_radius_min));
+  }
+  int min_size = std::min(image_size[0], std::min(image_size[1],
+                                                  image_size[2]));
+  vector<array<float,3> > membrane_centers(params.num_membranes);
+  vector<float> membrane_radii(params.num_membranes);
+  for (int i = 0; i < params.num_membranes; i++) {
+    for (int d = 0; d < 3; d++)
+      membrane_centers[i][d] = (0.25 + 0.5*uniform(rand_gen)) * image_size[d];
+    membrane_radii[i] = (0.1 + 0.2*uniform(rand_gen)) * min_size;
+  }
+
+  // Add the noise.  (Each row uses its own random number generator, so
+  // the rows can be filled in parallel.)
+  #pragma omp parallel for collapse(2)
+  for (int iz = 0; iz < image_size[2]; iz++) {
+    for (int iy = 0; iy < image_size[1]; iy++) {
+      mt19937 row_gen(params.seed + 1 + iz*image_size[1] + iy);
+      normal_distribution<float> gauss(0.0, params.noise);
+      for (int ix = 0; ix < image_size[0]; ix++)
+        aaafDest[iz][iy][ix] = gauss(row_gen);
+    }
+  }
+
+  // Add the membranes
+  float inv_width_sq = 1.0 / (2.0 * params.membrane_thickness *
+                              params.membrane_thickness);
+  #pragma omp parallel for collapse(2)
+  for (int iz = 0; iz < image_size[2]; iz++) {
+    for (int iy = 0; iy < image_size[1]; iy++) {
+      for (int ix = 0; ix < image_size[0]; ix++) {
+        for (int i = 0; i < params.num_membranes; i++) {
+          float dx = ix - membrane_centers[i][0];
+          float dy = iy - membrane_centers[i][1];
+          float dz = iz - membrane_centers[i][2];
+          float r = sqrt(dx*dx + dy*dy + dz*dz) - membrane_radii[i];
+          aaafDest[iz][iy][ix] -= exp(-r*r*inv_width_sq);
+        }
+      }
+    }
+  }
+
+  // Add the blobs (each one only effects the voxels nearby)
+  for (int i = 0; i < params.num_blobs; i++) {
+    float R = blob_radii[i];
+    int w = static_cast<int>(ceil(2.0*R));
+    int lo[3], hi[3];
+    for (int d = 0; d < 3; d++) {
+      lo[d] = std::max(static_cast<int>(blob_crds[i][d]) - w, 0);
+      hi[d] = std::min(static_cast<int>(blob_crds[i][d]) + w, image_size[d]-1);
+    }
+    for (int iz = lo[2]; iz <= hi[2]; iz++) {
+      for (int iy = lo[1]; iy <= hi[1]; iy++) {
+        for (int ix = lo[0]; ix <= hi[0]; ix++) {
+          float dx = ix - blob_crds[i][0];
+          float dy = iy - blob_crds[i][1];
+          float dz = iz - blob_crds[i][2];
+          float r_sq = dx*dx + dy*dy + dz*dz;
+          aaafDest[iz][iy][ix] -= exp(-r_sq / (R*R));
+        }
+      }
+    }
+  }
+
+  if (pBlobCrds)
+    *pBlobCrds = blob_crds;
+  if (pBlobRadii)
+    *pBlobRadii = blob_radii;
+} //GenerateSyntheticVolume()
+
+
+
+#endif //#ifndef _SYNTHETIC_VOLUME_HPP
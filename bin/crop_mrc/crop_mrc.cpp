@@ -29,20 +29,28 @@ int main(int argc, char **argv) {
     int zmax = atoi(argv[8]);
     if (zmax < zmin) throw InputErr("Error zmin > zmax\n");
 
-    // Read the file
+    // Read the header of the file (but not the image)
     cerr << "Reading tomogram \""<<in_file_name<<"\"" << endl;
     MrcSimple tomo;
-    tomo.Read(in_file_name, false);//You can also use "tomo.Read(cin);" or "cin>>tomo;"
+    tomo.ReadHeader(in_file_name);
     tomo.PrintStats(cerr);  //Optional (display the tomogram size & format)
 
     if (xmin < 0) xmin = 0;
     if (ymin < 0) ymin = 0;
     if (zmin < 0) zmin = 0;
-    if (xmax > tomo.header.nvoxels[0]) xmax = tomo.header.nvoxels[0];
-    if (ymax > tomo.header.nvoxels[1]) ymax = tomo.header.nvoxels[1];
-    if (zmax > tomo.header.nvoxels[2]) zmax = tomo.header.nvoxels[2];
+    if (xmax >= tomo.header.nvoxels[0]) xmax = tomo.header.nvoxels[0] - 1;
+    if (ymax >= tomo.header.nvoxels[1]) ymax = tomo.header.nvoxels[1] - 1;
+    if (zmax >= tomo.header.nvoxels[2]) zmax = tomo.header.nvoxels[2] - 1;
+    if ((xmax < xmin) || (ymax < ymin) || (zmax < zmin))
+      throw InputErr("Error: The region lies outside the tomogram.\n");
 
+    // Now read only the voxels inside the region from the file.
+    // (This is much faster than reading the entire file if the file is large.)
     MrcSimple cropped_tomo;
+    cropped_tomo.ReadRegion(in_file_name,
+                            xmin, xmax+1,
+                            ymin, ymax+1,
+                            zmin, zmax+1);
     cropped_tomo.header = tomo.header;
 
     float voxel_size[3];
@@ -58,21 +66,17 @@ int main(int argc, char **argv) {
     nvoxels[0] = 1 + xmax-xmin;
     nvoxels[1] = 1 + ymax-ymin;
     nvoxels[2] = 1 + zmax-zmin;
-    cropped_tomo.Resize(nvoxels);
     cropped_tomo.header.nvoxels[0] = nvoxels[0];
     cropped_tomo.header.nvoxels[1] = nvoxels[1];
     cropped_tomo.header.nvoxels[2] = nvoxels[2];
+    cropped_tomo.header.mvoxels[0] = nvoxels[0];
+    cropped_tomo.header.mvoxels[1] = nvoxels[1];
+    cropped_tomo.header.mvoxels[2] = nvoxels[2];
     //           and shift origin[0],origin[1],origin[2] accordingly
     cropped_tomo.header.origin[0]= tomo.header.origin[0]+(xmin-1)*voxel_size[0];
     cropped_tomo.header.origin[1]= tomo.header.origin[1]+(ymin-1)*voxel_size[1];
     cropped_tomo.header.origin[2]= tomo.header.origin[2]+(zmin-1)*voxel_size[2];
 
-    for (int iz = 0; iz <= zmax-zmin; iz++)
-      for (int iy = 0; iy <= ymax-ymin; iy++)
-	for (int ix = 0; ix <= xmax-xmin; ix++)
-	  cropped_tomo.aaafI[iz][iy][ix] = 
-	    tomo.aaafI[iz+zmin][iy+ymin][ix+xmin];
-
     cropped_tomo.FindMinMaxMean(); //update the min, max, mean header params
 
     // Write the file
@@ -67,7 +67,9 @@ BlobDogNM(int const image_size[3], //!<source image size
           // optional arguments
           ostream *pReportProgress = nullptr, //!< report progress to the user?
           Scalar ****aaaafI = nullptr, //!<preallocated memory for filtered images
-          Scalar **aafI = nullptr     //!<preallocated memory for filtered images
+          Scalar **aafI = nullptr,    //!<preallocated memory for filtered images
+          bool incremental = false,   //!<blur the image incrementally?
+          int max_pyramid_level = 0   //!<search for blobs in a downsampled image?
           )
 {
 
@@ -107,7 +109,9 @@ BlobDogNM(int const image_size[3], //!<source image size
            use_threshold_ratios,
            pReportProgress,
            aaaafI,
-           aafI);
+           aafI,
+           incremental,
+           max_pyramid_level);
 
   bool discard_overlapping_blobs =
     ((sep_ratio_thresh > 0.0) ||
@@ -186,7 +190,9 @@ _BlobDogNM(int const image_size[3], //!<source image size
            Scalar nonmax_max_overlap_small=1.0,  //!<maximum volume overlap with smaller blob
            ostream *pReportProgress = nullptr,
            Scalar ****aaaafI = nullptr, //!<preallocated memory for filtered images
-           Scalar **aafI = nullptr     //!<preallocated memory for filtered images
+           Scalar **aafI = nullptr,    //!<preallocated memory for filtered images
+           bool incremental = false,   //!<blur the image incrementally?
+           int max_pyramid_level = 0   //!<search for blobs in a downsampled image?
            )
 {
   
@@ -217,7 +223,9 @@ _BlobDogNM(int const image_size[3], //!<source image size
             nonmax_max_overlap_small,
             pReportProgress,
             aaaafI,
-            aafI);
+            aafI,
+            incremental,
+            max_pyramid_level);
 
 } //_BlobDogNM(...,filter_truncate_ratio,filter_truncate_threshold,...)
 
@@ -2,10 +2,17 @@
 #define _FILE_IO_HPP
 
 #include <cassert>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <iterator>
+#include <algorithm>
 using namespace std;
 #include <err_visfd.hpp>
 #include <mrc_simple.hpp>
@@ -13,23 +20,105 @@ using namespace std;
 #include "settings.hpp"
 
 
-static vector<string> &split(const string &s, char delim, vector<string> &elems){
-  stringstream ss(s);
-  string item;
-  while (getline(ss, item, delim)) {
-    elems.push_back(item);
+/// @brief  Read the entire contents of a stream into a string.
+static string
+_ReadEntireStream(istream &f)
+{
+  return string(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+}
+
+
+/// @brief  Find the next line of text in a buffer (which must end in '\0').
+///         (Lines are delimited by '\n'.  As with getline(), no empty line
+///          is reported after a '\n' at the very end of the buffer.)
+/// @return false if there are no more lines.  Otherwise the line begins at
+///         "line_begin" and ends at "line_end", and "p" points to the next line.
+static inline bool
+_NextLine(const char *&p,          //!< current position in the buffer
+          const char *buf_end,     //!< the end of the buffer
+          const char *&line_begin, //!< store the beginning of the line here
+          const char *&line_end,   //!< store the end of the line here
+          char comment_char = '\0' //!< (if != '\0') line ends at this character
+          )
+{
+  if (p >= buf_end)
+    return false;
+  line_begin = p;
+  const char *nl = static_cast<const char*>(memchr(p, '\n', buf_end - p));
+  if (! nl)
+    nl = buf_end;
+  p = ((nl < buf_end) ? nl + 1 : buf_end);
+  line_end = nl;
+  if (comment_char != '\0') {
+    const char *ic = static_cast<const char*>(memchr(line_begin,
+                                                     comment_char,
+                                                     line_end - line_begin));
+    if (ic)
+      line_end = ic;
   }
-  return elems;
+  return true;
 }
 
 
-static vector<string> split(const string &s, char delim) {
-  vector<string> elems;
-  split(s, delim, elems);
-  return elems;
+// Convert the text at "p" into a number (without copying it), and advance
+// "p" past the number.  Leading whitespace must already have been skipped.
+// Returns false (and leaves "p" unchanged) if there is no number at "p".
+// (These functions are used by _ParseEntry() below.)
+static inline bool _StrToNumber(const char *&p, float &x) {
+  char *end; x = strtof(p, &end); bool ok = (end != p); p = end; return ok;
+}
+static inline bool _StrToNumber(const char *&p, double &x) {
+  char *end; x = strtod(p, &end); bool ok = (end != p); p = end; return ok;
+}
+static inline bool _StrToNumber(const char *&p, long double &x) {
+  char *end; x = strtold(p, &end); bool ok = (end != p); p = end; return ok;
+}
+static inline bool _StrToNumber(const char *&p, int &x) {
+  char *end; x = strtol(p, &end, 10); bool ok = (end != p); p = end; return ok;
+}
+static inline bool _StrToNumber(const char *&p, long &x) {
+  char *end; x = strtol(p, &end, 10); bool ok = (end != p); p = end; return ok;
 }
 
 
+/// @brief  Read the next whitespace-delimited entry on a line of text.
+///         Numbers are converted directly from the text (as "operator >>"
+///         would).  This version is used when "Entry" is numeric.
+/// @return false if there are no more entries (or if the next entry
+///         can not be converted to a number).
+template<typename Entry>
+static inline bool
+_ParseEntry(const char *&p, const char *line_end, Entry &x)
+{
+  while ((p < line_end) && isspace(static_cast<unsigned char>(*p)))
+    p++;
+  if (p >= line_end)
+    return false;
+  const char *start = p;
+  if (! _StrToNumber(p, x) || (p > line_end)) {
+    p = start;
+    return false;
+  }
+  return true;
+}
+
+/// @brief  Read the next whitespace-delimited word on a line of text.
+static inline bool
+_ParseEntry(const char *&p, const char *line_end, string &x)
+{
+  while ((p < line_end) && isspace(static_cast<unsigned char>(*p)))
+    p++;
+  if (p >= line_end)
+    return false;
+  const char *start = p;
+  while ((p < line_end) && (! isspace(static_cast<unsigned char>(*p))))
+    p++;
+  x.assign(start, p);
+  return true;
+}
+
+
+
 /// @brief   Read a multi-column text file and store the words on each line
 ///          in a vector of vectors.  This function can also be used to
 ///          read a file containing multiple columns of numbers, for example
@@ -42,31 +131,23 @@ ReadMulticolumnFile(istream &f,  //!< the file to be read
                     char comment_char='#' //!<ignore text following this character ('\0' disables)
                     )
 {
+  // Read the entire file at once, and convert the entries on each line
+  // directly from this buffer.  (This is much faster than using getline()
+  // and a stringstream for every line when the file is large.)
   vvDest.clear();
-  string strLine;
-  size_t i_line = 1;
-  while (getline(f, strLine))
+  string buf = _ReadEntireStream(f);
+  const char *p = buf.c_str();
+  const char *buf_end = p + buf.size();
+  const char *line_begin;
+  const char *line_end;
+  while (_NextLine(p, buf_end, line_begin, line_end, comment_char))
   {
-    // ignore text after comments
-    size_t ic = strLine.find(comment_char);
-    if (ic != string::npos)
-      strLine = strLine.substr(0, ic);
-    stringstream ssLine(strLine);
     vector<Entry> row;
     Entry x;
-    try {
-      while (ssLine >> x) {
-        row.push_back(x);
-      }
-    } // try {
-    catch ( ... ) {
-      stringstream err_msg;
-      err_msg << "Error: File read error (invalid entry?) on line: "
-              << i_line << "\n";
-      throw VisfdErr(err_msg.str());
-    }
+    const char *q = line_begin;
+    while (_ParseEntry(q, line_end, x))
+      row.push_back(x);
     vvDest.push_back(row);
-    i_line++;
   }
 } // ReadMulticolumnFile()
 
@@ -115,50 +196,60 @@ ConvertStringsToCoordinates(const vector<vector<string> > &vvWords_orig, //!< wo
                             )
 {
   vvCoords.clear();
+  vvCoords.reserve(vvWords_orig.size());
 
   bool is_output_from_imod = false;
-  vector<vector<string> > vvWords = vvWords_orig;
-  vector<Coordinate> linked_set;
 
-  for (size_t i = 0; i < vvWords.size(); i++)
+  for (size_t i = 0; i < vvWords_orig.size(); i++)
   {
-    if ((vvWords[i].size() > 0) && (vvWords[i][0] == "Pixel")) {
-      vvWords[i].erase(vvWords[i].begin(), vvWords[i].begin() + 1);
+    const vector<string> &words = vvWords_orig[i];
+    size_t w = 0; // index of the first word containing a coordinate
+    if ((words.size() > 0) && (words[0] == "Pixel")) {
+      w = 1;
       is_output_from_imod = true;
     }
     vector<Coordinate> xyz;
 
-    if (vvWords[i].size() == 0) {
+    if (words.size() == 0) {
       vvCoords.push_back(vector<Coordinate>(0));
       continue;
     }
 
+    if (words.size() < w + num_columns) {
+      stringstream err_msg;
+      err_msg << "Error: File read error (too few entries?) on line: "
+              << i+1 << "\n";
+      throw VisfdErr(err_msg.str());
+    }
+
     for (int d=0; d < num_columns; d++) {
       // Get rid if weird characters enclosing or separating the words
       // such as '(', ')', or ','
-      if ((vvWords[i][d].size() >= 0) && (vvWords[i][d][0] == '(')) {
-        // Delete the '(' character from the beginning of the string.
+      // (Instead of copying the word, keep track of where the number
+      //  begins and ends within it.)
+      const string &word = words[w + d];
+      const char *begin = word.c_str();
+      const char *end = begin + word.size();
+      if ((begin < end) && (*begin == '(')) {
+        // Skip the '(' character at the beginning of the string.
         // (IMOD surrounds the coordinates with '(' and ')' characters.)
-        vvWords[i][d] = vvWords[i][d].substr(1, string::npos);
+        begin++;
         is_output_from_imod = true;
       }
-      int n_chars;
-      n_chars = vvWords[i][d].size();
-      if ((vvWords[i][d].size()>=0) && (vvWords[i][d][n_chars-1]==')')) {
-        // Delete the ')' character from the end of the string.
+      if ((begin < end) && (*(end-1) == ')')) {
+        // Skip the ')' character at the end of the string.
         // (IMOD surrounds the coordinates with '(' and ')' characters.)
-        vvWords[i][d] = vvWords[i][d].substr(0, n_chars-1);
+        end--;
         is_output_from_imod = true;
       }
-      n_chars = vvWords[i][d].size();
-      if ((vvWords[i][d].size()>=0) && (vvWords[i][d][n_chars-1]==','))
-        vvWords[i][d] = vvWords[i][d].substr(0, n_chars-1);
+      if ((begin < end) && (*(end-1) == ','))
+        end--;
 
       // Now convert the remaining string to a number
-      try {
-        double x = stof(vvWords[i][d]); //<-- coordinate (x, y, or z)
-      }
-      catch ( ... ) {
+      // (strtod() stops at the trailing ')' or ',' characters, if present)
+      char *number_end;
+      double x_orig = strtod(begin, &number_end); //<-- coordinate (x, y, or z)
+      if ((number_end == begin) || (number_end > end)) {
         stringstream err_msg;
         err_msg << "Error: File read error (invalid entry?) on line: "
                 << i+1 << "\n";
@@ -168,20 +259,20 @@ ConvertStringsToCoordinates(const vector<vector<string> > &vvWords_orig, //!< wo
       // The way we interpret the number depends on whether or not
       // we suspect the number was printed by IMOD, which uses
       // a somewhat unconventional coordinate system
-      Coordinate x = stod(vvWords[i][d]);
+      Coordinate x = x_orig;
       if (is_output_from_imod)
         x = floor(x) - 1.0;
 
       // Finally, store the coordinate in "xyz"
       xyz.push_back(x);
 
-    } //for (int d=0; d < vvWords[i].size(); d++)
+    } //for (int d=0; d < num_columns; d++)
 
     vvCoords.push_back(xyz);
 
-  } //for (size_t i = 0; i < vvWords.size(); i++)
+  } //for (size_t i = 0; i < vvWords_orig.size(); i++)
 
-  assert(vvCoords.size() == vvWords.size());
+  assert(vvCoords.size() == vvWords_orig.size());
 
 
   return is_output_from_imod;
@@ -212,10 +303,9 @@ ReadCoordinates(string filename,  //!< the name of the file to be read
 
   ReadMulticolumnFile(filename, vvWords, comment_char);
 
+  // (Blank lines are allowed.  They are skipped below.)
   for (size_t i = 0; i < vvWords.size(); i++) {
-    if (vvWords[i].size() == 0)
-      vvWords.erase(vvWords.begin()+i, vvWords.begin()+i+1);
-    else if (vvWords[i].size() < 3) {
+    if ((vvWords[i].size() > 0) && (vvWords[i].size() < 3)) {
       stringstream err_msg;
       err_msg << "Format error near line "<<i+1<<" of file \""
               << filename+"\"\n";
@@ -228,9 +318,10 @@ ReadCoordinates(string filename,  //!< the name of the file to be read
                                 vvCoords); // store coordinates here
 
   vaCoords.clear();
+  vaCoords.reserve(vvCoords.size());
   for (size_t i = 0; i < vvCoords.size(); i++) {
     if (vvCoords[i].size() >= 3) {
-      array<float, 3> xyz = {vvCoords[i][0], vvCoords[i][1], vvCoords[i][2]};
+      array<Coordinate, 3> xyz = {vvCoords[i][0], vvCoords[i][1], vvCoords[i][2]};
       vaCoords.push_back(xyz);
     }
   }
@@ -263,17 +354,36 @@ ReadBlobCoordsFile(string in_coords_file_name, //!< name of file we will read
     throw VisfdErr("Error: unable to open \""+
                    in_coords_file_name +"\" for reading.\n");
 
-  bool custom_diameters = false;
-  while (coords_file) {
-    string strLine;
-    getline(coords_file, strLine);
-    if (strLine.size() == 0)
-      continue;
-    stringstream ssLine(strLine);
-    double x, y, z;
-    ssLine >> x;
-    ssLine >> y;
-    ssLine >> z;
+  // Read the entire file at once, and convert the numbers on each line
+  // directly from this buffer.  (This is much faster than using getline()
+  // and a stringstream for every line when the file contains many blobs.)
+  string buffer = _ReadEntireStream(coords_file);
+  coords_file.close();
+  const char *p = buffer.c_str();
+  const char *buf_end = p + buffer.size();
+  const char *line_begin;
+  const char *line_end;
+  size_t line_number = 0;
+
+  while (_NextLine(p, buf_end, line_begin, line_end)) {
+    line_number++;
+    double entries[5];
+    int num_entries = 0;
+    const char *q = line_begin;
+    while ((num_entries < 5) && _ParseEntry(q, line_end, entries[num_entries]))
+      num_entries++;
+    if (num_entries == 0)
+      continue;  // skip blank lines
+    if (num_entries < 3) {
+      stringstream err_msg;
+      err_msg << "Error: Format error near line " << line_number
+              << " of file \"" << in_coords_file_name << "\"\n"
+              << "       (Each line should contain at least 3 numbers.)\n";
+      throw VisfdErr(err_msg.str());
+    }
+    double x = entries[0];
+    double y = entries[1];
+    double z = entries[2];
     double ix, iy, iz;
     ix = floor((x / distance_scale) + 0.5);
     iy = floor((y / distance_scale) + 0.5);
@@ -285,14 +395,11 @@ ReadBlobCoordsFile(string in_coords_file_name, //!< name of file we will read
 
     Scalar diameter = -1.0;
     Scalar score = score_default;
-    if (ssLine) { // Does the file contain a 4th column? (the diameter)
-      Scalar _diameter;
-      ssLine >> _diameter;
+    if (num_entries >= 4) { // Does the file contain a 4th column? (the diameter)
+      Scalar _diameter = entries[3];
       // convert from physical distance to # of voxels:
       _diameter /= distance_scale;
-      if (ssLine)
-        diameter = _diameter;
-      custom_diameters = true;
+      diameter = _diameter;
     }
 
     if (diameter < 0) { //If file does not contain a 4th column, or if < 0
@@ -306,12 +413,8 @@ ReadBlobCoordsFile(string in_coords_file_name, //!< name of file we will read
     else
       diameter *= diameter_factor;
 
-    if (ssLine) {
-      Scalar _score;
-      ssLine >> _score;
-      if (ssLine)
-        score = _score;
-    }
+    if (num_entries >= 5)
+      score = entries[4];
 
     if (pCrds)
       (*pCrds).push_back(ixiyiz);
@@ -320,27 +423,96 @@ ReadBlobCoordsFile(string in_coords_file_name, //!< name of file we will read
     if (pScores)
       (*pScores).push_back(score);
 
-  } //while (coords_file) {...
+  } //while (_NextLine(p, buf_end, line_begin, line_end))
 } //ReadBlobCoordsFile()
 
 
 
 
+/// @brief  Write one line of text for each entry in "a" (and "b", if not
+///         nullptr) to the file "f", beginning with "prefix".  Each line
+///         contains the 3 numbers in a[i] (followed by the 3 numbers in b[i]).
+///         Numbers are printed the same way "operator <<" would print them
+///         (using the default precision).  The lines are formatted in
+///         parallel (in chunks), and the chunks are written in order.
+template<typename Scalar>
+
+static void
+_WriteTextRows(ostream &f,
+               const vector<array<Scalar,3> > &a,
+               const vector<array<Scalar,3> > *pb = nullptr,
+               const char *prefix = "")
+{
+  const size_t LINES_PER_CHUNK = 16384;
+  const size_t CHUNKS_PER_BATCH = 32;
+  size_t n = a.size();
+  size_t num_chunks = (n + LINES_PER_CHUNK - 1) / LINES_PER_CHUNK;
+  vector<string> chunks(CHUNKS_PER_BATCH);
+
+  for (size_t batch_begin = 0;
+       batch_begin < num_chunks;
+       batch_begin += CHUNKS_PER_BATCH)
+  {
+    size_t batch_end = std::min(batch_begin + CHUNKS_PER_BATCH, num_chunks);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t c = batch_begin; c < batch_end; c++) {
+      string &chunk = chunks[c - batch_begin];
+      chunk.clear();
+      size_t i_begin = c * LINES_PER_CHUNK;
+      size_t i_end = std::min(i_begin + LINES_PER_CHUNK, n);
+      char line[256];
+      for (size_t i = i_begin; i < i_end; i++) {
+        int len;
+        if (pb)
+          len = snprintf(line, sizeof(line), "%s%g %g %g %g %g %g\n", prefix,
+                         static_cast<double>(a[i][0]),
+                         static_cast<double>(a[i][1]),
+                         static_cast<double>(a[i][2]),
+                         static_cast<double>((*pb)[i][0]),
+                         static_cast<double>((*pb)[i][1]),
+                         static_cast<double>((*pb)[i][2]));
+        else
+          len = snprintf(line, sizeof(line), "%s%g %g %g\n", prefix,
+                         static_cast<double>(a[i][0]),
+                         static_cast<double>(a[i][1]),
+                         static_cast<double>(a[i][2]));
+        chunk.append(line, std::min(static_cast<size_t>(len), sizeof(line)-1));
+      }
+    }
+
+    for (size_t c = batch_begin; c < batch_end; c++)
+      f.write(chunks[c - batch_begin].data(), chunks[c - batch_begin].size());
+  }
+} //_WriteTextRows()
+
+
+
+/// @brief  Write an oriented point cloud (a list of coordinates and
+///         surface normals) to a PLY file.  If "binary" is true, the
+///         "binary_little_endian" format is used (with 32-bit floats).
+///         Binary files are much smaller and faster to read and write, and
+///         because every vertex occupies the same number of bytes, a
+///         portion of the file can be read without reading all of it.
+///         (See ReadOrientedPointCloudPLY().)
 template<typename Scalar>
 
 static void
 WriteOrientedPointCloudPLY(string filename,
-                           vector<array<Scalar,3> > coords,
-                           vector<array<Scalar,3> > norms)
+                           const vector<array<Scalar,3> > &coords,
+                           const vector<array<Scalar,3> > &norms,
+                           bool binary = false)
 {
   assert(coords.size() == norms.size());
   
   size_t n = coords.size();
   fstream ply_file;
-  ply_file.open(filename, ios::out);
+  ply_file.open(filename, ios::out | ios::binary);
+  if (! ply_file)
+    throw VisfdErr("Error: unable to open \""+ filename +"\" for writing.\n");
   ply_file <<
     "ply\n"
-    "format ascii 1.0\n"
+    "format " << (binary ? "binary_little_endian" : "ascii") << " 1.0\n"
     "comment  created by visfd\n"
     "element vertex " << n << "\n"
     "property float x\n"
@@ -351,12 +523,241 @@ WriteOrientedPointCloudPLY(string filename,
     "property float nz\n"
     //"property list uchar int vertex_index\n" <- needed for "faces" only
     "end_header\n";
-           
-  for (size_t i=0; i < n; i++)
-    ply_file << coords[i][0] << " "<< coords[i][1] << " " << coords[i][2] <<" "
-             << norms[i][0] << " " << norms[i][1] << " " << norms[i][2] <<"\n";
+
+  if (! binary) {
+    _WriteTextRows(ply_file, coords, &norms);
+    ply_file.close();
+    return;
+  }
+
+  // Binary format: 6 floats per vertex, stored in little-endian byte order
+  // (regardless of the byte order used by this computer).
+  const size_t VERTICES_PER_CHUNK = 65536;
+  const size_t RECORD_SIZE = 6 * 4;
+  vector<unsigned char> chunk;
+  for (size_t i_begin = 0; i_begin < n; i_begin += VERTICES_PER_CHUNK) {
+    size_t i_end = std::min(i_begin + VERTICES_PER_CHUNK, n);
+    chunk.resize((i_end - i_begin) * RECORD_SIZE);
+    #pragma omp parallel for
+    for (size_t i = i_begin; i < i_end; i++) {
+      unsigned char *record = &(chunk[(i - i_begin) * RECORD_SIZE]);
+      for (int d = 0; d < 6; d++) {
+        float x = (d < 3) ? coords[i][d] : norms[i][d-3];
+        uint32_t bits;
+        static_assert(sizeof(float) == 4, "float must be 32 bits");
+        memcpy(&bits, &x, 4);
+        for (int b = 0; b < 4; b++)
+          record[4*d + b] = (bits >> (8*b)) & 0xff;
+      }
+    }
+    ply_file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+  }
   ply_file.close();
-}
+} //WriteOrientedPointCloudPLY()
+
+
+
+/// @brief  Read an oriented point cloud (a list of coordinates and surface
+///         normals) from a PLY file.  The "ascii", "binary_little_endian",
+///         and "binary_big_endian" formats are supported.  The coordinates
+///         are read from the "x", "y", "z" properties of each vertex, and the
+///         normals are read from the "nx", "ny", "nz" properties (if present;
+///         otherwise they are set to 0).  Other vertex properties are ignored.
+///         The vertices must be the first element in the file.
+///         Only vertices first, first+1, ..., first+count-1 are read.
+///         (In binary files, the remaining vertices are skipped using seekg(),
+///          so large files can be read a portion at a time.)
+/// @return The total number of vertices in the file.
+template<typename Scalar>
+
+static size_t
+ReadOrientedPointCloudPLY(string filename,
+                          vector<array<Scalar,3> > &coords, //!< store coordinates here
+                          vector<array<Scalar,3> > &norms, //!< store normals here
+                          size_t first = 0, //!< index of the first vertex to read
+                          size_t count = SIZE_MAX //!< maximum number of vertices to read
+                          )
+{
+  coords.clear();
+  norms.clear();
+  fstream ply_file;
+  ply_file.open(filename, ios::in | ios::binary);
+  if (! ply_file)
+    throw VisfdErr("Error: unable to open \""+ filename +"\" for reading.\n");
+
+  // ---- Read the header ----
+  enum {ASCII, BINARY_LITTLE_ENDIAN, BINARY_BIG_ENDIAN} format = ASCII;
+  size_t num_vertices = 0;
+  bool vertex_element_found = false;
+  bool in_vertex_element = false;
+  vector<int> prop_sizes;  // size of each vertex property (in bytes)
+  vector<int> prop_is_int; // is this property an integer (or floating point)?
+  vector<bool> prop_is_signed;
+  int prop_index[6] = {-1, -1, -1, -1, -1, -1}; // which properties are x,y,z,nx,ny,nz?
+  const char *prop_names[6] = {"x", "y", "z", "nx", "ny", "nz"};
+  string strLine;
+  getline(ply_file, strLine);
+  if ((strLine != "ply") && (strLine != "ply\r"))
+    throw VisfdErr("Error: \""+ filename +"\" is not a PLY file.\n");
+  while (true) {
+    if (! getline(ply_file, strLine))
+      throw VisfdErr("Error: \""+ filename +"\" has no \"end_header\".\n");
+    stringstream ssLine(strLine);
+    string keyword;
+    ssLine >> keyword;
+    if (keyword == "end_header")
+      break;
+    else if (keyword == "format") {
+      string fmt;
+      ssLine >> fmt;
+      if (fmt == "ascii")
+        format = ASCII;
+      else if (fmt == "binary_little_endian")
+        format = BINARY_LITTLE_ENDIAN;
+      else if (fmt == "binary_big_endian")
+        format = BINARY_BIG_ENDIAN;
+      else
+        throw VisfdErr("Error: unsupported PLY format \""+ fmt +"\"\n"
+                       "       in file \""+ filename +"\"\n");
+    }
+    else if (keyword == "element") {
+      string element_name;
+      ssLine >> element_name;
+      in_vertex_element = (element_name == "vertex");
+      if (in_vertex_element) {
+        if (vertex_element_found)
+          throw VisfdErr("Error: multiple \"vertex\" elements in PLY file \""+
+                         filename +"\"\n");
+        vertex_element_found = true;
+        ssLine >> num_vertices;
+      }
+      else if (! vertex_element_found)
+        throw VisfdErr("Error: The \"vertex\" element must appear first in PLY file \""+
+                       filename +"\"\n");
+    }
+    else if ((keyword == "property") && in_vertex_element) {
+      string type, name;
+      ssLine >> type >> name;
+      int size = 0;
+      bool is_int = true;
+      bool is_signed = true;
+      if ((type == "char") || (type == "int8"))
+        size = 1;
+      else if ((type == "uchar") || (type == "uint8")) {
+        size = 1; is_signed = false;
+      }
+      else if ((type == "short") || (type == "int16"))
+        size = 2;
+      else if ((type == "ushort") || (type == "uint16")) {
+        size = 2; is_signed = false;
+      }
+      else if ((type == "int") || (type == "int32"))
+        size = 4;
+      else if ((type == "uint") || (type == "uint32")) {
+        size = 4; is_signed = false;
+      }
+      else if ((type == "float") || (type == "float32")) {
+        size = 4; is_int = false;
+      }
+      else if ((type == "double") || (type == "float64")) {
+        size = 8; is_int = false;
+      }
+      else
+        throw VisfdErr("Error: unsupported vertex property type \""+ type +"\"\n"
+                       "       in PLY file \""+ filename +"\"\n");
+      for (int d = 0; d < 6; d++)
+        if (name == prop_names[d])
+          prop_index[d] = prop_sizes.size();
+      prop_sizes.push_back(size);
+      prop_is_int.push_back(is_int);
+      prop_is_signed.push_back(is_signed);
+    }
+    // (Other lines, such as "comment" lines, are ignored.)
+  } //while (true)
+
+  if ((prop_index[0] < 0) || (prop_index[1] < 0) || (prop_index[2] < 0))
+    throw VisfdErr("Error: PLY file \""+ filename +"\" lacks x,y,z coordinates.\n");
+
+  if (first > num_vertices)
+    first = num_vertices;
+  count = std::min(count, num_vertices - first);
+  coords.resize(count);
+  norms.resize(count);
+  int num_props = prop_sizes.size();
+  vector<double> values(num_props);
+
+  if (format == ASCII) {
+    string buffer = _ReadEntireStream(ply_file);
+    const char *p = buffer.c_str();
+    const char *buf_end = p + buffer.size();
+    const char *line_begin;
+    const char *line_end;
+    for (size_t i = 0; i < first + count; i++) {
+      if (! _NextLine(p, buf_end, line_begin, line_end))
+        throw VisfdErr("Error: PLY file \""+ filename +"\" is truncated.\n");
+      if (i < first)
+        continue;
+      const char *q = line_begin;
+      for (int j = 0; j < num_props; j++)
+        if (! _ParseEntry(q, line_end, values[j]))
+          throw VisfdErr("Error: PLY file \""+ filename +"\" is truncated.\n");
+      for (int d = 0; d < 3; d++) {
+        coords[i-first][d] = values[prop_index[d]];
+        norms[i-first][d] = ((prop_index[d+3] >= 0)
+                             ? values[prop_index[d+3]]
+                             : 0.0);
+      }
+    }
+    return num_vertices;
+  }
+
+  // Binary formats
+  size_t record_size = 0;
+  for (int j = 0; j < num_props; j++)
+    record_size += prop_sizes[j];
+  ply_file.seekg(static_cast<streamoff>(first * record_size), ios::cur);
+  bool swap_bytes = (format == BINARY_BIG_ENDIAN);
+  vector<unsigned char> record(record_size);
+  for (size_t i = 0; i < count; i++) {
+    ply_file.read(reinterpret_cast<char*>(record.data()), record_size);
+    if (! ply_file)
+      throw VisfdErr("Error: PLY file \""+ filename +"\" is truncated.\n");
+    const unsigned char *field = record.data();
+    for (int j = 0; j < num_props; j++) {
+      int size = prop_sizes[j];
+      uint64_t bits = 0;  // the bytes in this field (in little-endian order)
+      for (int b = 0; b < size; b++)
+        bits |= (static_cast<uint64_t>(field[swap_bytes ? size-1-b : b])
+                 << (8*b));
+      if (! prop_is_int[j]) {
+        if (size == 4) {
+          uint32_t bits32 = bits;
+          float x;
+          memcpy(&x, &bits32, 4);
+          values[j] = x;
+        }
+        else {
+          double x;
+          static_assert(sizeof(double) == 8, "double must be 64 bits");
+          memcpy(&x, &bits, 8);
+          values[j] = x;
+        }
+      }
+      else if (prop_is_signed[j] && (bits >> (8*size - 1)) & 1)
+        values[j] = static_cast<double>(bits) - ldexp(1.0, 8*size);
+      else
+        values[j] = static_cast<double>(bits);
+      field += size;
+    }
+    for (int d = 0; d < 3; d++) {
+      coords[i][d] = values[prop_index[d]];
+      norms[i][d] = ((prop_index[d+3] >= 0)
+                     ? values[prop_index[d+3]]
+                     : 0.0);
+    }
+  }
+  return num_vertices;
+} //ReadOrientedPointCloudPLY()
 
 
 
@@ -365,28 +766,23 @@ template<typename Scalar>
 
 static void
 WriteOrientedPointCloudOBJ(string filename,
-                           vector<array<Scalar,3> > coords,
-                           vector<array<Scalar,3> > norms)
+                           const vector<array<Scalar,3> > &coords,
+                           const vector<array<Scalar,3> > &norms)
 {
   assert(coords.size() == norms.size());
   
-  size_t n = coords.size();
   fstream obj_file;
   obj_file.open(filename, ios::out);
   obj_file << "# WaveFront *.obj file created by visfd\n";
   obj_file << "\n"
            << "g obj1_\n"
            << "\n";
-           
-  for (size_t i=0; i < n; i++)
-    obj_file << "v "
-             << coords[i][0] <<" "<< coords[i][1] <<" "<< coords[i][2] <<"\n";
+
+  _WriteTextRows<Scalar>(obj_file, coords, nullptr, "v ");
 
   obj_file << "\n";
 
-  for (size_t i=0; i < n; i++)
-    obj_file << "vn "
-             << norms[i][0] <<" "<< norms[i][1] <<" "<< norms[i][2] <<"\n";
+  _WriteTextRows<Scalar>(obj_file, norms, nullptr, "vn ");
 
   obj_file.close();
 }
@@ -437,7 +833,8 @@ WriteOrientedPointCloud(string pointcloud_file_name,
                         const int image_size[3],
                         VectorContainer const *const *const *aaaafVector,
                         Scalar const *const *const *aaafMask = nullptr,
-                        const Scalar *voxel_width=nullptr)
+                        const Scalar *voxel_width=nullptr,
+                        bool binary=false) //!< write a binary PLY file?
 {
   assert(aaaafVector);
   vector<array<Scalar,3> > coords;
@@ -482,7 +879,8 @@ WriteOrientedPointCloud(string pointcloud_file_name,
 
   WriteOrientedPointCloudPLY(pointcloud_file_name,
                              coords,
-                             norms);
+                             norms,
+                             binary);
 
 } //WriteOrientedPointCloud()
 
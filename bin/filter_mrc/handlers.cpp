@@ -7,6 +7,7 @@
 #include <sstream>
 #include <algorithm>
 #include <array>
+#include <map>
 //#include <fftw3.h>  not needed yet
 using namespace std;
 
@@ -34,6 +35,15 @@ using namespace visfd;
 #include "handlers_unsupported.hpp"
 
 
+
+// In batch mode (see "-batch"), the same filter is often applied to many
+// images.  Generating a large 3D filter can be slow, so the filters we have
+// created so far are stored here, indexed by the parameters used to create
+// them.
+struct CachedFilter3D {
+  Filter3D<float, int> filter;
+};
+static map<vector<float>, CachedFilter3D> g_filter3d_cache;
 void
 HandleGGauss(Settings settings,
              MrcSimple &tomo_in,
@@ -41,13 +51,27 @@ HandleGGauss(Settings settings,
              MrcSimple &mask,
              float voxel_width[3])
 {
-  Filter3D<float, int>
-    filter = GenFilterGenGauss3D(settings.width_a,
-                                 settings.m_exp,
-                                 settings.filter_truncate_ratio,
-                                 settings.filter_truncate_threshold,
-                                 static_cast<float*>(nullptr),
-                                 &cerr);
+  vector<float> key = {static_cast<float>(Settings::GGAUSS),
+                       settings.width_a[0],
+                       settings.width_a[1],
+                       settings.width_a[2],
+                       settings.m_exp,
+                       settings.filter_truncate_ratio,
+                       settings.filter_truncate_threshold};
+  if (g_filter3d_cache.find(key) == g_filter3d_cache.end())
+    g_filter3d_cache[key].filter =
+      GenFilterGenGauss3D(settings.width_a,
+                          settings.m_exp,
+                          settings.filter_truncate_ratio,
+                          settings.filter_truncate_threshold,
+                          static_cast<float*>(nullptr),
+                          &cerr);
+  else
+    cerr << " (reusing the filter created for an earlier image)\n";
+
+  Filter3D<float, int> &filter = g_filter3d_cache[key].filter;
+
+  filter.convolve_method = settings.convolve_method; // use FFTs?
 
   filter.Apply(tomo_in.header.nvoxels,
                tomo_in.aaafI,
@@ -114,18 +138,36 @@ HandleDogg(Settings settings,
 {
   cerr << "filter_type = Difference-of-Generalized-Gaussians (DOGG)\n";
 
-  Filter3D<float, int> filter;
-  float A, B;       // let the user know what A B coefficients were used
+  vector<float> key = {static_cast<float>(Settings::DOGG),
+                       settings.width_a[0],
+                       settings.width_a[1],
+                       settings.width_a[2],
+                       settings.width_b[0],
+                       settings.width_b[1],
+                       settings.width_b[2],
+                       settings.m_exp,
+                       settings.n_exp,
+                       settings.filter_truncate_ratio,
+                       settings.filter_truncate_threshold};
+  if (g_filter3d_cache.find(key) == g_filter3d_cache.end()) {
+    CachedFilter3D &cached = g_filter3d_cache[key];
+    cached.filter =
+      GenFilterDogg3D(settings.width_a,//"a" parameter in formula
+                      settings.width_b,//"b" parameter in formula
+                      settings.m_exp,  //"m" parameter in formula
+                      settings.n_exp,  //"n" parameter in formula
+                      settings.filter_truncate_ratio,
+                      settings.filter_truncate_threshold,
+                      static_cast<float*>(nullptr), // (A and B coeffs
+                      static_cast<float*>(nullptr), //  are not needed)
+                      &cerr);
+  }
+  else
+    cerr << " (reusing the filter created for an earlier image)\n";
 
-  filter = GenFilterDogg3D(settings.width_a,//"a" parameter in formula
-                           settings.width_b,//"b" parameter in formula
-                           settings.m_exp,  //"m" parameter in formula
-                           settings.n_exp,  //"n" parameter in formula
-                           settings.filter_truncate_ratio,
-                           settings.filter_truncate_threshold,
-                           &A,
-                           &B,
-                           &cerr);
+  Filter3D<float, int> &filter = g_filter3d_cache[key].filter;
+
+  filter.convolve_method = settings.convolve_method; // use FFTs?
 
   filter.Apply(tomo_in.header.nvoxels,
                tomo_in.aaafI,
@@ -591,7 +633,9 @@ HandleBlobDetector(Settings settings,
              settings.nonmax_max_volume_overlap_small,
              &cerr,
              aaaafI,
-             aafI);
+             aafI,
+             settings.blob_incremental,
+             settings.blob_pyramid_max_level);
 
 
   long n_minima = minima_crds_voxels.size();
@@ -1059,6 +1103,7 @@ HandleWatershed(Settings settings,
             settings.watershed_boundary_label,
             &extrema_crds,
             &extrema_scores,
+            settings.watershed_num_blocks,
             &cerr);
 
   for (int iz = 0; iz < image_size[2]; ++iz)
@@ -1145,6 +1190,10 @@ HandleClusterConnected(Settings settings,
                    #endif
                    pMustLinkConstraints,
                    true, //(clusters begin at regions of high saliency)
+                   (settings.connect_num_blocks > 0
+                    ? ClusterAlgorithm::CLUSTER_BY_UNION_FIND
+                    : ClusterAlgorithm::CLUSTER_BY_FLOODING),
+                   settings.connect_num_blocks,
                    &cerr);  //!< print progress to the user
 
   // Now, copy the contents of aaaClusterId into tomo_out.aaafI
@@ -1165,6 +1214,140 @@ HandleClusterConnected(Settings settings,
 
 
 
+// Diagonalize the tensors in one row of voxels (aafTensors[ix]).
+// Voxels whose tensor is nullptr (ie. outside the mask) are skipped.
+// The eigenvalues of the tensor at voxel ix are stored in aEivals[ix].
+// If aEivects != nullptr, the principal eigenvector is stored in aEivects[ix].
+// (Its sign is chosen the same way ConvertFlatSym2Evects3() chooses it.)
+// When compiled for AVX2 or AVX-512, DiagonalizeFlatSym3Batch() is used
+// to process many tensors at once.  Otherwise, the tensors are diagonalized
+// one at a time, which is faster without wide vector registers.
+static void
+DiagonalizeTensorRow(int nx,
+                     float const *const *aafTensors,
+                     array<float, 3> *aEivals,
+                     array<float, 3> *aEivects,
+                     EigenOrderType eival_order)
+{
+  #if defined(__AVX2__) || defined(__AVX512F__)
+  vector<int> vIx;
+  for (int ix = 0; ix < nx; ix++)
+    if (aafTensors[ix])
+      vIx.push_back(ix);
+  size_t n = vIx.size();
+  // Rearrange the tensors in "structure-of-arrays" format
+  vector<float> vSource[6];
+  float const *aSource[6];
+  for (int k = 0; k < 6; k++) {
+    vSource[k].resize(n);
+    for (size_t i = 0; i < n; i++)
+      vSource[k][i] = aafTensors[vIx[i]][k];
+    aSource[k] = vSource[k].data();
+  }
+  vector<float> vEivals[3];
+  float *aEivalsSoA[3];
+  vector<float> vEivects[3][3];
+  float *aaEivectsSoA[3][3];
+  for (int d = 0; d < 3; d++) {
+    vEivals[d].resize(n);
+    aEivalsSoA[d] = vEivals[d].data();
+    for (int e = 0; e < 3; e++) {
+      vEivects[e][d].resize(aEivects ? n : 0);
+      aaEivectsSoA[e][d] = vEivects[e][d].data();
+    }
+  }
+  DiagonalizeFlatSym3Batch(n,
+                           aSource,
+                           aEivalsSoA,
+                           aEivects ? aaEivectsSoA : nullptr,
+                           eival_order);
+  for (size_t i = 0; i < n; i++) {
+    int ix = vIx[i];
+    for (int d = 0; d < 3; d++)
+      aEivals[ix][d] = vEivals[d][i];
+    if (aEivects) {
+      float eivects[3][3];
+      for (int e = 0; e < 3; e++)
+        for (int d = 0; d < 3; d++)
+          eivects[e][d] = vEivects[e][d][i];
+      float sign = (Determinant3(eivects) < 0.0) ? -1.0 : 1.0;
+      for (int d = 0; d < 3; d++)
+        aEivects[ix][d] = sign * eivects[0][d];
+    }
+  }
+  #else
+  for (int ix = 0; ix < nx; ix++) {
+    if (! aafTensors[ix])
+      continue;
+    float eivals[3];
+    float eivects[3][3];
+    ConvertFlatSym2Evects3(aafTensors[ix],
+                           eivals,
+                           eivects,
+                           eival_order);
+    for (int d = 0; d < 3; d++)
+      aEivals[ix][d] = eivals[d];
+    if (aEivects)
+      for (int d = 0; d < 3; d++)
+        aEivects[ix][d] = eivects[0][d];
+  }
+  #endif //#if defined(__AVX2__) || defined(__AVX512F__)
+} //DiagonalizeTensorRow()
+
+
+
+// Cluster the voxels detected by HandleRidgeDetector() into connected
+// surfaces (see ClusterConnected()).  The tensor at each voxel may be stored
+// using floats, or using a more compact type (see "-connect-fp16").
+template<typename TensorContainer>
+static void
+ClusterRidgeVoxels(const Settings &settings,
+                   MrcSimple &tomo_in,
+                   MrcSimple &mask,
+                   array<float, 3> ***aaaafDirection,
+                   TensorContainer const *const *const *aaaafTensor,
+                   vector<vector<array<float, 3> > > *pMustLinkConstraints,
+                   ptrdiff_t ***aaaiClusterId)
+{
+  vector<array<float, 3> > cluster_centers;
+  vector<float> cluster_sizes;
+  vector<float> cluster_saliencies;
+
+  ClusterConnected(tomo_in.header.nvoxels, //image size
+                   tomo_in.aaafI, //<-saliency
+                   aaaiClusterId, //<-which cluster does each voxel belong to?  (results will be stored here)
+                   mask.aaafI,
+                   settings.connect_threshold_saliency,
+                   static_cast<ptrdiff_t>(0), //this value is ignored, but it specifies the type of array we are using
+                   true,  //(voxels not belonging to clusters are assigned the highest value = num_clusters+1)
+                   aaaafDirection,
+                   settings.connect_threshold_vector_saliency,
+                   settings.connect_threshold_vector_neighbor,
+                   false, //eigenvector signs are arbitrary so ignore them
+                   aaaafTensor,
+                   settings.connect_threshold_tensor_saliency,
+                   settings.connect_threshold_tensor_neighbor,
+                   true,  //the tensor should be positive definite near the target
+                   1,
+                   &cluster_centers,
+                   &cluster_sizes,
+                   &cluster_saliencies,
+                   ClusterSortCriteria::SORT_BY_SIZE,
+                   static_cast<float***>(nullptr),
+                   #ifndef DISABLE_STANDARDIZE_VECTOR_DIRECTION
+                   aaaafDirection,
+                   #endif
+                   pMustLinkConstraints,
+                   true, //(clusters begin at regions of high saliency)
+                   (settings.connect_num_blocks > 0
+                    ? ClusterAlgorithm::CLUSTER_BY_UNION_FIND
+                    : ClusterAlgorithm::CLUSTER_BY_FLOODING),
+                   settings.connect_num_blocks,
+                   &cerr);  //!< print progress to the user
+} //ClusterRidgeVoxels()
+
+
+
 void
 HandleRidgeDetector(Settings settings,
                     MrcSimple &tomo_in,
@@ -1198,40 +1381,49 @@ HandleRidgeDetector(Settings settings,
 
   float sigma = settings.width_a[0];
 
-  // Allocate space for the arrays where will will store the image intensity
-  // gradient vectors and Hessian matrices during the calculation. This is messy
-  // I apologize for not using simpler data structures, but I was trying
-  // to reduce memory usage.
+  // Allocate space for the array where we will store the direction of the
+  // principal eigenvector of the Hessian at every voxel.  This could be
+  // implemented as "float ****aaaafDirection;", however instead we use:
 
-  // Allocate the image storing the gradient at every voxel.  This could be
-  // implemented as "float ****aaaafGradient;", however instead we use:
-
-  array<float, 3> ***aaaafGradient;
+  array<float, 3> ***aaaafDirection;
 
   // Alternatively, we could have defined it using:
-  // float ****aaaafGradient;  (or  float ***aaaafGradient[3];)
-  // however defining it as "array<float, 3> ***aaaafGradient;" makes it easier
+  // float ****aaaafDirection;  (or  float ***aaaafDirection[3];)
+  // however defining it as "array<float, 3> ***aaaafDirection;" makes it easier
   // to allocate memory for this array using "Alloc3d()" defined in "alloc3d.h".
 
-  array<float, 3> *aafGradient;
+  array<float, 3> *aafDirection;
   // The "Alloc3d()" function also needs an argument which is a pointer to
-  // a 1-D array with the contents of aaaafGradient arranged consecutively.
-  // That's what "aafGradient" is.
+  // a 1-D array with the contents of aaaafDirection arranged consecutively.
+  // That's what "aafDirection" is.
 
-  // Now use Alloc3D() to allocate space for both aafGradient and aaaafGradient.
+  // Now use Alloc3D() to allocate space for both aafDirection and aaaafDirection.
 
   Alloc3D(tomo_in.header.nvoxels,
-          &(aafGradient),
-          &(aaaafGradient));
+          &(aafDirection),
+          &(aaaafDirection));
 
-  // The storage requirement for Hessians (6 floats) is large enough that
-  // I decided to represent hessians using a CompactMultiChannelImage3D.
+  // The storage requirement for tensors (6 floats) is large enough that
+  // I decided to represent them using a CompactMultiChannelImage3D.
   // Internally this is a 4-dimensional array, however the last dimension
   // is only allocated (non-null) for voxels which were selected by the user
   // (ie voxels for which the mask is non-zero).  This can reduce memory usage
   // by a factor of up to 3 (assuming floats) for this array.
+  // This array is only needed if we are using tensor voting (which stores
+  // its results here), or if we are clustering voxels using the Hessian.
   CompactMultiChannelImage3D<float> tmp_tensor(6);
-  tmp_tensor.Resize(tomo_in.header.nvoxels, mask.aaafI, &cerr);
+  bool use_tensor_voting = (settings.surface_tv_sigma > 0.0);
+  bool store_hessian = ((! use_tensor_voting) &&
+                        settings.cluster_connected_voxels);
+  // If requested, store the Hessian in half precision (using 2 bytes per
+  // number instead of 4) to save memory.  (This is only possible when tensor
+  // voting is not used, because tensor voting accumulates its results here.)
+  CompactMultiChannelImage3D<float, Half> tmp_hessian16(6);
+  bool store_hessian16 = (store_hessian && settings.connect_fp16);
+  if (store_hessian16)
+    tmp_hessian16.Resize(tomo_in.header.nvoxels, mask.aaafI, &cerr);
+  else if (use_tensor_voting || store_hessian)
+    tmp_tensor.Resize(tomo_in.header.nvoxels, mask.aaafI, &cerr);
 
 
   // How did the user specify how wide to make the filter window?
@@ -1272,7 +1464,11 @@ HandleRidgeDetector(Settings settings,
                &cerr);
   }
 
-  // Using this blurred image, calculate the 2nd derivative matrix everywhere:
+  // Using this blurred image, calculate the 2nd derivative matrix everywhere,
+  // diagonalize it, and store the saliency (score) of each voxel in
+  // tomo_out.aaafI, and the direction of its principal eigenvector
+  // in aaaafDirection.  (This is done in a single pass.  The Hessian
+  // is only saved if we need it later.)
 
   cerr << "Applying a Gaussian blur of width sigma="
        << sigma*voxel_width[0] << " voxels" << endl;
@@ -1283,120 +1479,43 @@ HandleRidgeDetector(Settings settings,
     throw VisfdErr("Error: Ridge-detection requires an image that is at least 3 voxels\n"
                    "       wide in the x,y,z directions.\n");
 
-  CalcHessian(tomo_in.header.nvoxels,
-              tomo_in.aaafI,
-              aaaafGradient,
-              tmp_tensor.aaaafI,
-              mask.aaafI,
-              sigma,
-              settings.filter_truncate_ratio,
-              &cerr);
-
-  cerr << "Diagonalizing the Hessians" << endl;
-
-
-  // DELETE THIS DEBUGGING CRUFT
-  //for(int iz=0; iz < image_size[2]; iz++)
-  //  for(int iy=0; iy < image_size[1]; iy++)
-  //    for(int ix=0; ix < image_size[0]; ix++)
-  //      tomo_out.aaafI[iz][iy][ix] =
-  //        FrobeniusNormSqdSym3(tmp_tensor.aaaafI[iz][iy][ix]);
-  //return;
-  // DELETE THIS DEBUGGING CRUFT
-
-
-  // We need to store the direction of the most important eigenvector
-  // somewhere.  To save space, why not store it in the aaaafGradient
-  // array?  (At this point, we are no longer using it).
-
-  array<float, 3> ***aaaafDirection = aaaafGradient;
-
-  // This just effectively changes the name
-  // from "aaaafGradient" to "aaaafDirection".
-  // The purpose of the name change is to make it easier to read the code later.
-
-  // Optional: store the saliency (score) of each voxel in tomo_out.aaafI
-  for(int iz=0; iz < image_size[2]; iz++)
-    for(int iy=0; iy < image_size[1]; iy++)
-      for(int ix=0; ix < image_size[0]; ix++)
-        tomo_out.aaafI[iz][iy][ix] = 0.0;
+  if (store_hessian16)
+    CalcHessianPlanarScore(tomo_in.header.nvoxels,
+                           tomo_in.aaafI,
+                           tomo_out.aaafI,
+                           aaaafDirection,
+                           tmp_hessian16.aaaafI,
+                           mask.aaafI,
+                           sigma,
+                           eival_order,
+                           settings.filter_truncate_ratio,
+                           &cerr);
+  else
+    CalcHessianPlanarScore(tomo_in.header.nvoxels,
+                           tomo_in.aaafI,
+                           tomo_out.aaafI,
+                           aaaafDirection,
+                           (store_hessian
+                            ? tmp_tensor.aaaafI
+                            : static_cast<float****>(nullptr)),
+                           mask.aaafI,
+                           sigma,
+                           eival_order,
+                           settings.filter_truncate_ratio,
+                           &cerr);
 
-  for(int iz=0; iz < image_size[2]; iz++) {
+  if (tomo_background.aaafI) {
     #pragma omp parallel for collapse(2)
-    for(int iy=0; iy < image_size[1]; iy++) {
-      for(int ix=0; ix < image_size[0]; ix++) {
-
-        if (! tmp_tensor.aaaafI[iz][iy][ix]) //ignore voxels that are either
-          continue;                         //in the mask or on the boundary
-
-        float eivals[3];
-        float eivects[3][3];
-
-        ConvertFlatSym2Evects3(tmp_tensor.aaaafI[iz][iy][ix],
-                               eivals,
-                               eivects,
-                               eival_order);
-
-        float score;
-
-        // DEBUG: REMOVE THE NEXT IF STATMENT AFTER DEBUGGING IS FINISHED
-        #ifndef NDEBUG
-        if ((ix==image_size[0]/2) && //if ((ix==78) &&
-            (iy == image_size[1] / 2) &&
-            (iz == image_size[2] / 2))
-        {
-          cerr << "[iz][iy][ix]=["<<iz<<"]["<<iy<<"]["<<ix<<"]\n"
-               << "eivals = "<<eivals[0]<<","<<eivals[1]<<","<<eivals[2]<<"\n"
-               << "eivects = \n"
-               << "    "<<eivects[0][0]<<","<<eivects[0][1]<<","<<eivects[0][2]<<"\n"
-               << "    "<<eivects[1][0]<<","<<eivects[1][1]<<","<<eivects[1][2]<<"\n"
-               << "    "<<eivects[2][0]<<","<<eivects[2][1]<<","<<eivects[2][2]<<"\n"
-               << endl;
-        }
-        #endif  //#ifndef NDEBUG
-
-
-        score = ScoreHessianPlanar(eivals,
-                                   aaaafGradient[iz][iy][ix]);
-
-        float peak_height = 1.0;
-        if (tomo_background.aaafI)
-          peak_height = (tomo_in.aaafI[iz][iy][ix] -
-                         tomo_background.aaafI[iz][iy][ix]);
-        score *= peak_height;
-
-        tomo_out.aaafI[iz][iy][ix] = score;
-
-        #if 0
-        //I will use this code eventually, but not yet
-        float gradient_along_v1 = DotProduct3(grad, eivects[0]);
-        float distance_to_ridge;
-        if (lambda1 != 0)
-          distance_to_ridge = abs(gradient_along_v1 / lambda1);
-        else
-          distance_to_ridge = std::numeric_limits<float>::infinity();
-
-        bool ridge_located_in_same_voxel = true;
-        for (int d=0; d<3; d++) {
-          float ridge_voxel_location = eivects[0][d] * distance_to_ridge;
-          if (abs(ridge_voxel_location) > 0.5)
-            ridge_located_in_same_voxel = false;
+    for(int iz=0; iz < image_size[2]; iz++) {
+      for(int iy=0; iy < image_size[1]; iy++) {
+        for(int ix=0; ix < image_size[0]; ix++) {
+          float peak_height = (tomo_in.aaafI[iz][iy][ix] -
+                               tomo_background.aaafI[iz][iy][ix]);
+          tomo_out.aaafI[iz][iy][ix] *= peak_height;
         }
-        //if ((distance_to_ridge < settings.ridge_detector_search_width*0.5) &&
-
-        if (! ridge_located_in_same_voxel)
-          out_tomo.aaafI[iz][iy][ix] = 0.0;  //then ignore discard this voxel
-        #endif
-
-
-        aaaafDirection[iz][iy][ix][0] = eivects[0][0];
-        aaaafDirection[iz][iy][ix][1] = eivects[0][1];
-        aaaafDirection[iz][iy][ix][2] = eivects[0][2];
-
-
-      } //for(int ix=0; ix < image_size[0]; ix++)
-    } //for(int iy=0; iy < image_size[1]; iy++)
-  } //for(int iz=0; iz < image_size[2]; iz++)
+      }
+    }
+  }
 
 
 
@@ -1451,7 +1570,7 @@ HandleRidgeDetector(Settings settings,
 
 
 
-  if (settings.surface_tv_sigma > 0.0) {
+  if (use_tensor_voting) {
     assert(settings.filter_truncate_ratio > 0);
 
     TV3D<float, int, array<float,3>, float* >
@@ -1466,19 +1585,24 @@ HandleRidgeDetector(Settings settings,
                     mask.aaafI,
                     mask.aaafI,
                     false,  // (we want to detect surfaces not curves)
-                    //settings.surface_hessian_score_threshold,
+                    settings.surface_tv_score_threshold,
                     true,   // (do normalize near rectangular image bounaries)
                     false,  // (diagonalize each tensor afterwards?)
                     &cerr);
 
+    #pragma omp parallel for collapse(2)
     for(int iz=0; iz < image_size[2]; iz++) {
       for(int iy=0; iy < image_size[1]; iy++) {
+        vector<array<float, 3> > vEivals(image_size[0]);
+        DiagonalizeTensorRow(image_size[0],
+                             tmp_tensor.aaaafI[iz][iy],
+                             vEivals.data(),
+                             nullptr,
+                             eival_order);
         for(int ix=0; ix < image_size[0]; ix++) {
-          float diagonalized_hessian[6];
-          DiagonalizeFlatSym3(tmp_tensor.aaaafI[iz][iy][ix],
-                              diagonalized_hessian,
-                              eival_order);
-          float score = ScoreTensorPlanar(diagonalized_hessian);
+          if (! tmp_tensor.aaaafI[iz][iy][ix]) //ignore voxels outside the mask
+            continue;
+          float score = ScoreTensorPlanar(vEivals[ix]);
           float peak_height = 1.0;
           if (tomo_background.aaafI)
             peak_height = (tomo_in.aaafI[iz][iy][ix] -
@@ -1488,7 +1612,7 @@ HandleRidgeDetector(Settings settings,
         }
       }
     }
-  } // if (settings.surface_tv_sigma > 0.0)
+  } // if (use_tensor_voting)
 
 
 
@@ -1499,25 +1623,22 @@ HandleRidgeDetector(Settings settings,
                         // should allocate a new 3D array to store the saliency)
 
     // Copy the principal eigenvector of tmp_tensor into aaaafDirection
-    for(int iz=0; iz < image_size[2]; iz++) {
-      for(int iy=0; iy < image_size[1]; iy++) {
-        for(int ix=0; ix < image_size[0]; ix++) {
-          float eivals[3];
-          float eivects[3][3];
-          ConvertFlatSym2Evects3(tmp_tensor.aaaafI[iz][iy][ix],
-                                 eivals,
-                                 eivects,
-                                 eival_order);
-          for (int d=0; d<3; d++)
-            aaaafDirection[iz][iy][ix][d] = eivects[0][d];
+    // (If tmp_tensor contains the Hessian, this was already done by
+    //  CalcHessianPlanarScore().)
+    if (use_tensor_voting) {
+      #pragma omp parallel for collapse(2)
+      for(int iz=0; iz < image_size[2]; iz++) {
+        for(int iy=0; iy < image_size[1]; iy++) {
+          vector<array<float, 3> > vEivals(image_size[0]);
+          DiagonalizeTensorRow(image_size[0],
+                               tmp_tensor.aaaafI[iz][iy],
+                               vEivals.data(),
+                               aaaafDirection[iz][iy],
+                               eival_order);
         }
       }
     }
 
-    vector<array<float, 3> > cluster_centers;
-    vector<float> cluster_sizes;
-    vector<float> cluster_saliencies;
-
     // Create a temporary array to store the cluster membership for each voxel.
     // Because the number or clusters could (conceivably) exceed 10^6, we
     // should not make this a table of ints or floats.  Instead use "ptrdiff_t".
@@ -1530,33 +1651,22 @@ HandleRidgeDetector(Settings settings,
     //  which will be written to a file later.  This way the end-user can
     //  view the results.)
 
-    ClusterConnected(tomo_in.header.nvoxels, //image size
-                     tomo_in.aaafI, //<-saliency
-                     aaaiClusterId, //<-which cluster does each voxel belong to?  (results will be stored here)
-                     mask.aaafI,
-                     settings.connect_threshold_saliency,
-                     static_cast<ptrdiff_t>(0), //this value is ignored, but it specifies the type of array we are using
-                     true,  //(voxels not belonging to clusters are assigned the highest value = num_clusters+1)
-                     aaaafDirection,
-                     settings.connect_threshold_vector_saliency,
-                     settings.connect_threshold_vector_neighbor,
-                     false, //eigenvector signs are arbitrary so ignore them
-                     tmp_tensor.aaaafI,
-                     settings.connect_threshold_tensor_saliency,
-                     settings.connect_threshold_tensor_neighbor,
-                     true,  //the tensor should be positive definite near the target
-                     1,
-                     &cluster_centers,
-                     &cluster_sizes,
-                     &cluster_saliencies,
-                     ClusterSortCriteria::SORT_BY_SIZE,
-                     static_cast<float***>(nullptr),
-                     #ifndef DISABLE_STANDARDIZE_VECTOR_DIRECTION
-                     aaaafDirection,
-                     #endif
-                     pMustLinkConstraints,
-                     true, //(clusters begin at regions of high saliency)
-                     &cerr);  //!< print progress to the user
+    if (tmp_hessian16.aaaafI)
+      ClusterRidgeVoxels(settings,
+                         tomo_in,
+                         mask,
+                         aaaafDirection,
+                         tmp_hessian16.aaaafI,
+                         pMustLinkConstraints,
+                         aaaiClusterId);
+    else
+      ClusterRidgeVoxels(settings,
+                         tomo_in,
+                         mask,
+                         aaaafDirection,
+                         tmp_tensor.aaaafI,
+                         pMustLinkConstraints,
+                         aaaiClusterId);
 
     // Now, copy the contents of aaaClusterId into tomo_out.aaafI
     for (int iz = 0; iz < image_size[2]; ++iz)
@@ -1609,7 +1719,8 @@ HandleRidgeDetector(Settings settings,
                             image_size,
                             aaaafDirection,
                             aaafSelectedVoxels,
-                            voxel_width);
+                            voxel_width,
+                            settings.out_normals_binary);
 
   } //if (settings.out_normals_fname != "")
 
@@ -1622,7 +1733,187 @@ HandleRidgeDetector(Settings settings,
 
 
   Dealloc3D(tomo_in.header.nvoxels,
-            &(aafGradient),
-            &(aaaafGradient));
+            &(aafDirection),
+            &(aaaafDirection));
 
 } //HandleRidgeDetector()
+
+
+
+
+/// @brief  Return the number of extra slices we must read on either side of
+///         each slab so that the filtered voxels within that slab are not
+///         effected by the slab boundaries.  (This is the halfwidth of the
+///         filter window in the z direction, or twice that for filters which
+///         are applied twice.)
+
+static int
+SlabHaloWidth(const Settings &settings)
+{
+  float ratio = settings.filter_truncate_ratio;
+  if (ratio <= 0.0)
+    //    filter_truncate_threshold = exp(-(1/2)*filter_truncate_ratio^2);
+    //    -> filter_truncate_ratio^2 = -2*log(filter_truncate_threshold)
+    ratio = sqrt(-2*log(settings.filter_truncate_threshold));
+  float sigma_z = 0.0;
+  int num_passes = 1;
+
+  if (settings.filter_type == Settings::GAUSS)
+    sigma_z = settings.width_a[2];
+  else if (settings.filter_type == Settings::DOG)
+    sigma_z = max(settings.width_a[2], settings.width_b[2]);
+  else if (settings.filter_type == Settings::DOG_SCALE_FREE)
+    sigma_z = settings.dogsf_width[2] *
+      (1.0 + 0.5*abs(settings.delta_sigma_over_sigma));
+  #ifndef DISABLE_TEMPLATE_MATCHING
+  else if (settings.filter_type == Settings::LOCAL_FLUCTUATIONS) {
+    if (settings.filter_truncate_ratio <= 0.0)
+      // (see LocalFluctuationsByRadius() in "filter3d_variants.hpp")
+      ratio = pow(-log(settings.filter_truncate_threshold),
+                  1.0 / settings.template_background_exponent);
+    sigma_z = (settings.template_background_radius[2] /
+               pow((9.0/2)*M_PI, 1.0/6));
+    // This filter is applied twice (to the image, and to its fluctuations)
+    num_passes = 2;
+  }
+  #endif
+  else
+    assert(false);
+
+  // (Add 1 to avoid round-off error.  A wider halo does no harm.)
+  return num_passes * (static_cast<int>(floor(sigma_z * ratio)) + 1);
+} //SlabHaloWidth()
+
+
+
+void
+HandleSlabStreaming(Settings settings,
+                    MrcSimple &tomo_in,
+                    float voxel_width[3])
+{
+  int image_size[3];
+  for (int d = 0; d < 3; d++)
+    image_size[d] = tomo_in.header.nvoxels[d];
+
+  if (settings.mask_file_name != "") {
+    MrcSimple mask;
+    mask.ReadHeader(settings.mask_file_name);
+    if ((mask.header.nvoxels[0] != image_size[0]) ||
+        (mask.header.nvoxels[1] != image_size[1]) ||
+        (mask.header.nvoxels[2] != image_size[2]))
+      throw VisfdErr("Error: The size of the mask image does not match the size of the input image.\n");
+  }
+
+  int halo = SlabHaloWidth(settings);
+
+  cerr << "Processing the image in slabs of thickness "
+       << settings.slab_thickness << " (plus " << halo
+       << " slices of overlap on either side)\n";
+
+  fstream out_file;
+  out_file.open(settings.out_file_name, ios::binary | ios::out);
+  if (! out_file)
+    throw VisfdErr("Error: unable to open \""+ settings.out_file_name+"\" for writing.\n");
+
+  // Write the header now.  (We will update its dmin, dmax, and dmean
+  //                          entries after all of the slabs are written.)
+  MrcHeader out_header = tomo_in.header;
+  out_header.mode = MrcHeader::MRC_MODE_FLOAT;
+  out_header.Write(out_file);
+
+  double brightness_total = 0.0;
+  double dmin = 0.0;  //impossible initial value
+  double dmax = -1.0; //impossible initial value
+
+  for (int iz_begin = 0;
+       iz_begin < image_size[2];
+       iz_begin += settings.slab_thickness)
+  {
+    int iz_end = min(iz_begin + settings.slab_thickness, image_size[2]);
+    // Read this slab, as well as the nearby slices (the "halo")
+    int iz_read_begin = max(iz_begin - halo, 0);
+    int iz_read_end = min(iz_end + halo, image_size[2]);
+
+    cerr << "\n"
+      " ---- Processing slices z = " << iz_begin << " ... " << iz_end - 1
+         << " (of " << image_size[2] << ") ----\n" << endl;
+
+    MrcSimple slab_in;
+    slab_in.ReadSlices(settings.in_file_name, iz_read_begin, iz_read_end);
+
+    MrcSimple mask;
+    if (settings.mask_file_name != "") {
+      mask.ReadSlices(settings.mask_file_name, iz_read_begin, iz_read_end);
+      // The mask should be 1 everywhere we want to consider, and 0 elsewhere.
+      if (settings.use_mask_select) {
+        for (int iz=0; iz<mask.header.nvoxels[2]; iz++)
+          for (int iy=0; iy<mask.header.nvoxels[1]; iy++)
+            for (int ix=0; ix<mask.header.nvoxels[0]; ix++)
+              if (mask.aaafI[iz][iy][ix] == settings.mask_select)
+                mask.aaafI[iz][iy][ix] = 1.0;
+              else
+                mask.aaafI[iz][iy][ix] = 0.0;
+      }
+    }
+
+    MrcSimple slab_out = slab_in;
+
+    if (settings.filter_type == Settings::GAUSS)
+      HandleGauss(settings, slab_in, slab_out, mask, voxel_width);
+    else if (settings.filter_type == Settings::DOG)
+      HandleDog(settings, slab_in, slab_out, mask, voxel_width);
+    else if (settings.filter_type == Settings::DOG_SCALE_FREE)
+      HandleDogScaleFree(settings, slab_in, slab_out, mask, voxel_width);
+    else if (settings.filter_type == Settings::LOCAL_FLUCTUATIONS)
+      HandleLocalFluctuations(settings, slab_in, slab_out, mask, voxel_width);
+    else
+      assert(false);
+
+    if (settings.use_intensity_map)
+      HandleThresholds(settings, slab_in, slab_out, mask, voxel_width);
+
+    if ((mask.aaafI) && (settings.use_mask_out))
+      for (int iz=0; iz<mask.header.nvoxels[2]; iz++)
+        for (int iy=0; iy<mask.header.nvoxels[1]; iy++)
+          for (int ix=0; ix<mask.header.nvoxels[0]; ix++)
+            if (mask.aaafI[iz][iy][ix] == 0.0)
+              slab_out.aaafI[iz][iy][ix] = settings.mask_out;
+
+    // Discard the halo.  Only write the slices belonging to this slab.
+    int iz0 = iz_begin - iz_read_begin;
+    int iz1 = iz_end - iz_read_begin;
+    for (int iz=iz0; iz<iz1; iz++) {
+      for (int iy=0; iy<image_size[1]; iy++) {
+        for (int ix=0; ix<image_size[0]; ix++) {
+          float brightness = slab_out.aaafI[iz][iy][ix];
+          brightness_total += brightness;
+          if (dmin > dmax) {
+            dmin = brightness;
+            dmax = brightness;
+          }
+          else {
+            if (brightness > dmax)
+              dmax = brightness;
+            if (brightness < dmin)
+              dmin = brightness;
+          }
+        }
+      }
+    }
+    slab_out.WriteSlices(out_file, iz0, iz1);
+    if (! out_file)
+      throw VisfdErr("Error: unable to write to \""+ settings.out_file_name+"\"\n");
+  } //for (int iz_begin = 0; iz_begin < image_size[2]; ...)
+
+  // Now go back and fill in the dmin, dmax, and dmean header entries
+  out_header.dmin = dmin;
+  out_header.dmax = dmax;
+  out_header.dmean = (brightness_total /
+                      (static_cast<double>(image_size[0]) *
+                       image_size[1] *
+                       image_size[2]));
+  out_file.seekp(0);
+  out_header.Write(out_file);
+  out_file.close();
+
+} //HandleSlabStreaming()
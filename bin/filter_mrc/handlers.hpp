@@ -138,4 +138,10 @@ HandleRidgeDetector(Settings settings,
                     float voxel_width[3]);
 
 
+void
+HandleSlabStreaming(Settings settings,
+                    MrcSimple &tomo_in,
+                    float voxel_width[3]);
+
+
 #endif //#ifndef _HANDLERS_H
@@ -806,6 +806,7 @@ HandleTemplateGGauss(Settings settings,
   // This will mean the maximum w_i is 1, and the others decay to 0, as we want
   float wpeak = w.aaafH[0][0][0];
   w.MultiplyScalar(1.0 / wpeak);
+  w.convolve_method = settings.convolve_method; // use FFTs?
 
   // Template function, Q:
   TemplateMatcher3D<float, int>
@@ -1405,64 +1406,92 @@ HandleDistanceToPoints(Settings settings,
   if (! coords_file)
     throw VisfdErr("Error: unable to open \""+
                    settings.in_coords_file_name +"\" for reading.\n");
-  vector<array<int,3> > crds;
-  while (coords_file) {
-    double x, y, z;
-    coords_file >> x;
-    coords_file >> y;
-    coords_file >> z;
-    double ix, iy, iz;
-    ix = floor((x / voxel_width[0]) + 0.5);
-    iy = floor((y / voxel_width[1]) + 0.5);
-    iz = floor((z / voxel_width[2]) + 0.5);
-    array<int, 3> ixiyiz;
-    ixiyiz[0] = ix;
-    ixiyiz[1] = iy;
-    ixiyiz[2] = iz;
-    crds.push_back(ixiyiz);
+  // Create an image which is non-zero at the location of each point.
+  float *afPoints;
+  float ***aaafPoints;
+  Alloc3D(tomo_in.header.nvoxels, &afPoints, &aaafPoints);
+  for (int iz=0; iz<tomo_in.header.nvoxels[2]; iz++)
+    for (int iy=0; iy<tomo_in.header.nvoxels[1]; iy++)
+      for (int ix=0; ix<tomo_in.header.nvoxels[0]; ix++)
+        aaafPoints[iz][iy][ix] = 0.0;
+  size_t num_points = 0;
+  // Points outside the image can not be stored in aaafPoints.  Keep track
+  // of them separately.  (They are handled after the distance transform.)
+  vector<array<int,3> > crds_outside;
+  double x, y, z;
+  while (coords_file >> x >> y >> z) {
+    int ix = floor((x / voxel_width[0]) + 0.5);
+    int iy = floor((y / voxel_width[1]) + 0.5);
+    int iz = floor((z / voxel_width[2]) + 0.5);
+    num_points++;
+    if ((ix < 0) || (ix >= tomo_in.header.nvoxels[0]) ||
+        (iy < 0) || (iy >= tomo_in.header.nvoxels[1]) ||
+        (iz < 0) || (iz >= tomo_in.header.nvoxels[2])) {
+      array<int, 3> ixiyiz;
+      ixiyiz[0] = ix;
+      ixiyiz[1] = iy;
+      ixiyiz[2] = iz;
+      crds_outside.push_back(ixiyiz);
+      continue;
+    }
+    aaafPoints[iz][iy][ix] = 1.0;
+  }
+  if (num_points == 0) {
+    Dealloc3D(tomo_in.header.nvoxels, &afPoints, &aaafPoints);
+    throw VisfdErr("Error: There are no points in \""+
+                   settings.in_coords_file_name +"\".\n");
   }
 
   cerr << " ------ calculating distance to points in "
        << settings.in_coords_file_name << " ------\n"
        << endl;
 
-  // At some point I was trying to be as general as possible and allowed
-  // for the possibility that voxels need not be cubes (same width x,y,z)
-  // Now, I realize that allowing for this possibility would slow down some
-  // calculations considerably, so I just assume cube-shaped voxels:
-  float voxel_width_ = voxel_width[0];
-  assert((voxel_width[0] == voxel_width[1]) &&
-         (voxel_width[1] == voxel_width[2]));
-
-  for (int iz=0; iz<tomo_out.header.nvoxels[2]; iz++) {
-    cerr << "processing Z-plane " << iz+1 << " / "
-         << tomo_out.header.nvoxels[2] << "\n";
-    for (int iy=0; iy<tomo_out.header.nvoxels[1]; iy++) {
-      for (int ix=0; ix<tomo_out.header.nvoxels[0]; ix++) {
-        int rminsq_int = SQR(tomo_out.header.nvoxels[0] +
-                             tomo_out.header.nvoxels[1] +
-                             tomo_out.header.nvoxels[2]);
-
-        if (mask.aaafI && (mask.aaafI[iz][iy][ix] == 0.0))
-          continue;
-
-        // Loop over all of the points and find the nearest one.
-        // Calculate the distance to that point, and store that in the tomogram.
-        // (Note: This is a terribly inefficient way to do this.
-        //        A paint-bucket-like-tool using expanding spheres would
-        //        be much faster and visit each voxel only once on average.)
-        for (vector<array<int,3> >::const_iterator pxyz=crds.begin();
-             pxyz != crds.end();
-             pxyz++) {
-          int rsqi=SQR(ix-(*pxyz)[0])+SQR(iy-(*pxyz)[1])+SQR(iz-(*pxyz)[2]);
-          if (rsqi < rminsq_int)
-            rminsq_int = rsqi;
+  // Now calculate the distance from every voxel to the nearest point.
+  // (If every point lies outside the image, this distance is infinite.)
+  DistanceTransform(tomo_in.header.nvoxels,
+                    aaafPoints,
+                    tomo_out.aaafI,
+                    static_cast<float const *const *const *>(nullptr),
+                    voxel_width,
+                    false,
+                    &cerr);
+
+  // Points outside the image are not visible to DistanceTransform().
+  // There are usually only a few of them, so check them one at a time.
+  if (crds_outside.size() > 0) {
+    cerr << "  (" << crds_outside.size() << " of the " << num_points
+         << " points lie outside the image.)\n";
+    #pragma omp parallel for collapse(2)
+    for (int iz=0; iz<tomo_out.header.nvoxels[2]; iz++) {
+      for (int iy=0; iy<tomo_out.header.nvoxels[1]; iy++) {
+        for (int ix=0; ix<tomo_out.header.nvoxels[0]; ix++) {
+          float rminsq = SQR(tomo_out.aaafI[iz][iy][ix]);
+          for (vector<array<int,3> >::const_iterator pxyz=crds_outside.begin();
+               pxyz != crds_outside.end();
+               pxyz++) {
+            float rsq = (SQR((ix - (*pxyz)[0]) * voxel_width[0]) +
+                         SQR((iy - (*pxyz)[1]) * voxel_width[1]) +
+                         SQR((iz - (*pxyz)[2]) * voxel_width[2]));
+            if (rsq < rminsq)
+              rminsq = rsq;
+          }
+          tomo_out.aaafI[iz][iy][ix] = sqrt(rminsq);
         }
-        float rmin = sqrt(rminsq_int * SQR(voxel_width_));
-        tomo_out.aaafI[iz][iy][ix] = rmin;
       }
     }
   }
+
+  // (Note: We did not pass the mask to DistanceTransform() because the mask
+  //  is only used to decide where to calculate the distance.  Points outside
+  //  the mask should still be considered.)
+  if (mask.aaafI)
+    for (int iz=0; iz<tomo_out.header.nvoxels[2]; iz++)
+      for (int iy=0; iy<tomo_out.header.nvoxels[1]; iy++)
+        for (int ix=0; ix<tomo_out.header.nvoxels[0]; ix++)
+          if (mask.aaafI[iz][iy][ix] == 0.0)
+            tomo_out.aaafI[iz][iy][ix] = tomo_in.aaafI[iz][iy][ix];
+
+  Dealloc3D(tomo_in.header.nvoxels, &afPoints, &aaafPoints);
 } //HandleDistanceToPoints()
 
 
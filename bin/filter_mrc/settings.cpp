@@ -20,12 +20,17 @@ using namespace std;
 Settings::Settings() {
   // Default settings
   in_file_name = "";
+  in_file_mmap = false;
+  slab_thickness = 0;
   in_set_image_size[0] = 0;
   in_set_image_size[1] = 0;
   in_set_image_size[2] = 0;
   invert_output = false;
   out_file_name = "";
   out_file_overwrite = false;
+  batch_file_name = "";
+  pin_threads = false;
+  num_threads = 0;
   mask_file_name = "";
   mask_select = 1;
   use_mask_select = false;
@@ -76,6 +81,9 @@ Settings::Settings() {
                             //voxels up to a distance of this many sigma away
                             //(Setting this to a number < 0 disables it.)
 
+  convolve_method = CONVOLVE_AUTO; //Use FFTs for non-separable filters only
+                            //when it is expected to be faster.
+
   dogsf_width[0] = 0.0;
   dogsf_width[1] = 0.0;
   dogsf_width[2] = 0.0;
@@ -113,6 +121,8 @@ Settings::Settings() {
   is_training_pos_in_voxels = false;
   is_training_neg_in_voxels = false;
   blob_width_multiplier = 1.0;
+  blob_incremental = false;
+  blob_pyramid_max_level = 0;
   nonmax_min_radial_separation_ratio = 0.0;
   nonmax_max_volume_overlap_small = std::numeric_limits<float>::infinity();
   nonmax_max_volume_overlap_large = std::numeric_limits<float>::infinity();
@@ -122,8 +132,10 @@ Settings::Settings() {
   watershed_boundary_label = 0.0;
   watershed_show_boundaries = true;
   watershed_threshold = std::numeric_limits<float>::infinity();
+  watershed_num_blocks = 1;
 
   out_normals_fname = "";
+  out_normals_binary = false;
   ridges_are_maxima = false;
   surface_hessian_score_threshold = 0.0; //don't discard any voxels before TV
   surface_hessian_score_threshold_is_a_fraction = false;
@@ -143,6 +155,8 @@ Settings::Settings() {
   connect_threshold_vector_neighbor = -std::numeric_limits<float>::infinity();
   connect_threshold_tensor_saliency = -std::numeric_limits<float>::infinity();
   connect_threshold_tensor_neighbor = -std::numeric_limits<float>::infinity();
+  connect_num_blocks = 0;
+  connect_fp16 = false;
   must_link_constraints.clear();
   is_must_link_constraints_in_voxels = false;
   select_cluster = 0;
@@ -211,6 +225,29 @@ void Settings::ParseArgs(int argc, char **argv) {
 
 
 
+void Settings::ParseArgs(int argc, char **argv, const vector<string>& vJob) {
+  assert(vJob.size() >= 2);
+  vector<string> vArgs;
+  ConvertArgvToVectorOfStrings(argc, argv, vArgs);
+  // Remove the "-batch" argument (so that we don't read the batch file again)
+  for (size_t i=1; i < vArgs.size(); ++i) {
+    if (vArgs[i] == "-batch") {
+      vArgs.erase(vArgs.begin()+i, vArgs.begin()+min(i+2, vArgs.size()));
+      break;
+    }
+  }
+  // The first two words in each job are the input and output file names.
+  // The remaining words are additional arguments.
+  vArgs.push_back("-in");
+  vArgs.push_back(vJob[0]);
+  vArgs.push_back("-out");
+  vArgs.push_back(vJob[1]);
+  vArgs.insert(vArgs.end(), vJob.begin()+2, vJob.end());
+  ParseArgs(vArgs);
+}
+
+
+
 void Settings::ConvertArgvToVectorOfStrings(int argc,
                                             char **argv,
                                             vector<string>& dest)
@@ -296,6 +333,58 @@ Settings::ParseArgs(vector<string>& vArgs)
 
     } // if (vArgs[i] == "-outf")
 
+
+    else if (vArgs[i] == "-batch")
+    {
+      if ((i+1 >= vArgs.size()) || (vArgs[i+1] == "") || (vArgs[i+1][0] == '-'))
+        throw InputErr("Error: The " + vArgs[i] + 
+                       " argument must be followed by a file name.\n");
+      batch_file_name = vArgs[i+1];
+      fstream f;
+      f.open(batch_file_name, ios::in);
+      if (! f)
+        throw InputErr("Error: unable to open \""+ batch_file_name +"\" for reading.\n");
+      vector<vector<string> > vvWords;
+      ReadMulticolumnFile(f, vvWords);
+      batch_jobs.clear();
+      for (size_t i_line = 0; i_line < vvWords.size(); i_line++) {
+        if (vvWords[i_line].size() == 0)
+          continue; // skip blank lines
+        if (vvWords[i_line].size() < 2) {
+          stringstream err_msg;
+          err_msg << "Error: Each line of \"" << batch_file_name << "\" must begin with\n"
+                  << "       the name of an input file and an output file.\n"
+                  << "       (See line " << i_line+1 << ".)\n";
+          throw InputErr(err_msg.str());
+        }
+        batch_jobs.push_back(vvWords[i_line]);
+      }
+      num_arguments_deleted = 2;
+    } // if (vArgs[i] == "-batch")
+
+
+    else if (vArgs[i] == "-mmap")
+    {
+      in_file_mmap = true;
+      num_arguments_deleted = 1;
+    } // if (vArgs[i] == "-mmap")
+
+    else if (vArgs[i] == "-slab")
+    {
+      try {
+        if ((i+1 >= vArgs.size()) || (vArgs[i+1] == ""))
+          throw invalid_argument("");
+        slab_thickness = stoi(vArgs[i+1]);
+        if (slab_thickness <= 0)
+          throw invalid_argument("");
+      }
+      catch (invalid_argument& exc) {
+        throw InputErr("Error: The " + vArgs[i] + 
+                       " argument must be followed by a positive integer.\n");
+      }
+      num_arguments_deleted = 2;
+    } // if (vArgs[i] == "-slab")
+
     else if (vArgs[i] == "-mask")
     {
       if ((i+1 >= vArgs.size()) || (vArgs[i+1] == "") || (vArgs[i+1][0] == '-'))
@@ -1172,6 +1261,37 @@ Settings::ParseArgs(vector<string>& vArgs)
 
 
 
+    else if (vArgs[i] == "-blob-incremental") {
+      blob_incremental = true;
+      num_arguments_deleted = 1;
+    }
+
+
+    else if (vArgs[i] == "-no-blob-incremental") {
+      blob_incremental = false;
+      num_arguments_deleted = 1;
+    }
+
+
+    else if (vArgs[i] == "-blob-pyramid") {
+      try {
+        if ((i+1 >= vArgs.size()) ||
+            (vArgs[i+1] == ""))
+          throw invalid_argument("");
+        blob_pyramid_max_level = stoi(vArgs[i+1]);
+        if (blob_pyramid_max_level < 0)
+          throw invalid_argument("");
+      }
+      catch (invalid_argument& exc) {
+        throw InputErr("Error: The " + vArgs[i] + 
+                       " argument must be followed by a non-negative integer\n");
+      }
+      num_arguments_deleted = 2;
+    }
+
+
+
+
     else if (vArgs[i] == "-dog-delta") {
       try {
         if ((i+1 >= vArgs.size()) ||
@@ -1289,6 +1409,20 @@ Settings::ParseArgs(vector<string>& vArgs)
     } // if (vArgs[i] == "-truncate-thresold")
 
 
+    else if (vArgs[i] == "-fft")
+    {
+      convolve_method = CONVOLVE_FFT;
+      num_arguments_deleted = 1;
+    }
+
+
+    else if (vArgs[i] == "-no-fft")
+    {
+      convolve_method = CONVOLVE_DIRECT;
+      num_arguments_deleted = 1;
+    }
+
+
 
 
     else if (vArgs[i] == "-rescale")
@@ -2063,6 +2197,26 @@ Settings::ParseArgs(vector<string>& vArgs)
     }
 
 
+    else if (vArgs[i] == "-watershed-blocks")
+    {
+      filter_type = WATERSHED;
+      try {
+        if ((i+1 >= vArgs.size()) ||
+            (vArgs[i+1] == ""))
+          throw invalid_argument("");
+        watershed_num_blocks = stoi(vArgs[i+1]);
+        if (watershed_num_blocks < 1)
+          throw invalid_argument("");
+      }
+      catch (invalid_argument& exc) {
+        throw InputErr("Error: The " + vArgs[i] + 
+                       " argument must be followed by a positive integer\n");
+      }
+      
+      num_arguments_deleted = 2;
+    }
+
+
 
     else if (vArgs[i] == "-planar") {
       throw InputErr("Error: As of 2019-4-11, the " + vArgs[i] + 
@@ -2249,12 +2403,14 @@ Settings::ParseArgs(vector<string>& vArgs)
     }
 
 
-    else if (vArgs[i] == "-surface-normals-file") {
+    else if ((vArgs[i] == "-surface-normals-file") ||
+             (vArgs[i] == "-surface-normals-file-binary")) {
       try {
         if ((i+1 >= vArgs.size()) ||
             (vArgs[i+1] == "") || (vArgs[i+1][0] == '-'))
           throw invalid_argument("");
         out_normals_fname = vArgs[i+1];
+        out_normals_binary = (vArgs[i] == "-surface-normals-file-binary");
       }
       catch (invalid_argument& exc) {
         throw InputErr("Error: The " + vArgs[i] + 
@@ -2371,6 +2527,30 @@ Settings::ParseArgs(vector<string>& vArgs)
       num_arguments_deleted = 2;
     }
 
+    else if (vArgs[i] == "-connect-blocks")
+    {
+      try {
+        if ((i+1 >= vArgs.size()) ||
+            (vArgs[i+1] == ""))
+          throw invalid_argument("");
+        connect_num_blocks = stoi(vArgs[i+1]);
+        if (connect_num_blocks < 1)
+          throw invalid_argument("");
+      }
+      catch (invalid_argument& exc) {
+        throw InputErr("Error: The " + vArgs[i] + 
+                       " argument must be followed by a positive integer\n");
+      }
+      num_arguments_deleted = 2;
+    }
+
+
+    else if (vArgs[i] == "-connect-fp16")
+    {
+      connect_fp16 = true;
+      num_arguments_deleted = 1;
+    }
+
 
     else if (vArgs[i] == "-select-cluster")
     {
@@ -2419,8 +2599,11 @@ Settings::ParseArgs(vector<string>& vArgs)
         if ((i+1 >= vArgs.size()) ||
             (vArgs[i+1] == "") || (vArgs[i+1][0] == '-'))
           throw invalid_argument("");
-        int num_threads = stoi(vArgs[i+1]);
-        omp_set_num_threads(num_threads);
+        num_threads = stoi(vArgs[i+1]);
+        if (num_threads <= 0)
+          throw invalid_argument("");
+        // (The number of threads is set later, when this job is run.
+        //  In batch mode, every job is parsed before the first job begins.)
       }
       catch (invalid_argument& exc) {
         throw InputErr("Error: The " + vArgs[i] + 
@@ -2432,6 +2615,17 @@ Settings::ParseArgs(vector<string>& vArgs)
     }
 
 
+    else if (vArgs[i] == "-pin") {
+      #ifdef DISABLE_OPENMP
+      throw InputErr("Error: The " + vArgs[i] + 
+                     " argument is only available if program was compiled\n"
+                     " with support for OpenMP (multiprocessor support).\n");
+      #endif
+      pin_threads = true;
+      num_arguments_deleted = 1;
+    }
+
+
     else if ((vArgs[i] == "-blob-intensity-vs-radius") ||
              (vArgs[i] == "-blob-radial-intensity"))
     {
@@ -2574,6 +2768,14 @@ Settings::ParseArgs(vector<string>& vArgs)
     throw InputErr(err_msg.str());
   }
 
+  if (batch_file_name != "") {
+    if ((in_file_name != "") || (out_file_name != ""))
+      throw InputErr("Error: The \"-in\" and \"-out\" arguments cannot be used together\n"
+                     "       with \"-batch\".  (The batch file contains those file names.)\n");
+    // The remaining checks are carried out separately for each job.
+    return;
+  }
+
 
   // ----------
   //if (filter_type == NONE)
@@ -2621,6 +2823,41 @@ Settings::ParseArgs(vector<string>& vArgs)
                    "\n"
                    "       To override this, use \"-outf\" instead of \"-out\".\n");
   }
+  if ((out_file_name == in_file_name) && in_file_mmap)
+  {
+    // (Overwriting a file while it is mapped into memory would corrupt
+    //  the data we are reading from it.)
+    throw InputErr("Error: The \"-mmap\" argument cannot be used when the input and output\n"
+                   "       image files are the same.\n");
+  }
+  if (slab_thickness > 0)
+  {
+    // In this mode, the image is read, filtered and written one slab at a
+    // time.  This only works for filters whose output at each voxel depends
+    // on nearby voxels, and for post-processing steps which do not depend
+    // on global properties of the image (such as the average brightness).
+    if (! ((filter_type == GAUSS) ||
+           (filter_type == DOG) ||
+           (filter_type == DOG_SCALE_FREE) ||
+           (filter_type == LOCAL_FLUCTUATIONS)))
+      throw InputErr("Error: The \"-slab\" argument can only be used together with the\n"
+                     "       \"-gauss\", \"-dog\", \"-log\", or \"-fluct\" filters.\n");
+    if ((in_file_name.size() == 0) || (out_file_name.size() == 0))
+      throw InputErr("Error: The \"-slab\" argument requires both an input and an output file.\n");
+    if (out_file_name == in_file_name)
+      throw InputErr("Error: The \"-slab\" argument cannot be used when the input and output\n"
+                     "       image files are the same.\n");
+    if (invert_output ||
+        rescale_min_max_in ||
+        rescale_min_max_out ||
+        find_minima ||
+        find_maxima ||
+        (use_intensity_map && out_thresh2_use_clipping_sigma) ||
+        (mask_rectangle_xmin <= mask_rectangle_xmax))
+      throw InputErr("Error: The \"-slab\" argument cannot be combined with arguments which\n"
+                     "       need the entire image at once, such as \"-invert\", \"-rescale-min-max\",\n"
+                     "       \"-find-minima\", \"-find-maxima\", \"-cl\", or \"-mask-rect\".\n");
+  }
 
 
   // REMOVE THIS CRUFT
@@ -73,9 +73,17 @@ class Settings {
   //      (shared by all filter types)
   
   string in_file_name; // name of the image file we want to read
+  bool in_file_mmap;   // map the input file into memory instead of reading it?
+  int slab_thickness;  // if > 0, process the image in slabs this many voxels
+                       // thick (in the z direction) to conserve memory
   int in_set_image_size[3];//image size (if the user did not supply a file name)
   string out_file_name; // name of the image file we want to create
   bool out_file_overwrite; // allow out_file_name to equal in_file_name?
+  string batch_file_name; // name of a file containing a list of jobs
+  bool pin_threads;     // bind each thread to a different cpu core?
+  int num_threads;      // number of threads requested using "-np" (0=default)
+  vector<vector<string> > batch_jobs; // input file, output file, and
+                                      // additional arguments for each job
   // Mask parameters are used to select (ignore) voxels from the original image.
   string mask_file_name; // name of an image file used for masking
   bool use_mask_select; // do we select voxels with a specific value?
@@ -163,6 +171,9 @@ class Settings {
   float filter_truncate_ratio;     // ignore voxels further away than this*width
   float filter_truncate_threshold; // ignore voxels if filter falls below this
 
+  // Should non-separable filters (like "-ggauss") use FFTs?
+  ConvolveMethod convolve_method;  // CONVOLVE_AUTO, CONVOLVE_DIRECT, or FFT
+
 
   // --- parameters for intensity maps and thresholding ---
   //
@@ -207,6 +218,7 @@ class Settings {
   bool watershed_show_boundaries;
   float watershed_boundary_label;
   float watershed_threshold;
+  int watershed_num_blocks;
   bool clusters_begin_at_maxima;
 
   // ---- parameters for the clustering of connected voxels into islands ----
@@ -217,6 +229,8 @@ class Settings {
   float connect_threshold_vector_neighbor;
   float connect_threshold_tensor_saliency;
   float connect_threshold_tensor_neighbor;
+  int connect_num_blocks;  // (if > 0, use the union-find clustering algorithm)
+  bool connect_fp16;       // store the Hessian using 16-bit floats?
   size_t select_cluster;
   string must_link_filename;
   vector<vector<array<float, 3> > > must_link_constraints;
@@ -225,6 +239,7 @@ class Settings {
   // ---- parameters used by the ridge detector used for detecting surfaces ----
 
   string out_normals_fname;
+  bool  out_normals_binary;
   bool  ridges_are_maxima;
   float surface_hessian_score_threshold;
   bool  surface_hessian_score_threshold_is_a_fraction;
@@ -246,6 +261,8 @@ class Settings {
 
   vector<float> blob_diameters;    // blob widths considered for scale free blob detection
   float blob_width_multiplier;
+  bool blob_incremental;           // compute each scale from the previous one?
+  int blob_pyramid_max_level;      // search for blobs in a downsampled image?
   string blob_minima_file_name;
   string blob_maxima_file_name;
   #ifndef DISABLE_INTENSITY_PROFILES
@@ -331,6 +348,13 @@ class Settings {
 
   void ParseArgs(int argc, char **argv);
 
+  /// @brief
+  /// Determine the settings for one of the jobs in a batch file
+  /// (see "-batch").  The arguments for this job are appended to the
+  /// command-line arguments (which are shared by all of the jobs).
+
+  void ParseArgs(int argc, char **argv, const vector<string>& vJob);
+
  private:
   void ParseArgs(vector<string>& vArgs);
   void ConvertArgvToVectorOfStrings(int argc, 
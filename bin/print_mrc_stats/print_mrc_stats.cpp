@@ -1,5 +1,4 @@
 #include <iostream>
-#include <fstream>
 using namespace std;
 #include "err.hpp"
 #include "mrc_simple.hpp"
@@ -16,17 +15,12 @@ int main(int argc, char **argv) {
   }
 
   try {
-    // Read the file
+    // Read the header of the file (the image itself is not needed)
     string in_file_name(argv[1]);
     cerr << "Reading tomogram \""<<in_file_name<<"\"" << endl;
-    fstream mrc_file;
-    mrc_file.open(in_file_name, ios::binary | ios::in);
-    if (! mrc_file) 
-      throw InputErr("Error: unable to open \"" + in_file_name + "\" for reading.\n");
-    MrcHeader header;
-    header.Read(mrc_file);
-    header.PrintStats(cout);
-    mrc_file.close();
+    MrcSimple tomo;
+    tomo.ReadHeader(in_file_name);
+    tomo.PrintStats(cout);
   }
   catch (const std::exception& e) {
     cerr << "\n" << e.what() << endl;
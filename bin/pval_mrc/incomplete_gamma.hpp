@@ -0,0 +1,102 @@
+#ifndef _INCOMPLETE_GAMMA_HPP
+#define _INCOMPLETE_GAMMA_HPP
+
+#include <cmath>
+#include <limits>
+using namespace std;
+
+
+// The regularized incomplete Gamma functions:
+//   P(a,x) = γ(a,x) / Γ(a)   (lower)
+//   Q(a,x) = Γ(a,x) / Γ(a)  = 1 - P(a,x)   (upper)
+// For integer a, Q(a,x) is the cumulative Poisson distribution:
+//   Q(n+1, λ) = Σ_{i=0}^{n}  λ^i exp(-λ) / i!
+// (This is what the "gamma_q()" and "gamma_p()" functions from BOOST compute.)
+// Whichever of P or Q is smaller is computed directly (using a series
+// when x < a+1, or a continued fraction otherwise), and the other one is
+// obtained by subtracting it from 1.  This way, the small tail probabilities
+// we care about are accurate to nearly full precision, even when "a" is large.
+// (See "Numerical Recipes", section 6.2.)
+
+
+// Series for P(a,x).  (Converges quickly when x < a+1.)
+static inline long double
+_GammaPSeries(long double a, long double x) {
+  long double eps = numeric_limits<long double>::epsilon();
+  long double ap = a;
+  long double del = 1.0 / a;
+  long double sum = del;
+  long max_iter = 100 + static_cast<long>(10.0 * sqrt(a + 1.0));
+  for (long n = 1; n <= max_iter; n++) {
+    ap += 1.0;
+    del *= x / ap;
+    sum += del;
+    if (fabs(del) < fabs(sum) * eps)
+      break;
+  }
+  return sum * exp(-x + a*log(x) - lgamma(a));
+}
+
+
+// Continued fraction for Q(a,x), evaluated using Lentz's method.
+// (Converges quickly when x >= a+1.)
+static inline long double
+_GammaQContinuedFraction(long double a, long double x) {
+  long double eps = numeric_limits<long double>::epsilon();
+  long double tiny = numeric_limits<long double>::min() / eps;
+  long double b = x + 1.0 - a;
+  long double c = 1.0 / tiny;
+  long double d = 1.0 / b;
+  long double h = d;
+  long max_iter = 100 + static_cast<long>(10.0 * sqrt(a + 1.0));
+  for (long i = 1; i <= max_iter; i++) {
+    long double an = -i * (i - a);
+    b += 2.0;
+    d = an*d + b;
+    if (fabs(d) < tiny)
+      d = tiny;
+    c = b + an/c;
+    if (fabs(c) < tiny)
+      c = tiny;
+    d = 1.0 / d;
+    long double del = d*c;
+    h *= del;
+    if (fabs(del - 1.0) < eps)
+      break;
+  }
+  return exp(-x + a*log(x) - lgamma(a)) * h;
+}
+
+
+/// @brief  The regularized lower incomplete Gamma function P(a,x).
+///         (By convention, P(a,x) = 1 when a <= 0, so that 1-P(n,λ) is the
+///          (empty) sum of the Poisson probabilities of seeing fewer than
+///          n=0 events.)
+static inline long double
+GammaP(long double a, long double x) {
+  if (a <= 0.0)
+    return 1.0;
+  if (x <= 0.0)
+    return 0.0;
+  if (x < a + 1.0)
+    return _GammaPSeries(a, x);
+  else
+    return 1.0 - _GammaQContinuedFraction(a, x);
+}
+
+
+/// @brief  The regularized upper incomplete Gamma function Q(a,x) = 1-P(a,x).
+static inline long double
+GammaQ(long double a, long double x) {
+  if (a <= 0.0)
+    return 0.0;
+  if (x <= 0.0)
+    return 1.0;
+  if (x < a + 1.0)
+    return 1.0 - _GammaPSeries(a, x);
+  else
+    return _GammaQContinuedFraction(a, x);
+}
+
+
+#endif //#ifndef _INCOMPLETE_GAMMA_HPP
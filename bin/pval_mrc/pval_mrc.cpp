@@ -1,5 +1,6 @@
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <string>
 #include <sstream>
 #include <iostream>
@@ -18,15 +19,135 @@ using namespace std;
 
 #include <mrc_simple.hpp>
 #include <filter3d.hpp>
+#include <scale_space.hpp>
 using namespace visfd;
 
 #include "err.hpp"
 #include "settings.hpp"
+#include "incomplete_gamma.hpp"
 
 
 // (Note: For gcc version 4.8.3, you must compile using: g++ -std=c++11)
 
 
+/// @brief  Find the voxel with the lowest (or highest) brightness among the
+///         voxels which are local minima (or maxima) of the image.
+///         (A voxel is a local minimum if none of its neighbors are darker.
+///          So voxels in a flat region, where the density is 0, count.)
+///         Voxels outside the mask are never considered.  Unless
+///         extrema_on_boundary is true, voxels on the boundary of the image
+///         (or adjacent to voxels outside the mask) are also excluded.
+///         The image is divided among the threads, and each thread keeps
+///         track of the most extreme voxel in its portion of the image.
+///         Since most voxels are not as extreme as the best voxel found so
+///         far, the (expensive) comparison with the 26 neighbors is usually
+///         skipped.  (Ties are broken in favor of the voxel which comes first,
+///         so the result does not depend on the number of threads.)
+///         If require_local_extremum is false, the neighbors are ignored
+///         and the most extreme voxel in the mask is returned instead.
+/// @return false if no local minima (or maxima) were found.
+
+static bool
+FindExtremeDensity(int const image_size[3],
+                   float const *const *const *aaafDensity,
+                   float const *const *const *aaafMask,
+                   bool use_min_density,
+                   bool extrema_on_boundary,
+                   float &extreme_density, //!< store the density here
+                   int afXextreme[3],      //!< store the location here
+                   bool require_local_extremum = true)
+{
+  // A sign flip converts the search for maxima into a search for minima
+  float sign = (use_min_density ? 1.0 : -1.0);
+  float best_val = 0.0;
+  size_t best_index = SIZE_MAX;
+
+  #pragma omp parallel
+  {
+    float thread_best_val = 0.0;
+    size_t thread_best_index = SIZE_MAX;
+
+    #pragma omp for collapse(2) schedule(static)
+    for (int iz = 0; iz < image_size[2]; iz++) {
+      for (int iy = 0; iy < image_size[1]; iy++) {
+        for (int ix = 0; ix < image_size[0]; ix++) {
+          float center_val = sign * aaafDensity[iz][iy][ix];
+          // (Voxels are visited in increasing order within each thread.)
+          if ((thread_best_index != SIZE_MAX) &&
+              (center_val >= thread_best_val))
+            continue;
+          if (aaafMask && (aaafMask[iz][iy][ix] == 0.0))
+            continue;
+          bool on_boundary = ((ix == 0) || (ix == image_size[0]-1) ||
+                              (iy == 0) || (iy == image_size[1]-1) ||
+                              (iz == 0) || (iz == image_size[2]-1));
+          if (on_boundary && (! extrema_on_boundary))
+            continue;
+          bool is_extremum = true;
+          if (! require_local_extremum) {
+            thread_best_val = center_val;
+            thread_best_index = ((size_t(iz) * image_size[1]) + iy)
+                                 * image_size[0] + ix;
+            continue;
+          }
+          for (int jz = -1; (jz <= 1) && is_extremum; jz++) {
+            for (int jy = -1; (jy <= 1) && is_extremum; jy++) {
+              for (int jx = -1; (jx <= 1) && is_extremum; jx++) {
+                if ((jx == 0) && (jy == 0) && (jz == 0))
+                  continue;
+                int iz_jz = iz + jz;
+                int iy_jy = iy + jy;
+                int ix_jx = ix + jx;
+                if ((iz_jz < 0) || (iz_jz >= image_size[2]) ||
+                    (iy_jy < 0) || (iy_jy >= image_size[1]) ||
+                    (ix_jx < 0) || (ix_jx >= image_size[0]))
+                  continue;
+                if (aaafMask && (aaafMask[iz_jz][iy_jy][ix_jx] == 0.0)) {
+                  if (! extrema_on_boundary)
+                    is_extremum = false;
+                  continue;
+                }
+                // (Ties are allowed.  The blurred density is often exactly
+                //  zero over large regions far away from the particles.)
+                if (sign * aaafDensity[iz_jz][iy_jy][ix_jx] < center_val)
+                  is_extremum = false;
+              }
+            }
+          }
+          if (! is_extremum)
+            continue;
+          thread_best_val = center_val;
+          thread_best_index = ((size_t(iz) * image_size[1]) + iy)
+                               * image_size[0] + ix;
+        } //for (int ix = 0; ix < image_size[0]; ix++)
+      } //for (int iy = 0; iy < image_size[1]; iy++)
+    } //for (int iz = 0; iz < image_size[2]; iz++)
+
+    #pragma omp critical
+    {
+      if ((thread_best_index != SIZE_MAX) &&
+          ((best_index == SIZE_MAX) ||
+           (thread_best_val < best_val) ||
+           ((thread_best_val == best_val) &&
+            (thread_best_index < best_index))))
+      {
+        best_val = thread_best_val;
+        best_index = thread_best_index;
+      }
+    }
+  } //#pragma omp parallel
+
+  if (best_index == SIZE_MAX)
+    return false;
+  extreme_density = sign * best_val;
+  afXextreme[0] = best_index % image_size[0];
+  afXextreme[1] = (best_index / image_size[0]) % image_size[1];
+  afXextreme[2] = best_index / (size_t(image_size[0]) * image_size[1]);
+  return true;
+} //FindExtremeDensity()
+
+
+
 int main(int argc, char **argv) {
   try {
 
@@ -235,6 +356,25 @@ int main(int argc, char **argv) {
     // First we must allocate a new array to store the filtered image.
     MrcSimple tomo_out = tomo_in;
 
+    // How wide is the filter window (over what size window do we integrate)?
+    if (settings.filter_truncate_ratio <= 0) {
+      assert(settings.filter_truncate_threshold > 0.0);
+      settings.filter_truncate_ratio = sqrt(-2*log(settings.filter_truncate_threshold));
+    }
+
+    bool blur_image = ((! settings.precomputed_gaussian_blur) ||
+                       (settings.vfSigma.size() > 1));
+
+    // Rather than blurring the original image from scratch for every sigma,
+    // blur it incrementally (in order of increasing sigma).
+    // (See the description of ScaleSpaceGauss for details.)
+    sort(settings.vfSigma.begin(), settings.vfSigma.end());
+    ScaleSpaceGauss<float> *pScaleSpace = nullptr;
+    if (blur_image)
+      pScaleSpace = new ScaleSpaceGauss<float>(tomo_in.header.nvoxels,
+                                               tomo_in.aaafI,
+                                               mask.aaafI,
+                                               settings.filter_truncate_ratio);
 
     for (int i_sig = 0; i_sig < settings.vfSigma.size(); ++i_sig) {
 
@@ -263,24 +403,25 @@ int main(int argc, char **argv) {
 
       sigma /= voxel_width[0]; //scale by voxel_width (if specified)
 
-
-      // How wide is the filter window (over what size window do we integrate)?
-      if (settings.filter_truncate_ratio <= 0) {
-        assert(settings.filter_truncate_threshold > 0.0);
-        settings.filter_truncate_ratio = sqrt(-2*log(settings.filter_truncate_threshold));
-      }
-      int filter_truncate_halfwidth = floor(sigma *
-                                            settings.filter_truncate_ratio);
-
       float gauss_peak_height_3D;
 
       {
-        // GenFilterGauss1D generates a 1D discrete normalized Gaussian (located
-        // in the afH[]) member. afH[0] is the height at the central peak. 
-        // However, for now I just use them to estimate the height of the 
-        // Gaussian peak.  (See below)
-        Filter1D<float, int> filter1D =
-          GenFilterGauss1D(sigma, filter_truncate_halfwidth);
+        // The 1D filters generated below are normalized discrete Gaussians.
+        // afH[0] is the height at the central peak.  For now, I just use
+        // them to estimate the height of the Gaussian peak.  (See below)
+        // We use the same kind of Gaussian that was used to blur the image:
+        // ScaleSpaceGauss uses the discrete analogue of the Gaussian.
+        // If the user blurred the image beforehand, we assume they used
+        // ApplyGauss() which samples the Gaussian at evenly spaced intervals.
+        Filter1D<float, int> filter1D;
+        if (blur_image) {
+          int halfwidth = ceil(sigma * settings.filter_truncate_ratio);
+          filter1D = GenFilterDiscreteGauss1D(sigma*sigma, halfwidth);
+        }
+        else {
+          int halfwidth = floor(sigma * settings.filter_truncate_ratio);
+          filter1D = GenFilterGauss1D(sigma, halfwidth);
+        }
 
         // A 3D Gaussian blur can be performed by expoiting the fact that
         // multidimensional Gaussians are "seperable" filters:  You can blur
@@ -302,17 +443,11 @@ int main(int argc, char **argv) {
       float num_bins = vol_total / volume_gaussian_bin;
 
       // Now blur the original image (if the user did not do it already)
-      if ((! settings.precomputed_gaussian_blur) ||
-          (settings.vfSigma.size() > 1)) {
-
-        ApplyGauss(tomo_in.header.nvoxels,
-                   tomo_in.aaafI,
-                   tomo_out.aaafI, //<-store resulting image here
-                   mask.aaafI,
-                   sigma,
-                   filter_truncate_halfwidth,
-                   true,
-                   &cerr);
+      if (blur_image) {
+
+        pScaleSpace->Apply(sigma,
+                           tomo_out.aaafI, //<-store resulting image here
+                           &cerr);
 
         // Densities everywhere are assumed to be in physical units
         // (ie. of 1/Angstroms^3),  NOT   1/voxels^3
@@ -328,81 +463,41 @@ int main(int argc, char **argv) {
     
       float extreme_density;
       int afXextreme[3] = {-1, -1, -1};
-      float global_minima;
-      float global_maxima;
 
       // Find the voxels with the minima and maxima intensities.
       // Discard global minima or maxima which lie on the boundary
       // The safe, careful way to do this is to only consider
       // voxels which are surrounded by other voxels and are
       // local minima or maxima.
-      for (int iz=0; iz < tomo_out.header.nvoxels[2]; iz++) {
-        for (int iy=0; iy < tomo_out.header.nvoxels[1]; iy++) {
-          for (int ix=0; ix < tomo_out.header.nvoxels[0]; ix++) {
-
-            bool is_local_minima = true;
-            bool is_local_maxima = true;
-
-            if (! settings.extrema_on_boundary) {
-              if ((ix == 0) || (ix ==  tomo_out.header.nvoxels[0]-1) ||
-                  (ix == 0) || (ix ==  tomo_out.header.nvoxels[0]-1) ||
-                  (ix == 0) || (ix ==  tomo_out.header.nvoxels[0]-1)) {
-                is_local_minima = false;
-                is_local_maxima = false;
-              }
-            }
-
-            float center_val = tomo_out.aaafI[iz][iy][ix];
-            for (int jz=-1; jz<=1; jz++) {
-              for (int jy=-1; jy<=1; jy++) {
-                for (int jx=-1; jx<=1; jx++) {
-                  if (! settings.extrema_on_boundary) {
-                    if (mask.aaafI && (mask.aaafI[iz+jz][iy+jy][ix+jx] == 0.0))
-                    {
-                      is_local_minima = false;
-                      is_local_maxima = false;
-                    }
-                  }
-                  if (tomo_out.aaafI[iz+jz][iy+jy][ix+jx] <= center_val)
-                    is_local_minima = false;
-                  if (tomo_out.aaafI[iz+jz][iy+jy][ix+jx] >= center_val)
-                    is_local_maxima = false;
-                }
-              }
-            }
-            if ((center_val < global_minima) || (afXextreme[0] == -1)) {
-              global_minima = center_val;
-              if (settings.use_min_density) {
-                extreme_density = global_minima;
-                afXextreme[0] = ix;
-                afXextreme[1] = iy;
-                afXextreme[2] = iz;
-              }
-            }
-            if ((center_val > global_maxima) || (afXextreme[0] == -1)) {
-              global_maxima = center_val;
-              if (! settings.use_min_density) {
-                extreme_density = global_maxima;
-                afXextreme[0] = ix;
-                afXextreme[1] = iy;
-                afXextreme[2] = iz;
-              }
-            }
-          } //for (int ix=1; ix < tomo_out.header.nvoxels[0]-1; ix++)
-        } //for (int iy=1; iy < tomo_out.header.nvoxels[1]-1; iy++)
-      } //for (int iz=1; iz < tomo_out.header.nvoxels[2]-1; iz++)
-
+      bool found = FindExtremeDensity(tomo_out.header.nvoxels,
+                                      tomo_out.aaafI,
+                                      mask.aaafI,
+                                      settings.use_min_density,
+                                      settings.extrema_on_boundary,
+                                      extreme_density,
+                                      afXextreme);
 
       // Did we fail to find any local minima or maxima densities?
-      if (afXextreme[0] == -1) {
-        string extrema_type = "minina";
+      // (This happens when sigma is large compared to the image.  Then the
+      //  blurred density is smooth, and its extrema lie on the boundary.)
+      // In that case, use the most extreme voxel in the mask instead.
+      if (! found) {
+        string extrema_type = "minima";
         if (! settings.use_min_density)
           extrema_type = "maxima";
-        stringstream msg_ss;
-        msg_ss << "Error: There are no local density " << extrema_type << "\n"
-               << "       in the image (at scale sigma = " << sigma << ")\n"
-               << "       Aborting...\n";
-        throw InputErr(msg_ss.str());
+        cerr << "WARNING: There are no local density " << extrema_type << "\n"
+             << "         in the image (at scale sigma = " << sigma << ")\n"
+             << "         Using the most extreme density in the image instead.\n";
+        found = FindExtremeDensity(tomo_out.header.nvoxels,
+                                   tomo_out.aaafI,
+                                   mask.aaafI,
+                                   settings.use_min_density,
+                                   true,
+                                   extreme_density,
+                                   afXextreme,
+                                   false);
+        if (! found)
+          throw InputErr("Error: The mask is empty.  Aborting...\n");
       }
 
       float ave_density = settings.num_particles / vol_total;
@@ -422,21 +517,28 @@ int main(int argc, char **argv) {
       long double lambda = ave_density * volume_gaussian_bin;
 
 
-      long double prob_cdf_obvious_way = 0.0;
-      if (settings.use_min_density) {
-        // Calculate the culmulative probability of seeing this many
-        // particles in the bin or less.  First try it the obvious way:
+      long double prob_cdf;
 
-        for (long i=0; i <= floor(k); i++)
-          prob_cdf_obvious_way += pow(lambda, i) * exp(-lambda) / tgamma(i+1.0);
-      }
-      else {
       // Calculate the culmulative probability of seeing this many
-      // particles in the bin or more.  First try it the obvious way:
-        for (long i=0; i < floor(k); i++)
-          prob_cdf_obvious_way += pow(lambda, i) * exp(-lambda) / tgamma(i+1.0);
-        prob_cdf_obvious_way = 1.0 - prob_cdf_obvious_way;
-      }
+      // particles in the bin or less (or this many or more).
+      // The cumulative distribution of the Poisson distribution is given by
+      // the (regularized) upper incomplete Gamma function, Q(a,x).
+      //   sum_{i=0}^{n} lambda^i exp(-lambda) / i!   =   Q(n+1, lambda)
+      // (Summing these terms one at a time is slow when k is large, and
+      //  the individual terms overflow once i exceeds ~170.)
+      //
+      // However, in our case the number of particles in this "bin" is not (k)
+      // necessarily an integer.  In that case we could use the continuous
+      // version of the (cumulative) Poisson distribution:
+      //   Q(k+1, lambda)  (or  1 - Q(k, lambda) = P(k, lambda))
+      // Instead, for consistency with earlier versions of this program,
+      // we round k down to the nearest integer, floor(k).
+      if (settings.use_min_density)
+        // probability of seeing floor(k) particles in the bin or less
+        prob_cdf = GammaQ(floor(k) + 1.0, lambda);
+      else
+        // probability of seeing floor(k) particles in the bin or more
+        prob_cdf = GammaP(floor(k), lambda);
 
       cerr << "####################################" << endl;
       cerr << "## DEBUG MESSAGES (PLEASE IGNORE) ##" << endl;
@@ -446,33 +548,9 @@ int main(int argc, char **argv) {
            << afXextreme[2] << ")" << endl;
       cerr << "## num_in_bin = " << k << endl;
       cerr << "## num_expected_in_bin = " << lambda << endl;
-      cerr << "## prob_cdf_obvious_way = " << prob_cdf_obvious_way << endl;
+      cerr << "## prob_cdf = " << prob_cdf << endl;
       cerr << "####################################" << endl;
 
-      long double prob_cdf;
-
-      // However, in our case the number of particles in this "bin" is not (k)
-      // necessarily an integer.  In that case use the continuous version of
-      // (the cumulative distribution) of the Poisson distributio.
-      // COMMENTING OUT: This requires the BOOST libraries
-      // COMMENTING OUT: if (use_min_density)
-      // COMMENTING OUT:   prob_cdf = gamma_q(k+1,lambda);
-      // COMMENTING OUT: else
-      // COMMENTING OUT:   prob_cdf = 1.0 - gamma_q(k,lambda);
-      //    (gamma_q() is defined in boost)
-
-      // The cumulative distribution of the Poisson distribution
-      // is also given by the upper incomplete Gamma function
-      // COMMENTING OUT: USE THE BOOST LIBRARY
-      //double prob_cdf = gamma_q(floor(k)+1, lambda);
-      // Unfortunately the  BOOST library can not be easily distributed with
-      // this code.  (Even if I throw away most ofthe BOOST code using the
-      // "bcp" utility, the remaining BOOST code exceeds the size of this
-      // the code for this project by a factor of 50.)
-      // Hence we will use the integer approximation ("obvious_way"):
-
-      prob_cdf = prob_cdf_obvious_way;
-
       // ...Now what is the probability that the number of particles
       //    in ANY OF THE BINS does not exceed "extreme_density"?
 
@@ -537,6 +615,9 @@ int main(int argc, char **argv) {
 
     } // for (int i_sig = 0; i_sig < settings.vfSigma.size(); i_sig++) {...
 
+    if (pScaleSpace)
+      delete pScaleSpace;
+
 
     if ((settings.out_file_name != "") && (settings.vfSigma.size() == 1))
     {
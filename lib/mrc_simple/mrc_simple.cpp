@@ -22,6 +22,13 @@
 #include <cmath>
 #include <fstream>
 #include <iostream>
+#include <vector>
+#ifndef DISABLE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 using namespace std;
 #include <alloc3d.hpp>
 using namespace visfd;
@@ -56,6 +63,7 @@ void MrcSimple::Alloc() {
   Alloc3D(header.nvoxels,
           &afI,
           &aaafI);
+  #pragma omp parallel for collapse(2)
   for (int iz = 0; iz < header.nvoxels[2]; iz++) {
     for (int iy = 0; iy < header.nvoxels[1]; iy++) {
       for (int ix = 0; ix < header.nvoxels[0]; ix++) {
@@ -68,6 +76,21 @@ void MrcSimple::Alloc() {
 
 
 void MrcSimple::Dealloc() {
+  #ifndef DISABLE_MMAP
+  if (pMappedFile) {
+    // Then afI points into the mapping.  Only the aaafI[][] tables
+    // were allocated (using Alloc3DPointers()).
+    float *afNotAllocated = nullptr;
+    Dealloc3D(header.nvoxels,
+              &afNotAllocated,
+              &aaafI);
+    munmap(pMappedFile, mapped_file_size);
+    pMappedFile = nullptr;
+    mapped_file_size = 0;
+    afI = nullptr;
+    return;
+  }
+  #endif
   Dealloc3D(header.nvoxels,
             &afI,
             &aaafI);
@@ -103,13 +126,12 @@ void PermuteInverseCArrayA(Int n,
 
 
 
-void MrcSimple::Read(istream& mrc_file,
-                     bool rescale,
-                     float ***aaafMask) {
+bool MrcSimple::ReadHeader(istream& mrc_file,
+                           Int axis_order[3]) {
   header.Read(mrc_file);
 
   //    Row-major format ??
-  Int *axis_order = nullptr;
+  bool permuted_axes = false;
   if ((header.mapCRS[0] != 1) ||
       (header.mapCRS[1] != 2) ||
       (header.mapCRS[2] != 3)) {
@@ -134,7 +156,7 @@ void MrcSimple::Read(istream& mrc_file,
     // we must rearrange it. (This makes my once pretty code much uglier.)
     // Make a copy of "mapCRS[]" now so that later we can keep track of 
     // which axis (x,y,z) was stored in each index (i,j,k) of the array.
-    axis_order = new Int[3];
+    permuted_axes = true;
     axis_order[0] = header.mapCRS[0] - 1;
     axis_order[1] = header.mapCRS[1] - 1;
     axis_order[2] = header.mapCRS[2] - 1;
@@ -161,17 +183,23 @@ void MrcSimple::Read(istream& mrc_file,
   header.mvoxels[1] = header.nvoxels[1];
   header.mvoxels[2] = header.nvoxels[2];
 
-  // Read the image
-  ReadArray(mrc_file, axis_order);
+  return permuted_axes;
 
+} //MrcSimple::ReadHeader()
 
-  if (rescale)
-    Rescale01(aaafMask);
 
 
-  // clean up
-  if (axis_order)
-    delete [] axis_order;
+void MrcSimple::Read(istream& mrc_file,
+                     bool rescale,
+                     float ***aaafMask) {
+  Int axis_order[3];
+  bool permuted_axes = ReadHeader(mrc_file, axis_order);
+
+  // Read the image
+  ReadArray(mrc_file, (permuted_axes ? axis_order : nullptr));
+
+  if (rescale)
+    Rescale01(aaafMask);
 
 } //MrcSimple::Read()
 
@@ -179,7 +207,8 @@ void MrcSimple::Read(istream& mrc_file,
 
 void MrcSimple::Read(string in_file_name,
                      bool rescale,
-                     float ***aaafMask) {
+                     float ***aaafMask,
+                     bool memory_map) {
   Int len_in_file_name = in_file_name.size();
   fstream mrc_file;
   mrc_file.open(in_file_name, ios::binary | ios::in);
@@ -192,12 +221,300 @@ void MrcSimple::Read(string in_file_name,
       (in_file_name.substr(len_in_file_name-4, len_in_file_name) == ".rec")) {
     header.use_signed_bytes = false; //(note: this could be changed later by Read())
   }
-  Read(mrc_file, rescale, aaafMask);
+  Int axis_order[3];
+  bool permuted_axes = ReadHeader(mrc_file, axis_order);
+
+  // Read the image (or map it into memory)
+  if (! (memory_map && MapArray(in_file_name, permuted_axes)))
+    ReadArray(mrc_file, (permuted_axes ? axis_order : nullptr));
+
+  if (rescale)
+    Rescale01(aaafMask);
+
+  mrc_file.close();
+}
+
+
+
+void MrcSimple::ReadHeader(string in_file_name) {
+  fstream mrc_file;
+  mrc_file.open(in_file_name, ios::binary | ios::in);
+  if (! mrc_file) 
+    throw MrcfileErr("Error: unable to open \""+ in_file_name +"\" for reading.\n");
+  Dealloc(); //free up any space you may have allocated earlier
+  Int len_in_file_name = in_file_name.size();
+  if ((len_in_file_name > 4)
+      && 
+      (in_file_name.substr(len_in_file_name-4, len_in_file_name) == ".rec")) {
+    header.use_signed_bytes = false; //(note: this could be changed later by Read())
+  }
+  Int axis_order[3];
+  ReadHeader(mrc_file, axis_order);
+  mrc_file.close();
+}
+
+
+
+void MrcSimple::ReadSlices(string in_file_name,
+                           int iz_begin,
+                           int iz_end) {
+  fstream mrc_file;
+  mrc_file.open(in_file_name, ios::binary | ios::in);
+  if (! mrc_file) 
+    throw MrcfileErr("Error: unable to open \""+ in_file_name +"\" for reading.\n");
+  Int len_in_file_name = in_file_name.size();
+  if ((len_in_file_name > 4)
+      && 
+      (in_file_name.substr(len_in_file_name-4, len_in_file_name) == ".rec")) {
+    header.use_signed_bytes = false; //(note: this could be changed later by Read())
+  }
+  Dealloc(); //free up any space you may have allocated earlier
+  Int axis_order[3];
+  if (ReadHeader(mrc_file, axis_order))
+    throw MrcfileErr("Error: Unable to read part of \""+ in_file_name +"\" because the data\n"
+                     "       in this file is not stored in row-major order.\n");
+  if ((iz_begin < 0) || (iz_end < iz_begin) || (iz_end > header.nvoxels[2]))
+    throw MrcfileErr("Error: Slice range out of bounds in \""+ in_file_name +"\"\n");
+
+  size_t entry_size = EntrySize();
+
+  // Skip over the slices we don't need, and read the remaining slices
+  // as if they were the entire image.
+  size_t section_size = (static_cast<size_t>(header.nvoxels[0]) *
+                         header.nvoxels[1]);
+  mrc_file.seekg(MrcHeader::SIZE_HEADER + iz_begin*section_size*entry_size);
+  header.nvoxels[2] = iz_end - iz_begin;
+  header.mvoxels[2] = header.nvoxels[2];
+  ReadArray(mrc_file, nullptr);
+  mrc_file.close();
+}
+
+
+
+void MrcSimple::ReadRegion(string in_file_name,
+                           int ix_begin,
+                           int ix_end,
+                           int iy_begin,
+                           int iy_end,
+                           int iz_begin,
+                           int iz_end) {
+  fstream mrc_file;
+  mrc_file.open(in_file_name, ios::binary | ios::in);
+  if (! mrc_file) 
+    throw MrcfileErr("Error: unable to open \""+ in_file_name +"\" for reading.\n");
+  Int len_in_file_name = in_file_name.size();
+  if ((len_in_file_name > 4)
+      && 
+      (in_file_name.substr(len_in_file_name-4, len_in_file_name) == ".rec")) {
+    header.use_signed_bytes = false; //(note: this could be changed later by Read())
+  }
+  Dealloc(); //free up any space you may have allocated earlier
+  Int axis_order[3];
+  if (ReadHeader(mrc_file, axis_order))
+    throw MrcfileErr("Error: Unable to read part of \""+ in_file_name +"\" because the data\n"
+                     "       in this file is not stored in row-major order.\n");
+  int region_begin[3] = {ix_begin, iy_begin, iz_begin};
+  int region_end[3] = {ix_end, iy_end, iz_end};
+  for (int d = 0; d < 3; d++)
+    if ((region_begin[d] < 0) || (region_end[d] < region_begin[d]) ||
+        (region_end[d] > header.nvoxels[d]))
+      throw MrcfileErr("Error: Region out of bounds in \""+ in_file_name +"\"\n");
+
+  size_t entry_size = EntrySize();
+  size_t NX = header.nvoxels[0];
+  size_t NY = header.nvoxels[1];
+  for (int d = 0; d < 3; d++) {
+    header.nvoxels[d] = region_end[d] - region_begin[d];
+    header.mvoxels[d] = header.nvoxels[d];
+  }
+  Alloc();
+
+  size_t nx = header.nvoxels[0];
+  size_t ny = header.nvoxels[1];
+  // If the region spans the entire width of the image (in the x direction),
+  // then the rows in each section are contiguous in the file, and they can
+  // be read all at once.  Otherwise read the region one row at a time.
+  bool full_rows = (nx == NX);
+  size_t rows_per_read = (full_rows ? ny : 1);
+  vector<char> acBuffer(rows_per_read * nx * entry_size);
+  if (nx == 0) {
+    mrc_file.close();
+    return;
+  }
+
+  for (Int iz = 0; iz < header.nvoxels[2]; iz++) {
+    for (size_t iy = 0; iy < ny; iy += rows_per_read) {
+      size_t offset = (((iz + iz_begin) * NY + (iy + iy_begin)) * NX
+                       + ix_begin);
+      mrc_file.seekg(MrcHeader::SIZE_HEADER + offset*entry_size);
+      mrc_file.read(acBuffer.data(), acBuffer.size());
+      if (! mrc_file)
+        throw MrcfileErr("Error: Unexpected end of MRC file.  (File is truncated?)\n");
+      ConvertEntries(rows_per_read * nx,
+                     acBuffer.data(),
+                     &(aaafI[iz][iy][0]));
+    }
+  }
   mrc_file.close();
+} //MrcSimple::ReadRegion()
+
+
+
+bool MrcSimple::MapArray(string mrc_file_name,
+                         bool permuted_axes) {
+  #ifdef DISABLE_MMAP
+  return false;
+  #else
+  if ((header.mode != MrcHeader::MRC_MODE_FLOAT) || permuted_axes)
+    return false;
+
+  // Check the byte order ("machine stamp") in the header (if present).
+  // (0x44 indicates little-endian, 0x11 indicates big-endian.)
+  // Bytes 213-216 of the header are stored at remaining_raw_data[4].
+  const uint16_t one = 1;
+  bool little_endian_cpu = (*reinterpret_cast<const char*>(&one) == 1);
+  char stamp = header.remaining_raw_data[4];
+  if (((stamp == 0x44) && (! little_endian_cpu)) ||
+      ((stamp == 0x11) && little_endian_cpu))
+    return false;
+
+  size_t num_voxels = (static_cast<size_t>(header.nvoxels[0]) *
+                       header.nvoxels[1] *
+                       header.nvoxels[2]);
+  size_t file_size_needed = (MrcHeader::SIZE_HEADER +
+                             num_voxels * sizeof(float));
+
+  int fd = open(mrc_file_name.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat file_stats;
+  if ((fstat(fd, &file_stats) != 0) ||
+      (static_cast<size_t>(file_stats.st_size) < file_size_needed)) {
+    close(fd);
+    return false;
+  }
+  // MAP_PRIVATE: Changes we make to the array are copy-on-write.
+  // They will not effect the file (or other programs reading it).
+  void *p = mmap(nullptr,
+                 file_size_needed,
+                 PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE,
+                 fd,
+                 0);
+  close(fd); // (the mapping remains valid after the file is closed)
+  if (p == MAP_FAILED)
+    return false;
+
+  Dealloc(); //free up any space you may have allocated earlier
+  pMappedFile = p;
+  mapped_file_size = file_size_needed;
+  afI = reinterpret_cast<float*>(static_cast<char*>(p) +
+                                 MrcHeader::SIZE_HEADER);
+
+  // Now create the aaafI[][] tables which point into afI[]
+  Alloc3DPointers(header.nvoxels, afI, &aaafI);
+  return true;
+  #endif //#ifdef DISABLE_MMAP
+} //MrcSimple::MapArray()
+
+
+
+
+
+// Convert an array of numbers (of type Entry) into floats.
+// (This simple loop is easy for the compiler to vectorize.)
+template<class Entry>
+static void ConvertToFloat(size_t n,
+                           Entry const *aSource,
+                           float *afDest) {
+  #pragma omp simd
+  for (size_t i = 0; i < n; i++)
+    afDest[i] = static_cast<float>(aSource[i]);
 }
 
 
 
+size_t MrcSimple::EntrySize() const {
+  size_t entry_size = 0;
+  switch (header.mode) {
+  case MrcHeader::MRC_MODE_BYTE:
+    entry_size = sizeof(int8_t);
+    break;
+  case MrcHeader::MRC_MODE_SHORT:
+    entry_size = sizeof(int16_t);
+    break;
+  case MrcHeader::MRC_MODE_USHORT:
+    entry_size = sizeof(uint16_t);
+    break;
+  case MrcHeader::MRC_MODE_FLOAT:
+    entry_size = sizeof(float);
+    break;
+  default:
+    throw MrcfileErr("UNSUPPORTED MODE in MRC file (unsupported MRC format)");
+    break;
+  } // switch (header.mode)
+  return entry_size;
+}
+
+
+
+void MrcSimple::ConvertEntries(size_t n,
+                               char *acBuffer,
+                               float *afDest) const {
+  switch (header.mode) {
+
+  case MrcHeader::MRC_MODE_BYTE:
+    if (header.use_signed_bytes)
+    {
+      int8_t *aEntries = reinterpret_cast<int8_t*>(acBuffer);
+
+      #ifdef ENABLE_IMOD_COMPATIBILITY
+      // MRC files using signed integers (eg. "mode 0") are
+      // interpreted differently by IMOD than they are by other software.
+      // In IMOD, voxel brightness values are adjusted to be so that 
+      // they lie in the range from 0..255.
+      // However files that use SIGNED bytes store their
+      // voxel brightnesses in the range from -128..127.
+      // For these files, IMOD automatically adds 128 to each voxel
+      // brightness value to insure the result lies between 0..255.
+      // Note: Neither UCSF Chimera, nor CCP-EM do this.
+      //  (CCP-EM is the distributor of the "mrcfile" python module.)
+      // To be compatible with the IMOD ecosystem, we must add 128:
+      for (size_t i = 0; i < n; i++)
+        aEntries[i] += 128;
+      // Note: Later on when writing these files (in signed byte
+      //       format), remember to subtract this offset before writing.
+      // Note: Surprisingly, IMOD does not seem to add an offset to voxel
+      //       brightnesses from files using "mode 1" (signed int16 format).
+      #endif // #ifdef ENABLE_IMOD_COMPATIBILITY
+
+      ConvertToFloat(n, aEntries, afDest);
+    }
+    else
+      ConvertToFloat(n,
+                     reinterpret_cast<uint8_t*>(acBuffer),
+                     afDest);
+    break;
+
+  case MrcHeader::MRC_MODE_SHORT:
+    ConvertToFloat(n,
+                   reinterpret_cast<int16_t*>(acBuffer),
+                   afDest);
+    break;
+
+  case MrcHeader::MRC_MODE_USHORT:
+    ConvertToFloat(n,
+                   reinterpret_cast<uint16_t*>(acBuffer),
+                   afDest);
+    break;
+
+  case MrcHeader::MRC_MODE_FLOAT:
+    memcpy(afDest, acBuffer, n * sizeof(float));
+    break;
+
+  } // switch (header.mode)
+} //MrcSimple::ConvertEntries()
+
 
 
 void MrcSimple::ReadArray(istream& mrc_file,
@@ -206,18 +523,6 @@ void MrcSimple::ReadArray(istream& mrc_file,
   Dealloc(); //free up any space you may have allocated earlier
   Alloc();   //allocate space for the array
 
-  // Something like this might be faster:
-  //mrc_file.read((char*)afI, sizeof(float)*num_voxels);
-  // (I don't remember why I did not use this approach.
-  //  Hopefully the code here fast enough in any case.)
-
-  size_t num_voxels = header.nvoxels[0] *
-                      header.nvoxels[1] *
-                      header.nvoxels[2];
-
-  Int iX = 0;
-  Int iY = 0;
-  Int iZ = 0;
   Int NX = header.nvoxels[0];
   Int NY = header.nvoxels[1];
   Int NZ = header.nvoxels[2];
@@ -231,121 +536,49 @@ void MrcSimple::ReadArray(istream& mrc_file,
     NY = header.nvoxels[ inv_axis_order[1] ];
     NZ = header.nvoxels[ inv_axis_order[2] ];
   }
-  
 
-  // REMOVE THIS CRUFT:
-  //for (size_t i = 0; i < num_voxels; i++) {
+  size_t entry_size = EntrySize();
+
+  // Read the file one section (XY plane, as stored in the file) at a time.
+  // Reading large blocks and converting them afterwards is much faster
+  // than reading (and converting) the voxels one at a time.
+  size_t section_size = static_cast<size_t>(NX) * NY;
+  vector<char> acBuffer(section_size * entry_size);
+  vector<float> afSection;
+  if (axis_order)
+    afSection.resize(section_size);
 
   for(Int iZ=0; iZ<NZ; iZ++) {
-    for(Int iY=0; iY<NY; iY++) {
-      for(Int iX=0; iX<NX; iX++) {
-        Int ix = iX;
-        Int iy = iY;
-        Int iz = iZ;
-        if (axis_order) {
-          int ixyz[3];
-          ixyz[0] = iX;
-          ixyz[1] = iY;
-          ixyz[2] = iZ;
-          ix = ixyz[ inv_axis_order[0] ];
-          iy = ixyz[ inv_axis_order[1] ];
-          iz = ixyz[ inv_axis_order[2] ];
-        }
 
-        switch (header.mode) {
-
-        case MrcHeader::MRC_MODE_BYTE:
-          if (header.use_signed_bytes)
-          {
-            int8_t entry;
-            mrc_file.read((char*)&entry, sizeof(char));
-
-            #ifdef ENABLE_IMOD_COMPATIBILITY
-            // MRC files using signed integers (eg. "mode 0") are
-            // interpreted differently by IMOD than they are by other software.
-            // In IMOD, voxel brightness values are adjusted to be so that 
-            // they lie in the range from 0..255.
-            // However files that use SIGNED bytes store their
-            // voxel brightnesses in the range from -128..127.
-            // For these files, IMOD automatically adds 128 to each voxel
-            // brightness value to insure the result lies between 0..255.
-            // Note: Neither UCSF Chimera, nor CCP-EM do this.
-            //  (CCP-EM is the distributor of the "mrcfile" python module.)
-            // To be compatible with the IMOD ecosystem, we must add 128:
-            entry += 128;
-            // Note: Later on when writing these files (in signed byte
-            //       format), remember to subtract this offset before writing.
-            // Note: Surprisingly, IMOD does not seem to add an offset to voxel
-            //       brightnesses from files using "mode 1" (signed int16 format).
-            #endif // #ifdef ENABLE_IMOD_COMPATIBILITY
-
-            aaafI[iz][iy][ix] = static_cast<float>(entry);
-          }
-          else
-          {
-            uint8_t entry;
-            mrc_file.read((char*)&entry, sizeof(char));
-            aaafI[iz][iy][ix] = static_cast<float>(entry);
-          }
-          break;
-
-        case MrcHeader::MRC_MODE_SHORT:
-          {
-            int16_t entry;
-            mrc_file.read((char*)&entry, sizeof(int16_t));
-            aaafI[iz][iy][ix] = static_cast<float>(entry);
-          }
-          break;
-
-        case MrcHeader::MRC_MODE_USHORT:
-          {
-            uint16_t entry;
-            mrc_file.read((char*)&entry, sizeof(uint16_t));
-            aaafI[iz][iy][ix] = static_cast<float>(entry);
-          }
-          break;
-
-        case MrcHeader::MRC_MODE_FLOAT:
-          {
-            float entry;
-            mrc_file.read((char*)&entry, sizeof(float));
-            //aaafI[iz][iy][ix] = static_cast<float>(entry);
-            aaafI[iz][iy][ix] = entry;  //(already type float)
-          }
-          break;
-        default:
-          throw MrcfileErr("UNSUPPORTED MODE in MRC file (unsupported MRC format)");
-          exit(-1);
-          break;
-        } // switch (header.mode)
-
-
-	// REMOVE THIS CRUFT:
-        // find indices for the next entry in the array:
-        //iX++;
-        //if (iX >= NX) {
-        //  iX = 0;
-        //  iY++;
-        //  if (iY >= NY) {
-        //    iY = 0;
-        //    iZ++;
-        //    if (iZ >= NZ) {
-        //      iZ = 0;
-        //    }
-        //  }
-        //}
-
-
-      } // for(Int iZ=0; iZ<NZ; iZ++)
-    } // for(Int iY=0; iY<NY; iY++) {
-  } // for(Int iX=0; iX<NX; iX++) {
-
-
-
-  // REMOVE THIS CRUFT:
-  //} //for (size_t i = 0; i < num_voxels; i++)
+    mrc_file.read(acBuffer.data(), acBuffer.size());
+    if (! mrc_file)
+      throw MrcfileErr("Error: Unexpected end of MRC file.  (File is truncated?)\n");
 
+    // If the file is stored in row-major order (the usual case), then
+    // convert the numbers directly into the corresponding section of afI[].
+    float *afDest = (axis_order
+                     ? afSection.data()
+                     : afI + iZ*section_size);
 
+    ConvertEntries(section_size, acBuffer.data(), afDest);
+
+    if (! axis_order)
+      continue;
+
+    // Otherwise, rearrange the voxels in this section
+    for(Int iY=0; iY<NY; iY++) {
+      for(Int iX=0; iX<NX; iX++) {
+        int ixyz[3];
+        ixyz[0] = iX;
+        ixyz[1] = iY;
+        ixyz[2] = iZ;
+        Int ix = ixyz[ inv_axis_order[0] ];
+        Int iy = ixyz[ inv_axis_order[1] ];
+        Int iz = ixyz[ inv_axis_order[2] ];
+        aaafI[iz][iy][ix] = afSection[iY*NX + iX];
+      }
+    }
+  } // for(Int iZ=0; iZ<NZ; iZ++)
 
 } //MrcSimple::ReadArray()
 
@@ -395,6 +628,20 @@ void MrcSimple::WriteArray(ostream& mrc_file) const {
 
 
 
+void MrcSimple::WriteSlices(ostream& mrc_file,
+                            int iz_begin,
+                            int iz_end) const {
+  assert((0 <= iz_begin) && (iz_end <= header.nvoxels[2]));
+  // The slices are contiguous in afI[], so we can write them all at once.
+  size_t section_size = (static_cast<size_t>(header.nvoxels[0]) *
+                         header.nvoxels[1]);
+  if (iz_end > iz_begin)
+    mrc_file.write(reinterpret_cast<char*>(afI + iz_begin*section_size),
+                   (iz_end - iz_begin) * section_size * sizeof(float));
+}
+
+
+
 void MrcSimple::FindMinMaxMean(float ***aaafMask) {
   double brightness_total = 0.0;
   double dmin = 0.0;  //impossible initial value
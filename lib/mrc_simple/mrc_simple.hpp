@@ -62,6 +62,12 @@ public:
                         ///<     afI[ix + iy*sizex + iz*sizex*sizey]
 private:
 
+  void *pMappedFile;    ///< if the file was memory-mapped (see Read()), this
+                        ///< points to the beginning of the mapping
+                        ///< (afI then points into the mapping, after the
+                        ///<  header).  Otherwise nullptr.
+  size_t mapped_file_size; ///< size of the mapping (in bytes)
+
   /// @brief  Allocate memory for the tomogram (image).
   ///   Allocates and initializes afI and aaafI. Invoke
   ///   after using ReadHeader(), or after modifying the header.
@@ -73,14 +79,68 @@ private:
 public:
 
   /// @brief  Read an .MRC/.REC file
+  /// @note  If memory_map==true, and if the file stores 32-bit floats in
+  ///        row-major order (mode 2, mapCRS = 1,2,3, native byte order),
+  ///        then the file is mapped into memory (using mmap()) instead of
+  ///        being read, and afI points directly into the mapping.
+  ///        This is much faster for large files.  The mapping is private
+  ///        (copy-on-write), so modifying afI will not alter the file.
+  ///        However the file should not be modified or overwritten by
+  ///        anyone (including you) until this object is destroyed.
+  ///        (Other files are read normally.)
   void Read(string mrc_file_name,  //!<name of the file
             bool rescale=false,     //!<Optional: rescale brightnesses from 0 to 1?
-            float ***aaafMask=nullptr//!<Optional: ignore zero-valued voxels in the aaafMask[][][] array
+            float ***aaafMask=nullptr,//!<Optional: ignore zero-valued voxels in the aaafMask[][][] array
+            bool memory_map=false   //!<Optional: map the file into memory?
             );
 
   /// @brief  Write an .MRC/.REC file
   void Write(string mrc_file_name); //Write an .MRC/.REC file
 
+  /// @brief  Read only the header of an .MRC/.REC file.
+  ///         (No memory is allocated for the image.  afI, aaafI = nullptr)
+  void ReadHeader(string mrc_file_name);
+
+  /// @brief  Read a range of XY slices (iz_begin <= iz < iz_end) from an
+  ///         .MRC/.REC file, without reading the rest of the file.
+  ///         Afterwards, header.nvoxels[2] = iz_end - iz_begin,
+  ///         and aaafI[0] contains the slice at iz_begin.
+  /// @note   This is used for processing images which are too large to fit
+  ///         in memory, one slab at a time.  Files whose axes are not stored
+  ///         in row-major order (mapCRS != 1,2,3) are not supported.
+  void ReadSlices(string mrc_file_name, //!< name of the file
+                  int iz_begin,         //!< first slice to read
+                  int iz_end            //!< read up to (not including) iz_end
+                  );
+
+  /// @brief  Read a rectangular region (ix_begin <= ix < ix_end,
+  ///         iy_begin <= iy < iy_end, iz_begin <= iz < iz_end) from an
+  ///         .MRC/.REC file.  Only the rows of voxels inside the region are
+  ///         read from the file (the rest are skipped using seekg()), so
+  ///         the time required depends on the size of the region, not the
+  ///         size of the file.  Afterwards, header.nvoxels[] stores the size
+  ///         of the region, and aaafI[0][0][0] contains the voxel at
+  ///         (ix_begin, iy_begin, iz_begin).  (The other header entries,
+  ///         including cellA[] and origin[], are not modified.)
+  /// @note   Files whose axes are not stored in row-major order
+  ///         (mapCRS != 1,2,3) are not supported.
+  void ReadRegion(string mrc_file_name, //!< name of the file
+                  int ix_begin,         //!< first voxel to read (x direction)
+                  int ix_end,           //!< read up to (not including) ix_end
+                  int iy_begin,         //!< first voxel to read (y direction)
+                  int iy_end,           //!< read up to (not including) iy_end
+                  int iz_begin,         //!< first slice to read
+                  int iz_end            //!< read up to (not including) iz_end
+                  );
+
+  /// @brief  Write the XY slices (iz_begin <= iz < iz_end) from this image
+  ///         to the end of a file.  (No header is written.  Use this together
+  ///         with header.Write() to write a large file one slab at a time.)
+  void WriteSlices(ostream& mrc_file, //!< write to this (binary) stream
+                   int iz_begin,      //!< first slice to write
+                   int iz_end         //!< write up to (not including) iz_end
+                   ) const;
+
   /// @brief  Read an .MRC/.REC file
   void Read(istream& mrc_file,      //!< Read an .MRC/.REC file (input stream)
             bool rescale=false,      //!<Optional: rescale brightnesses from 0 to 1?
@@ -127,6 +187,8 @@ private:
   void Init() {
     afI = nullptr;
     aaafI = nullptr;
+    pMappedFile = nullptr;
+    mapped_file_size = 0;
     header.mode = MrcHeader::MRC_MODE_FLOAT;
   }
 
@@ -173,6 +235,8 @@ public:
     std::swap(header, other.header);
     std::swap(afI, other.afI);
     std::swap(aaafI, other.aaafI);
+    std::swap(pMappedFile, other.pMappedFile);
+    std::swap(mapped_file_size, other.mapped_file_size);
     // (do I need to do something fancier for multidimensional arrays (aaafI)?)
   }
 
@@ -185,6 +249,11 @@ public:
 
 private:
 
+  /// @brief  Read the header, and convert it to row-major order if necessary.
+  /// @return true if the array in the file is not stored in row-major order.
+  ///         In that case, the order of the axes is stored in axis_order[].
+  bool ReadHeader(istream& mrc_file, Int axis_order[3]);
+
   /// @brief
   /// Invoke only after header.Read()
   /// If you want to read the header and array separately, you can do that too:
@@ -192,6 +261,21 @@ private:
   /// After that, you can read the rest of the file using:
   void ReadArray(istream& mrc_file, int const *axis_order);
 
+  /// @brief  The number of bytes used to store each voxel in the file
+  ///         (which depends on header.mode).
+  size_t EntrySize() const;
+
+  /// @brief  Convert n voxels read from the file (stored in acBuffer[] in
+  ///         the format indicated by header.mode) into floats.
+  ///         (Note: The contents of acBuffer[] may be modified.)
+  void ConvertEntries(size_t n, char *acBuffer, float *afDest) const;
+
+  /// @brief  Invoke only after ReadHeader().  Try to map the array stored
+  ///         in the file into memory.  (See the notes for Read().)
+  /// @return false if the file's format does not permit this (or if mmap()
+  ///         is unavailable), in which case the array must be read normally.
+  bool MapArray(string mrc_file_name, bool permuted_axes);
+
   /// @brief
   /// Invoke only after header.Read()
   /// If you want to write the header and array separately, you can do that too:
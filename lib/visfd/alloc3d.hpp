@@ -7,14 +7,64 @@
 #ifndef _ALLOC3D_HPP
 #define _ALLOC3D_HPP
 
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <volume_arena.hpp> // defines "VolumeArena"
+
 
 namespace visfd {
 
+/// @brief
+/// Create only the pointer-to-a-pointer-to-a-pointer table (aaaX) for an
+/// existing contiguous array (aX), so that its contents can be accessed
+/// using aaaX[k][j][i] notation.  (The table should be deallocated by
+/// invoking Dealloc3D() with a null paX argument.)
+
+template<typename Entry, typename Integer>
+void Alloc3DPointers(Integer const size[3], //!< size of the array in x,y,z directions
+                     Entry *aX,             //!< 1-D contiguous-memory array
+                     Entry ****paaaX)       //!< pointer to 3-D multidimensional array
+{
+  // The table of pointers to each plane (size[2] entries), and the table
+  // of pointers to each row (size[2]*size[1] entries) share one block.
+  void *p = VolumeArena::Global().Acquire((size_t(size[2]) +
+                                           size_t(size[2]) * size[1])
+                                          * sizeof(Entry*));
+  *paaaX = static_cast<Entry***>(p);
+  Entry **aaX = reinterpret_cast<Entry**>(*paaaX + size[2]);
+
+  // (The aaafX[][] pointers should point to to the 
+  //  appropriate locations within the afX array.)
+  for(Integer iz=0; iz<size[2]; iz++) {
+    (*paaaX)[iz] = aaX + size_t(iz)*size[1];
+    for(Integer iy=0; iy<size[1]; iy++) {
+      (*paaaX)[iz][iy] = aX + ((size_t(iz)*size[1] + iy) * size[0]);
+    }
+  }
+}
+
+
+
 /// @brief
 /// Alloc3D() is a function for allocating 3-dimensional arrays of data
 /// (contiguous in memory, in row-major format.)
 /// (The functions in this file are used to allocate arrays for storing
 ///  tomographic data, and also precomputed filter-weights.)
+///
+/// The memory is obtained from VolumeArena::Global().  It is aligned to
+/// (at least) 64 bytes, and it is recycled after Dealloc3D() is invoked.
+/// When the memory has never been used before, it is initialized in
+/// parallel, one z-slab per thread.  (On machines with several sockets, the
+/// operating system places each page of memory near the thread which
+/// touched it first.)  The loop used here:
+///   #pragma omp parallel for collapse(2) schedule(static)
+///   for (iz ...) for (iy ...) for (ix ...)
+/// is the same loop used by most of the filters that process these arrays
+/// later, so each thread processes memory that is close to it (provided
+/// the threads do not migrate between sockets, eg. OMP_PROC_BIND=close).
+/// Otherwise, as with "new", the contents of the array are not initialized
+/// (for simple types).
 
 
 template<typename Entry, typename Integer>
@@ -26,31 +76,31 @@ void Alloc3D(Integer const size[3], //!< size of the array in x,y,z directions
     return;
 
   // Allocate a 3-dimensional table row-major order
+  size_t n_plane = size_t(size[0]) * size_t(size[1]);
+  bool is_new;
+  *paX = static_cast<Entry*>
+    (VolumeArena::Global().Acquire(n_plane * size[2] * sizeof(Entry),
+                                   &is_new));
+
+  // Construct the entries (or touch the new pages for the first time).
+  if (is_new || (! is_trivial<Entry>::value)) {
+    Entry *aX = *paX;
+    #pragma omp parallel for collapse(2) schedule(static)
+    for(Integer iz=0; iz<size[2]; iz++)
+      for(Integer iy=0; iy<size[1]; iy++)
+        for(Integer ix=0; ix<size[0]; ix++)
+          new (aX + (size_t(iz)*size[1] + iy)*size[0] + ix) Entry();
+  }
+
   // Optional: Also allocate a conventional 3-dimensional
   //           pointer-to-a-pointer-to-a-pointer data structure (aaaX), that
   //           you can use to access the contents using aaaX[k][j][i] notation.
-  *paX = new Entry [size[0] * 
-                    size[1] * 
-                    size[2]];
-
-  if (! paaaX)
-    return;
-
-  *paaaX = new Entry** [size[2]];
-
-  // (The aaafX[][] pointers should point to to the 
-  //  appropriate locations within the afX array.)
-  for(Integer iz=0; iz<size[2]; iz++) {
-    (*paaaX)[iz] = new Entry* [size[1]];
-    for(Integer iy=0; iy<size[1]; iy++) {
-      (*paaaX)[iz][iy] = &((*paX)[iz*size[0]
-                                    *size[1] + 
-                                  iy*size[0]]);
-    }
-  }
+  if (paaaX)
+    Alloc3DPointers(size, *paX, paaaX);
 }
 
 
+
 /// @brief
 /// This function is the corresponding way to dellocate arrays
 /// that were created using Alloc3D()
@@ -62,14 +112,16 @@ void Dealloc3D(Integer const size[3], //!< size of the array in x,y,z directions
                Entry ****paaaX)      //!< pointer to 3-D multidimensional array
 {
   if (paaaX && *paaaX) {
-    for(Integer iz=0; iz<size[2]; iz++)
-      if ((*paaaX)[iz])
-        delete [] (*paaaX)[iz];
-    delete [] (*paaaX);
+    VolumeArena::Global().Release(*paaaX);
     *paaaX = nullptr;
   }
   if (paX && *paX) {
-    delete [] *paX;
+    if (! is_trivial<Entry>::value) {
+      size_t n = size_t(size[0]) * size_t(size[1]) * size_t(size[2]);
+      for (size_t i=0; i<n; i++)
+        (*paX)[i].~Entry();
+    }
+    VolumeArena::Global().Release(*paX);
     *paX = nullptr;
   }
 }
@@ -0,0 +1,219 @@
+///   @file brick_occupancy.hpp
+///   @brief a coarse index of the voxels in an image which belong to a mask,
+///          used to skip over regions of the image far away from the mask
+
+#ifndef _BRICK_OCCUPANCY_HPP
+#define _BRICK_OCCUPANCY_HPP
+
+#include <cassert>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+
+
+namespace visfd {
+
+
+
+/// @brief  The default width of the (cubic) bricks used by BrickOccupancy.
+const int BRICK_OCCUPANCY_WIDTH = 8;
+
+/// @brief  Filters only build a BrickOccupancy if the mask occupies less than
+///         this fraction of the image.  (Denser masks leave few empty regions
+///         to skip, so building the index would rarely pay for itself.)
+const double BRICK_OCCUPANCY_MAX_FRACTION = 0.5;
+
+
+
+/// @brief  Estimate the fraction of the voxels in an image where the mask is
+///         non-zero, by examining only every "stride"th row of voxels in the
+///         y and z directions.  This is much cheaper than building a
+///         BrickOccupancy, and it is used to decide whether to build one.
+/// @return a number between 0 and 1
+
+template<typename Scalar>
+double
+EstimateMaskFraction(int const image_size[3], //!< #voxels in xyz
+                     Scalar const *const *const *aaafMask, //!< the mask
+                     int stride = BRICK_OCCUPANCY_WIDTH / 2 //!< sample spacing
+                     )
+{
+  assert(aaafMask);
+  assert(stride > 0);
+  size_t num_sampled = 0;
+  size_t num_nonzero = 0;
+  for (int iz = stride/2; iz < image_size[2]; iz += stride) {
+    for (int iy = stride/2; iy < image_size[1]; iy += stride) {
+      for (int ix = 0; ix < image_size[0]; ix++)
+        if (aaafMask[iz][iy][ix] != 0.0)
+          num_nonzero++;
+      num_sampled += image_size[0];
+    }
+  }
+  if (num_sampled == 0) {
+    // (This only happens for tiny images.  In that case, check every voxel.)
+    for (int iz = 0; iz < image_size[2]; iz++)
+      for (int iy = 0; iy < image_size[1]; iy++)
+        for (int ix = 0; ix < image_size[0]; ix++)
+          if (aaafMask[iz][iy][ix] != 0.0)
+            num_nonzero++;
+    num_sampled = (size_t(image_size[0]) *
+                   size_t(image_size[1]) *
+                   size_t(image_size[2]));
+  }
+  if (num_sampled == 0)
+    return 0.0;
+  return double(num_nonzero) / num_sampled;
+}
+
+
+
+/// @class  BrickOccupancy
+/// @brief  This class divides an image into cubic "bricks" (8x8x8 voxels by
+///         default) and records which bricks contain at least one voxel
+///         where the mask is non-zero.  It is built once (requiring one pass
+///         over the mask).  Afterwards, it can quickly determine whether a
+///         rectangular region of the image is empty (ie. whether the mask is
+///         zero everywhere in that region).  Filters use it to skip over the
+///         parts of the image which are far away from the mask, so that
+///         their cost scales with the volume of the mask (rather than the
+///         volume of the entire image).
+///
+///         The answers are conservative:  Empty() never returns true if the
+///         region contains a voxel in the mask.  (It occasionally returns
+///         false for empty regions which share a brick with the mask.)
+///         Each query requires O(1) time.  (A summed-area table of the
+///         occupied bricks is used.)
+///
+/// Example usage:
+/// @code
+/// BrickOccupancy occupancy(image_size, aaafMask);
+/// if (occupancy.Empty(0, image_size[0]-1, iy-h, iy+h, iz-h, iz+h))
+///   continue; // (no voxels near row iy,iz belong to the mask)
+/// @endcode
+
+class BrickOccupancy {
+
+  int image_size[3];
+  int brick_width;
+  int num_bricks[3];
+  vector<size_t> prefix; //!< summed-area table of occupied bricks
+                         //!< (size: (num_bricks[0]+1)*(num_bricks[1]+1)*...)
+
+public:
+
+  template<typename Scalar>
+  BrickOccupancy(int const set_image_size[3], //!< #voxels in xyz
+                 Scalar const *const *const *aaafMask, //!< voxels where the mask is non-zero are "occupied"
+                 int set_brick_width = BRICK_OCCUPANCY_WIDTH //!< brick width
+                 )
+  {
+    assert(aaafMask);
+    assert(set_brick_width > 0);
+    brick_width = set_brick_width;
+    for (int d = 0; d < 3; d++) {
+      image_size[d] = set_image_size[d];
+      num_bricks[d] = (image_size[d] + brick_width - 1) / brick_width;
+    }
+
+    // Which bricks contain at least one voxel in the mask?
+    vector<char> occupied(size_t(num_bricks[0]) *
+                          size_t(num_bricks[1]) *
+                          size_t(num_bricks[2]), 0);
+    #pragma omp parallel for collapse(2)
+    for (int bz = 0; bz < num_bricks[2]; bz++) {
+      for (int by = 0; by < num_bricks[1]; by++) {
+        int iz_end = std::min((bz+1)*brick_width, image_size[2]);
+        int iy_end = std::min((by+1)*brick_width, image_size[1]);
+        for (int iz = bz*brick_width; iz < iz_end; iz++) {
+          for (int iy = by*brick_width; iy < iy_end; iy++) {
+            for (int ix = 0; ix < image_size[0]; ix++) {
+              if (aaafMask[iz][iy][ix] != 0.0)
+                occupied[(size_t(bz)*num_bricks[1] + by)*num_bricks[0]
+                         + ix/brick_width] = 1;
+            }
+          }
+        }
+      }
+    }
+
+    // Now compute the summed-area table.
+    // prefix[Index(bx,by,bz)] = the number of occupied bricks whose indices
+    // are less than bx, by, and bz (in the x, y, and z directions).
+    prefix.assign(size_t(num_bricks[0]+1) *
+                  size_t(num_bricks[1]+1) *
+                  size_t(num_bricks[2]+1), 0);
+    for (int bz = 0; bz < num_bricks[2]; bz++)
+      for (int by = 0; by < num_bricks[1]; by++)
+        for (int bx = 0; bx < num_bricks[0]; bx++)
+          prefix[Index(bx+1, by+1, bz+1)] =
+            occupied[(size_t(bz)*num_bricks[1] + by)*num_bricks[0] + bx]
+            + prefix[Index(bx,   by+1, bz+1)]
+            + prefix[Index(bx+1, by,   bz+1)]
+            + prefix[Index(bx+1, by+1, bz  )]
+            - prefix[Index(bx,   by,   bz+1)]
+            - prefix[Index(bx,   by+1, bz  )]
+            - prefix[Index(bx+1, by,   bz  )]
+            + prefix[Index(bx,   by,   bz  )];
+  } //BrickOccupancy()
+
+
+  /// @brief  Is the mask zero everywhere in the rectangular region
+  ///         xmin<=ix<=xmax, ymin<=iy<=ymax, zmin<=iz<=zmax ?
+  ///         (The region is clipped to the boundaries of the image first.
+  ///          Regions which lie entirely outside the image are empty.)
+  bool Empty(int xmin, int xmax,
+             int ymin, int ymax,
+             int zmin, int zmax) const
+  {
+    int lo[3] = {xmin, ymin, zmin};
+    int hi[3] = {xmax, ymax, zmax};
+    for (int d = 0; d < 3; d++) {
+      lo[d] = std::max(lo[d], 0);
+      hi[d] = std::min(hi[d], image_size[d]-1);
+      if (lo[d] > hi[d])
+        return true;
+      // convert from voxels to bricks (b0 <= b < b1)
+      lo[d] = lo[d] / brick_width;
+      hi[d] = hi[d] / brick_width + 1;
+    }
+    size_t count = (prefix[Index(hi[0], hi[1], hi[2])]
+                    - prefix[Index(lo[0], hi[1], hi[2])]
+                    - prefix[Index(hi[0], lo[1], hi[2])]
+                    - prefix[Index(hi[0], hi[1], lo[2])]
+                    + prefix[Index(lo[0], lo[1], hi[2])]
+                    + prefix[Index(lo[0], hi[1], lo[2])]
+                    + prefix[Index(hi[0], lo[1], lo[2])]
+                    - prefix[Index(lo[0], lo[1], lo[2])]);
+    return count == 0;
+  }
+
+
+  /// @brief  The fraction of the bricks which contain voxels in the mask.
+  double OccupiedFraction() const {
+    size_t num_tot = (size_t(num_bricks[0]) *
+                      size_t(num_bricks[1]) *
+                      size_t(num_bricks[2]));
+    if (num_tot == 0)
+      return 0.0;
+    return (double(prefix[Index(num_bricks[0], num_bricks[1], num_bricks[2])])
+            / num_tot);
+  }
+
+
+private:
+
+  size_t Index(int bx, int by, int bz) const {
+    return ((size_t(bz)*(num_bricks[1]+1) + by)*(num_bricks[0]+1) + bx);
+  }
+
+}; // class BrickOccupancy
+
+
+
+} //namespace visfd
+
+
+
+#endif //#ifndef _BRICK_OCCUPANCY_HPP
@@ -18,6 +18,9 @@
 #include <tuple>
 #include <set>
 #include <queue>
+#include <array>
+#include <unordered_map>
+#include <algorithm>
 using namespace std;
 #include <err_visfd.hpp> // defines the "VisfdErr" exception type
 #include <eigen3_simple.hpp>  // defines matrix diagonalizer (DiagonalizeSym3())
@@ -27,6 +30,7 @@ using namespace std;
 #include <alloc3d.hpp>    // defines Alloc3D() and Dealloc3D()
 #include <filter1d.hpp>   // defines "Filter1D" (used in ApplySeparable())
 #include <filter3d.hpp>   // defines common 3D image filters
+#include <voxel_index.hpp> // defines "NearestVoxelIndex"
 
 
 
@@ -52,6 +56,631 @@ typedef enum eClusterSortCriteria {
 
 
 
+/// @brief   The following enumerated constants are used as arguments
+///          to the ClusterConnected() function.
+///          They select the algorithm used to group voxels into clusters.
+///
+///          CLUSTER_BY_FLOODING grows clusters outward from saliency maxima
+///          (or minima) in order of decreasing saliency, like Watershed().
+///
+///          CLUSTER_BY_UNION_FIND joins neighboring voxels together using a
+///          union-find (disjoint-set) data structure.  The image is divided
+///          into slabs (blocks of z-planes) which are processed in parallel.
+
+typedef enum eClusterAlgorithm {
+  CLUSTER_BY_FLOODING,
+  CLUSTER_BY_UNION_FIND
+} ClusterAlgorithm;
+
+
+
+/// @brief  This function is used by ClusterConnected() to decide whether
+///         to discard voxel ix,iy,iz because the Hessian of aaafSaliency at
+///         that location is incompatible with aaaafSymmetricTensor[iz][iy][ix]
+///         or with aaaafVector[iz][iy][ix].
+///         (See ClusterConnected() for a description of the arguments.)
+/// @return true if the voxel should be discarded.
+
+template<typename Scalar, typename VectorContainer, typename TensorContainer>
+
+static bool
+_ClusterDiscardVoxel(int ix,
+                     int iy,
+                     int iz,
+                     int const image_size[3],
+                     Scalar const *const *const *aaafSaliency,
+                     VectorContainer const *const *const *aaaafVector,
+                     Scalar threshold_vector_saliency,
+                     bool consider_dot_product_sign,
+                     TensorContainer const *const *const *aaaafSymmetricTensor,
+                     Scalar threshold_tensor_saliency,
+                     bool tensor_is_positive_definite_near_ridge,
+                     bool start_from_saliency_maxima,
+                     selfadjoint_eigen3::EigenOrderType eival_order)
+{
+  if ((! aaaafSymmetricTensor) && (! aaaafVector))
+    return false;
+
+  // -----------------------------------------------
+  // First, condsider discarding voxel ix,iy,iz due to
+  // inconsistencies between aaafSaliency and aaaafSymTensor here
+  // -----------------------------------------------
+
+  Scalar saliency_hessian3x3[3][3];
+
+  CalcHessianFiniteDifferences(aaafSaliency, //!< source image
+                               ix, iy, iz,
+                               saliency_hessian3x3,
+                               image_size);
+
+  // Confusing sign compatibility issue:
+  // We assume that the tensor passed
+  // by the caller will be positive-definite near a ridge.
+  // In other words, it's largest eigenvalue will be positive there,
+  // and its corresponding eigenvector is assumed to point in a direction
+  // where the 2nd-derivative is largest.
+  // In that case we must invert the sign of the hessian matrix before we
+  // compare it with the tensor, because we also assume the saliency is
+  // bright on a dark background.  Hence it's second derivative (ie. its 
+  // Hessian) along that direction will be negative instead of positive
+  // at that location.  Hence if both of these assumptions are true, 
+  // we must multiply the entries in saliency_hessian by -1 before 
+  // comparing them with the tensor.
+
+  if (tensor_is_positive_definite_near_ridge ==
+      start_from_saliency_maxima) {
+    for (int di = 0; di < 3; di++)
+      for (int dj = di; dj < 3; dj++)
+        saliency_hessian3x3[di][dj] *= -1.0;
+  }
+
+  // To reduce memory consumption,
+  // save the resulting 3x3 matrix in a smaller 1-D array (with 6 entries)
+  // whose index is given by MapIndices_3x3_to_linear[][]
+
+  Scalar saliency_hessian[6];
+
+  for (int di = 0; di < 3; di++)
+    for (int dj = di; dj < 3; dj++)
+      saliency_hessian[ MapIndices_3x3_to_linear[di][dj] ]
+        = saliency_hessian3x3[di][dj];
+
+  if (aaaafSymmetricTensor) {
+
+    // (Copy the tensor, in case it is stored using a different numeric type.)
+    Scalar tensor[6];
+    for (int k = 0; k < 6; k++)
+      tensor[k] = aaaafSymmetricTensor[iz][iy][ix][k];
+
+    Scalar tp = TraceProductSym3(saliency_hessian, tensor);
+    Scalar fs = FrobeniusNormSym3(saliency_hessian);
+    Scalar ft = FrobeniusNormSym3(tensor);
+
+    if (tp < threshold_tensor_saliency * fs * ft)
+      return true;
+  }
+
+  // -----------------------------------------------
+  // Then, condsider discarding voxel ix,iy,iz due to
+  // inconsistencies between aaafSaliency and aaaafVector at this location
+  // -----------------------------------------------
+
+  if (aaaafVector) {
+    Scalar s_eivals[3];
+    Scalar s_eivects[3][3];
+
+    // the eigenvector of the saliency_hessian that we care about is the
+    // one with the largest eigenvalue (which is assumed to be positive).
+
+    ConvertFlatSym2Evects3(saliency_hessian,
+                           s_eivals,
+                           s_eivects,
+                           eival_order);
+
+    if (consider_dot_product_sign) {
+      if (DotProduct3(s_eivects[0], //principal (first) eivenvector
+                      aaaafVector[iz][iy][ix])
+          <
+          (threshold_vector_saliency *
+           Length3(s_eivects[0]) *
+           Length3(aaaafVector[iz][iy][ix])))
+        return true;
+    }
+    else {
+      if (SQR(DotProduct3(s_eivects[0], //principal (first) eivenvector
+                          aaaafVector[iz][iy][ix]))
+          <
+          (SQR(threshold_vector_saliency) *
+           SquaredNorm3(s_eivects[0]) *
+           SquaredNorm3(aaaafVector[iz][iy][ix])))
+        return true;
+    }
+  }
+
+  return false;
+
+} //_ClusterDiscardVoxel()
+
+
+
+/// @brief  This function is used by ClusterConnected() to decide whether
+///         two neighboring voxels (ix,iy,iz) and (jx,jy,jz) are compatible,
+///         ie. whether their tensors (aaaafSymmetricTensor) and vectors
+///         (aaaafVector) point in similar directions.
+///         (See ClusterConnected() for a description of the arguments.)
+/// @return false if the two voxels should not be joined together.
+
+template<typename Scalar, typename VectorContainer, typename TensorContainer>
+
+static bool
+_ClusterNeighborsCompatible(int ix,
+                            int iy,
+                            int iz,
+                            int jx,
+                            int jy,
+                            int jz,
+                            VectorContainer const *const *const *aaaafVector,
+                            Scalar threshold_vector_neighbor,
+                            bool consider_dot_product_sign,
+                            TensorContainer const *const *const *aaaafSymmetricTensor,
+                            Scalar threshold_tensor_neighbor)
+{
+  // -----------------------------------------------
+  // Condsider discarding voxel jx,jy,jz due to
+  // inconsistencies between aaaafSymTensor[iz][iy][ix]
+  //                     and aaaafSymTensor[jz][jy][jx]
+  // -----------------------------------------------
+  if (aaaafSymmetricTensor) {
+    // (Copy the tensors, in case they are stored using a different type.)
+    Scalar tensor_i[6];
+    Scalar tensor_j[6];
+    for (int k = 0; k < 6; k++) {
+      tensor_i[k] = aaaafSymmetricTensor[iz][iy][ix][k];
+      tensor_j[k] = aaaafSymmetricTensor[jz][jy][jx][k];
+    }
+    if (TraceProductSym3(tensor_i, tensor_j)
+        <
+        (threshold_tensor_neighbor *
+         FrobeniusNormSym3(tensor_i) *
+         FrobeniusNormSym3(tensor_j)))
+      return false;
+  }
+
+  // -----------------------------------------------
+  // Condsider discarding voxel jx,jy,jz due to
+  // inconsistencies between aaaafVector[iz][iy][ix]
+  //                     and aaaafVector[jz][jy][jx]
+  // -----------------------------------------------
+  // (Note: For compatibility with earlier versions, the vectors are only
+  //  compared when the tensors are also available, and when the sign of
+  //  the dot product matters, threshold_tensor_neighbor is used.)
+  if (aaaafSymmetricTensor && aaaafVector) {
+    if (consider_dot_product_sign) {
+      if (DotProduct3(aaaafVector[iz][iy][ix],
+                      aaaafVector[jz][jy][jx])
+          <
+          (threshold_tensor_neighbor *
+           Length3(aaaafVector[iz][iy][ix])*
+           Length3(aaaafVector[jz][jy][jx])))
+        return false;
+    }
+    else {
+      if (SQR(DotProduct3(aaaafVector[iz][iy][ix],
+                          aaaafVector[jz][jy][jx]))
+          <
+          (SQR(threshold_vector_neighbor) *
+           SquaredNorm3(aaaafVector[iz][iy][ix])*
+           SquaredNorm3(aaaafVector[jz][jy][jx])))
+        return false;
+    }
+  }
+  return true;
+
+} //_ClusterNeighborsCompatible()
+
+
+
+/// @class  _UnionFindParity
+/// @brief  A union-find (disjoint-set) data structure used by
+///         ClusterConnected().  Each element (voxel) stores the index of its
+///         parent, as well as a "parity" bit which indicates whether its
+///         orientation is flipped relative to its parent.  (The parity bit is
+///         used to keep track of the relative signs of voxel directions
+///         which lack polarity.  Otherwise it is ignored.)
+///         The parent and parity are packed into a single 64-bit integer.
+///         Roots are their own parent.  Find() uses path-halving.
+/// @note   Find() and Link() may be invoked from multiple threads at once,
+///         as long as different threads operate on disjoint sets of
+///         elements.  Once they are finished, FindReadOnly() can be invoked
+///         from any thread.  (No locks are required.)
+
+class _UnionFindParity {
+
+  vector<uint64_t> parent_parity; //!< (parent_index << 1) | parity
+
+public:
+
+  _UnionFindParity(size_t n): parent_parity(n) {
+    #pragma omp parallel for
+    for (size_t i = 0; i < n; i++)
+      parent_parity[i] = i << 1;
+  }
+
+  /// @brief  Find the root of the set containing element i.
+  ///         If pParity != nullptr, then *pParity will store the parity of
+  ///         element i relative to the root.
+  uint64_t Find(uint64_t i, bool *pParity = nullptr) {
+    uint64_t parity = 0;
+    while (true) {
+      uint64_t pi = parent_parity[i];
+      uint64_t p = pi >> 1;
+      if (p == i)
+        break;
+      uint64_t pp = parent_parity[p];
+      if ((pp >> 1) != p) {
+        // path halving: point i to its grandparent
+        pi = ((pp >> 1) << 1) | ((pi ^ pp) & 1);
+        parent_parity[i] = pi;
+      }
+      parity ^= (pi & 1);
+      i = pi >> 1;
+    }
+    if (pParity)
+      *pParity = parity;
+    return i;
+  }
+
+  /// @brief  Same as Find(), but the data structure is not modified.
+  uint64_t FindReadOnly(uint64_t i, bool *pParity = nullptr) const {
+    uint64_t parity = 0;
+    while ((parent_parity[i] >> 1) != i) {
+      parity ^= (parent_parity[i] & 1);
+      i = parent_parity[i] >> 1;
+    }
+    if (pParity)
+      *pParity = parity;
+    return i;
+  }
+
+  /// @brief  Merge the sets containing elements i and j.
+  ///         (The root with the larger index is attached to the other root.)
+  ///         The parity of j relative to i will equal "parity_ij".
+  /// @return false if i and j already belong to the same set, but their
+  ///         relative parity differs from parity_ij.  Otherwise true.
+  bool Link(uint64_t i, uint64_t j, bool parity_ij) {
+    bool parity_i, parity_j;
+    uint64_t root_i = Find(i, &parity_i);
+    uint64_t root_j = Find(j, &parity_j);
+    uint64_t parity_roots = parity_i ^ parity_j ^ parity_ij;
+    if (root_i == root_j)
+      return (parity_roots == 0);
+    if (root_i < root_j)
+      parent_parity[root_j] = (root_i << 1) | parity_roots;
+    else
+      parent_parity[root_i] = (root_j << 1) | parity_roots;
+    return true;
+  }
+
+}; // class _UnionFindParity
+
+
+
+/// @brief  This function is used by ClusterConnected() when the
+///         CLUSTER_BY_UNION_FIND algorithm is selected.  Clusters are the
+///         connected islands of voxels which were not discarded, where
+///         neighboring voxels are only connected if they are compatible.
+///         (These are the same clusters that the CLUSTER_BY_FLOODING
+///          algorithm produces.)  The image is divided into num_blocks slabs
+///         (blocks of z-planes).  The voxels within each slab are joined
+///         together in parallel.  Then the slabs are joined together.
+///         Afterwards, each voxel in aaaiDest is assigned to the (lowest)
+///         basin-ID of the local maxima (or minima) which belong to its
+///         cluster, or UNDEFINED if there are none.  basin2cluster[] is also
+///         updated.  (See ClusterConnected() for the meaning of the others.)
+/// @note   If voxel directions lack polarity (and aaaafVectorStandardized is
+///         not nullptr), then the voxels in each slab are joined together in
+///         order of decreasing saliency.  Voxels are not joined if their
+///         directions cannot be oriented consistently (see ClusterConnected).
+///         (In that case, the connections between slabs are made last,
+///          so inconsistent loops are more likely to be cut there.)
+
+template<typename Scalar, typename Label, typename Coordinate, typename VectorContainer, typename TensorContainer>
+
+static void
+_ClusterConnectedUnionFind(int const image_size[3],
+                           Scalar const *const *const *aaafSaliency,
+                           Label ***aaaiDest,
+                           Scalar const *const *const *aaafMask,
+                           Scalar threshold_saliency,
+                           VectorContainer const *const *const *aaaafVector,
+                           Scalar threshold_vector_saliency,
+                           Scalar threshold_vector_neighbor,
+                           bool consider_dot_product_sign,
+                           TensorContainer const *const *const *aaaafSymmetricTensor,
+                           Scalar threshold_tensor_saliency,
+                           Scalar threshold_tensor_neighbor,
+                           bool tensor_is_positive_definite_near_ridge,
+                           bool start_from_saliency_maxima,
+                           selfadjoint_eigen3::EigenOrderType eival_order,
+                           int const (*neighbors)[3],
+                           int num_neighbors,
+                           vector<array<Coordinate, 3> > const &extrema_locations,
+                           int num_blocks,
+                           ptrdiff_t UNDEFINED,
+                           ptrdiff_t ACCEPTED, //!< (an impossible value)
+                           vector<ptrdiff_t> &basin2cluster,
+                           VectorContainer ***aaaafVectorStandardized,
+                           bool &voxels_discarded_due_to_polarity,
+                           array<int, 3> &voxel_discarded_due_to_polarity,
+                           Scalar &voxel_discarded_due_to_polarity_saliency,
+                           ostream *pReportProgress)
+{
+  Scalar SIGN_FACTOR = 1.0;
+  if (start_from_saliency_maxima)
+    SIGN_FACTOR = -1.0;
+
+  bool use_polarity = (aaaafVector && aaaafVectorStandardized &&
+                       (! consider_dot_product_sign));
+
+  uint64_t nx = image_size[0];
+  uint64_t ny = image_size[1];
+  uint64_t nz = image_size[2];
+
+  // Decide which voxels should be discarded. (Mark the others as "ACCEPTED")
+  #pragma omp parallel for collapse(2) schedule(dynamic)
+  for (int iz=0; iz<image_size[2]; iz++) {
+    for (int iy=0; iy<image_size[1]; iy++) {
+      for (int ix=0; ix<image_size[0]; ix++) {
+        if (aaafMask && aaafMask[iz][iy][ix] == 0.0)
+          continue;
+        if (aaafSaliency[iz][iy][ix] * SIGN_FACTOR >
+            threshold_saliency * SIGN_FACTOR)
+          continue;
+        if (_ClusterDiscardVoxel(ix, iy, iz,
+                                 image_size,
+                                 aaafSaliency,
+                                 aaaafVector,
+                                 threshold_vector_saliency,
+                                 consider_dot_product_sign,
+                                 aaaafSymmetricTensor,
+                                 threshold_tensor_saliency,
+                                 tensor_is_positive_definite_near_ridge,
+                                 start_from_saliency_maxima,
+                                 eival_order))
+          continue;
+        aaaiDest[iz][iy][ix] = ACCEPTED;
+      }
+    }
+  }
+
+  // Divide the image into slabs
+  if (num_blocks > image_size[2])
+    num_blocks = image_size[2];
+  if (num_blocks < 1)
+    num_blocks = 1;
+  vector<int> block_iz_begin(num_blocks+1);
+  for (int b = 0; b <= num_blocks; b++)
+    block_iz_begin[b] = (static_cast<size_t>(image_size[2]) * b) / num_blocks;
+
+  if (pReportProgress)
+    *pReportProgress << "  joining neighboring voxels in "
+                     << num_blocks << " slab(s)" << endl;
+
+  _UnionFindParity uf(nx * ny * nz);
+
+  // Keep track of the brightest voxel which was cut from each slab
+  vector<Scalar> vCutScore(num_blocks+1,
+                           std::numeric_limits<Scalar>::infinity());
+  vector<uint64_t> vCutIndex(num_blocks+1, 0);
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int b = 0; b < num_blocks; b++) {
+    int iz_begin = block_iz_begin[b];
+    int iz_end = block_iz_begin[b+1];
+
+    // In which order should we visit the voxels in this slab?
+    // If the voxel directions lack polarity, then we visit them in order of
+    // decreasing saliency (*SIGN_FACTOR).  Otherwise the order does not matter.
+    vector<pair<Scalar, uint64_t> > vOrder;
+    for (int iz = iz_begin; iz < iz_end; iz++)
+      for (int iy = 0; iy < image_size[1]; iy++)
+        for (int ix = 0; ix < image_size[0]; ix++)
+          if ((! (aaafMask && aaafMask[iz][iy][ix] == 0.0)) &&
+              (aaaiDest[iz][iy][ix] == ACCEPTED))
+            vOrder.push_back(make_pair(aaafSaliency[iz][iy][ix] * SIGN_FACTOR,
+                                       ix + nx*(iy + ny*iz)));
+    if (use_polarity)
+      sort(vOrder.begin(), vOrder.end());
+
+    for (auto p = vOrder.begin(); p != vOrder.end(); p++) {
+      Scalar i_score = p->first;
+      int ix = p->second % nx;
+      int iy = (p->second / nx) % ny;
+      int iz = p->second / (nx * ny);
+      for (int j = 0; j < num_neighbors; j++) {
+        int iz_jz = iz + neighbors[j][2];
+        int iy_jy = iy + neighbors[j][1];
+        int ix_jx = ix + neighbors[j][0];
+        if ((iz_jz < iz_begin) || (iz_end <= iz_jz))
+          continue;
+        if ((iy_jy < 0) || (image_size[1] <= iy_jy))
+          continue;
+        if ((ix_jx < 0) || (image_size[0] <= ix_jx))
+          continue;
+        if (aaafMask && (aaafMask[iz_jz][iy_jy][ix_jx] == 0.0))
+          continue;
+        if (aaaiDest[iz_jz][iy_jy][ix_jx] != ACCEPTED)
+          continue;
+        // Consider each pair of neighbors only once (when visiting the
+        // second voxel in the pair).
+        uint64_t j_index = ix_jx + nx*(iy_jy + ny*iz_jz);
+        if (use_polarity) {
+          Scalar j_score = aaafSaliency[iz_jz][iy_jy][ix_jx] * SIGN_FACTOR;
+          if ((j_score > i_score) ||
+              ((j_score == i_score) && (j_index > p->second)))
+            continue;
+        }
+        else if (j_index > p->second)
+          continue;
+        if (! _ClusterNeighborsCompatible(ix, iy, iz,
+                                          ix_jx, iy_jy, iz_jz,
+                                          aaaafVector,
+                                          threshold_vector_neighbor,
+                                          consider_dot_product_sign,
+                                          aaaafSymmetricTensor,
+                                          threshold_tensor_neighbor))
+          continue;
+        bool parity = false;
+        if (use_polarity)
+          parity = (DotProduct3(aaaafVector[iz][iy][ix],
+                                aaaafVector[iz_jz][iy_jy][ix_jx]) < 0.0);
+        if ((! uf.Link(j_index, p->second, parity)) &&
+            (vCutScore[b] == std::numeric_limits<Scalar>::infinity())) {
+          vCutScore[b] = i_score;
+          vCutIndex[b] = p->second;
+        }
+      } // for (int j = 0; j < num_neighbors; j++)
+    } // for (auto p = vOrder.begin(); p != vOrder.end(); p++)
+  } // for (int b = 0; b < num_blocks; b++)
+
+
+  // Now join neighboring voxels from different slabs.
+  // Find all of the pairs of neighbors that straddle the boundaries between
+  // slabs (and the score of the weaker voxel in each pair).
+  vector<tuple<Scalar, uint64_t, uint64_t> > vCrossings;
+  for (int b = 1; b < num_blocks; b++) {
+    for (int iz = block_iz_begin[b]; iz < block_iz_begin[b+1]; iz++) {
+      for (int iy = 0; iy < image_size[1]; iy++) {
+        for (int ix = 0; ix < image_size[0]; ix++) {
+          if (aaafMask && (aaafMask[iz][iy][ix] == 0.0))
+            continue;
+          if (aaaiDest[iz][iy][ix] != ACCEPTED)
+            continue;
+          for (int j = 0; j < num_neighbors; j++) {
+            int iz_jz = iz + neighbors[j][2];
+            int iy_jy = iy + neighbors[j][1];
+            int ix_jx = ix + neighbors[j][0];
+            if ((iz_jz < 0) || (block_iz_begin[b] <= iz_jz))
+              continue;
+            if ((iy_jy < 0) || (image_size[1] <= iy_jy))
+              continue;
+            if ((ix_jx < 0) || (image_size[0] <= ix_jx))
+              continue;
+            if (aaafMask && (aaafMask[iz_jz][iy_jy][ix_jx] == 0.0))
+              continue;
+            if (aaaiDest[iz_jz][iy_jy][ix_jx] != ACCEPTED)
+              continue;
+            if (! _ClusterNeighborsCompatible(ix, iy, iz,
+                                              ix_jx, iy_jy, iz_jz,
+                                              aaaafVector,
+                                              threshold_vector_neighbor,
+                                              consider_dot_product_sign,
+                                              aaaafSymmetricTensor,
+                                              threshold_tensor_neighbor))
+              continue;
+            Scalar score = std::max(aaafSaliency[iz][iy][ix] * SIGN_FACTOR,
+                                    aaafSaliency[iz_jz][iy_jy][ix_jx] *
+                                    SIGN_FACTOR);
+            vCrossings.push_back(make_tuple(score,
+                                            ix + nx*(iy + ny*iz),
+                                            ix_jx + nx*(iy_jy + ny*iz_jz)));
+          }
+        }
+      }
+    }
+  }
+
+  if (use_polarity)
+    sort(vCrossings.begin(), vCrossings.end());
+
+  for (auto p = vCrossings.begin(); p != vCrossings.end(); p++) {
+    uint64_t i_index = get<1>(*p);
+    uint64_t j_index = get<2>(*p);
+    bool parity = false;
+    if (use_polarity) {
+      int ix = i_index % nx;
+      int iy = (i_index / nx) % ny;
+      int iz = i_index / (nx * ny);
+      int jx = j_index % nx;
+      int jy = (j_index / nx) % ny;
+      int jz = j_index / (nx * ny);
+      parity = (DotProduct3(aaaafVector[iz][iy][ix],
+                            aaaafVector[jz][jy][jx]) < 0.0);
+    }
+    if ((! uf.Link(j_index, i_index, parity)) &&
+        (vCutScore[num_blocks] == std::numeric_limits<Scalar>::infinity())) {
+      vCutScore[num_blocks] = get<0>(*p);
+      vCutIndex[num_blocks] = i_index;
+    }
+  }
+  vCrossings.clear();
+
+  // Which voxel (that we cut) had the highest saliency (*SIGN_FACTOR)?
+  for (int b = 0; b <= num_blocks; b++) {
+    if (vCutScore[b] == std::numeric_limits<Scalar>::infinity())
+      continue;
+    if ((! voxels_discarded_due_to_polarity) ||
+        (vCutScore[b] < voxel_discarded_due_to_polarity_saliency*SIGN_FACTOR)) {
+      voxels_discarded_due_to_polarity = true;
+      voxel_discarded_due_to_polarity_saliency = vCutScore[b] * SIGN_FACTOR;
+      voxel_discarded_due_to_polarity[0] = vCutIndex[b] % nx;
+      voxel_discarded_due_to_polarity[1] = (vCutIndex[b] / nx) % ny;
+      voxel_discarded_due_to_polarity[2] = vCutIndex[b] / (nx * ny);
+    }
+  }
+
+  // Each cluster is labelled by the first basin (local maxima or minima)
+  // which belongs to it.  (Clusters without any basins will be discarded.)
+  unordered_map<uint64_t, ptrdiff_t> root2basin;
+  for (size_t i=0; i < extrema_locations.size(); i++) {
+    int ix = extrema_locations[i][0];
+    int iy = extrema_locations[i][1];
+    int iz = extrema_locations[i][2];
+    if (aaaiDest[iz][iy][ix] != ACCEPTED) {
+      // (If the voxel at this local minima or maxima was discarded, then
+      //  this entire basin should be deleted from consideration.)
+      basin2cluster[i] = -1;
+      continue;
+    }
+    uint64_t root = uf.Find(ix + nx*(iy + ny*iz));
+    auto p = root2basin.find(root);
+    if (p == root2basin.end()) {
+      root2basin[root] = i;
+      basin2cluster[i] = i;
+    }
+    else
+      basin2cluster[i] = p->second;
+  }
+
+  // Assign each voxel to the basin that labels its cluster.
+  #pragma omp parallel for collapse(2)
+  for (int iz=0; iz<image_size[2]; iz++) {
+    for (int iy=0; iy<image_size[1]; iy++) {
+      for (int ix=0; ix<image_size[0]; ix++) {
+        if (aaafMask && aaafMask[iz][iy][ix] == 0.0)
+          continue;
+        if (aaaiDest[iz][iy][ix] != ACCEPTED) {
+          aaaiDest[iz][iy][ix] = UNDEFINED;
+          continue;
+        }
+        bool parity;
+        uint64_t root = uf.FindReadOnly(ix + nx*(iy + ny*iz), &parity);
+        auto p = root2basin.find(root);
+        if (p == root2basin.end()) {
+          aaaiDest[iz][iy][ix] = UNDEFINED;
+          continue;
+        }
+        aaaiDest[iz][iy][ix] = p->second;
+        if (use_polarity && parity)
+          for (int d = 0; d < 3; d++)
+            aaaafVectorStandardized[iz][iy][ix][d] *= -1.0;
+      }
+    }
+  }
+} //_ClusterConnectedUnionFind()
+
+
+
 /// @brief  WARNING: EXPERIMENTAL CODE.
 ///        THIS FUNCTION'S ARGUMENT LIST MAY CHANGE SIGNIFICANTLY IN THE FUTURE.
 ///         This function is used to cluster voxels of high saliency
@@ -117,6 +746,13 @@ typedef enum eClusterSortCriteria {
 ///         closed loops loops that have directions which cannot be chosen
 ///         consistently, they will be cut at a location where their saliency
 ///         is weak.  (The goal is to avoid Möbius-strip-like defects.)
+/// @note   If algorithm == CLUSTER_BY_UNION_FIND, then the clusters are
+///         computed using a union-find data structure, processing num_blocks
+///         slabs of the image in parallel.  This requires an additional
+///         8 bytes of memory per voxel.  The clusters are identical to the
+///         clusters produced by CLUSTER_BY_FLOODING (the default), unless
+///         some of them contain loops which are not consistently orientable
+///         (see above).  In that case the locations of the cuts can differ.
 
 template<typename Scalar, typename Label, typename Coordinate, typename VectorContainer=Scalar*, typename TensorContainer=Scalar*>
 
@@ -147,6 +783,8 @@ ClusterConnected(int const image_size[3],                   //!< #voxels in xyz
                  #endif
                  const vector<vector<array<Coordinate, 3> > > *pMustLinkConstraints=nullptr,  //!< Optional: a list of sets of voxel locations.  This insures that voxels in each set will belong to the same cluster.
                  bool start_from_saliency_maxima=true,             //!< start from local maxima? (if false, minima will be used)  WARNING: As of 2019-2-28, this function has not yet been tested with the non-default value (false)
+                 ClusterAlgorithm algorithm = ClusterAlgorithm::CLUSTER_BY_FLOODING, //!< which algorithm should we use?
+                 int num_blocks = 1,                      //!< number of slabs to process in parallel (if algorithm==CLUSTER_BY_UNION_FIND)
                  ostream *pReportProgress=nullptr)  //!< print progress to the user?
 {
   selfadjoint_eigen3::EigenOrderType eival_order;
@@ -252,20 +890,6 @@ ClusterConnected(int const image_size[3],                   //!< #voxels in xyz
     }
   }
 
-  // Define "q", the set of voxels which are adjacent to the voxels we have
-  // processed so far.  These are the voxels to be processed in the next
-  // iteration.  This is implemented as a priority-queue, sorted by intensity.
-  // Each voxel in "q" has an intensity, a basin-ID (Label), and a location.
-
-  priority_queue<tuple
-                  <
-                   Scalar,    // the "height" of that voxel (brightness)
-                   ptrdiff_t,     // the basin-ID to which the voxel belongs
-                   array<Coordinate, 3>  // location of the voxel
-                  >
-                > q;
-
-
   if (pReportProgress)
     *pReportProgress <<
       "-- Clustering voxels belonging to different objects --\n"
@@ -273,48 +897,6 @@ ClusterConnected(int const image_size[3],                   //!< #voxels in xyz
                      << (start_from_saliency_maxima ? "maxima" : "minima")
                      << endl;
 
-  // Initialize the queue with the voxels at these minima locations
-
-  for (size_t i=0; i < extrema_locations.size(); i++) {
-    // Create an entry in q for each of the local minima
-
-    // Assign a different integer to each of these minima, starting at 1
-    ptrdiff_t which_basin = i;
-
-    int ix = extrema_locations[i][0];
-    int iy = extrema_locations[i][1];
-    int iz = extrema_locations[i][2];
-
-    // These entries in the priority queue will be sorted by "score"
-    // which is the intensity of the image at this voxel location.
-    Scalar score = extrema_scores[i];
-    assert(score == aaafSaliency[iz][iy][ix]);
-    score *= SIGN_FACTOR; //(enable search for either local minima OR maxima)
-
-    // Note:FindExtrema() should avoid minima above threshold_saliency,
-    //     or maxima below threshold_saliency. We check for that with an assert:
-    assert(score <= threshold_saliency * SIGN_FACTOR);
-
-    // copy the ix,iy,iz coordinates into an array<Coordinate, 3>
-    array<Coordinate, 3> icrds;
-    // (It seems like there should be a way to do this in 1 line, but I'm
-    //  unfamiliar with the new C++ array initializer syntax and I'm on a plane 
-    //  without internet at the moment.  So I'll just do it the obvious way.)
-    icrds[0] = ix;
-    icrds[1] = iy;
-    icrds[2] = iz;
-
-    q.push(make_tuple(-score, // <-- entries sorted lexicographically by -score
-                      which_basin,
-                      icrds));
-
-
-    assert(aaaiDest[iz][iy][ix] == UNDEFINED);
-    aaaiDest[iz][iy][ix] = QUEUED;
-
-  } // for (size_t i=0; i < extrema_locations.size(); i++)
-
-
   // Each cluster contains one or more "basins"
   // A "basin" is a group of connected voxels which are all part of the
   // same local minima (or maxima).
@@ -325,31 +907,9 @@ ClusterConnected(int const image_size[3],                   //!< #voxels in xyz
     basin2cluster[i] = i;
 
   // Inverse lookup table
-  vector<set<ptrdiff_t> > cluster2basins(extrema_locations.size());
-  for (size_t i=0; i < basin2cluster.size(); i++) {
-    cluster2basins[i] = set<ptrdiff_t>();
-    cluster2basins[i].insert(i);
-  }
-
+  // (Each cluster stores a list of the basins it contains.)
+  vector<vector<ptrdiff_t> > cluster2basins(extrema_locations.size());
 
-  // Count the number of voxels in the image we will need to consider.
-  // (This will be used for printing out progress estimates later.)
-  size_t n_voxels_processed = 0;
-  //size_t n_voxels_image = image_size[0] * image_size[1] * image_size[2];
-  size_t n_voxels_image = 0;
-  for (int iz=0; iz<image_size[2]; iz++) {
-    for (int iy=0; iy<image_size[1]; iy++) {
-      for (int ix=0; ix<image_size[0]; ix++) {
-        if (aaafMask && aaafMask[iz][iy][ix] == 0.0)
-          continue;
-        if (SIGN_FACTOR * aaafSaliency[iz][iy][ix]
-            >
-            SIGN_FACTOR * threshold_saliency)
-          continue;
-        n_voxels_image++;
-      }
-    }
-  }
 
   #ifndef DISABLE_STANDARDIZE_VECTOR_DIRECTION
   // initialize aaaafVectorStandardized[][][]
@@ -369,148 +929,191 @@ ClusterConnected(int const image_size[3],                   //!< #voxels in xyz
   int voxel_discarded_due_to_polarity_iy = -1; // an impossible value
   int voxel_discarded_due_to_polarity_iz = -1; // an impossible value
   #endif // #ifndef DISABLE_STANDARDIZE_VECTOR_DIRECTION
- 
-  // Loop over all the voxels on the periphery
-  // of the voxels with lower intensity (brightness).
-  // This is a priority-queue of voxels which lie adjacent to 
-  // the voxels which have been already considered.
-  // As we consider new voxels, add their neighbors to this queue as well
-  // until we process all voxels in the image.
-
-  //#ifndef NDEBUG
-  //set<array<Coordinate, 3> > visited;
-  //#endif
-
-  while (! q.empty())
+
+
+  if (algorithm == CLUSTER_BY_UNION_FIND)
+  {
+    #ifndef DISABLE_STANDARDIZE_VECTOR_DIRECTION
+    VectorContainer ***aaaafVectorFlipped = aaaafVectorStandardized;
+    #else
+    VectorContainer ***aaaafVectorFlipped = nullptr;
+    bool voxels_discarded_due_to_polarity = false;
+    Scalar voxel_discarded_due_to_polarity_saliency = -1.0;
+    #endif
+    array<int, 3> voxel_discarded_due_to_polarity = {-1, -1, -1};
+
+    _ClusterConnectedUnionFind(image_size,
+                               aaafSaliency,
+                               aaaiDest,
+                               aaafMask,
+                               threshold_saliency,
+                               aaaafVector,
+                               threshold_vector_saliency,
+                               threshold_vector_neighbor,
+                               consider_dot_product_sign,
+                               aaaafSymmetricTensor,
+                               threshold_tensor_saliency,
+                               threshold_tensor_neighbor,
+                               tensor_is_positive_definite_near_ridge,
+                               start_from_saliency_maxima,
+                               eival_order,
+                               neighbors,
+                               num_neighbors,
+                               extrema_locations,
+                               num_blocks,
+                               UNDEFINED,
+                               QUEUED,
+                               basin2cluster,
+                               aaaafVectorFlipped,
+                               voxels_discarded_due_to_polarity,
+                               voxel_discarded_due_to_polarity,
+                               voxel_discarded_due_to_polarity_saliency,
+                               pReportProgress);
+
+    #ifndef DISABLE_STANDARDIZE_VECTOR_DIRECTION
+    voxel_discarded_due_to_polarity_ix = voxel_discarded_due_to_polarity[0];
+    voxel_discarded_due_to_polarity_iy = voxel_discarded_due_to_polarity[1];
+    voxel_discarded_due_to_polarity_iz = voxel_discarded_due_to_polarity[2];
+    #endif
+    for (size_t i=0; i < basin2cluster.size(); i++)
+      if (basin2cluster[i] >= 0)
+        cluster2basins[basin2cluster[i]].push_back(i);
+  } // if (algorithm == CLUSTER_BY_UNION_FIND)
+  else // if (algorithm == CLUSTER_BY_FLOODING)
   {
-    tuple<Scalar, ptrdiff_t, array<Coordinate, 3> > p = q.top();
-    q.pop();
 
-    // Figure out the properties of that voxel (position, intensity/score,basin)
-    Scalar i_score = -std::get<0>(p); //abs(i_score) = voxel intensity = aaafSaliency[iz][iy][ix]
-    Scalar i_which_basin = std::get<1>(p); // the basin to which that voxel belongs (tentatively)
-    int ix = std::get<2>(p)[0]; // voxel location
-    int iy = std::get<2>(p)[1]; //   "      "
-    int iz = std::get<2>(p)[2]; //   "      "
+    // Define "q", the set of voxels which are adjacent to the voxels we have
+    // processed so far.  These are the voxels to be processed in the next
+    // iteration.  This is implemented as a priority-queue, sorted by intensity.
+    // Each voxel in "q" has an intensity, a basin-ID (Label), and a location.
 
-    // Should we ignore this voxel?
+    priority_queue<tuple
+                    <
+                     Scalar,    // the "height" of that voxel (brightness)
+                     ptrdiff_t,     // the basin-ID to which the voxel belongs
+                     array<Coordinate, 3>  // location of the voxel
+                    >
+                  > q;
 
-    if (i_score > threshold_saliency * SIGN_FACTOR) {
-      // stop when the voxel brightness(*SIGN_FACTOR) exceeds the threshold_saliency
-      aaaiDest[iz][iy][ix] = UNDEFINED;
-      continue;
-    }
 
-    if (aaafMask && aaafMask[iz][iy][ix] == 0.0) {
-      // ignore voxel if the user specified a mask and the voxel does not belong
-      aaaiDest[iz][iy][ix] = UNDEFINED;
-      continue;
-    }
+    // Initialize the queue with the voxels at these minima locations
 
+    for (size_t i=0; i < extrema_locations.size(); i++) {
+      // Create an entry in q for each of the local minima
 
-    { // Use inconsistencies in aaafSaliency to discard voxel ix,iy,iz?
-      
-      // -----------------------------------------------
-      // First, condsider discarding voxel ix,iy,iz due to
-      // inconsistencies between aaafSaliency and aaaafSymTensor here
-      // -----------------------------------------------
-
-      Scalar saliency_hessian3x3[3][3];
-
-      CalcHessianFiniteDifferences(aaafSaliency, //!< source image
-                                   ix, iy, iz,
-                                   saliency_hessian3x3,
-                                   image_size);
-
-      // Confusing sign compatibility issue:
-      // We assume that the tensor passed
-      // by the caller will be positive-definite near a ridge.
-      // In other words, it's largest eigenvalue will be positive there,
-      // and its corresponding eigenvector is assumed to point in a direction
-      // where the 2nd-derivative is largest.
-      // In that case we must invert the sign of the hessian matrix before we
-      // compare it with the tensor, because we also assume the saliency is
-      // bright on a dark background.  Hence it's second derivative (ie. its 
-      // Hessian) along that direction will be negative instead of positive
-      // at that location.  Hence if both of these assumptions are true, 
-      // we must multiply the entries in saliency_hessian by -1 before 
-      // comparing them with the tensor.
-
-      if (tensor_is_positive_definite_near_ridge ==
-          start_from_saliency_maxima) {
-        for (int di = 0; di < 3; di++)
-          for (int dj = di; dj < 3; dj++)
-            saliency_hessian3x3[di][dj] *= -1.0;
-      }
+      // Assign a different integer to each of these minima, starting at 1
+      ptrdiff_t which_basin = i;
 
-      // To reduce memory consumption,
-      // save the resulting 3x3 matrix in a smaller 1-D array (with 6 entries)
-      // whose index is given by MapIndices_3x3_to_linear[][]
+      int ix = extrema_locations[i][0];
+      int iy = extrema_locations[i][1];
+      int iz = extrema_locations[i][2];
 
-      Scalar saliency_hessian[6];
+      // These entries in the priority queue will be sorted by "score"
+      // which is the intensity of the image at this voxel location.
+      Scalar score = extrema_scores[i];
+      assert(score == aaafSaliency[iz][iy][ix]);
+      score *= SIGN_FACTOR; //(enable search for either local minima OR maxima)
 
-      for (int di = 0; di < 3; di++)
-        for (int dj = di; dj < 3; dj++)
-          saliency_hessian[ MapIndices_3x3_to_linear[di][dj] ]
-            = saliency_hessian3x3[di][dj];
+      // Note:FindExtrema() should avoid minima above threshold_saliency,
+      //     or maxima below threshold_saliency. We check for that with an assert:
+      assert(score <= threshold_saliency * SIGN_FACTOR);
 
-      bool discard_this_voxel = false;
+      // copy the ix,iy,iz coordinates into an array<Coordinate, 3>
+      array<Coordinate, 3> icrds;
+      // (It seems like there should be a way to do this in 1 line, but I'm
+      //  unfamiliar with the new C++ array initializer syntax and I'm on a plane 
+      //  without internet at the moment.  So I'll just do it the obvious way.)
+      icrds[0] = ix;
+      icrds[1] = iy;
+      icrds[2] = iz;
 
-      if (aaaafSymmetricTensor) {
+      q.push(make_tuple(-score, // <-- entries sorted lexicographically by -score
+                        which_basin,
+                        icrds));
 
-        Scalar tp = TraceProductSym3(saliency_hessian, 
-                                     aaaafSymmetricTensor[iz][iy][ix]);
-        Scalar fs = FrobeniusNormSym3(saliency_hessian);
-        Scalar ft = FrobeniusNormSym3(aaaafSymmetricTensor[iz][iy][ix]);
 
-        if (tp < threshold_tensor_saliency * fs * ft) {
-          discard_this_voxel = true;
+      assert(aaaiDest[iz][iy][ix] == UNDEFINED);
+      aaaiDest[iz][iy][ix] = QUEUED;
+
+    } // for (size_t i=0; i < extrema_locations.size(); i++)
+
+
+    // Initially, each basin is it's own cluster.
+    for (size_t i=0; i < basin2cluster.size(); i++)
+      if (basin2cluster[i] >= 0)
+        cluster2basins[basin2cluster[i]].push_back(i);
+
+
+    // Count the number of voxels in the image we will need to consider.
+    // (This will be used for printing out progress estimates later.)
+    size_t n_voxels_processed = 0;
+    //size_t n_voxels_image = image_size[0] * image_size[1] * image_size[2];
+    size_t n_voxels_image = 0;
+    for (int iz=0; iz<image_size[2]; iz++) {
+      for (int iy=0; iy<image_size[1]; iy++) {
+        for (int ix=0; ix<image_size[0]; ix++) {
+          if (aaafMask && aaafMask[iz][iy][ix] == 0.0)
+            continue;
+          if (SIGN_FACTOR * aaafSaliency[iz][iy][ix]
+              >
+              SIGN_FACTOR * threshold_saliency)
+            continue;
+          n_voxels_image++;
         }
       }
+    }
 
-      // -----------------------------------------------
-      // Then, condsider discarding voxel ix,iy,iz due to
-      // inconsistencies between aaafSaliency and aaaafVector at this location
-      // -----------------------------------------------
-
-      Scalar s_eivals[3];
-      Scalar s_eivects[3][3];
-
-      // the eigenvector of the saliency_hessian that we care about is the
-      // one with the largest eigenvalue (which is assumed to be positive).
-
-      ConvertFlatSym2Evects3(saliency_hessian,
-                             s_eivals,
-                             s_eivects,
-                             eival_order);
-
-      if (aaaafVector) {
-        bool vect_threshold_exceeded = false;
-
-        if (consider_dot_product_sign) {
-          if (DotProduct3(s_eivects[0], //principal (first) eivenvector
-                          aaaafVector[iz][iy][ix])
-              <
-              (threshold_vector_saliency *
-               Length3(s_eivects[0]) *
-               Length3(aaaafVector[iz][iy][ix])))
-            vect_threshold_exceeded = true;
-        }
-        else {
-          if (SQR(DotProduct3(s_eivects[0], //principal (first) eivenvector
-                              aaaafVector[iz][iy][ix]))
-              <
-              (SQR(threshold_vector_saliency) *
-               SquaredNorm3(s_eivects[0]) *
-               SquaredNorm3(aaaafVector[iz][iy][ix])))
-            vect_threshold_exceeded = true;
-        }
-        if (vect_threshold_exceeded) {
-          discard_this_voxel = true;
-        }
+    // Loop over all the voxels on the periphery
+    // of the voxels with lower intensity (brightness).
+    // This is a priority-queue of voxels which lie adjacent to 
+    // the voxels which have been already considered.
+    // As we consider new voxels, add their neighbors to this queue as well
+    // until we process all voxels in the image.
+
+    //#ifndef NDEBUG
+    //set<array<Coordinate, 3> > visited;
+    //#endif
+
+    while (! q.empty())
+    {
+      tuple<Scalar, ptrdiff_t, array<Coordinate, 3> > p = q.top();
+      q.pop();
+
+      // Figure out the properties of that voxel (position, intensity/score,basin)
+      Scalar i_score = -std::get<0>(p); //abs(i_score) = voxel intensity = aaafSaliency[iz][iy][ix]
+      Scalar i_which_basin = std::get<1>(p); // the basin to which that voxel belongs (tentatively)
+      int ix = std::get<2>(p)[0]; // voxel location
+      int iy = std::get<2>(p)[1]; //   "      "
+      int iz = std::get<2>(p)[2]; //   "      "
+
+      // Should we ignore this voxel?
+
+      if (i_score > threshold_saliency * SIGN_FACTOR) {
+        // stop when the voxel brightness(*SIGN_FACTOR) exceeds the threshold_saliency
+        aaaiDest[iz][iy][ix] = UNDEFINED;
+        continue;
       }
 
-      if (discard_this_voxel) {
+      if (aaafMask && aaafMask[iz][iy][ix] == 0.0) {
+        // ignore voxel if the user specified a mask and the voxel does not belong
+        aaaiDest[iz][iy][ix] = UNDEFINED;
+        continue;
+      }
+
+
+      // Use inconsistencies in aaafSaliency to discard voxel ix,iy,iz?
+      if (_ClusterDiscardVoxel(ix, iy, iz,
+                               image_size,
+                               aaafSaliency,
+                               aaaafVector,
+                               threshold_vector_saliency,
+                               consider_dot_product_sign,
+                               aaaafSymmetricTensor,
+                               threshold_tensor_saliency,
+                               tensor_is_positive_definite_near_ridge,
+                               start_from_saliency_maxima,
+                               eival_order))
+      {
         aaaiDest[iz][iy][ix] = UNDEFINED;
         // Are we deleting a voxel which is also a basin local minima/maxima?
         if ((ix == extrema_locations[i_which_basin][0]) &&
@@ -522,244 +1125,203 @@ ClusterConnected(int const image_size[3],                   //!< #voxels in xyz
         continue;
       }
 
-    } // Use inconsistencies in aaafSaliency to discard voxel ix,iy,iz?
 
+      assert(aaaiDest[iz][iy][ix] == QUEUED);
+      // Now we assign this voxel to the basin
+      aaaiDest[iz][iy][ix] = i_which_basin;
+      // (Note: This will prevent the voxel from being visited again.)
 
-    assert(aaaiDest[iz][iy][ix] == QUEUED);
-    // Now we assign this voxel to the basin
-    aaaiDest[iz][iy][ix] = i_which_basin;
-    // (Note: This will prevent the voxel from being visited again.)
 
+      if (pReportProgress) {
+        // Every time the amount of progress increases by 1%, inform the user:
+        n_voxels_processed++;
+        size_t percentage = (n_voxels_processed*100) / n_voxels_image;
+        size_t percentage_previous = ((n_voxels_processed-1)*100)/n_voxels_image;
+        if (percentage != percentage_previous)
+          *pReportProgress << " percent complete: " << percentage << endl;
+      }
 
-    if (pReportProgress) {
-      // Every time the amount of progress increases by 1%, inform the user:
-      n_voxels_processed++;
-      size_t percentage = (n_voxels_processed*100) / n_voxels_image;
-      size_t percentage_previous = ((n_voxels_processed-1)*100)/n_voxels_image;
-      if (percentage != percentage_previous)
-        *pReportProgress << " percent complete: " << percentage << endl;
-    }
 
+      //#ifndef NDEBUG
+      //array<Coordinate, 3> ixiyiz;
+      //ixiyiz[0] = ix;
+      //ixiyiz[1] = iy;
+      //ixiyiz[2] = iz;
+      //assert(visited.find(ixiyiz) == visited.end());
+      //visited.insert(ixiyiz);
+      //#endif //#ifndef NDEBUG
+
+
+      // ---------- Meyer (and Beucher's?) inter-pixel flood algorith: ---------
+      // Check the voxels that surround voxel (ix,iy,iz)
+
+      // ---- loop over neighbors ----
+      // Let (jx,jy,jz) denote the index offset for the neighbor voxels
+      // (located at ix+jx,iy+jy,iz+jz)
+      for (int j = 0; j < num_neighbors; j++) {
+        int jx = neighbors[j][0];
+        int jy = neighbors[j][1];
+        int jz = neighbors[j][2];
+        int iz_jz = iz + jz;
+        int iy_jy = iy + jy;
+        int ix_jx = ix + jx;
+        if ((iz_jz < 0) || (image_size[2] <= iz_jz))
+          continue;
+        if ((iy_jy < 0) || (image_size[1] <= iy_jy))
+          continue;
+        if ((ix_jx < 0) || (image_size[0] <= ix_jx))
+          continue;
 
-    //#ifndef NDEBUG
-    //array<Coordinate, 3> ixiyiz;
-    //ixiyiz[0] = ix;
-    //ixiyiz[1] = iy;
-    //ixiyiz[2] = iz;
-    //assert(visited.find(ixiyiz) == visited.end());
-    //visited.insert(ixiyiz);
-    //#endif //#ifndef NDEBUG
-
-
-    // ---------- Meyer (and Beucher's?) inter-pixel flood algorith: ---------
-    // Check the voxels that surround voxel (ix,iy,iz)
-
-    // ---- loop over neighbors ----
-    // Let (jx,jy,jz) denote the index offset for the neighbor voxels
-    // (located at ix+jx,iy+jy,iz+jz)
-    for (int j = 0; j < num_neighbors; j++) {
-      int jx = neighbors[j][0];
-      int jy = neighbors[j][1];
-      int jz = neighbors[j][2];
-      int iz_jz = iz + jz;
-      int iy_jy = iy + jy;
-      int ix_jx = ix + jx;
-      if ((iz_jz < 0) || (image_size[2] <= iz_jz))
-        continue;
-      if ((iy_jy < 0) || (image_size[1] <= iy_jy))
-        continue;
-      if ((ix_jx < 0) || (image_size[0] <= ix_jx))
-        continue;
+        if (aaafMask && (aaafMask[iz_jz][iy_jy][ix_jx] == 0.0))
+          continue;
 
-      if (aaafMask && (aaafMask[iz_jz][iy_jy][ix_jx] == 0.0))
-        continue;
 
+        // Difference between voxel ix,iy,iz and ix_jx,iy_jy,iz_jz too large?
+        if (! _ClusterNeighborsCompatible(ix, iy, iz,
+                                          ix_jx, iy_jy, iz_jz,
+                                          aaaafVector,
+                                          threshold_vector_neighbor,
+                                          consider_dot_product_sign,
+                                          aaaafSymmetricTensor,
+                                          threshold_tensor_neighbor))
+          continue;
 
-      { // Difference between voxel ix,iy,iz and ix_jx,iy_jy,iz_jz too large?
-
-        // -----------------------------------------------
-        // Then, condsider discarding voxel ix_jx,iy_jy,iz_jz due to
-        // inconsistencies between aaaafVector[iz][iy][ix]
-        //                     and aaaafVector[iz_jz][iy_jy][ix_jx]
-        // -----------------------------------------------
-        if (aaaafSymmetricTensor) {
-          if (TraceProductSym3(aaaafSymmetricTensor[iz][iy][ix],
-                               aaaafSymmetricTensor[iz_jz][iy_jy][ix_jx])
-              <
-              (threshold_tensor_neighbor *
-               FrobeniusNormSym3(aaaafSymmetricTensor[iz][iy][ix]) *
-               FrobeniusNormSym3(aaaafSymmetricTensor[iz_jz][iy_jy][ix_jx])))
-          {
-            continue;
-          }
-        }
 
-        // -----------------------------------------------
-        // Then, condsider discarding voxel ix_jx,iy_jy,iz_jz due to
-        // inconsistencies between aaaafSymTensor[iz][iy][ix]
-        //                     and aaaafSymTensor[iz_jz][iy_jy][ix_jx]
-        // -----------------------------------------------
-        if (aaaafSymmetricTensor) {
-          if (consider_dot_product_sign) {
-            if (DotProduct3(aaaafVector[iz][iy][ix],
-                            aaaafVector[iz_jz][iy_jy][ix_jx])
-                <
-                (threshold_tensor_neighbor *
-                 Length3(aaaafVector[iz][iy][ix])*
-                 Length3(aaaafVector[iz_jz][iy_jy][ix_jx])))
-            {
-              continue;
-            }
-          }
-          else {
-            if (SQR(DotProduct3(aaaafVector[iz][iy][ix],
-                                aaaafVector[iz_jz][iy_jy][ix_jx]))
-                <
-                (SQR(threshold_vector_neighbor) *
-                 SquaredNorm3(aaaafVector[iz][iy][ix])*
-                 SquaredNorm3(aaaafVector[iz_jz][iy_jy][ix_jx])))
-            {
-              continue;
-            }
-          }
+        if (aaaiDest[iz_jz][iy_jy][ix_jx] == QUEUED) {
+          continue;
         }
-      } // Difference between voxel ix,iy,iz and ix_jx,iy_jy,iz_jz too large?
-
-
-      if (aaaiDest[iz_jz][iy_jy][ix_jx] == QUEUED) {
-        continue;
-      }
-      else if (aaaiDest[iz_jz][iy_jy][ix_jx] == UNDEFINED)
-      {
+        else if (aaaiDest[iz_jz][iy_jy][ix_jx] == UNDEFINED)
+        {
 
-        aaaiDest[iz_jz][iy_jy][ix_jx] = QUEUED;
+          aaaiDest[iz_jz][iy_jy][ix_jx] = QUEUED;
 
-        // and push this neighboring voxels onto the queue.
-        // (...if they have not been assigned to a basin yet.  This
-        //  insures that the same voxel is never pushed more than once.)
-        array<Coordinate, 3> neighbor_crds;
-        neighbor_crds[0] = ix_jx;
-        neighbor_crds[1] = iy_jy;
-        neighbor_crds[2] = iz_jz;
-        Scalar neighbor_score = aaafSaliency[iz_jz][iy_jy][ix_jx]*SIGN_FACTOR;
-        q.push(make_tuple(-neighbor_score,
-                          i_which_basin,
-                          neighbor_crds));
+          // and push this neighboring voxels onto the queue.
+          // (...if they have not been assigned to a basin yet.  This
+          //  insures that the same voxel is never pushed more than once.)
+          array<Coordinate, 3> neighbor_crds;
+          neighbor_crds[0] = ix_jx;
+          neighbor_crds[1] = iy_jy;
+          neighbor_crds[2] = iz_jz;
+          Scalar neighbor_score = aaafSaliency[iz_jz][iy_jy][ix_jx]*SIGN_FACTOR;
+          q.push(make_tuple(-neighbor_score,
+                            i_which_basin,
+                            neighbor_crds));
 
 
-        #ifndef DISABLE_STANDARDIZE_VECTOR_DIRECTION
-        if (aaaafVector && aaaafVectorStandardized &&
-            (! consider_dot_product_sign))
-        {
-          if (DotProduct3(aaaafVectorStandardized[iz][iy][ix],
-                          aaaafVectorStandardized[iz_jz][iy_jy][ix_jx])
-              <
-              0.0)
+          #ifndef DISABLE_STANDARDIZE_VECTOR_DIRECTION
+          if (aaaafVector && aaaafVectorStandardized &&
+              (! consider_dot_product_sign))
           {
-            // Voxels added as the basin is growing should always have
-            // directions which are compatible with each other.
-            // (IE the dot product between them should not be negative.)
-            // (Why?  See "Discussion" below)
-            // If this is not the case, then invert the sign of the newcommers.
-            // (Note: The voxels within different basins are made compatible
-            //        by flipping the sign of their entry in "basin2polarity[]")
-            aaaafVectorStandardized[iz_jz][iy_jy][ix_jx][0] *= -1.0;
-            aaaafVectorStandardized[iz_jz][iy_jy][ix_jx][1] *= -1.0;
-            aaaafVectorStandardized[iz_jz][iy_jy][ix_jx][2] *= -1.0;
-            // Discussion:
-            // It is possible to assume this because the topology of the
-            // basins that we are growing at this point cannot have loops.
-            // This is because each neighboring voxel we add in this step
-            // is of type UNDEFINED.  Later we may encounter loops when we
-            // run into neighboring voxels which have already beem processed.
-            // We will worry about Möbius loops then.
-          }
-        } // if (aaaafVectorStandardized && (! consider_dot_product_sign))
-        #endif
-
+            if (DotProduct3(aaaafVectorStandardized[iz][iy][ix],
+                            aaaafVectorStandardized[iz_jz][iy_jy][ix_jx])
+                <
+                0.0)
+            {
+              // Voxels added as the basin is growing should always have
+              // directions which are compatible with each other.
+              // (IE the dot product between them should not be negative.)
+              // (Why?  See "Discussion" below)
+              // If this is not the case, then invert the sign of the newcommers.
+              // (Note: The voxels within different basins are made compatible
+              //        by flipping the sign of their entry in "basin2polarity[]")
+              aaaafVectorStandardized[iz_jz][iy_jy][ix_jx][0] *= -1.0;
+              aaaafVectorStandardized[iz_jz][iy_jy][ix_jx][1] *= -1.0;
+              aaaafVectorStandardized[iz_jz][iy_jy][ix_jx][2] *= -1.0;
+              // Discussion:
+              // It is possible to assume this because the topology of the
+              // basins that we are growing at this point cannot have loops.
+              // This is because each neighboring voxel we add in this step
+              // is of type UNDEFINED.  Later we may encounter loops when we
+              // run into neighboring voxels which have already beem processed.
+              // We will worry about Möbius loops then.
+            }
+          } // if (aaaafVectorStandardized && (! consider_dot_product_sign))
+          #endif
 
-      } // else if (aaaiDest[iz_jz][iy_jy][ix_jx] == UNDEFINED)
-      else {
 
-        assert(aaaiDest[iz][iy][ix] == i_which_basin);
+        } // else if (aaaiDest[iz_jz][iy_jy][ix_jx] == UNDEFINED)
+        else {
 
-        ptrdiff_t basin_i = aaaiDest[iz][iy][ix];
-        ptrdiff_t basin_j = aaaiDest[iz_jz][iy_jy][ix_jx];
+          assert(aaaiDest[iz][iy][ix] == i_which_basin);
 
-        ptrdiff_t cluster_i = basin2cluster[basin_i];
-        ptrdiff_t cluster_j = basin2cluster[basin_j];
+          ptrdiff_t basin_i = aaaiDest[iz][iy][ix];
+          ptrdiff_t basin_j = aaaiDest[iz_jz][iy_jy][ix_jx];
 
-        #ifndef DISABLE_STANDARDIZE_VECTOR_DIRECTION
-        bool polarity_match = true;
-        if (aaaafVectorStandardized && (! consider_dot_product_sign))
-        {
-          if (DotProduct3(aaaafVectorStandardized[iz][iy][ix],
-                          aaaafVectorStandardized[iz_jz][iy_jy][ix_jx])
-              *
-              basin2polarity[basin_i]
-              *
-              basin2polarity[basin_j]
-              <
-              0.0)
-            polarity_match = false;
-        }
-        #endif
+          ptrdiff_t cluster_i = basin2cluster[basin_i];
+          ptrdiff_t cluster_j = basin2cluster[basin_j];
 
-        if (cluster_i == cluster_j) {
           #ifndef DISABLE_STANDARDIZE_VECTOR_DIRECTION
-          if (! polarity_match) {
-            voxels_discarded_due_to_polarity = true;
-            voxel_discarded_due_to_polarity_ix = ix_jx;
-            voxel_discarded_due_to_polarity_iy = iy_jy;
-            voxel_discarded_due_to_polarity_iz = iz_jz;
-            voxel_discarded_due_to_polarity_saliency = aaafSaliency[iz_jz][iy_jy][ix_jx];
-
-            // In that case throw away this voxel.
-            // Hopefully this will prevent linking of voxels containing
-            // vector directors which cannot be reconciled.  Example:
-            // This should prevent surfaces which resemble a Möbius strip
-            // from forming a complete closed loop.  Hopefully it will
-            // cut the loop at the voxels with the most tenuous connections.
-            continue;
+          bool polarity_match = true;
+          if (aaaafVectorStandardized && (! consider_dot_product_sign))
+          {
+            if (DotProduct3(aaaafVectorStandardized[iz][iy][ix],
+                            aaaafVectorStandardized[iz_jz][iy_jy][ix_jx])
+                *
+                basin2polarity[basin_i]
+                *
+                basin2polarity[basin_j]
+                <
+                0.0)
+              polarity_match = false;
           }
           #endif
-        }
-        else //if (cluster_i != cluster_j)
-        {
-          // -- merge the two clusters to which basin_i and basin_j belong --
-
-          // (arbitrarily) choose the cluster with the smaller ID number
-          // to absorb the other cluster, and delete the other cluster.
-          ptrdiff_t merged_cluster_id  = std::min(cluster_i, cluster_j);
-          ptrdiff_t deleted_cluster_id = std::max(cluster_i, cluster_j);
-          assert(cluster_i != cluster_j);
-
-          // copy the basins from the deleted cluster into the merged cluster
-          for (auto p = cluster2basins[deleted_cluster_id].begin();
-               p != cluster2basins[deleted_cluster_id].end();
-               p++)
-          {
-            ptrdiff_t basin_id = *p;
-            cluster2basins[merged_cluster_id].insert(basin_id);
-            basin2cluster[basin_id] = merged_cluster_id;
 
+          if (cluster_i == cluster_j) {
             #ifndef DISABLE_STANDARDIZE_VECTOR_DIRECTION
-            if (aaaafVector && aaaafVectorStandardized &&
-                (! consider_dot_product_sign))
-            {
-              if (! polarity_match)
-                basin2polarity[basin_id] *= -1.0;
+            if (! polarity_match) {
+              voxels_discarded_due_to_polarity = true;
+              voxel_discarded_due_to_polarity_ix = ix_jx;
+              voxel_discarded_due_to_polarity_iy = iy_jy;
+              voxel_discarded_due_to_polarity_iz = iz_jz;
+              voxel_discarded_due_to_polarity_saliency = aaafSaliency[iz_jz][iy_jy][ix_jx];
+
+              // In that case throw away this voxel.
+              // Hopefully this will prevent linking of voxels containing
+              // vector directors which cannot be reconciled.  Example:
+              // This should prevent surfaces which resemble a Möbius strip
+              // from forming a complete closed loop.  Hopefully it will
+              // cut the loop at the voxels with the most tenuous connections.
+              continue;
             }
             #endif
           }
+          else //if (cluster_i != cluster_j)
+          {
+            // -- merge the two clusters to which basin_i and basin_j belong --
+
+            // (arbitrarily) choose the cluster with the smaller ID number
+            // to absorb the other cluster, and delete the other cluster.
+            ptrdiff_t merged_cluster_id  = std::min(cluster_i, cluster_j);
+            ptrdiff_t deleted_cluster_id = std::max(cluster_i, cluster_j);
+            assert(cluster_i != cluster_j);
+
+            // copy the basins from the deleted cluster into the merged cluster
+            for (auto p = cluster2basins[deleted_cluster_id].begin();
+                 p != cluster2basins[deleted_cluster_id].end();
+                 p++)
+            {
+              ptrdiff_t basin_id = *p;
+              cluster2basins[merged_cluster_id].push_back(basin_id);
+              basin2cluster[basin_id] = merged_cluster_id;
 
-          // -- delete all the basins from the deleted cluster --
-          cluster2basins[deleted_cluster_id].clear();
+              #ifndef DISABLE_STANDARDIZE_VECTOR_DIRECTION
+              if (aaaafVector && aaaafVectorStandardized &&
+                  (! consider_dot_product_sign))
+              {
+                if (! polarity_match)
+                  basin2polarity[basin_id] *= -1.0;
+              }
+              #endif
+            }
+
+            // -- delete all the basins from the deleted cluster --
+            cluster2basins[deleted_cluster_id].clear();
 
-        } // if (aaaiDest[iz_jz][iy_jy][ix_jx] != aaaiDest[iz][iy][ix])
-      } // else clause for "if (aaaiDest[iz_jz][iy_jy][ix_jx] == UNDEFINED)"
-    } // for (int j = 0; j < num_neighbors; j++)
-  } //while (q.size() != 0)
+          } // if (aaaiDest[iz_jz][iy_jy][ix_jx] != aaaiDest[iz][iy][ix])
+        } // else clause for "if (aaaiDest[iz_jz][iy_jy][ix_jx] == UNDEFINED)"
+      } // for (int j = 0; j < num_neighbors; j++)
+    } //while (q.size() != 0)
+  } // else // if (algorithm == CLUSTER_BY_FLOODING)
 
 
   #ifndef NDEBUG
@@ -777,6 +1339,16 @@ ClusterConnected(int const image_size[3],                   //!< #voxels in xyz
   if (pMustLinkConstraints)
   {
 
+    // Build a spatial index of the voxels which belong to a cluster.
+    // (We use it to find the voxel nearest to each must-link location.)
+    set<Label> ignore_these_voxel_types;
+    ignore_these_voxel_types.insert(UNDEFINED);
+    NearestVoxelIndex voxel_index(image_size,
+                                  aaaiDest, //inverse lookup voxel location->basinID
+                                  aaafMask,
+                                  ignore_these_voxel_types, // skip over these voxels
+                                  true); //invert selection (skip over them)
+
     // loop over the different groups of voxels
     //    (we will force each voxel in a group to belong to the same cluster)
 
@@ -800,16 +1372,22 @@ ClusterConnected(int const image_size[3],                   //!< #voxels in xyz
       array<int,3> r_j={-1,-1,-1};      //an impossible value
 
 
+      // Find the voxels nearest to the locations in this group (in parallel)
+      size_t group_size = (*pMustLinkConstraints)[i_group].size();
+      vector<array<int,3> > vR_init(group_size);
+      vector<array<int,3> > vR(group_size);
+      for (size_t i = 0; i < group_size; i++)
+        for (int d = 0; d < 3; d++)
+          vR_init[i][d] =
+            int(floor((*pMustLinkConstraints)[i_group][i][d]+0.5));
+      voxel_index.FindNearest(vR_init, vR);
+
       // Loop over the voxels in each group 
       // and force them to belong to the same cluster
 
-      for (auto pLocation = (*pMustLinkConstraints)[i_group].begin();
-           pLocation != (*pMustLinkConstraints)[i_group].end();
-           pLocation++)
+      for (size_t i = 0; i < group_size; i++)
       {
-        r_i_init[0] = int(floor((*pLocation)[0]+0.5));
-        r_i_init[1] = int(floor((*pLocation)[1]+0.5));
-        r_i_init[2] = int(floor((*pLocation)[2]+0.5));
+        r_i_init = vR_init[i];
         if (*pReportProgress) {
           *pReportProgress << "  finding voxel nearest to (";
           for (int d = 0; d < 3; d++) {
@@ -819,16 +1397,7 @@ ClusterConnected(int const image_size[3],                   //!< #voxels in xyz
           *pReportProgress << ") -> (";
         }
 
-        set<Label> ignore_these_voxel_types;
-        ignore_these_voxel_types.insert(UNDEFINED);
-
-        FindNearestVoxel(image_size,
-                         r_i_init, //find voxel in aaaiDest closest to this
-                         r_i, //store the location here
-                         aaaiDest, //inverse lookup voxel location->basinID
-                         aaafMask,
-                         ignore_these_voxel_types, // skip over these voxels
-                         true); //invert selection (skip over them)
+        r_i = vR[i]; // the voxel in aaaiDest closest to r_i_init
 
         if (*pReportProgress) {
           for (int d = 0; d < 3; d++) {
@@ -836,7 +1405,7 @@ ClusterConnected(int const image_size[3],                   //!< #voxels in xyz
             if (d+1 != 3) *pReportProgress << ",";
           }
           *pReportProgress << ")";
-          if (aaaafVectorStandardized) {
+          if (aaaafVectorStandardized && (r_i[0] != -1)) {
             *pReportProgress << ", normal=(";
             for (int d = 0; d < 3; d++) {
               aaaafVectorStandardized[r_i[2]][r_i[1]][r_i[0]][d];
@@ -934,7 +1503,7 @@ ClusterConnected(int const image_size[3],                   //!< #voxels in xyz
                  p++)
             {
               ptrdiff_t basin_id = *p;
-              cluster2basins[merged_cluster_id].insert(basin_id);
+              cluster2basins[merged_cluster_id].push_back(basin_id);
               basin2cluster[basin_id] = merged_cluster_id;
 
               #ifndef DISABLE_STANDARDIZE_VECTOR_DIRECTION
@@ -959,7 +1528,7 @@ ClusterConnected(int const image_size[3],                   //!< #voxels in xyz
         r_j_init = r_i_init;
         r_j = r_i;
 
-      } //for (auto pLocation = (*pMustLinkConstraints)[i].begin(); ...)
+      } //for (size_t i = 0; i < group_size; i++)
       
     } //for (size_t i = 0; i < pMustLinkConstraints->size(); i++)
     
@@ -993,6 +1562,8 @@ ClusterConnected(int const image_size[3],                   //!< #voxels in xyz
 
   // Renumber the clusters from 0 ... n_clusters-1
   for (size_t i=0; i < basin2cluster.size(); i++) {
+    if (basin2cluster[i] < 0)
+      continue; // (this basin was deleted)
     basin2cluster[i] = clusterold2clusternew[basin2cluster[i]];
   }
 
@@ -0,0 +1,230 @@
+///   @file compact_scalar.hpp
+///   @brief compact (16-bit and 8-bit) number types which can be used to
+///          store large intermediate images (such as tensors or unit vectors)
+///          using less memory.  Calculations are still carried out using
+///          ordinary floats.  (Values are converted when they are loaded
+///          and stored.)
+
+#ifndef _COMPACT_SCALAR_HPP
+#define _COMPACT_SCALAR_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#if defined(__F16C__) && !defined(DISABLE_F16C)
+#include <immintrin.h>  // defines _cvtss_sh(), _mm256_cvtph_ps(), ...
+#endif
+using namespace std;
+
+
+
+namespace visfd {
+
+
+
+/// @brief  Convert a float into IEEE 754 half-precision format (binary16),
+///         rounding to the nearest representable value.
+///         Values too large to represent are converted to infinity.
+///         (If the CPU supports the F16C instructions, and the compiler was
+///          told to use them, eg. using "-mf16c" or "-march=native", then
+///          a single instruction is used.)
+
+inline uint16_t
+FloatToHalfBits(float f)
+{
+  #if defined(__F16C__) && !defined(DISABLE_F16C)
+  return _cvtss_sh(f, 0); // (0 = round to nearest even)
+  #else
+  // (This is a port of the "float_to_half_fast3_rtne()" function written by
+  //  Fabian Giesen, which is in the public domain.)
+  const uint32_t F32_INFTY = 255u << 23;
+  const uint32_t F16_MAX = (127u + 16u) << 23;
+  const uint32_t DENORM_MAGIC = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  uint32_t sign = u & 0x80000000u;
+  u ^= sign;
+  uint16_t h;
+  if (u >= F16_MAX)  // Inf or NaN (or too large)
+    h = (u > F32_INFTY) ? 0x7e00 : 0x7c00;
+  else if (u < (113u << 23)) {
+    // The result is subnormal (or zero).  Adding a "magic" number aligns the
+    // 10 mantissa bits at the bottom of the float (rounding them correctly).
+    float fmagic;
+    float fu;
+    memcpy(&fmagic, &DENORM_MAGIC, sizeof(fmagic));
+    memcpy(&fu, &u, sizeof(fu));
+    fu += fmagic;
+    memcpy(&u, &fu, sizeof(u));
+    h = u - DENORM_MAGIC;
+  }
+  else {
+    uint32_t mant_odd = (u >> 13) & 1u;
+    u += ((15u - 127u) << 23) + 0xfffu; // adjust the exponent, and round
+    u += mant_odd;
+    h = u >> 13;
+  }
+  return h | (sign >> 16);
+  #endif
+}
+
+
+
+/// @brief  Convert a number in IEEE 754 half-precision format (binary16)
+///         into a float.  (This conversion is exact.)
+
+inline float
+HalfBitsToFloat(uint16_t h)
+{
+  #if defined(__F16C__) && !defined(DISABLE_F16C)
+  return _cvtsh_ss(h);
+  #else
+  const uint32_t SHIFTED_EXP = 0x7c00u << 13;
+  const uint32_t MAGIC = 113u << 23;
+  uint32_t u = (h & 0x7fffu) << 13; // exponent and mantissa bits
+  uint32_t exp = SHIFTED_EXP & u;
+  u += (127u - 15u) << 23;          // adjust the exponent
+  float f;
+  if (exp == SHIFTED_EXP)           // Inf or NaN?
+    u += (128u - 16u) << 23;
+  else if (exp == 0) {              // zero or subnormal?
+    u += 1u << 23;
+    float fmagic;
+    memcpy(&fmagic, &MAGIC, sizeof(fmagic));
+    memcpy(&f, &u, sizeof(f));
+    f -= fmagic;                    // renormalize
+    memcpy(&u, &f, sizeof(u));
+  }
+  u |= static_cast<uint32_t>(h & 0x8000u) << 16; // sign bit
+  memcpy(&f, &u, sizeof(f));
+  return f;
+  #endif
+}
+
+
+
+/// @class  Half
+/// @brief  A 16-bit (IEEE 754 "binary16") floating point number.
+///         It has 11 significant bits (about 3 decimal digits), and can
+///         represent numbers as large as 65504.  It is intended for storage
+///         only.  (It is converted to a float whenever it is used in an
+///         arithmetic expression.)  Half the memory of a float is required.
+///
+/// Example usage:
+/// @code
+/// CompactMultiChannelImage3D<float, Half> tensors(6, image_size, aaafMask);
+/// tensors.aaaafI[iz][iy][ix][k] = x;      // (x is converted to a Half)
+/// float y = tensors.aaaafI[iz][iy][ix][k]; // (converted back to a float)
+/// @endcode
+
+class Half {
+  uint16_t bits;
+public:
+  Half(): bits(0) {}
+  Half(float f): bits(FloatToHalfBits(f)) {}
+  operator float() const {
+    return HalfBitsToFloat(bits);
+  }
+  Half& operator += (float x) { *this = float(*this) + x; return *this; }
+  Half& operator -= (float x) { *this = float(*this) - x; return *this; }
+  Half& operator *= (float x) { *this = float(*this) * x; return *this; }
+  Half& operator /= (float x) { *this = float(*this) / x; return *this; }
+}; //class Half
+
+
+
+/// @class  SignedNormalized
+/// @brief  A number between -1 and 1 stored as a (8-bit or 16-bit) integer.
+///         The spacing between representable numbers is 1/127 (for 8-bit
+///         integers) or 1/32767 (for 16-bit integers).  Numbers outside this
+///         range are clipped.  This is useful for storing the components
+///         of unit vectors (such as surface normals).
+///         The "Integer" type should be a signed integer type.
+///         (See the SNorm8 and SNorm16 typedefs below.)
+
+template<typename Integer>
+
+class SignedNormalized {
+  Integer i;
+  static float Max() {
+    return static_cast<float>(numeric_limits<Integer>::max());
+  }
+public:
+  SignedNormalized(): i(0) {}
+  SignedNormalized(float f) {
+    f = std::max(std::min(f, 1.0f), -1.0f);
+    i = static_cast<Integer>(std::floor(f * Max() + 0.5f));
+  }
+  operator float() const {
+    return i * (1.0f / Max());
+  }
+  SignedNormalized& operator += (float x) { *this = float(*this)+x; return *this; }
+  SignedNormalized& operator -= (float x) { *this = float(*this)-x; return *this; }
+  SignedNormalized& operator *= (float x) { *this = float(*this)*x; return *this; }
+  SignedNormalized& operator /= (float x) { *this = float(*this)/x; return *this; }
+}; //class SignedNormalized
+
+typedef SignedNormalized<int8_t> SNorm8;
+typedef SignedNormalized<int16_t> SNorm16;
+
+
+
+/// @brief  Copy an array of numbers, converting them from one type to another.
+///         (The general version of this function converts each number
+///          individually.  Faster versions are used for converting between
+///          Half and float when the F16C instructions are available.)
+
+template<typename Source, typename Dest>
+
+inline void
+ConvertArray(size_t n,             //!< number of entries in the arrays
+             Source const *aSource, //!< the array to be converted
+             Dest *aDest            //!< store the converted numbers here
+             )
+{
+  for (size_t i = 0; i < n; i++)
+    aDest[i] = aSource[i];
+}
+
+
+#if defined(__F16C__) && defined(__AVX__) && !defined(DISABLE_F16C)
+
+// Convert 8 numbers at a time using the F16C instructions
+
+inline void
+ConvertArray(size_t n, Half const *aSource, float *aDest)
+{
+  static_assert(sizeof(Half) == sizeof(uint16_t), "unexpected padding");
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm_loadu_si128(reinterpret_cast<__m128i const *>(aSource + i));
+    _mm256_storeu_ps(aDest + i, _mm256_cvtph_ps(h));
+  }
+  for (; i < n; i++)
+    aDest[i] = aSource[i];
+}
+
+inline void
+ConvertArray(size_t n, float const *aSource, Half *aDest)
+{
+  static_assert(sizeof(Half) == sizeof(uint16_t), "unexpected padding");
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(aSource + i), 0);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(aDest + i), h);
+  }
+  for (; i < n; i++)
+    aDest[i] = aSource[i];
+}
+
+#endif //#if defined(__F16C__) && defined(__AVX__) && !defined(DISABLE_F16C)
+
+
+
+} //namespace visfd
+
+
+
+#endif //#ifndef _COMPACT_SCALAR_HPP
@@ -0,0 +1,214 @@
+///   @file distance_transform.hpp
+///   @brief an exact Euclidean distance transform which requires O(N) time
+///          (where N is the number of voxels in the image)
+
+#ifndef _DISTANCE_TRANSFORM_HPP
+#define _DISTANCE_TRANSFORM_HPP
+
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <ostream>
+#include <vector>
+using namespace std;
+#include <err_visfd.hpp> // defines the "VisfdErr" exception type
+
+
+
+namespace visfd {
+
+
+
+/// @brief  Compute the lower envelope of a set of parabolas in 1 dimension:
+/// @code
+///   aDest[i] = min_j ( aSource[j] + width_sq*(i-j)^2 )
+/// @endcode
+///         Entries in aSource[] which equal infinity are ignored.
+///         (If they are all infinite, then so is every entry in aDest[].)
+///         This is the 1-D distance transform described in:
+///         Felzenszwalb & Huttenlocher, Theory of Computing, 8:415-428 (2012)
+///         It requires O(n) time.  The source and dest arrays may overlap.
+///         This function was not intended for public use.
+
+template<typename Scalar>
+
+static void
+_DistanceTransform1D(int n, //!< number of entries in the arrays
+                     Scalar const *aSource, //!< squared distances (so far)
+                     Scalar *aDest, //!< store the result here
+                     double width_sq, //!< square of the voxel width
+                     vector<int> &vSites, //!< temporary array (size >= n)
+                     vector<double> &vBounds, //!< temporary array (size >= n+1)
+                     vector<double> &vF //!< temporary array (size >= n)
+                     )
+{
+  const double INF = numeric_limits<double>::infinity();
+  // Make a copy of the source (in case it overlaps with aDest)
+  for (int i = 0; i < n; i++)
+    vF[i] = aSource[i];
+
+  // "vSites" stores the locations of the parabolas in the lower envelope.
+  // "vBounds" stores the intervals where each of these parabolas is lowest.
+  int k = -1; // the index of the rightmost parabola in the envelope
+  for (int q = 0; q < n; q++) {
+    if (vF[q] == INF)
+      continue;
+    double s = -INF;
+    while (k >= 0) {
+      int v = vSites[k];
+      // the intersection between the parabolas centered at q and v
+      s = ((vF[q] + width_sq*q*q) - (vF[v] + width_sq*v*v)) /
+        (2.0 * width_sq * (q - v));
+      if (s > vBounds[k])
+        break;
+      k--;
+    }
+    if (k < 0)
+      s = -INF;
+    k++;
+    vSites[k] = q;
+    vBounds[k] = s;
+    vBounds[k+1] = INF;
+  }
+
+  if (k < 0) {
+    for (int i = 0; i < n; i++)
+      aDest[i] = INF;
+    return;
+  }
+
+  int j = 0;
+  for (int i = 0; i < n; i++) {
+    while (vBounds[j+1] < i)
+      j++;
+    int v = vSites[j];
+    aDest[i] = vF[v] + width_sq * (i - v) * (i - v);
+  }
+} //_DistanceTransform1D()
+
+
+
+/// @brief  Calculate the (Euclidean) distance from every voxel in the image
+///         to the nearest "object" voxel.  Object voxels are voxels whose
+///         brightness in the source image (aaafSource) is non-zero.
+///         (So, for example, a mask can be converted into a distance map.)
+///         The distance is exact, and the calculation requires O(N) time,
+///         where N is the number of voxels.  It is carried out separately in
+///         the x, y, and z directions.  (See _DistanceTransform1D().)
+///
+/// @note   Voxels outside the image are not considered.  Voxels where the
+///         mask is 0 are neither objects nor destinations.  (aaafDest is 0
+///         at these voxels.)  However the distance is still calculated as a
+///         straight line, even if that line passes outside the mask.
+///         If there are no object voxels, then the distance is infinite.
+
+template<typename Scalar>
+
+void
+DistanceTransform(int const image_size[3], //!< source image size
+                  Scalar const *const *const *aaafSource, //!< objects are non-zero
+                  Scalar ***aaafDest, //!< distance to the nearest object
+                  Scalar const *const *const *aaafMask = nullptr, //!< ignore voxels where mask==0
+                  Scalar const *voxel_width = nullptr, //!< (optional) the width of each voxel in the x,y,z directions (1 by default)
+                  bool return_squared_distance = false, //!< report distance^2 ?
+                  ostream *pReportProgress = nullptr //!< print progress to the user?
+                  )
+{
+  assert(aaafSource);
+  assert(aaafDest);
+  double width_sq[3] = {1.0, 1.0, 1.0};
+  if (voxel_width)
+    for (int d = 0; d < 3; d++)
+      width_sq[d] = voxel_width[d] * voxel_width[d];
+
+  const Scalar INF = numeric_limits<Scalar>::infinity();
+
+  if (pReportProgress)
+    *pReportProgress << "  calculating the distance transform (x,y,z directions)" << endl;
+
+  // The squared distances are stored in aaafDest as we go.
+  // First, calculate the distance along the x direction.
+  #pragma omp parallel
+  {
+    vector<int> vSites(image_size[0]);
+    vector<double> vBounds(image_size[0]+1);
+    vector<double> vF(image_size[0]);
+    vector<Scalar> vTmp(image_size[0]);
+    #pragma omp for collapse(2)
+    for (int iz = 0; iz < image_size[2]; iz++) {
+      for (int iy = 0; iy < image_size[1]; iy++) {
+        for (int ix = 0; ix < image_size[0]; ix++) {
+          bool is_object = ((aaafSource[iz][iy][ix] != 0.0) &&
+                            ((! aaafMask) || (aaafMask[iz][iy][ix] != 0.0)));
+          vTmp[ix] = is_object ? 0.0 : INF;
+        }
+        _DistanceTransform1D(image_size[0],
+                             vTmp.data(),
+                             aaafDest[iz][iy],
+                             width_sq[0],
+                             vSites, vBounds, vF);
+      }
+    }
+  } //#pragma omp parallel
+
+  // Then the y direction
+  #pragma omp parallel
+  {
+    vector<int> vSites(image_size[1]);
+    vector<double> vBounds(image_size[1]+1);
+    vector<double> vF(image_size[1]);
+    vector<Scalar> vTmp(image_size[1]);
+    #pragma omp for collapse(2)
+    for (int iz = 0; iz < image_size[2]; iz++) {
+      for (int ix = 0; ix < image_size[0]; ix++) {
+        for (int iy = 0; iy < image_size[1]; iy++)
+          vTmp[iy] = aaafDest[iz][iy][ix];
+        _DistanceTransform1D(image_size[1],
+                             vTmp.data(),
+                             vTmp.data(),
+                             width_sq[1],
+                             vSites, vBounds, vF);
+        for (int iy = 0; iy < image_size[1]; iy++)
+          aaafDest[iz][iy][ix] = vTmp[iy];
+      }
+    }
+  } //#pragma omp parallel
+
+  // Then the z direction
+  #pragma omp parallel
+  {
+    vector<int> vSites(image_size[2]);
+    vector<double> vBounds(image_size[2]+1);
+    vector<double> vF(image_size[2]);
+    vector<Scalar> vTmp(image_size[2]);
+    #pragma omp for collapse(2)
+    for (int iy = 0; iy < image_size[1]; iy++) {
+      for (int ix = 0; ix < image_size[0]; ix++) {
+        for (int iz = 0; iz < image_size[2]; iz++)
+          vTmp[iz] = aaafDest[iz][iy][ix];
+        _DistanceTransform1D(image_size[2],
+                             vTmp.data(),
+                             vTmp.data(),
+                             width_sq[2],
+                             vSites, vBounds, vF);
+        for (int iz = 0; iz < image_size[2]; iz++) {
+          if (aaafMask && (aaafMask[iz][iy][ix] == 0.0))
+            aaafDest[iz][iy][ix] = 0.0;
+          else if (return_squared_distance)
+            aaafDest[iz][iy][ix] = vTmp[iz];
+          else
+            aaafDest[iz][iy][ix] = sqrt(vTmp[iz]);
+        }
+      }
+    }
+  } //#pragma omp parallel
+
+} //DistanceTransform()
+
+
+
+} //namespace visfd
+
+
+
+#endif //#ifndef _DISTANCE_TRANSFORM_HPP
@@ -13,9 +13,11 @@
 #include <limits>
 #include <ostream>
 #include <vector>
+#include <map>
 #include <tuple>
 #include <set>
 #include <queue>
+#include <array>
 using namespace std;
 #include <err_visfd.hpp> // defines the "VisfdErr" exception type
 #include <eigen3_simple.hpp>  // defines matrix diagonalizer (DiagonalizeSym3())
@@ -31,6 +33,63 @@ namespace visfd {
 
 
 
+/// @brief  The number of z-slices in each of the slabs that DrawSpheres()
+///         divides the image into.  (Each slab is drawn by one thread.)
+const int DRAW_SPHERES_SLAB_WIDTH = 8;
+
+
+
+/// @brief  The voxels belonging to a spherical shell (centered at the origin)
+///         stored as spans of consecutive voxels in each (y,z) row.
+///         In row (jy,jz), the voxels in the shell are the ones whose jx
+///         satisfies xi <= |jx| <= xo.  (The row is empty if xo < xi.)
+///         This is used by DrawSpheres().  Spheres of the same size share
+///         the same table.
+/// @note   THIS DATA STRUCTURE WAS NOT INTENDED FOR PUBLIC USE
+
+struct _SphereSpans {
+  int Rs; //!< the shell lies within a cube of width 2*Rs+1
+  vector<array<int,2> > xi_xo; //!< xi,xo for each row (jy,jz) (stored at
+                               //!< index (jz+Rs)*(2*Rs+1)+(jy+Rs))
+  long num_voxels; //!< the number of voxels in the shell
+
+  template<typename Scalar>
+  _SphereSpans(int set_Rs,         //!< maximum |jx|, |jy|, and |jz|
+               Scalar Rssqr_min,   //!< voxels in the shell satisfy
+               Scalar Rssqr_max)   //!< Rssqr_min <= jx^2+jy^2+jz^2 <= Rssqr_max
+  {
+    Rs = set_Rs;
+    int width = 2*Rs+1;
+    xi_xo.resize(width*width);
+    num_voxels = 0;
+    for (int jz = -Rs; jz <= Rs; jz++) {
+      for (int jy = -Rs; jy <= Rs; jy++) {
+        // Moving outward from jx=0, the voxels in the shell form an interval
+        int xi = Rs+1;
+        int xo = -1;
+        for (int jx = 0; jx <= Rs; jx++) {
+          int rsqr = jx*jx + jy*jy + jz*jz;
+          if ((Rssqr_min <= rsqr) && (rsqr <= Rssqr_max)) {
+            if (xi > jx)
+              xi = jx;
+            xo = jx;
+          }
+        }
+        array<int,2> span = {xi, xo};
+        xi_xo[(jz+Rs)*width + (jy+Rs)] = span;
+        if (xi <= xo)
+          num_voxels += ((xi == 0) ? 2*xo+1 : 2*(xo-xi+1));
+      }
+    }
+  }
+
+  const array<int,2> &Row(int jy, int jz) const {
+    return xi_xo[(jz+Rs)*(2*Rs+1) + (jy+Rs)];
+  }
+}; //struct _SphereSpans
+
+
+
 /// @brief  Create a 3D image containing multiple spheres (or spherical shells)
 ///         various sizes, thicknesses, and locations, specified by the caller.
 ///         The resulting spheres can (optionally) be superimposed with the
@@ -117,31 +176,42 @@ DrawSpheres(int const image_size[3], //!< image size
   // scores. Rescale the tomogram intensities so that they are approximately
   // in the range of scores.  This way we can see both at the same time
   // (when viewing the tomogram using IMOD, for example)
+  // (The background is filled in a single pass over the image.)
+  bool use_background = (aaafBackground && (background_stddev > 0.0));
+  #pragma omp parallel for collapse(2)
   for (int iz = 0; iz < image_size[2]; iz++) {
     for (int iy = 0; iy < image_size[1]; iy++) {
-      for (int ix = 0; ix < image_size[0]; ix++) {
-        if (background_stddev > 0.0)
-          aaafDest[iz][iy][ix] =
+      if (use_background) {
+        for (int ix = 0; ix < image_size[0]; ix++) {
+          Scalar rescaled =
             ((aaafBackground[iz][iy][ix] - background_ave) / background_stddev)
             *
             voxel_intensity_foreground_rms
             *
             voxel_intensity_background_rescale;
-        else
-          aaafDest[iz][iy][ix] = 0.0;
+          aaafDest[iz][iy][ix] = rescaled + voxel_intensity_background;
+        }
+      }
+      else {
+        for (int ix = 0; ix < image_size[0]; ix++)
+          aaafDest[iz][iy][ix] = voxel_intensity_background;
       }
     }
   }
 
 
-  for (int iz=0; iz<image_size[2]; iz++)
-    for (int iy=0; iy<image_size[1]; iy++)
-      for (int ix=0; ix<image_size[0]; ix++)
-        aaafDest[iz][iy][ix] += voxel_intensity_background;
-
+  // Now draw the spheres.  Instead of testing every voxel in a cube
+  // surrounding each sphere, look up which voxels in each row belong to the
+  // sphere (or shell) using a table of spans.  Spheres of the same size
+  // (and shell thickness) share the same table.
 
   bool warn_points_outside_image = false;
 
+  vector<_SphereSpans> span_tables;
+  map<tuple<int, Scalar, Scalar>, size_t> span_table_lookup;
+  vector<size_t> which_table(centers.size());
+  vector<array<int,3> > icenters(centers.size());
+
   for (int i = 0; i < centers.size(); i++) {
     if (pReportProgress)
       *pReportProgress << "processing coordinates " << i+1 << " / "
@@ -151,6 +221,9 @@ DrawSpheres(int const image_size[3], //!< image size
     int ix = centers[i][0];
     int iy = centers[i][1];
     int iz = centers[i][2];
+    icenters[i][0] = ix;
+    icenters[i][1] = iy;
+    icenters[i][2] = iz;
 
     if ((ix < 0) || (iy < 0) || (iz < 0) ||
         (ix >= image_size[0]) ||
@@ -171,56 +244,146 @@ DrawSpheres(int const image_size[3], //!< image size
                        << ", th=" << (*pShellThicknesses)[i]
                        <<"\n";
 
-    // Normalize the brightness of each sphere?
-    // (ie by dividing the intensity by the number of voxels in the sphere)
-    Scalar imultiplier = 1.0;
+    tuple<int, Scalar, Scalar> key(Rs, Rssqr_min, Rssqr_max);
+    auto p = span_table_lookup.find(key);
+    if (p == span_table_lookup.end()) {
+      span_tables.push_back(_SphereSpans(Rs, Rssqr_min, Rssqr_max));
+      p = span_table_lookup.insert(make_pair(key, span_tables.size()-1)).first;
+    }
+    which_table[i] = p->second;
+  } //for (int i = 0; i < centers.size(); i++)
+
+
+  // Normalize the brightness of each sphere?
+  // (ie by dividing the intensity by the number of voxels in the sphere)
+  vector<Scalar> intensities(centers.size());
+  #pragma omp parallel for schedule(dynamic)
+  for (size_t i = 0; i < centers.size(); i++) {
     long nvoxelspersphere = 1;
     if (voxel_intensity_foreground_normalize) {
-      nvoxelspersphere = 0;
-      for (int jz = -Rs; jz <= Rs; jz++) {
-        for (int jy = -Rs; jy <= Rs; jy++) {
-          for (int jx = -Rs; jx <= Rs; jx++) {
-            if (aaafMask
-                &&
-                (aaafMask[static_cast<int>(iz)+jz]
-                         [static_cast<int>(iy)+jy]
-                         [static_cast<int>(ix)+jx]
-                 == 0.0))
+      const _SphereSpans &spans = span_tables[which_table[i]];
+      nvoxelspersphere = spans.num_voxels;
+      if (aaafMask) {
+        // Only count the voxels in the mask (ignoring voxels outside the image)
+        nvoxelspersphere = 0;
+        int Rs = spans.Rs;
+        for (int jz = -Rs; jz <= Rs; jz++) {
+          int iz = icenters[i][2] + jz;
+          if ((iz < 0) || (iz >= image_size[2]))
+            continue;
+          for (int jy = -Rs; jy <= Rs; jy++) {
+            int iy = icenters[i][1] + jy;
+            if ((iy < 0) || (iy >= image_size[1]))
               continue;
-            Scalar rsqr = jx*jx + jy*jy + jz*jz;
-            if ((Rssqr_min <= rsqr) && (rsqr <= Rssqr_max))
-              nvoxelspersphere++;
+            const array<int,2> &xi_xo = spans.Row(jy, jz);
+            for (int jx = -xi_xo[1]; jx <= xi_xo[1]; jx++) {
+              if (abs(jx) < xi_xo[0])
+                continue;
+              int ix = icenters[i][0] + jx;
+              if ((ix >= 0) && (ix < image_size[0]) &&
+                  (aaafMask[iz][iy][ix] != 0.0))
+                nvoxelspersphere++;
+            }
           }
         }
       }
     }
-    imultiplier = 1.0;
+    Scalar imultiplier = 1.0;
     if (nvoxelspersphere > 0)
       imultiplier = 1.0 / nvoxelspersphere;
-    for (int jz = -Rs; jz <= Rs; jz++) {
-      for (int jy = -Rs; jy <= Rs; jy++) {
-        for (int jx = -Rs; jx <= Rs; jx++) {
-          int rsqr = jx*jx + jy*jy + jz*jz;
-          if (! ((Rssqr_min <= rsqr) && (rsqr <= Rssqr_max)))
-            continue;
-          else if ((ix+jx < 0) ||
-                   (ix+jx >= image_size[0]) ||
-                   (iy+jy < 0) ||
-                   (iy+jy >= image_size[1]) ||
-                   (iz+jz < 0) ||
-                   (iz+jz >= image_size[2]))
-            continue;
-          else if (aaafMask
-                   &&
-                   (aaafMask[iz+jz][iy+jy][ix+jx] == 0.0))
+    intensities[i] = (*pVoxelIntensitiesForeground)[i] * imultiplier;
+  }
+
+
+  // Divide the image into slabs (of DRAW_SPHERES_SLAB_WIDTH z-slices).
+  // Make a list of the spheres which overlap with each slab.
+  // (These lists are created using a counting sort.  Within each list,
+  //  the spheres remain in their original order, so that when spheres
+  //  overlap, spheres later in the list are drawn on top, as before.)
+  // Each slab is drawn by a single thread, so the threads never write
+  // to the same voxel.
+
+  int num_slabs = ((image_size[2] + DRAW_SPHERES_SLAB_WIDTH - 1) /
+                   DRAW_SPHERES_SLAB_WIDTH);
+  vector<size_t> slab_begin(num_slabs + 1, 0);
+  vector<size_t> slab_spheres;
+  for (int pass = 0; pass < 2; pass++) {
+    vector<size_t> slab_end;
+    if (pass == 1) {
+      for (int s = 0; s < num_slabs; s++)
+        slab_begin[s+1] += slab_begin[s];
+      slab_spheres.resize(slab_begin[num_slabs]);
+      slab_end.assign(slab_begin.begin(), slab_begin.end()-1);
+    }
+    for (size_t i = 0; i < centers.size(); i++) {
+      int Rs = span_tables[which_table[i]].Rs;
+      int iz_min = std::max(icenters[i][2] - Rs, 0);
+      int iz_max = std::min(icenters[i][2] + Rs, image_size[2]-1);
+      if (iz_min > iz_max)
+        continue;
+      for (int s = iz_min / DRAW_SPHERES_SLAB_WIDTH;
+           s <= iz_max / DRAW_SPHERES_SLAB_WIDTH; s++) {
+        if (pass == 0)
+          slab_begin[s+1]++;
+        else
+          slab_spheres[slab_end[s]++] = i;
+      }
+    }
+  }
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int s = 0; s < num_slabs; s++) {
+    int slab_z_min = s * DRAW_SPHERES_SLAB_WIDTH;
+    int slab_z_max = std::min(slab_z_min + DRAW_SPHERES_SLAB_WIDTH,
+                              image_size[2]) - 1;
+    for (size_t k = slab_begin[s]; k < slab_begin[s+1]; k++) {
+      size_t i = slab_spheres[k];
+      const _SphereSpans &spans = span_tables[which_table[i]];
+      int Rs = spans.Rs;
+      int ix = icenters[i][0];
+      int iy = icenters[i][1];
+      int iz = icenters[i][2];
+      Scalar intensity = intensities[i];
+      int jz_min = std::max(-Rs, slab_z_min - iz);
+      int jz_max = std::min(Rs, slab_z_max - iz);
+      int jy_min = std::max(-Rs, -iy);
+      int jy_max = std::min(Rs, image_size[1]-1 - iy);
+      for (int jz = jz_min; jz <= jz_max; jz++) {
+        for (int jy = jy_min; jy <= jy_max; jy++) {
+          const array<int,2> &xi_xo = spans.Row(jy, jz);
+          int xi = xi_xo[0];
+          int xo = xi_xo[1];
+          if (xo < xi)
             continue;
-          else
-            aaafDest[iz+jz][iy+jy][ix+jx] =
-              (*pVoxelIntensitiesForeground)[i] * imultiplier;
+          // This row contains either one span: -xo <= jx <= xo (if xi == 0)
+          // or two spans: -xo <= jx <= -xi,  and  xi <= jx <= xo
+          int spans_jx[2][2] = {{-xo, -xi}, {xi, xo}};
+          int num_spans = 2;
+          if (xi == 0) {
+            spans_jx[0][1] = xo;
+            num_spans = 1;
+          }
+          Scalar *afDest = aaafDest[iz+jz][iy+jy];
+          Scalar const *afMask = (aaafMask
+                                  ? aaafMask[iz+jz][iy+jy]
+                                  : nullptr);
+          for (int n = 0; n < num_spans; n++) {
+            int ix_begin = std::max(ix + spans_jx[n][0], 0);
+            int ix_end = std::min(ix + spans_jx[n][1], image_size[0]-1);
+            if (afMask) {
+              for (int jx = ix_begin; jx <= ix_end; jx++)
+                if (afMask[jx] != 0.0)
+                  afDest[jx] = intensity;
+            }
+            else {
+              for (int jx = ix_begin; jx <= ix_end; jx++)
+                afDest[jx] = intensity;
+            }
+          }
         }
       }
-    }
-  } //for (int i = 0; i < centers.size(); i++) {
+    } //for (size_t k = slab_begin[s]; k < slab_begin[s+1]; k++)
+  } //for (int s = 0; s < num_slabs; s++)
 
 
   if (pReportProgress && warn_points_outside_image)
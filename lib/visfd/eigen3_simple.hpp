@@ -21,6 +21,7 @@
 #include <cstring>
 #include <cassert>
 #include <type_traits>
+#include <algorithm>
 using namespace std;
 
 
@@ -405,6 +406,251 @@ namespace selfadjoint_eigen3 {
   }
 
 
+
+
+  /// @brief  The number of matrices processed together by
+  ///         DiagonalizeFlatSym3Batch().  (16 floats fill an AVX-512 register,
+  ///         or two AVX2 registers.)
+  const int DIAGONALIZE_SYM3_BATCH_WIDTH = 16;
+
+  /// @brief  The number of Jacobi sweeps used by DiagonalizeFlatSym3Batch().
+  ///         (Convergence is quadratic.  After 4 sweeps, the off-diagonal
+  ///          entries are negligible, even in double precision.)
+  const int DIAGONALIZE_SYM3_BATCH_SWEEPS = 4;
+
+
+
+  /// @brief  Apply a Jacobi rotation to a symmetric 3x3 matrix (whose entries
+  ///         are stored in separate variables), in order to zero its (p,q)
+  ///         entry (apq).  "r" is the remaining index (so arp and arq are the
+  ///         other two off-diagonal entries).  The rotation is also applied
+  ///         to columns p and q of the matrix of eigenvectors (v).
+  ///         There are no branches, so that this function can be inlined
+  ///         into a loop that the compiler vectorizes.
+  ///         (See Numerical Recipes, 2nd edition, section 11.1)
+  ///         This function was not intended for public use.
+
+  template <typename Scalar>
+  static inline void
+  _JacobiRotateSym3(Scalar &app, Scalar &aqq, Scalar &apq,
+                    Scalar &arp, Scalar &arq,
+                    Scalar &v0p, Scalar &v0q,
+                    Scalar &v1p, Scalar &v1q,
+                    Scalar &v2p, Scalar &v2q)
+  {
+    // (Very large values of theta correspond to negligible rotations.
+    //  They are clamped to avoid overflow when squaring them.)
+    const Scalar THETA_MAX = 1.0e15;
+    bool nonzero = (apq != 0.0);
+    Scalar theta = (aqq - app) / (2.0 * (nonzero ? apq : 1.0));
+    Scalar theta_abs = std::min(std::abs(theta), THETA_MAX);
+    Scalar t = 1.0 / (theta_abs + std::sqrt(theta_abs*theta_abs + 1.0));
+    t = nonzero ? ((theta < 0.0) ? -t : t) : 0.0;
+    Scalar c = 1.0 / std::sqrt(t*t + 1.0);
+    Scalar s = t * c;
+    app -= t * apq;
+    aqq += t * apq;
+    apq = 0.0;
+    Scalar rp = arp;
+    Scalar rq = arq;
+    arp = c*rp - s*rq;
+    arq = s*rp + c*rq;
+    Scalar vp, vq;
+    vp = v0p; vq = v0q; v0p = c*vp - s*vq; v0q = s*vp + c*vq;
+    vp = v1p; vq = v1q; v1p = c*vp - s*vq; v1q = s*vp + c*vq;
+    vp = v2p; vq = v2q; v2p = c*vp - s*vq; v2q = s*vp + c*vq;
+  } //_JacobiRotateSym3()
+
+
+
+  /// @brief  Swap a and b if "do_swap" is true (without branching).
+  ///         This function was not intended for public use.
+
+  template <typename Scalar>
+  static inline void
+  _CondSwap(bool do_swap, Scalar &a, Scalar &b)
+  {
+    Scalar tmp = a;
+    a = do_swap ? b : a;
+    b = do_swap ? tmp : b;
+  }
+
+
+
+  /// @brief  Diagonalize a large number of symmetric 3x3 matrices.
+  ///         This is an alternative to invoking DiagonalizeSym3() for each
+  ///         matrix, which is faster when there are many matrices.
+  ///         The matrices are processed DIAGONALIZE_SYM3_BATCH_WIDTH at a
+  ///         time using the cyclic Jacobi method (with a fixed number of
+  ///         sweeps).  Unlike the closed-form solution used by
+  ///         DiagonalizeSym3(), this requires no trigonometric functions or
+  ///         branches, so the inner loop can be vectorized by the compiler
+  ///         (using SSE, AVX2 or AVX-512, depending on the compiler's target
+  ///         flags, eg. "-march=native").  Matrices with degenerate
+  ///         eigenvalues require no special treatment.
+  ///
+  ///         The matrices (and results) are stored in "structure-of-arrays"
+  ///         format:  aSource[k][i] is the k'th entry of the i'th matrix
+  ///         (in the compact format used by DiagonalizeFlatSym3(), so that
+  ///         k = MapIndices_3x3_to_linear[di][dj]).  The eigenvalues are
+  ///         stored in aEivals[0][i], aEivals[1][i], aEivals[2][i], in the
+  ///         same order that DiagonalizeSym3() uses.  If aaEivects is not
+  ///         nullptr, then aaEivects[j][d][i] stores the d'th component of
+  ///         the j'th eigenvector of the i'th matrix.
+  /// @note   The eigenvalues agree with DiagonalizeSym3() (up to round-off
+  ///         error).  The eigenvectors agree up to a sign.  (When eigenvalues
+  ///         are degenerate, any orthonormal basis of their eigenspace
+  ///         is a valid choice, and the two functions may choose differently.)
+  /// @note   Calculations are carried out using the "Scalar" type.
+
+  template <typename Scalar>
+  void
+  DiagonalizeFlatSym3Batch(size_t n, //!< the number of matrices
+                           Scalar const *const aSource[6], //!< the matrices (see above)
+                           Scalar *const aEivals[3], //!< store the eigenvalues here
+                           Scalar *const (*aaEivects)[3] = nullptr, //!< optional: store the eigenvectors here (aaEivects[j][d][i])
+                           EigenOrderType eival_order = INCREASING_EIVALS)
+  {
+    const int W = DIAGONALIZE_SYM3_BATCH_WIDTH;
+    const bool order_inc = (eival_order == INCREASING_EIVALS);
+    const bool order_dec = (eival_order == DECREASING_EIVALS);
+    const bool order_inc_abs = (eival_order == INCREASING_ABS_EIVALS);
+    const bool order_dec_abs = (eival_order == DECREASING_ABS_EIVALS);
+    const bool order_inc_distinct = (eival_order == INCREASINGLY_DISTINCT_EIVALS);
+    const bool order_dec_distinct = (eival_order == DECREASINGLY_DISTINCT_EIVALS);
+
+    for (size_t i_begin = 0; i_begin < n; i_begin += W) {
+      int w = std::min(static_cast<size_t>(W), n - i_begin);
+      // Copy the next W matrices into a contiguous buffer.
+      // (Unused lanes are filled with zeros.)
+      Scalar m[6][W];
+      for (int k=0; k<6; k++)
+        for (int j=0; j<W; j++)
+          m[k][j] = (j < w) ? aSource[k][i_begin + j] : 0.0;
+
+      // The state of each lane is stored in arrays, so that every loop over
+      // the lanes (j) is a simple loop which the compiler can vectorize.
+      Scalar shift[W], scale[W];
+      Scalar a00[W], a11[W], a22[W], a01[W], a12[W], a02[W];
+      // The columns of v[][] will contain the eigenvectors.
+      Scalar v00[W], v01[W], v02[W];
+      Scalar v10[W], v11[W], v12[W];
+      Scalar v20[W], v21[W], v22[W];
+
+      #pragma omp simd
+      for (int j=0; j<W; j++) {
+        // Shift the matrix to the mean eigenvalue and scale it so that its
+        // entries lie between -1 and 1.  (See DiagonalizeSym3().)
+        shift[j] = (m[0][j] + m[1][j] + m[2][j]) / 3.0;
+        Scalar b00 = m[0][j] - shift[j];
+        Scalar b11 = m[1][j] - shift[j];
+        Scalar b22 = m[2][j] - shift[j];
+        scale[j] = std::max(std::max(std::max(std::abs(b00),
+                                              std::abs(b11)),
+                                     std::max(std::abs(b22),
+                                              std::abs(m[3][j]))),
+                            std::max(std::abs(m[4][j]),
+                                     std::abs(m[5][j])));
+        Scalar scale_inv = 1.0 / ((scale[j] > 0.0) ? scale[j] : 1.0);
+        a00[j] = b00 * scale_inv;
+        a11[j] = b11 * scale_inv;
+        a22[j] = b22 * scale_inv;
+        a01[j] = m[3][j] * scale_inv;
+        a12[j] = m[4][j] * scale_inv;
+        a02[j] = m[5][j] * scale_inv;
+        v00[j] = 1.0; v01[j] = 0.0; v02[j] = 0.0;
+        v10[j] = 0.0; v11[j] = 1.0; v12[j] = 0.0;
+        v20[j] = 0.0; v21[j] = 0.0; v22[j] = 1.0;
+      }
+
+      for (int sweep = 0; sweep < DIAGONALIZE_SYM3_BATCH_SWEEPS; sweep++) {
+        #pragma omp simd
+        for (int j=0; j<W; j++) {
+          _JacobiRotateSym3(a00[j], a11[j], a01[j],  a02[j], a12[j],
+                            v00[j], v01[j],  v10[j], v11[j],  v20[j], v21[j]);
+          _JacobiRotateSym3(a11[j], a22[j], a12[j],  a01[j], a02[j],
+                            v01[j], v02[j],  v11[j], v12[j],  v21[j], v22[j]);
+          _JacobiRotateSym3(a00[j], a22[j], a02[j],  a01[j], a12[j],
+                            v00[j], v02[j],  v10[j], v12[j],  v20[j], v22[j]);
+        }
+      }
+
+      Scalar eivals[3][W];
+      Scalar eivects[3][3][W];
+
+      #pragma omp simd
+      for (int j=0; j<W; j++) {
+        Scalar r0 = a00[j], r1 = a11[j], r2 = a22[j];
+        Scalar u00 = v00[j], u01 = v01[j], u02 = v02[j];
+        Scalar u10 = v10[j], u11 = v11[j], u12 = v12[j];
+        Scalar u20 = v20[j], u21 = v21[j], u22 = v22[j];
+
+        // Sort the eigenvalues in increasing order (as DiagonalizeSym3() does)
+        bool do_swap;
+        do_swap = (r0 > r1);
+        _CondSwap(do_swap, r0, r1);
+        _CondSwap(do_swap, u00, u01);
+        _CondSwap(do_swap, u10, u11);
+        _CondSwap(do_swap, u20, u21);
+        do_swap = (r1 > r2);
+        _CondSwap(do_swap, r1, r2);
+        _CondSwap(do_swap, u01, u02);
+        _CondSwap(do_swap, u11, u12);
+        _CondSwap(do_swap, u21, u22);
+        do_swap = (r0 > r1);
+        _CondSwap(do_swap, r0, r1);
+        _CondSwap(do_swap, u00, u01);
+        _CondSwap(do_swap, u10, u11);
+        _CondSwap(do_swap, u20, u21);
+
+        // Rescale the eigenvalues back to their original size.
+        r0 = r0*scale[j] + shift[j];
+        r1 = r1*scale[j] + shift[j];
+        r2 = r2*scale[j] + shift[j];
+
+        // Then swap the first and last eigenvalues (and eigenvectors),
+        // if necessary, to obtain the order requested by the caller.
+        // (The "&" and "|" operators are used instead of "&&" and "||"
+        //  to avoid branching.)
+        do_swap =
+          ((order_inc & (r0 > r2)) |
+           (order_dec & (r0 < r2)) |
+           (order_inc_abs & (std::abs(r0) > std::abs(r2))) |
+           (order_dec_abs & (std::abs(r0) < std::abs(r2))) |
+           (order_inc_distinct & (r1-r0 > r2-r1)) |
+           (order_dec_distinct & (r1-r0 < r2-r1)));
+        _CondSwap(do_swap, r0, r2);
+        _CondSwap(do_swap, u00, u02);
+        _CondSwap(do_swap, u10, u12);
+        _CondSwap(do_swap, u20, u22);
+
+        eivals[0][j] = r0;
+        eivals[1][j] = r1;
+        eivals[2][j] = r2;
+        eivects[0][0][j] = u00;
+        eivects[0][1][j] = u10;
+        eivects[0][2][j] = u20;
+        eivects[1][0][j] = u01;
+        eivects[1][1][j] = u11;
+        eivects[1][2][j] = u21;
+        eivects[2][0][j] = u02;
+        eivects[2][1][j] = u12;
+        eivects[2][2][j] = u22;
+      } //for (int j=0; j<W; j++)
+
+      // Copy the results
+      for (int d=0; d<3; d++)
+        for (int j=0; j<w; j++)
+          aEivals[d][i_begin + j] = eivals[d][j];
+      if (aaEivects)
+        for (int e=0; e<3; e++)
+          for (int d=0; d<3; d++)
+            for (int j=0; j<w; j++)
+              aaEivects[e][d][i_begin + j] = eivects[e][d][j];
+    } //for (size_t i_begin = 0; i_begin < n; i_begin += W)
+  } //DiagonalizeFlatSym3Batch()
+
+
 } //namespace selfadjoint_eigenvalues3
 
 
@@ -15,6 +15,8 @@
 #include <tuple>
 #include <set>
 #include <queue>
+#include <array>
+#include <algorithm>
 using namespace std;
 #include <err_visfd.hpp> // defines the "VisfdErr" exception type
 #include <eigen3_simple.hpp>  // defines matrix diagonalizer (DiagonalizeSym3())
@@ -23,6 +25,8 @@ using namespace std;
 #include <alloc3d.hpp>    // defines Alloc3D() and Dealloc3D()
 #include <filter1d.hpp>   // defines "Filter1D" (used in ApplySeparable())
 #include <filter3d.hpp>   // defines common 3D image filters
+#include <scale_space.hpp> // defines ScaleSpaceLoG (used in BlobDog())
+#include <pyramid.hpp>     // defines ImagePyramid (used in BlobDog())
 #include <feature_implementation.hpp>
 
 
@@ -222,6 +226,183 @@ FindExtrema(int const image_size[3],            //!< size of input image array
 
 
 
+/// @brief  Refine the locations of blobs which were detected approximately
+///         (for example, using a downsampled version of the image).
+///         For each blob, a (scale-normalized) LoG filter of width σ is
+///         applied to a small window of the image surrounding that blob.
+///         The blob is then moved to the voxel within "search_radius" of its
+///         original location where the filtered image is lowest (if
+///         find_minima==true) or highest (otherwise).  Its score is replaced
+///         by the filtered brightness at that voxel.  Since each window
+///         includes the entire region needed by the filter, the scores are
+///         identical to the scores obtained by filtering the entire image.
+/// @note   Blobs which end up at the same location (with the same σ)
+///         are merged.
+
+template<typename Scalar>
+
+void
+RefineBlobLocations(int const image_size[3], //!< source image size
+                    Scalar const *const *const *aaafSource, //!< source image
+                    Scalar const *const *const *aaafMask, //!< ignore voxels where mask==0
+                    vector<array<Scalar,3> > &blob_crds, //!< location of each blob (updated)
+                    vector<Scalar> &blob_sigma, //!< the "σ" of each blob
+                    vector<Scalar> &blob_scores, //!< the score of each blob (updated)
+                    bool find_minima, //!< are the blobs minima (dark)?
+                    int search_radius, //!< consider voxels this close to the original location
+                    Scalar delta_sigma_over_sigma=0.02,//!< δ param for approximating LoG with DoG
+                    Scalar truncate_ratio=2.8 //!< how many sigma before truncating?
+                    )
+{
+  assert(blob_crds.size() == blob_sigma.size());
+  size_t n_blobs = blob_crds.size();
+  blob_scores.resize(n_blobs);
+
+  #pragma omp parallel for schedule(dynamic)
+  for (size_t i = 0; i < n_blobs; i++) {
+    // The filter extends this far from each voxel (see ApplyLog())
+    int halfwidth = floor(truncate_ratio * blob_sigma[i] *
+                          (1.0 + 0.5*delta_sigma_over_sigma));
+    int center[3];
+    int search_lo[3], search_hi[3]; // the region we search
+    int window_lo[3], window_size[3]; // the region we filter
+    for (int d = 0; d < 3; d++) {
+      center[d] = static_cast<int>(floor(blob_crds[i][d] + 0.5));
+      center[d] = std::max(0, std::min(center[d], image_size[d]-1));
+      search_lo[d] = std::max(0, center[d] - search_radius);
+      search_hi[d] = std::min(image_size[d]-1, center[d] + search_radius);
+      window_lo[d] = std::max(0, search_lo[d] - halfwidth);
+      int window_hi = std::min(image_size[d]-1, search_hi[d] + halfwidth);
+      window_size[d] = window_hi - window_lo[d] + 1;
+    }
+
+    // Copy the contents of the window (and the mask)
+    Scalar *afWindow;
+    Scalar ***aaafWindow;
+    Scalar *afWindowMask = nullptr;
+    Scalar ***aaafWindowMask = nullptr;
+    Scalar *afFiltered;
+    Scalar ***aaafFiltered;
+    Alloc3D(window_size, &afWindow, &aaafWindow);
+    Alloc3D(window_size, &afFiltered, &aaafFiltered);
+    if (aaafMask)
+      Alloc3D(window_size, &afWindowMask, &aaafWindowMask);
+    for (int iz = 0; iz < window_size[2]; iz++) {
+      for (int iy = 0; iy < window_size[1]; iy++) {
+        for (int ix = 0; ix < window_size[0]; ix++) {
+          int Ix = ix + window_lo[0];
+          int Iy = iy + window_lo[1];
+          int Iz = iz + window_lo[2];
+          aaafWindow[iz][iy][ix] = aaafSource[Iz][Iy][Ix];
+          if (aaafMask)
+            aaafWindowMask[iz][iy][ix] = aaafMask[Iz][Iy][Ix];
+        }
+      }
+    }
+
+    ApplyLog(window_size,
+             aaafWindow,
+             aaafFiltered,
+             aaafWindowMask,
+             blob_sigma[i],
+             delta_sigma_over_sigma,
+             truncate_ratio);
+
+    // Find the best voxel in the search region
+    bool found = false;
+    Scalar best_score = 0.0;
+    for (int Iz = search_lo[2]; Iz <= search_hi[2]; Iz++) {
+      for (int Iy = search_lo[1]; Iy <= search_hi[1]; Iy++) {
+        for (int Ix = search_lo[0]; Ix <= search_hi[0]; Ix++) {
+          if (aaafMask && (aaafMask[Iz][Iy][Ix] == 0.0))
+            continue;
+          Scalar score = aaafFiltered[Iz-window_lo[2]]
+                                     [Iy-window_lo[1]]
+                                     [Ix-window_lo[0]];
+          if ((! found) ||
+              (find_minima && (score < best_score)) ||
+              ((! find_minima) && (score > best_score))) {
+            found = true;
+            best_score = score;
+            blob_crds[i][0] = Ix;
+            blob_crds[i][1] = Iy;
+            blob_crds[i][2] = Iz;
+          }
+        }
+      }
+    }
+    blob_scores[i] = best_score;
+
+    Dealloc3D(window_size, &afWindow, &aaafWindow);
+    Dealloc3D(window_size, &afFiltered, &aaafFiltered);
+    if (aaafMask)
+      Dealloc3D(window_size, &afWindowMask, &aaafWindowMask);
+  } //for (size_t i = 0; i < n_blobs; i++)
+
+  // Merge blobs which have moved to the same location (with the same σ)
+  set<tuple<Scalar, Scalar, Scalar, Scalar> > already_found;
+  size_t n_kept = 0;
+  for (size_t i = 0; i < n_blobs; i++) {
+    auto key = make_tuple(blob_crds[i][0], blob_crds[i][1], blob_crds[i][2],
+                          blob_sigma[i]);
+    if (already_found.find(key) != already_found.end())
+      continue;
+    already_found.insert(key);
+    blob_crds[n_kept] = blob_crds[i];
+    blob_sigma[n_kept] = blob_sigma[i];
+    blob_scores[n_kept] = blob_scores[i];
+    n_kept++;
+  }
+  blob_crds.resize(n_kept);
+  blob_sigma.resize(n_kept);
+  blob_scores.resize(n_kept);
+} //RefineBlobLocations()
+
+
+
+
+/// @brief  Decide how many times an image can be downsampled (2x binned)
+///         before searching for blobs, given the smallest blob width (σ).
+///         At the chosen level, the narrowest LoG filter should still be at
+///         least "min_sigma" voxels wide (after accounting for the blur
+///         introduced by downsampling), and the image should still be at
+///         least "min_size" voxels wide in every direction.
+/// @return the number of levels (0 means do not downsample)
+
+template<typename Scalar>
+
+int
+ChooseBlobPyramidLevel(int const image_size[3], //!< source image size
+                       const vector<Scalar>& blob_sigma, //!< blob widths
+                       int max_level, //!< never downsample more than this
+                       Scalar min_sigma=1.5, //!< narrowest filter (in coarse voxels)
+                       int min_size=16 //!< smallest image (in coarse voxels)
+                       )
+{
+  if (blob_sigma.size() == 0)
+    return 0;
+  Scalar sigma_min = *std::min_element(blob_sigma.begin(), blob_sigma.end());
+  int level = 0;
+  for (int L = 1; L <= max_level; L++) {
+    double var = SQR(sigma_min) - ImagePyramid<Scalar>::BlurVariance(L);
+    if ((var <= 0.0) || (sqrt(var) / (1 << L) < min_sigma))
+      break;
+    bool too_small = false;
+    for (int d = 0; d < 3; d++)
+      if ((image_size[d] >> L) < min_size)
+        too_small = true;
+    if (too_small)
+      break;
+    level = L;
+  }
+  return level;
+} //ChooseBlobPyramidLevel()
+
+
+
+
+
+
 /// @brief Find all scale-invariant blobs in the image as a function of Gaussian
 ///        width (ie. the "sigma" parameter), regardless of overlap.  (A blob's
 ///        "sigma" parameter represents the optimal width of the Gaussian blur
@@ -261,7 +442,9 @@ BlobDog(int const image_size[3], //!< source image size
         bool use_threshold_ratios=true, //!< threshold=ratio*best_score ?
         ostream *pReportProgress = nullptr, //!< optional: report progress to the user?
         Scalar ****aaaafI = nullptr, //!<optional: preallocated memory for filtered images (indexable)
-        Scalar **aafI = nullptr      //!<optional: preallocated memory for filtered images (contiguous)
+        Scalar **aafI = nullptr,     //!<optional: preallocated memory for filtered images (contiguous)
+        bool incremental = false,    //!<optional: blur the image incrementally? (See ScaleSpaceLoG)
+        int max_pyramid_level = 0    //!<optional: search for blobs in a downsampled image? (See ImagePyramid)
         )
 
 {
@@ -285,6 +468,96 @@ BlobDog(int const image_size[3], //!< source image size
   if (pv_maxima_scores == nullptr)
     pv_maxima_scores = &maxima_scores;
 
+  // Optional: Search for blobs in a downsampled version of the image,
+  // and refine their locations afterwards using the original image.
+  int pyramid_level = ChooseBlobPyramidLevel(image_size,
+                                             blob_sigma,
+                                             max_pyramid_level);
+  if (pyramid_level > 0) {
+    if (pReportProgress)
+      *pReportProgress
+        << "\n----- Searching for blobs in an image downsampled by "
+        << (1 << pyramid_level) << "x -----\n\n";
+    ImagePyramid<Scalar> pyramid(image_size,
+                                 aaafSource,
+                                 aaafMask,
+                                 pyramid_level,
+                                 pReportProgress);
+    // The widths of the blobs in the downsampled image are smaller.
+    // (We must also subtract the blur introduced by downsampling.)
+    vector<Scalar> coarse_sigma(blob_sigma.size());
+    for (size_t ir = 0; ir < blob_sigma.size(); ir++)
+      coarse_sigma[ir] =
+        sqrt(SQR(blob_sigma[ir]) -
+             ImagePyramid<Scalar>::BlurVariance(pyramid_level))
+        / (1 << pyramid_level);
+    BlobDog(pyramid.size(pyramid_level),
+            pyramid.image(pyramid_level),
+            pyramid.mask(pyramid_level),
+            coarse_sigma,
+            pva_minima_crds,
+            pva_maxima_crds,
+            pv_minima_sigma,
+            pv_maxima_sigma,
+            pv_minima_scores,
+            pv_maxima_scores,
+            delta_sigma_over_sigma,
+            truncate_ratio,
+            minima_threshold,
+            maxima_threshold,
+            use_threshold_ratios,
+            pReportProgress,
+            static_cast<Scalar****>(nullptr),
+            static_cast<Scalar**>(nullptr),
+            incremental);
+
+    // Convert the locations and widths back to the original image
+    vector<Scalar> *apv_sigma[2] = {pv_minima_sigma, pv_maxima_sigma};
+    vector<array<Scalar,3> > *apva_crds[2] = {pva_minima_crds,
+                                              pva_maxima_crds};
+    for (int m = 0; m < 2; m++) {
+      for (size_t i = 0; i < apv_sigma[m]->size(); i++) {
+        size_t ir = std::find(coarse_sigma.begin(), coarse_sigma.end(),
+                              (*apv_sigma[m])[i]) - coarse_sigma.begin();
+        assert(ir < blob_sigma.size());
+        (*apv_sigma[m])[i] = blob_sigma[ir];
+        for (int d = 0; d < 3; d++)
+          (*apva_crds[m])[i][d] =
+            ImagePyramid<Scalar>::CoarseToFine((*apva_crds[m])[i][d],
+                                               pyramid_level);
+      }
+    }
+
+    if (pReportProgress)
+      *pReportProgress
+        << " Refining the locations of " << pva_minima_crds->size()
+        << " and " << pva_maxima_crds->size()
+        << " minima and maxima blobs, respectively...\n";
+    RefineBlobLocations(image_size,
+                        aaafSource,
+                        aaafMask,
+                        *pva_minima_crds,
+                        *pv_minima_sigma,
+                        *pv_minima_scores,
+                        true,
+                        1 << pyramid_level,
+                        delta_sigma_over_sigma,
+                        truncate_ratio);
+    RefineBlobLocations(image_size,
+                        aaafSource,
+                        aaafMask,
+                        *pva_maxima_crds,
+                        *pv_maxima_sigma,
+                        *pv_maxima_scores,
+                        false,
+                        1 << pyramid_level,
+                        delta_sigma_over_sigma,
+                        truncate_ratio);
+    if (pReportProgress)
+      *pReportProgress << " ...done.\n" << endl;
+    return;
+  } //if (pyramid_level > 0)
+
   // We need 3 images to store the result of filtering the image
   // using DoG filters with 3 different widths.  Store those images here:
 
@@ -313,6 +586,25 @@ BlobDog(int const image_size[3], //!< source image size
   }
 
 
+  // Optional: Compute the filtered images incrementally (each one from the
+  // previous one) instead of filtering the original image from scratch each
+  // time.  This requires the blob widths to be in increasing order.
+  ScaleSpaceLoG<Scalar> *pScaleSpace = nullptr;
+  if (incremental &&
+      std::is_sorted(blob_sigma.begin(), blob_sigma.end()))
+  {
+    if (pReportProgress)
+      *pReportProgress
+        << " -- Attempting to allocate space for "
+        << (aaafMask ? 4 : 2) << " more images.        --\n"
+        << " --  (needed for incremental blurring)                   --\n";
+    pScaleSpace = new ScaleSpaceLoG<Scalar>(image_size,
+                                            aaafSource,
+                                            aaafMask,
+                                            delta_sigma_over_sigma,
+                                            truncate_ratio);
+  }
+
   Scalar global_min_score = 1.0;  //impossible, minima < 0
   Scalar global_max_score = -1.0; //impossible, maxima > 0
 
@@ -361,13 +653,17 @@ BlobDog(int const image_size[3], //!< source image size
 
     //Apply the LoG filter (approximated with a DoG filter)
     //      ...using the most recent blob width:
-    ApplyLog(image_size,
-             aaafSource,
-             aaaafI[j2i[1]], //<-store the most recent filtered image
-             aaafMask,
-             blob_sigma[ir],
-             delta_sigma_over_sigma,
-             truncate_ratio);
+    if (pScaleSpace)
+      pScaleSpace->Apply(blob_sigma[ir],
+                         aaaafI[j2i[1]]); //<-store the most recent image
+    else
+      ApplyLog(image_size,
+               aaafSource,
+               aaaafI[j2i[1]], //<-store the most recent filtered image
+               aaafMask,
+               blob_sigma[ir],
+               delta_sigma_over_sigma,
+               truncate_ratio);
 
     // We must have filtered at least 3 images using different blob widths
     if (ir < 2)
@@ -425,12 +721,13 @@ BlobDog(int const image_size[3], //!< source image size
           for (int ix = 0; ix < image_size[0]; ix++) {
             // Search the 81-1 = 80 surrounding voxels to see if this voxel is
             // either a minima or a maxima in 4-dimensional x,y,z,r space
+            // (Most voxels are neither, so stop as soon as we know that.)
             bool is_minima = true;
             bool is_maxima = true;
-            for (int jr = -1; jr <= 1; jr++) {
-              for (int jz = -1; jz <= 1; jz++) {
-                for (int jy = -1; jy <= 1; jy++) {
-                  for (int jx = -1; jx <= 1; jx++) {
+            for (int jr = -1; (jr <= 1) && (is_minima || is_maxima); jr++) {
+              for (int jz = -1; (jz <= 1) && (is_minima || is_maxima); jz++) {
+                for (int jy = -1; (jy <= 1) && (is_minima || is_maxima); jy++) {
+                  for (int jx = -1; (jx <= 1) && (is_minima || is_maxima); jx++) {
                     if (jx==0 && jy==0 && jz==0 && jr==0)
                       continue; // Skip the central voxel. Check neighbors only
                     int Ix = ix + jx;
@@ -556,6 +853,9 @@ BlobDog(int const image_size[3], //!< source image size
 
   } //for (ir = 0; ir < blob_sigma.size(); ir++)
 
+  if (pScaleSpace)
+    delete pScaleSpace;
+
 
 
   if ((minima_threshold != std::numeric_limits<Scalar>::infinity()) ||
@@ -673,7 +973,9 @@ BlobDogD(int const image_size[3], //!<source image size
          bool    use_threshold_ratios=false, //!<threshold=ratio*best_score?
          ostream *pReportProgress = nullptr, //!<report progress to the user?
          Scalar ****aaaafI = nullptr, //!<preallocated memory for filtered images
-         Scalar **aafI = nullptr     //!<preallocated memory for filtered images (conserve memory)
+         Scalar **aafI = nullptr,    //!<preallocated memory for filtered images (conserve memory)
+         bool incremental = false,   //!<blur the image incrementally? (See ScaleSpaceLoG)
+         int max_pyramid_level = 0   //!<search for blobs in a downsampled image? (See ImagePyramid)
          )
 {
 
@@ -700,7 +1002,9 @@ BlobDogD(int const image_size[3], //!<source image size
           use_threshold_ratios,
           pReportProgress,
           aaaafI,
-          aafI);
+          aafI,
+          incremental,
+          max_pyramid_level);
 
   if (pv_minima_diameters) {
     pv_minima_diameters->resize(minima_sigma.size());
@@ -1343,8 +1647,8 @@ CalcHessian(int const image_size[3], //!< source image size
 
   // Now compute gradients and hessians
 
+  #pragma omp parallel for collapse(2)
   for (int iz = 0; iz < image_size[2]; iz++) {
-    #pragma omp parallel for collapse(2)
     for (int iy = 0; iy < image_size[1]; iy++) {
       for (int ix = 0; ix < image_size[0]; ix++) {
         if (aaafMask && (aaafMask[iz][iy][ix] == 0.0))
@@ -2078,6 +2382,145 @@ ScoreHessianPlanar(TensorContainer diagonalizedHessian,
 
 
 
+/// @brief  Calculate the hessian of the source image (after blurring it with
+///         a Gaussian of width sigma), diagonalize it, and store only the
+///         planar ridge score (see ScoreHessianPlanar()) and the principal
+///         eigenvector at every location where aaafMask is non-zero.
+///         This produces the same results as invoking CalcHessian(), followed
+///         by DiagonalizeHessianImage() and ScoreHessianPlanar(), but the
+///         image is only traversed once after blurring.  The hessian at
+///         each voxel is computed from the blurred image (one thin slab at a
+///         time per thread) and diagonalized in temporary variables.
+///         The full 6-channel hessian image is only stored if requested
+///         (ie. if aaaafHessian != nullptr).
+/// @note   Voxels outside the mask are assigned a score of 0.
+///         (aaaafDirection and aaaafHessian are not modified at these voxels.)
+/// @note   The "VectorContainer" and "TensorContainer" objects are expected
+///         to behave like one-dimensional arrays of 3 and 6 scalars.
+
+template<typename Scalar, typename VectorContainer=Scalar*, typename TensorContainer=Scalar*>
+
+void
+CalcHessianPlanarScore(int const image_size[3], //!< source image size
+                       Scalar const *const *const *aaafSource, //!< source image
+                       Scalar ***aaafScore, //!< store the planar ridge score here
+                       VectorContainer ***aaaafDirection, //!< store the principal eigenvector here (if not nullptr)
+                       TensorContainer ***aaaafHessian, //!< also store the hessian here (if not nullptr)
+                       Scalar const *const *const *aaafMask, //!< ignore voxels where mask==0
+                       Scalar sigma, //!< Gaussian width in x,y,z drections
+                       EigenOrderType eival_order = selfadjoint_eigen3::INCREASING_EIVALS, //!< which eigenvector is the principal eigenvector? (See DiagonalizeHessianImage())
+                       Scalar truncate_ratio=2.5, //!< how many sigma before truncating?
+                       ostream *pReportProgress = nullptr //!< print progress to the user?
+                       )
+{
+  assert(aaafSource);
+  assert(aaafScore);
+
+  if ((image_size[0] < 3) ||
+      (image_size[1] < 3) ||
+      (image_size[2] < 3))
+    throw VisfdErr("Error: CalcHessianPlanarScore() requires an image that is at least 3 voxels\n"
+                   "       wide in the x,y,z directions.\n");
+
+  int truncate_halfwidth = floor(sigma * truncate_ratio);
+
+  // First smooth the image.  (See the comments in CalcHessian().)
+  if (pReportProgress)
+    *pReportProgress
+      << " -- Attempting to allocate space for one more image.       --\n"
+      << " -- (If this crashes your computer, find a computer with   --\n"
+      << " --  more RAM and use \"ulimit\", OR use a smaller image.)   --\n"
+      << "\n";
+
+  Scalar ***aaafSmoothed;
+  Scalar *afSmoothed;
+  Alloc3D(image_size,
+          &afSmoothed,
+          &aaafSmoothed);
+
+  ApplyGauss(image_size,
+             aaafSource,
+             aaafSmoothed,
+             aaafMask,
+             sigma,
+             truncate_halfwidth,
+             false,
+             pReportProgress);
+
+  if (pReportProgress)
+    *pReportProgress << "Calculating and diagonalizing the Hessian"
+                     << " associated with each voxel\n";
+
+  // Each thread processes a contiguous range of rows.  Since the
+  // hessian at each voxel depends only on the 3x3x3 voxels surrounding it,
+  // the rows of the blurred image needed by each thread remain in the cache.
+  #pragma omp parallel for collapse(2) schedule(static)
+  for (int iz = 0; iz < image_size[2]; iz++) {
+    for (int iy = 0; iy < image_size[1]; iy++) {
+      for (int ix = 0; ix < image_size[0]; ix++) {
+        if (aaafMask && (aaafMask[iz][iy][ix] == 0.0)) {
+          aaafScore[iz][iy][ix] = 0.0;
+          continue;
+        }
+
+        Scalar hessian[3][3];
+        CalcHessianFiniteDifferences(aaafSmoothed,
+                                     ix, iy, iz,
+                                     hessian,
+                                     image_size);
+
+        // Insure that the result is dimensionless (see CalcHessian())
+        double matrix[3][3];
+        for (int di=0; di < 3; di++) {
+          for (int dj=0; dj < 3; dj++) {
+            hessian[di][dj] *= sigma*sigma;
+            matrix[di][dj] = hessian[di][dj];
+          }
+        }
+
+        if (aaaafHessian) {
+          for (int di = 0; di < 3; di++)
+            for (int dj = di; dj < 3; dj++)
+              aaaafHessian[iz][iy][ix][ MapIndices_3x3_to_linear[di][dj] ]
+                = hessian[di][dj];
+        }
+
+        double eivals[3];
+        double eivects[3][3];
+        DiagonalizeSym3(matrix,
+                        eivals,
+                        eivects,
+                        eival_order);
+
+        // Use the same conventions as DiagonalizeFlatSym3(), which stores
+        // the eigenvalues as Scalars, and flips the sign of the first
+        // eigenvector if necessary so that the eigenvectors form a rotation.
+        Scalar diagonalized_hessian[3];
+        for (int d = 0; d < 3; d++)
+          diagonalized_hessian[d] = eivals[d];
+
+        aaafScore[iz][iy][ix] = ScoreHessianPlanar(diagonalized_hessian,
+                                                   static_cast<Scalar*>(nullptr));
+
+        if (aaaafDirection) {
+          double sign = (Determinant3(eivects) < 0.0) ? -1.0 : 1.0;
+          for (int d = 0; d < 3; d++)
+            aaaafDirection[iz][iy][ix][d] = sign * eivects[0][d];
+        }
+      } //for (int ix = 0; ix < image_size[0]; ix++)
+    } //for (int iy = 0; iy < image_size[1]; iy++)
+  } //for (int iz = 0; iz < image_size[2]; iz++)
+
+  Dealloc3D(image_size,
+            &afSmoothed,
+            &aaafSmoothed);
+
+} //CalcHessianPlanarScore()
+
+
+
+
+
 /// @brief: Calculate how "plane"-like a feature along a ridge is
 ///         from the tensor created by the process of tensor voting.
 ///         This function assumes that "diagonalizedMatrix3x3" has been 
@@ -2099,6 +2542,66 @@ ScoreTensorPlanar(const TensorContainer diagonalizedMatrix3)
 
 
 
+/// @brief  The minimum width of the cubic "bricks" that TV3D::TVDenseStick()
+///         divides the image into.  (Each thread casts the votes from one
+///         brick at a time.  Bricks are also at least 2*halfwidth wide.)
+const int TV3D_MIN_BRICK_WIDTH = 16;
+
+
+/// @brief  (This value for the EXPONENT template parameter of
+///          _TVAngularDecay indicates the exponent is not known until
+///          run time.  Exponents from 1 to 16 are known at compile time.)
+const int TV3D_EXPONENT_RUNTIME = -1;
+
+
+/// @brief  Raise "x" to an integer power, N, known at compile time.
+///         (The compiler replaces this with a short chain of multiplications.)
+template<int N>
+struct _IntPower {
+  template<typename Scalar>
+  static inline Scalar Eval(Scalar x) {
+    return (N % 2 ? x : 1) * _IntPower<N/2>::Eval(x*x);
+  }
+};
+
+template<>
+struct _IntPower<0> {
+  template<typename Scalar>
+  static inline Scalar Eval(Scalar /*x*/) {
+    return 1;
+  }
+};
+
+
+/// @brief  Calculate the angular decay used in tensor voting:
+///         (angle_dependence)^EXPONENT, given angle_dependence2 (its square)
+template<int EXPONENT>
+struct _TVAngularDecay {
+  template<typename Scalar>
+  static inline Scalar Eval(Scalar angle_dependence2,
+                            int /*exponent*/) {
+    Scalar decay = _IntPower<EXPONENT/2>::Eval(angle_dependence2);
+    if (EXPONENT % 2)
+      decay *= sqrt(std::max(angle_dependence2, static_cast<Scalar>(0.0)));
+    return decay;
+  }
+};
+
+/// @brief  Calculate the angular decay used in tensor voting for other
+///         exponents.  (This is slower, although most compilers can evaluate
+///         pow() for several voxels simultaneously using SIMD instructions,
+///         as long as its arguments are the same type.)
+template<>
+struct _TVAngularDecay<TV3D_EXPONENT_RUNTIME> {
+  template<typename Scalar>
+  static inline Scalar Eval(Scalar angle_dependence2,
+                            int exponent) {
+    return pow(angle_dependence2, static_cast<Scalar>(0.5*exponent));
+  }
+};
+
+
+
 /// @class  TV3D
 /// @brief  A class for performing simple tensor-voting image processing 
 ///         operations in 3D.  Currently only "stick" voting is supported.
@@ -2121,6 +2624,7 @@ private:
   Filter3D<Scalar, Integer> radial_decay_lookup;
   array<Scalar, 3> ***aaaafDisplacement;
   array<Scalar, 3> *aafDisplacement;
+  Filter3D<Scalar, Integer> displacement_lookup[3]; //!< the x,y,z components of aaaafDisplacement (stored separately to simplify SIMD)
 
 public:
 
@@ -2190,9 +2694,10 @@ public:
   /// @note:  The computation time for this algorithm is proportional to the 
   ///         number of voxels with non-zero aaafSaliency[][][] values.
   ///         Hence, the speed can be dramatically increased by zeroing
-  ///         voxels with low saliency.  For typical cryo-EM images of
-  ///         cells, 95% of the voxels can usually be discarded (by setting
-  ///         their saliencies to zero), with no effect on the output.
+  ///         voxels with low saliency (or by using the "saliency_threshold"
+  ///         argument).  For typical cryo-EM images of cells, 95% of the
+  ///         voxels can usually be discarded, with no effect on the output.
+  ///         (Only the remaining "salient" voxels are visited when voting.)
 
   void
   TVDenseStick(Integer const image_size[3],  //!< source image size
@@ -2202,7 +2707,7 @@ public:
                Scalar const *const *const *aaafMaskSource=nullptr,  //!< ignore voxels in source where mask==0
                Scalar const *const *const *aaafMaskDest=nullptr,  //!< don't cast votes wherever mask==0
                bool detect_curves_not_surfaces=false, //!< do "sticks" represent curve tangents (instead of surface normals)?
-               //Scalar saliency_threshold = 0.0,
+               Scalar saliency_threshold=0.0, //!< voxels with |saliency| <= this cast no votes
                bool normalize=true, //!< normalize aaaafDest due to incomplete sums near boundaries?
                bool diagonalize_dest=false, //!< diagonalize each tensor in aaaafDest?
                ostream *pReportProgress=nullptr  //!< print progress to the user?
@@ -2237,8 +2742,8 @@ public:
       Alloc3D(image_size,
               &(_afSaliency),
               &(_aaafSaliency));
+      #pragma omp parallel for collapse(2)
       for (Integer iz=0; iz<image_size[2]; iz++) {
-        #pragma omp parallel for collapse(2)
         for (Integer iy=0; iy<image_size[1]; iy++) {
           for (Integer ix=0; ix<image_size[0]; ix++) {
             if ((! aaafMaskDest) || (aaafMaskDest[iz][iy][ix] == 0))
@@ -2258,7 +2763,7 @@ public:
                  aaafMaskSource,
                  aaafMaskDest,
                  detect_curves_not_surfaces,
-                 //saliency_threshold,
+                 saliency_threshold,
                  aaafDenominator,
                  pReportProgress);
 
@@ -2275,8 +2780,8 @@ public:
       if (aaafMaskSource) {
 
         assert(aaafDenominator);
+        #pragma omp parallel for collapse(2)
         for (Integer iz=0; iz<image_size[2]; iz++) {
-          #pragma omp parallel for collapse(2)
           for (Integer iy=0; iy<image_size[1]; iy++) {
             for (Integer ix=0; ix<image_size[0]; ix++) {
               if ((! aaafMaskDest) || (aaafMaskDest[iz][iy][ix] == 0))
@@ -2326,8 +2831,8 @@ public:
           filter1d.Apply(image_size[d], afAllOnes, aafDenom_precomputed[d]);
           delete [] afAllOnes;
         }
+        #pragma omp parallel for collapse(2)
         for (Integer iz = 0; iz < image_size[2]; iz++) {
-          #pragma omp parallel for collapse(2)
           for (Integer iy = 0; iy < image_size[1]; iy++) {
             for (Integer ix = 0; ix < image_size[0]; ix++) {
               if ((! aaafMaskDest) || (aaafMaskDest[iz][iy][ix] == 0))
@@ -2405,7 +2910,7 @@ private:
                Scalar const *const *const *aaafMaskSource=nullptr,  //!< ignore voxels in source where mask==0
                Scalar const *const *const *aaafMaskDest=nullptr,  //!< don't cast votes wherever mask==0
                bool detect_curves_not_surfaces=false,
-               //Scalar saliency_threshold = 0.0,
+               Scalar saliency_threshold=0.0,
                Scalar ***aaafDenominator=nullptr,
                ostream *pReportProgress=nullptr  //!< print progress to the user?
                )
@@ -2426,8 +2931,8 @@ private:
             if (aaafMaskSource && (aaafMaskSource[iz][iy][ix] == 0))
               continue;
             n_all++;
-            //if (aaafSaliency[iz][iy][ix] > saliency_threshold)
-            if (aaafSaliency[iz][iy][ix] != 0.0)
+            if ((aaafSaliency[iz][iy][ix] != 0.0) &&
+                (abs(aaafSaliency[iz][iy][ix]) > saliency_threshold))
               n_salient++;
           }
         }
@@ -2441,12 +2946,15 @@ private:
 
 
     // First, initialize the arrays which will store the results with zeros.
+    // (Voxels outside aaafMaskDest are skipped.  For some kinds of
+    //  TensorContainers, no space is allocated for these voxels.)
     for (Integer iz=0; iz<image_size[2]; iz++)
       for (Integer iy=0; iy<image_size[1]; iy++)
         for (Integer ix=0; ix<image_size[0]; ix++)
-          for (int di=0; di<3; di++)
-            for (int dj=0; dj<3; dj++)
-              aaaafDest[iz][iy][ix][ MapIndices_3x3_to_linear[di][dj] ] = 0.0;
+          if ((! aaafMaskDest) || (aaafMaskDest[iz][iy][ix] != 0.0))
+            for (int di=0; di<3; di++)
+              for (int dj=0; dj<3; dj++)
+                aaaafDest[iz][iy][ix][ MapIndices_3x3_to_linear[di][dj] ] = 0.0;
 
     if (aaafDenominator) {
       // aaafDenominator[][][] keeps track of how much of the sum of
@@ -2465,68 +2973,165 @@ private:
     //assert(pV->nchannels() == 3);
     //pV->Resize(image_size, aaafMaskSource, pReportProgress);
 
+    // Most voxels in a typical image have negligible saliency and cast no
+    // votes.  So rather than visiting every voxel in the image, first make
+    // a (sparse) list of the voxels which will cast votes.  To allow these
+    // voters to cast votes in parallel without interfering with each other,
+    // the image is divided into cubic "bricks".  Each thread casts the votes
+    // from all of the voters in one brick into a (private) tile of memory,
+    // and then adds the contents of that tile to aaaafDest.  A tile extends
+    // beyond its brick by "halfwidth" voxels in each direction.  The bricks
+    // are at least 2*halfwidth voxels wide, so tiles belonging to bricks
+    // which are not adjacent never overlap.  The bricks are divided into 8
+    // groups ("colors") which contain no adjacent bricks, and each group is
+    // processed in parallel, one group at a time.
+
+    Integer brick_width = 2*std::max(std::max(halfwidth[0], halfwidth[1]),
+                                     halfwidth[2]);
+    if (brick_width < TV3D_MIN_BRICK_WIDTH)
+      brick_width = TV3D_MIN_BRICK_WIDTH;
+    Integer num_bricks[3];
+    for (int d=0; d<3; d++)
+      num_bricks[d] = (image_size[d] + brick_width - 1) / brick_width;
+
+    // The voters belonging to each brick:
+    vector<vector<array<Integer, 3> > >
+      vVoters(num_bricks[0] * num_bricks[1] * num_bricks[2]);
+    for (Integer iz=0; iz<image_size[2]; iz++) {
+      for (Integer iy=0; iy<image_size[1]; iy++) {
+        for (Integer ix=0; ix<image_size[0]; ix++) {
+          Scalar saliency = aaafSaliency[iz][iy][ix];
+          if ((saliency == 0.0) || (abs(saliency) <= saliency_threshold))
+            continue;
+          if (aaafMaskSource && (aaafMaskSource[iz][iy][ix] == 0.0))
+            continue;
+          size_t i_brick = ((iz / brick_width) * num_bricks[1] +
+                            (iy / brick_width)) * num_bricks[0] +
+                            (ix / brick_width);
+          array<Integer, 3> voter = {ix, iy, iz};
+          vVoters[i_brick].push_back(voter);
+        }
+      }
+    }
+
+    // Sort the non-empty bricks into 8 groups ("colors")
+    vector<size_t> vColorBricks[8];
+    for (Integer bz=0; bz<num_bricks[2]; bz++) {
+      for (Integer by=0; by<num_bricks[1]; by++) {
+        for (Integer bx=0; bx<num_bricks[0]; bx++) {
+          size_t i_brick = (bz*num_bricks[1] + by)*num_bricks[0] + bx;
+          if (vVoters[i_brick].size() == 0)
+            continue;
+          int color = (bx % 2) + 2*(by % 2) + 4*(bz % 2);
+          vColorBricks[color].push_back(i_brick);
+        }
+      }
+    }
+
     if (pReportProgress)
       *pReportProgress << "---- Begin Tensor Voting (dense, stick) ----\n"
-                       << "  progress: processing plane#" << endl;
+                       << "  progress: processing brick group#" << endl;
 
-    // The mask should be 1 everywhere we want to consider, and 0 elsewhere.
-    // Multiplying the density in the tomogram by the mask removes some of 
-    // the voxels from consideration later on when we do the filtering.
-    // (Later, we will adjust the weight of the average we compute when we
-    //  apply the filter in order to account for the voxels we deleted now.)
+    size_t max_tile_size = 1;
+    for (int d=0; d<3; d++)
+      max_tile_size *= std::min(brick_width + 2*halfwidth[d], image_size[d]);
 
-    for (Integer iz=0; iz<image_size[2]; iz++) {
+    #pragma omp parallel
+    {
+      // Each thread stores the votes it casts in these arrays:
+      vector<Scalar> vTile(6 * max_tile_size);
+      vector<Scalar> vTileDenom;
+      if (aaafDenominator)
+        vTileDenom.resize(max_tile_size);
 
-      if (pReportProgress)
-        *pReportProgress << "  " << iz+1 << " / " << image_size[2] << "\n";
+      for (int color=0; color<8; color++) {
 
-      #pragma omp parallel for collapse(2)
-      for (Integer iy=0; iy<image_size[1]; iy++) {
+        #pragma omp master
+        {
+          if (pReportProgress)
+            *pReportProgress << "  " << color+1 << " / " << 8 << "\n";
+        }
 
-        for (Integer ix=0; ix<image_size[0]; ix++) {
+        #pragma omp for schedule(dynamic)
+        for (size_t i=0; i < vColorBricks[color].size(); i++) {
+          vector<array<Integer, 3> > &voters = vVoters[vColorBricks[color][i]];
 
-          // ------------ Uncomment whichever is faster: -----------
-          // EITHER uncomment TVCastStickVotes() or TVReceiveStickVotes()
-          // (VERSION1 OR VERSION2), BUT NOT BOTH
-
-          // VERSION1:
-          //           Have the voxel at ix,iy,iz cast votes at nearby voxels:
-
-          TVCastStickVotes(ix, iy, iz,
-                           image_size,
-                           aaafSaliency,
-                           aaaafV,
-                           aaaafDest,
-                           aaafMaskSource,
-                           aaafMaskDest,
-                           detect_curves_not_surfaces,
-                           //saliency_threshold,
-                           aaafDenominator);
-
-          // VERSION 2: Have the voxel at ix,iy,iz receive votes
-          //            from nearby voxels
-          //
-          //TVReceiveStickVotes(ix, iy, iz,
-          //                    image_size,
-          //                    aaafSaliency,
-          //                    aaaafV,
-          //                    aaaafDest,
-          //                    aaafMaskSource,
-          //                    aaafMaskDest,
-          //                    detect_curves_not_surfaces,
-          //                    //saliency_threshold,
-          //                    (aaafDenominator
-          //                     ? &(aaafDenominator[iz][iy][ix])
-          //                     : nullptr));
+          // The tile only needs to enclose the voters in this brick
+          // (and the voxels within "halfwidth" of them).
+          Integer tile_begin[3];
+          Integer tile_end[3];
+          for (int d=0; d<3; d++) {
+            tile_begin[d] = voters[0][d];
+            tile_end[d] = voters[0][d];
+          }
+          for (auto pv = voters.begin(); pv != voters.end(); pv++) {
+            for (int d=0; d<3; d++) {
+              tile_begin[d] = std::min(tile_begin[d], (*pv)[d]);
+              tile_end[d] = std::max(tile_end[d], (*pv)[d]);
+            }
+          }
+          Integer tile_size[3];
+          for (int d=0; d<3; d++) {
+            tile_begin[d] = std::max(tile_begin[d] - halfwidth[d],
+                                     static_cast<Integer>(0));
+            tile_end[d] = std::min(tile_end[d] + halfwidth[d] + 1,
+                                   image_size[d]);
+            tile_size[d] = tile_end[d] - tile_begin[d];
+          }
+          size_t tile_nvoxels = tile_size[0] * tile_size[1] * tile_size[2];
+          assert(tile_nvoxels <= max_tile_size);
 
-        }
-      }
-    }
+          std::fill(vTile.begin(), vTile.begin() + 6*tile_nvoxels, 0.0);
+          if (aaafDenominator)
+            std::fill(vTileDenom.begin(), vTileDenom.begin()+tile_nvoxels, 0.0);
+
+          for (auto pv = voters.begin(); pv != voters.end(); pv++)
+            TVCastStickVotes((*pv)[0], (*pv)[1], (*pv)[2],
+                             image_size,
+                             aaafSaliency,
+                             aaaafV,
+                             tile_begin,
+                             tile_size,
+                             vTile.data(),
+                             aaafMaskSource,
+                             detect_curves_not_surfaces,
+                             (aaafDenominator
+                              ? vTileDenom.data()
+                              : nullptr));
+
+          // Now add the votes in the tile to aaaafDest (and aaafDenominator).
+          // (No other thread is writing to this region of the image now.)
+          for (Integer tz=0; tz<tile_size[2]; tz++) {
+            Integer iz = tile_begin[2] + tz;
+            for (Integer ty=0; ty<tile_size[1]; ty++) {
+              Integer iy = tile_begin[1] + ty;
+              for (Integer tx=0; tx<tile_size[0]; tx++) {
+                Integer ix = tile_begin[0] + tx;
+                if (aaafMaskDest && (aaafMaskDest[iz][iy][ix] == 0.0))
+                  continue;
+                size_t it = (tz*tile_size[1] + ty)*tile_size[0] + tx;
+                for (int k=0; k<6; k++)
+                  aaaafDest[iz][iy][ix][k] += vTile[k*tile_nvoxels + it];
+                if (aaafDenominator)
+                  aaafDenominator[iz][iy][ix] += vTileDenom[it];
+              }
+            }
+          }
+        } //for (size_t i=0; i < vColorBricks[color].size(); i++)
+      } //for (int color=0; color<8; color++)
+    } //#pragma omp parallel
 
   } //TVDenseStick()
 
 
-  /// @brief  Cast stick votes from one voxel to all nearby voxels
+  /// @brief  Cast stick votes from one voxel to all nearby voxels.
+  ///         The votes are added to a (rectangular) tile of memory
+  ///         (afTile) which must enclose all of the voxels (in the image)
+  ///         within "halfwidth" of the voter.  The tile stores each of the
+  ///         6 entries of the (symmetric) tensors in a separate 3D array.
+  ///         (This way, the votes cast at adjacent voxels are contiguous.)
+  ///         (Votes are cast everywhere in the tile, including voxels
+  ///          outside the destination mask.  The caller ignores them.)
   void
   TVCastStickVotes(Integer ix,  //!< coordinates of the voter
                    Integer iy,  //!< coordinates of the voter
@@ -2534,20 +3139,88 @@ private:
                    Integer const image_size[3],
                    Scalar const *const *const *aaafSaliency, //!< saliency (score) of each voxel (usually calculated from Hessian eigenvalues)
                    VectorContainer const *const *const *aaaafV,  //!< vector associated with each voxel
-                   TensorContainer ***aaaafDest,  //!< votes will be collected here
+                   Integer const tile_begin[3], //!< location of the tile's corner in the image
+                   Integer const tile_size[3], //!< size of the tile
+                   Scalar *afTile,  //!< votes will be collected here
                    Scalar const *const *const *aaafMaskSource,  //!< ignore voxels in source where mask==0
-                   Scalar const *const *const *aaafMaskDest,  //!< ignore voxels in dest where mask==0
                    bool detect_curves_not_surfaces = false,
-                   //Scalar saliency_threshold = 0.0,
-                   Scalar ***aaafDenominator = nullptr) const
+                   Scalar *afTileDenominator = nullptr) const
+  {
+    // The angular part of the vote is (cos θ)^exponent (see below).
+    // Invoke a version of _TVCastStickVotes() which was compiled for this
+    // exponent, so that this power can be calculated using multiplication.
+    // (Other exponents are handled by a slower version which invokes pow().)
+    void (TV3D::*pCastStickVotes)(Integer, Integer, Integer,
+                                  Integer const *,
+                                  Scalar const *const *const *,
+                                  VectorContainer const *const *const *,
+                                  Integer const *,
+                                  Integer const *,
+                                  Scalar *,
+                                  Scalar const *const *const *,
+                                  bool,
+                                  Scalar *) const;
+    switch(exponent) {
+    case 1: pCastStickVotes = &TV3D::template _TVCastStickVotes<1>; break;
+    case 2: pCastStickVotes = &TV3D::template _TVCastStickVotes<2>; break;
+    case 3: pCastStickVotes = &TV3D::template _TVCastStickVotes<3>; break;
+    case 4: pCastStickVotes = &TV3D::template _TVCastStickVotes<4>; break;
+    case 5: pCastStickVotes = &TV3D::template _TVCastStickVotes<5>; break;
+    case 6: pCastStickVotes = &TV3D::template _TVCastStickVotes<6>; break;
+    case 7: pCastStickVotes = &TV3D::template _TVCastStickVotes<7>; break;
+    case 8: pCastStickVotes = &TV3D::template _TVCastStickVotes<8>; break;
+    case 9: pCastStickVotes = &TV3D::template _TVCastStickVotes<9>; break;
+    case 10: pCastStickVotes = &TV3D::template _TVCastStickVotes<10>; break;
+    case 11: pCastStickVotes = &TV3D::template _TVCastStickVotes<11>; break;
+    case 12: pCastStickVotes = &TV3D::template _TVCastStickVotes<12>; break;
+    case 13: pCastStickVotes = &TV3D::template _TVCastStickVotes<13>; break;
+    case 14: pCastStickVotes = &TV3D::template _TVCastStickVotes<14>; break;
+    case 15: pCastStickVotes = &TV3D::template _TVCastStickVotes<15>; break;
+    case 16: pCastStickVotes = &TV3D::template _TVCastStickVotes<16>; break;
+    default:
+      pCastStickVotes = &TV3D::template _TVCastStickVotes<TV3D_EXPONENT_RUNTIME>;
+      break;
+    }
+    (this->*pCastStickVotes)(ix, iy, iz,
+                             image_size,
+                             aaafSaliency,
+                             aaaafV,
+                             tile_begin,
+                             tile_size,
+                             afTile,
+                             aaafMaskSource,
+                             detect_curves_not_surfaces,
+                             afTileDenominator);
+  } // TVCastStickVotes()
+
+
+
+  /// @brief  This version of TVCastStickVotes() was compiled for a specific
+  ///         angular exponent.  (If EXPONENT equals TV3D_EXPONENT_RUNTIME,
+  ///         then the "exponent" member is used instead.)
+  ///         The inner loop processes several neighbors at once (using SIMD
+  ///         instructions), so it avoids branching.
+  template<int EXPONENT>
+  void
+  _TVCastStickVotes(Integer ix,  //!< coordinates of the voter
+                    Integer iy,  //!< coordinates of the voter
+                    Integer iz,  //!< coordinates of the voter
+                    Integer const image_size[3],
+                    Scalar const *const *const *aaafSaliency, //!< saliency (score) of each voxel (usually calculated from Hessian eigenvalues)
+                    VectorContainer const *const *const *aaaafV,  //!< vector associated with each voxel
+                    Integer const tile_begin[3], //!< location of the tile's corner in the image
+                    Integer const tile_size[3], //!< size of the tile
+                    Scalar *afTile,  //!< votes will be collected here
+                    Scalar const *const *const *aaafMaskSource,  //!< ignore voxels in source where mask==0
+                    bool detect_curves_not_surfaces,
+                    Scalar *afTileDenominator) const
   {
     assert(aaafSaliency);
     assert(aaaafV);
-    assert(aaaafDest);
+    assert(afTile);
 
     Scalar saliency = aaafSaliency[iz][iy][ix];
     if (saliency == 0.0)
-    //if (saliency <= saliency_threshold)
       return;
 
     Scalar mask_val = 1.0;
@@ -2561,10 +3234,62 @@ private:
     for (int d=0; d<3; d++)
       n[d] = aaaafV[iz][iy][ix][d];
 
-    //Note: The "filter_val" also is needed to calculate
-    //      the denominator used in normalization.
-    //      It is unusual to use a mask unless you intend
-    //      to normalize the result later, but I don't enforce this
+    //
+    //                .
+    //               /:
+    //              / :
+    //     theta ->/  :<-
+    //            /   :
+    //           /    :
+    //          /     :
+    //         /      :
+    //        /       ^
+    //       /        |
+    //      /         | n
+    //   r '-.        |
+    //        ''--..,,|
+    //                 0
+    //
+    // "n" = the direction of the stick tensor.  If the object being 
+    //       detected is a surface, n is perpendicular to that surface.
+    //       If the object is a curve, then n points tangent to the curve.
+    // "r" = the position of the vote receiver relative to the voter
+    //
+    // "theta" = the angle of r relative to the plane perpendicular to n.
+    //           (NOT the angle of r relative to n.  This is a confusing
+    //            convention, but this is how it is normally defined.)
+    //
+    // The vote cast at r is the tensor product of "n_rotated" with itself,
+    //   n_rotated = n - 2*sin(theta)*r  (=the reflection of n about r)
+    // (Its sign does not matter.)  This is multiplied by the saliency, the
+    // radial decay (a Gaussian), and the angular decay, which is
+    //   (cos(theta))^exponent  (when detecting surfaces), or
+    //   (sin(theta))^exponent  (when detecting curves).
+    // If we are detecting 1-dimensional curves (polymers, etc...) instead of
+    // 2-dimensional surfaces (membranes, ...) then the stick direction is
+    // assumed to be along the curve (as opposed to perpendicular to the
+    // 2D surface).  In both cases, the square of the quantity we raise to
+    // this exponent is  angle_dependence2 = c0 + c1*sin(theta)^2
+    Scalar c0 = 1.0;
+    Scalar c1 = -1.0;
+    if (detect_curves_not_surfaces) {
+      c0 = 0.0;
+      c1 = 1.0;
+    }
+
+    Scalar weight = saliency * mask_val;
+
+    int i00 = MapIndices_3x3_to_linear[0][0];
+    int i01 = MapIndices_3x3_to_linear[0][1];
+    int i02 = MapIndices_3x3_to_linear[0][2];
+    int i11 = MapIndices_3x3_to_linear[1][1];
+    int i12 = MapIndices_3x3_to_linear[1][2];
+    int i22 = MapIndices_3x3_to_linear[2][2];
+    size_t tile_nvoxels = tile_size[0] * tile_size[1] * tile_size[2];
+
+    // Only loop over the neighbors inside the image boundaries.
+    Integer jx_begin = std::max(-halfwidth[0], -ix);
+    Integer jx_end = std::min(halfwidth[0], image_size[0]-1-ix);
 
     for (Integer jz=-halfwidth[2]; jz<=halfwidth[2]; jz++) {
       Integer iz_jz = iz+jz;
@@ -2576,128 +3301,64 @@ private:
         if ((iy_jy < 0) || (image_size[1] <= iy_jy))
           continue;
 
-        for (Integer jx=-halfwidth[0]; jx<=halfwidth[0]; jx++) {
-          Integer ix_jx = ix+jx;
-          if ((ix_jx < 0) || (image_size[0] <= ix_jx))
-            continue;
-
-          if ((aaafMaskDest) && (aaafMaskDest[iz_jz][iy_jy][ix_jx] == 0.0))
-            continue;
-
-          // The function describing how the vote-strength falls off with
-          // distance has been precomputed and is stored in
-          // radial_decay_lookup.aaafH[jz][jy][jx];
-          // In most tensor-voting implementations, this is a Gaussian.
-          Scalar filter_val = radial_decay_lookup.aaafH[jz][jy][jx];
-          if (aaafMaskSource)
-            filter_val *= mask_val;
-
-          Scalar decay_radial = filter_val;
-          if (decay_radial == 0.0)
-            continue;
-
-          Scalar r[3];
-          for (int d=0; d<3; d++)
-            r[d] = aaaafDisplacement[jz][jy][jx][d];
-
-          //
-          //   .
-          //   :\
-          //   : \
-          // ->:  \<- theta
-          //   :   \
-          //   :    \
-          //   :     \
-          //   :      \
-          //   :       \
-          //   ^        \
-          //   |         \
-          // n |          \
-          //   |        .-' r
-          //   |,,..--''
-          //  0
-          //
-          // "n" = the direction of the stick tensor.  If the object being 
-          //       detected is a surface, n is perpendicular to that surface.
-          //       If the object is a curve, then n points tangent to the curve.
-          // "r" = the position of the vote receiver relative to the voter
-          //
-          // "theta" = the angle of r relative to the plane perpendicular to n.
-          //           (NOT the angle of r relative to n.  This is a confusing
-          //            convention, but this is how it is normally defined.)
-
-          Scalar sintheta = DotProduct3(r, n); //(sin() not cos(), see diagram)
+        // The function describing how the vote-strength falls off with
+        // distance has been precomputed and is stored in
+        // radial_decay_lookup.aaafH[jz][jy][jx];
+        // In most tensor-voting implementations, this is a Gaussian.
+        // (The normalized displacement "r" has also been precomputed.)
+        Scalar const *afH = radial_decay_lookup.aaafH[jz][jy];
+        Scalar const *afR0 = displacement_lookup[0].aaafH[jz][jy];
+        Scalar const *afR1 = displacement_lookup[1].aaafH[jz][jy];
+        Scalar const *afR2 = displacement_lookup[2].aaafH[jz][jy];
+
+        // Find the location in the tile where the votes are stored
+        // (for the voxels along this row, after shifting by ix).
+        size_t it_row = (((iz_jz - tile_begin[2]) * tile_size[1] +
+                          (iy_jy - tile_begin[1])) * tile_size[0] +
+                         (ix - tile_begin[0]));
+        Scalar *afTile00 = afTile + i00*tile_nvoxels + it_row;
+        Scalar *afTile01 = afTile + i01*tile_nvoxels + it_row;
+        Scalar *afTile02 = afTile + i02*tile_nvoxels + it_row;
+        Scalar *afTile11 = afTile + i11*tile_nvoxels + it_row;
+        Scalar *afTile12 = afTile + i12*tile_nvoxels + it_row;
+        Scalar *afTile22 = afTile + i22*tile_nvoxels + it_row;
+
+        #pragma omp simd
+        for (Integer jx=jx_begin; jx<=jx_end; jx++) {
+          Scalar r0 = afR0[jx];
+          Scalar r1 = afR1[jx];
+          Scalar r2 = afR2[jx];
+          Scalar sintheta = r0*n[0] + r1*n[1] + r2*n[2];
           Scalar sinx2 = sintheta * 2.0;
-          Scalar sin2 = sintheta * sintheta;
-          Scalar cos2 = 1.0 - sin2;
-          Scalar angle_dependence2 = cos2;
-          if (detect_curves_not_surfaces) {
-            // If we are detecting 1-dimensional curves (polymers, etc...)
-            // instead of 2-dimensional surfaces (membranes, ...)
-            // then the stick direction is assumed to be along the 
-            // of the curve, (as opposed to perpendicular to the 2D surface).
-            // As such
-            angle_dependence2 = sin2;
-          }
-
-          Scalar decay_angular;
-
-          switch(exponent) {
-          case 2:
-            decay_angular = angle_dependence2;
-            break;
-          case 4:
-            decay_angular = angle_dependence2 * angle_dependence2;
-            break;
-          default:
-            //Scalar angle_dependence = sqrt(angle_dependence2);
-            decay_angular = pow(angle_dependence2, 0.5*exponent);
-            break;
-          }
-
-          Scalar n_rotated[3];
-          for (int d=0; d<3; d++) {
-            if (detect_curves_not_surfaces)
-              n_rotated[d] = n[d] - sinx2*r[d];
-            else
-              n_rotated[d] = sinx2*r[d] - n[d];
-          }
-
-          Scalar tensor_vote[3][3];
-          for (int di = 0; di < 3; di++) {
-            for (int dj = di; dj < 3; dj++) {
-              tensor_vote[di][dj] = (saliency *
-                                     decay_radial *
-                                     decay_angular *
-                                     n_rotated[di] * n_rotated[dj]);
-
-              // OLD CODE: I used to implement aaaafDest as a 5-D array.
-              //
-              //aaaafDest[iz_jz][iy_jy][ix_jx][di][dj] += tensor_vote[di][dj];
-              //
-              // NEW CODE:
-              // The ix_jx,iy_jy,iz_jz'th entry in aaaafDest should be
-              // a 3x3 matrix. Since this matrix is symmentric, it contains
-              // only 6 non-redundant entries.  Consequently there is no
-              // need to store 9 numbers if only 6 are needed.
-              // So I implemented a version of the 3x3 matrix which has
-              // only 6 entries, arranged in a 1-D array of size 6.
-              // To access these entries, use "MapIndices_3x3_to_linear[][]".
-
-              aaaafDest[iz_jz][iy_jy][ix_jx][MapIndices_3x3_to_linear[di][dj]]
-                += tensor_vote[di][dj];
-            }
-          }
+          Scalar angle_dependence2 = c0 + c1*sintheta*sintheta;
+          Scalar decay_angular =
+            _TVAngularDecay<EXPONENT>::Eval(angle_dependence2,
+                                            static_cast<int>(exponent));
+          Scalar w = weight * afH[jx] * decay_angular;
+          Scalar nr0 = n[0] - sinx2*r0;
+          Scalar nr1 = n[1] - sinx2*r1;
+          Scalar nr2 = n[2] - sinx2*r2;
+          afTile00[jx] += w * nr0 * nr0;
+          afTile01[jx] += w * nr0 * nr1;
+          afTile02[jx] += w * nr0 * nr2;
+          afTile11[jx] += w * nr1 * nr1;
+          afTile12[jx] += w * nr1 * nr2;
+          afTile22[jx] += w * nr2 * nr2;
+        }
 
-          if (aaafDenominator)
-            aaafDenominator[iz_jz][iy_jy][ix_jx] += filter_val;
+        //Note: The "filter_val" also is needed to calculate
+        //      the denominator used in normalization.
+        if (afTileDenominator) {
+          Scalar *afDenomRow = afTileDenominator + it_row;
+          #pragma omp simd
+          for (Integer jx=jx_begin; jx<=jx_end; jx++)
+            afDenomRow[jx] += mask_val * afH[jx];
+        }
 
-        } // for (Integer jx=-halfwidth[0]; jx<=halfwidth[0]; jx++)
       } // for (Integer jy=-halfwidth[1]; jy<=halfwidth[1]; jy++)
     } // for (Integer jz=-halfwidth[2]; jz<=halfwidth[2]; jz++)
 
-
-  } // TVCastStickVotes()
+  } // _TVCastStickVotes()
 
 
 
@@ -2775,21 +3436,20 @@ private:
           }
 
           //
-          //   .
-          //   :\
-          //   : \
-          // ->:  \<- theta
-          //   :   \
-          //   :    \
-          //   :     \
-          //   :      \
-          //   :       \
-          //   ^        \
-          //   |         \
-          // n |          \
-          //   |        .-' r
-          //   |,,..--''
-          //  0
+          //                .
+          //               /:
+          //              / :
+          //     theta ->/  :<-
+          //            /   :
+          //           /    :
+          //          /     :
+          //         /      :
+          //        /       ^
+          //       /        |
+          //      /         | n
+          //   r '-.        |
+          //        ''--..,,|
+          //                 0
           //
           // "n" = the direction of the stick tensor.  If the object being 
           //       detected is a surface, n is perpendicular to that surface.
@@ -2881,6 +3541,8 @@ private:
     std::swap(sigma, other.sigma);
     std::swap(exponent, other.exponent);
     std::swap(radial_decay_lookup, other.radial_decay_lookup);
+    for (int d=0; d<3; d++)
+      std::swap(displacement_lookup[d], other.displacement_lookup[d]);
     std::swap(aafDisplacement, other.aafDisplacement);
     std::swap(aaaafDisplacement, other.aaaafDisplacement);
     std::swap(halfwidth, other.halfwidth);
@@ -2923,6 +3585,15 @@ private:
 
     AllocDisplacement();
     PrecalcDisplacement(aaaafDisplacement);
+
+    for (int d=0; d<3; d++) {
+      displacement_lookup[d] = radial_decay_lookup; //(allocate, same size)
+      for (Integer iz = -halfwidth[2]; iz <= halfwidth[2]; iz++)
+        for (Integer iy = -halfwidth[1]; iy <= halfwidth[1]; iy++)
+          for (Integer ix = -halfwidth[0]; ix <= halfwidth[0]; ix++)
+            displacement_lookup[d].aaafH[iz][iy][ix] =
+              aaaafDisplacement[iz][iy][ix][d];
+    }
   }
 
 
@@ -16,6 +16,7 @@
 #include <tuple>
 #include <set>
 #include <queue>
+#include <array>
 using namespace std;
 #include <err_visfd.hpp> // defines the "VisfdErr" exception type
 #include <eigen3_simple.hpp>  // defines matrix diagonalizer (DiagonalizeSym3())
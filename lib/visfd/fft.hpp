@@ -0,0 +1,546 @@
+///   @file fft.hpp
+///   @brief a small, self-contained, mixed-radix fast Fourier transform (FFT)
+///          and an FFT-based 3D convolution, used by Filter3D::Apply()
+///          for large (non-separable) filters.
+
+#ifndef _FFT_HPP
+#define _FFT_HPP
+
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <ostream>
+#include <vector>
+using namespace std;
+#include <err_visfd.hpp> // defines the "VisfdErr" exception type
+
+
+
+namespace visfd {
+
+
+
+/// @brief  Return the smallest integer >= n whose prime factors are all
+///         2, 3, or 5.  FFTs of these sizes are fast.  (Used for padding.)
+
+inline int
+NextFastFFTSize(int n)
+{
+  if (n < 1)
+    return 1;
+  while (true) {
+    int m = n;
+    while (m % 2 == 0) m /= 2;
+    while (m % 3 == 0) m /= 3;
+    while (m % 5 == 0) m /= 5;
+    if (m == 1)
+      return n;
+    n++;
+  }
+}
+
+
+
+/// @class FFT1D
+/// @brief  A (1-dimensional) discrete Fourier transform of arbitrary size.
+///         Sizes whose prime factors are 2, 3, and 5 are handled with
+///         specialized butterflies.  Other prime factors are supported
+///         using a (slower) generic butterfly.
+///         (The recursive decimation-in-time scheme used here follows the
+///          same strategy used in the "KISS FFT" library by Mark Borgerding.)
+/// @note   The inverse transform is not normalized.
+///         (Transforming forward and then backward multiplies by n.)
+
+template<typename Scalar>
+
+class FFT1D {
+
+  int n;                      //!< the number of entries in the transform
+  vector<int> factors;        //!< pairs of numbers: (radix p, stride m)
+  vector<complex<Scalar> > twiddles_fwd; //!< exp(-2πik/n) for k=0..n-1
+  vector<complex<Scalar> > twiddles_inv; //!< exp(+2πik/n) for k=0..n-1
+
+public:
+
+  FFT1D(int set_n = 0) {
+    Resize(set_n);
+  }
+
+  int size() const {
+    return n;
+  }
+
+  /// @brief  Choose the size of the transform, and precompute the factors
+  ///         and twiddle factors needed to compute it.
+  void Resize(int set_n) {
+    n = set_n;
+    factors.clear();
+    twiddles_fwd.resize(n);
+    twiddles_inv.resize(n);
+    for (int k = 0; k < n; k++) {
+      // (compute the twiddle factors in double precision)
+      double phase = -2.0 * M_PI * k / n;
+      twiddles_fwd[k] = complex<Scalar>(cos(phase), sin(phase));
+      twiddles_inv[k] = conj(twiddles_fwd[k]);
+    }
+    // Factor n, preferring radix 4, then 2, then 3, 5, and other odd numbers.
+    int p = 4;
+    int remaining = n;
+    int floor_sqrt = floor(sqrt(static_cast<double>(n)));
+    while (remaining > 1) {
+      while (remaining % p) {
+        switch (p) {
+        case 4: p = 2; break;
+        case 2: p = 3; break;
+        default: p += 2; break;
+        }
+        if (p > floor_sqrt)
+          p = remaining;
+      }
+      remaining /= p;
+      factors.push_back(p);
+      factors.push_back(remaining);
+    }
+  } //Resize()
+
+
+  /// @brief  Compute the discrete Fourier transform of afIn[] and store it
+  ///         in afOut[].  (afIn and afOut must not overlap.)
+  /// @code
+  ///  afOut[k] = Σ_j afIn[j*in_stride] * exp(∓2πijk/n)
+  /// @endcode
+  /// (The "-" sign is used for forward transforms, "+" for inverse transforms.)
+
+  void Transform(complex<Scalar> const *afIn, //!< input array
+                 complex<Scalar> *afOut,      //!< store the result here
+                 bool inverse = false,        //!< inverse transform?
+                 int in_stride = 1 //!< distance between successive inputs
+                 ) const
+  {
+    assert(afIn != afOut);
+    if (n == 0)
+      return;
+    if (n == 1) {
+      afOut[0] = afIn[0];
+      return;
+    }
+    Work(afOut, afIn, 1, in_stride, &(factors[0]), inverse);
+  }
+
+private:
+
+  void Work(complex<Scalar> *Fout,
+            complex<Scalar> const *f,
+            size_t fstride,
+            int in_stride,
+            int const *pFactors,
+            bool inverse) const
+  {
+    complex<Scalar> *Fout_beg = Fout;
+    int p = pFactors[0];
+    int m = pFactors[1];
+    complex<Scalar> const *Fout_end = Fout + p*m;
+
+    if (m == 1) {
+      do {
+        *Fout = *f;
+        f += fstride * in_stride;
+      } while (++Fout != Fout_end);
+    }
+    else {
+      do {
+        // Recursively compute the p smaller transforms (each of size m)
+        Work(Fout, f, fstride*p, in_stride, pFactors+2, inverse);
+        f += fstride * in_stride;
+      } while ((Fout += m) != Fout_end);
+    }
+
+    Fout = Fout_beg;
+
+    // Now combine the p smaller transforms together
+    switch (p) {
+    case 2: Butterfly2(Fout, fstride, m, inverse); break;
+    case 3: Butterfly3(Fout, fstride, m, inverse); break;
+    case 4: Butterfly4(Fout, fstride, m, inverse); break;
+    case 5: Butterfly5(Fout, fstride, m, inverse); break;
+    default: ButterflyGeneric(Fout, fstride, m, p, inverse); break;
+    }
+  } //Work()
+
+
+  void Butterfly2(complex<Scalar> *Fout,
+                  size_t fstride,
+                  int m,
+                  bool inverse) const
+  {
+    complex<Scalar> const *tw = (inverse
+                                 ? &(twiddles_inv[0])
+                                 : &(twiddles_fwd[0]));
+    complex<Scalar> *Fout2 = Fout + m;
+    for (int k = 0; k < m; k++) {
+      complex<Scalar> t = Fout2[k] * tw[k*fstride];
+      Fout2[k] = Fout[k] - t;
+      Fout[k] += t;
+    }
+  }
+
+
+  void Butterfly3(complex<Scalar> *Fout,
+                  size_t fstride,
+                  int m,
+                  bool inverse) const
+  {
+    complex<Scalar> const *tw = (inverse
+                                 ? &(twiddles_inv[0])
+                                 : &(twiddles_fwd[0]));
+    // (epi3 = exp(∓2πi/3).  Its real part is -1/2.)
+    Scalar epi3_imag = tw[fstride*m].imag();
+    for (int k = 0; k < m; k++) {
+      complex<Scalar> s1 = Fout[k+m]   * tw[k*fstride];
+      complex<Scalar> s2 = Fout[k+2*m] * tw[2*k*fstride];
+      complex<Scalar> s3 = s1 + s2;
+      complex<Scalar> s0 = (s1 - s2) * epi3_imag;
+      complex<Scalar> a = Fout[k] - s3 * Scalar(0.5);
+      Fout[k] += s3;
+      Fout[k+m]   = complex<Scalar>(a.real() - s0.imag(),
+                                    a.imag() + s0.real());
+      Fout[k+2*m] = complex<Scalar>(a.real() + s0.imag(),
+                                    a.imag() - s0.real());
+    }
+  }
+
+
+  void Butterfly4(complex<Scalar> *Fout,
+                  size_t fstride,
+                  int m,
+                  bool inverse) const
+  {
+    complex<Scalar> const *tw = (inverse
+                                 ? &(twiddles_inv[0])
+                                 : &(twiddles_fwd[0]));
+    for (int k = 0; k < m; k++) {
+      complex<Scalar> s0 = Fout[k+m]   * tw[k*fstride];
+      complex<Scalar> s1 = Fout[k+2*m] * tw[2*k*fstride];
+      complex<Scalar> s2 = Fout[k+3*m] * tw[3*k*fstride];
+      complex<Scalar> s5 = Fout[k] - s1;
+      complex<Scalar> f0 = Fout[k] + s1;
+      complex<Scalar> s3 = s0 + s2;
+      complex<Scalar> s4 = s0 - s2;
+      Fout[k+2*m] = f0 - s3;
+      Fout[k] = f0 + s3;
+      if (inverse) {
+        Fout[k+m]   = complex<Scalar>(s5.real() - s4.imag(),
+                                      s5.imag() + s4.real());
+        Fout[k+3*m] = complex<Scalar>(s5.real() + s4.imag(),
+                                      s5.imag() - s4.real());
+      }
+      else {
+        Fout[k+m]   = complex<Scalar>(s5.real() + s4.imag(),
+                                      s5.imag() - s4.real());
+        Fout[k+3*m] = complex<Scalar>(s5.real() - s4.imag(),
+                                      s5.imag() + s4.real());
+      }
+    }
+  }
+
+
+  void Butterfly5(complex<Scalar> *Fout,
+                  size_t fstride,
+                  int m,
+                  bool inverse) const
+  {
+    complex<Scalar> const *tw = (inverse
+                                 ? &(twiddles_inv[0])
+                                 : &(twiddles_fwd[0]));
+    // (ya = exp(∓2πi/5),  yb = exp(∓4πi/5))
+    complex<Scalar> ya = tw[fstride*m];
+    complex<Scalar> yb = tw[fstride*2*m];
+    for (int u = 0; u < m; u++) {
+      complex<Scalar> s0 = Fout[u];
+      complex<Scalar> s1 = Fout[u+m]   * tw[u*fstride];
+      complex<Scalar> s2 = Fout[u+2*m] * tw[2*u*fstride];
+      complex<Scalar> s3 = Fout[u+3*m] * tw[3*u*fstride];
+      complex<Scalar> s4 = Fout[u+4*m] * tw[4*u*fstride];
+      complex<Scalar> s7 = s1 + s4;
+      complex<Scalar> s10 = s1 - s4;
+      complex<Scalar> s8 = s2 + s3;
+      complex<Scalar> s9 = s2 - s3;
+
+      Fout[u] = s0 + s7 + s8;
+
+      complex<Scalar> s5(s0.real() + s7.real()*ya.real() + s8.real()*yb.real(),
+                         s0.imag() + s7.imag()*ya.real() + s8.imag()*yb.real());
+      complex<Scalar> s6(s10.imag()*ya.imag() + s9.imag()*yb.imag(),
+                         -s10.real()*ya.imag() - s9.real()*yb.imag());
+      Fout[u+m]   = s5 - s6;
+      Fout[u+4*m] = s5 + s6;
+
+      complex<Scalar> s11(s0.real() + s7.real()*yb.real() + s8.real()*ya.real(),
+                          s0.imag() + s7.imag()*yb.real() + s8.imag()*ya.real());
+      complex<Scalar> s12(-s10.imag()*yb.imag() + s9.imag()*ya.imag(),
+                          s10.real()*yb.imag() - s9.real()*ya.imag());
+      Fout[u+2*m] = s11 + s12;
+      Fout[u+3*m] = s11 - s12;
+    }
+  }
+
+
+  // (This generic butterfly handles radix 7, 11, and any other prime.
+  //  It requires O(p^2) operations per group, which is fine for small p.)
+  void ButterflyGeneric(complex<Scalar> *Fout,
+                        size_t fstride,
+                        int m,
+                        int p,
+                        bool inverse) const
+  {
+    complex<Scalar> const *tw = (inverse
+                                 ? &(twiddles_inv[0])
+                                 : &(twiddles_fwd[0]));
+    complex<Scalar> scratch_small[8];
+    vector<complex<Scalar> > scratch_large;
+    complex<Scalar> *scratch = scratch_small;
+    if (p > 8) {
+      scratch_large.resize(p);
+      scratch = &(scratch_large[0]);
+    }
+    for (int u = 0; u < m; u++) {
+      int k = u;
+      for (int q1 = 0; q1 < p; q1++) {
+        scratch[q1] = Fout[k];
+        k += m;
+      }
+      k = u;
+      for (int q1 = 0; q1 < p; q1++) {
+        size_t twidx = 0;
+        Fout[k] = scratch[0];
+        for (int q = 1; q < p; q++) {
+          twidx += fstride * k;
+          if (twidx >= static_cast<size_t>(n))
+            twidx -= n;
+          Fout[k] += scratch[q] * tw[twidx];
+        }
+        k += m;
+      }
+    }
+  } //ButterflyGeneric()
+
+}; // class FFT1D
+
+
+
+
+/// @brief  Compute the (unnormalized) 3D discrete Fourier transform of
+///         a complex array of size n[0] x n[1] x n[2] (stored in afData,
+///         with x varying fastest), in place.
+///         The optional nonzero[] argument lets the caller specify that
+///         the data is zero outside the region  x<nonzero[0], y<nonzero[1],
+///         z<nonzero[2].  For forward transforms this allows us to skip rows
+///         which are known to be zero.  (It is ignored for inverse transforms.)
+///         Similarly, the optional needed[] argument lets the caller specify
+///         that only entries in the region x<needed[0], y<needed[1],
+///         z<needed[2] will be used by the caller afterwards.  For inverse
+///         transforms, this allows us to skip computing the other entries.
+
+template<typename Scalar>
+
+void
+FFT3D(int const n[3],              //!< the size of the array
+      complex<Scalar> *afData,     //!< the data to be transformed (in place)
+      bool inverse = false,        //!< inverse transform?
+      int const *nonzero = nullptr,//!< optional: data=0 outside this region
+      int const *needed = nullptr, //!< optional: only need results here
+      ostream *pReportProgress = nullptr //!< print progress to the user?
+      )
+{
+  size_t stride[3] = {1,
+                      static_cast<size_t>(n[0]),
+                      static_cast<size_t>(n[0]) * n[1]};
+
+  // We transform the x axis first (then y, then z).
+  // This lets us skip over lines which are either zero,
+  // or whose results are not needed.
+  for (int d = 0; d < 3; d++) {
+    // The other two directions are "d1" and "d2"
+    int d1 = (d+1) % 3;
+    int d2 = (d+2) % 3;
+    int n1 = n[d1];
+    int n2 = n[d2];
+    // Restrict the lines we need to transform:
+    //   If forward: directions we have not transformed yet are still zero
+    //               beyond nonzero[].  (Directions we have transformed
+    //               already are no longer zero.)
+    //   If inverse: directions we have transformed already will not be
+    //               mixed again, so only entries within needed[] matter.
+    if (! inverse) {
+      if (nonzero && (d1 > d)) n1 = nonzero[d1];
+      if (nonzero && (d2 > d)) n2 = nonzero[d2];
+    }
+    else {
+      if (needed && (d1 < d)) n1 = needed[d1];
+      if (needed && (d2 < d)) n2 = needed[d2];
+    }
+
+    if (pReportProgress)
+      *pReportProgress << "  progress: FFT along the "
+                       << ((d==0) ? "X" : ((d==1) ? "Y" : "Z"))
+                       << " direction" << endl;
+
+    #pragma omp parallel
+    {
+      FFT1D<Scalar> fft(n[d]);
+      vector<complex<Scalar> > afIn(n[d]);
+      vector<complex<Scalar> > afOut(n[d]);
+
+      #pragma omp for collapse(2)
+      for (int i2 = 0; i2 < n2; i2++) {
+        for (int i1 = 0; i1 < n1; i1++) {
+          complex<Scalar> *line = afData + i1*stride[d1] + i2*stride[d2];
+          bool all_zero = true;
+          for (int j = 0; j < n[d]; j++) {
+            afIn[j] = line[j*stride[d]];
+            if (afIn[j] != complex<Scalar>(0.0, 0.0))
+              all_zero = false;
+          }
+          if (all_zero)
+            continue; // (the transform of zero is zero)
+          fft.Transform(&(afIn[0]), &(afOut[0]), inverse);
+          for (int j = 0; j < n[d]; j++)
+            line[j*stride[d]] = afOut[j];
+        }
+      }
+    } // #pragma omp parallel
+  } // for (int d = 0; d < 3; d++)
+} //FFT3D()
+
+
+
+
+/// @brief  Compute the convolution of a 3D image with a 3D filter using
+///         fast Fourier transforms.  This function computes the same
+///         g[i] and d[i] sums that Filter3D::Apply() computes:
+/// @code
+/// g[i] = Σ_j  h[j] * f[i-j] * mask[i-j]
+/// d[i] = Σ_j  h[j] * mask[i-j]
+/// @endcode
+/// (If aaafMask==nullptr, then mask[i] = 1 inside the image, 0 outside.)
+/// The running time is O(N*log(N)), where N is the number of voxels in the
+/// image, regardless of the size of the filter.
+///
+/// @note  Both sums are computed simultaneously.  Because h[] is real,
+///        we can store f*mask in the real part of a complex array, and
+///        mask in the imaginary part, and convolve them both with h at once.
+///
+/// @note  This requires additional memory for two complex arrays, each of
+///        which is slightly larger than the image (due to padding).
+///        (In total, this is roughly 4 times the size of the image.)
+///
+/// @note: THIS FUNCTION WAS NOT INTENDED FOR PUBLIC USE.
+///        (Use Filter3D::Apply() instead.)
+
+template<typename Scalar, typename Integer>
+
+void
+ConvolveFFT3D(Integer const image_size[3], //!< source image size
+              Scalar const *const *const *aaafSource, //!< source image f[i]
+              Scalar ***aaafDest, //!< store the convolution g[i] here
+              Scalar const *const *const *aaafMask, //!< optional mask[i]
+              Scalar ***aaafDenominator, //!< optional: store d[i] here
+              Scalar const *const *const *aaafH, //!< filter h[j] (indexed from -halfwidth to +halfwidth)
+              Integer const halfwidth[3], //!< filter half-width
+              ostream *pReportProgress = nullptr //!< print progress?
+              )
+{
+  // Pad the image with zeros to avoid wrap-around artifacts.
+  // The circular convolution computed using FFTs agrees with the linear
+  // convolution over the image, as long as the padded size in each
+  // direction is at least image_size[d] + halfwidth[d].
+  int n_pad[3];
+  int nonzero[3];
+  for (int d = 0; d < 3; d++) {
+    n_pad[d] = NextFastFFTSize(image_size[d] + halfwidth[d]);
+    nonzero[d] = image_size[d];
+  }
+  size_t n_total = (static_cast<size_t>(n_pad[0]) * n_pad[1]) * n_pad[2];
+
+  if (pReportProgress)
+    *pReportProgress
+      << "  progress: convolving using FFTs (padded size: "
+      << n_pad[0] << " x " << n_pad[1] << " x " << n_pad[2] << ")\n"
+      << " -- Attempting to allocate space for 2 complex arrays.        --\n"
+      << " -- (If this crashes your computer, find a computer with     --\n"
+      << " --  more RAM and use \"ulimit\", OR use a smaller image.)     --\n";
+
+  vector<complex<Scalar> > afF(n_total, complex<Scalar>(0.0, 0.0));
+  vector<complex<Scalar> > afH(n_total, complex<Scalar>(0.0, 0.0));
+
+  // Real part: f[i]*mask[i].  Imaginary part: mask[i]  (if needed)
+  #pragma omp parallel for collapse(2)
+  for (Integer iz = 0; iz < image_size[2]; iz++) {
+    for (Integer iy = 0; iy < image_size[1]; iy++) {
+      size_t offset = (static_cast<size_t>(iz)*n_pad[1] + iy) * n_pad[0];
+      for (Integer ix = 0; ix < image_size[0]; ix++) {
+        Scalar m = 1.0;
+        if (aaafMask)
+          m = aaafMask[iz][iy][ix];
+        Scalar f = ((m == 0.0) ? 0.0 : m * aaafSource[iz][iy][ix]);
+        afF[offset + ix] = complex<Scalar>(f,
+                                           aaafDenominator ? m : 0.0);
+      }
+    }
+  }
+
+  // The filter entries h[j] are stored at index j (modulo n_pad)
+  for (Integer jz = -halfwidth[2]; jz <= halfwidth[2]; jz++) {
+    size_t iz = (jz < 0) ? jz + n_pad[2] : jz;
+    for (Integer jy = -halfwidth[1]; jy <= halfwidth[1]; jy++) {
+      size_t iy = (jy < 0) ? jy + n_pad[1] : jy;
+      for (Integer jx = -halfwidth[0]; jx <= halfwidth[0]; jx++) {
+        size_t ix = (jx < 0) ? jx + n_pad[0] : jx;
+        afH[(iz*n_pad[1] + iy)*n_pad[0] + ix] = aaafH[jz][jy][jx];
+      }
+    }
+  }
+
+  FFT3D(n_pad, &(afF[0]), false, nonzero, nonzero, pReportProgress);
+  FFT3D(n_pad, &(afH[0]), false, nullptr, nullptr, pReportProgress);
+
+  // Multiply the two transforms together (convolution theorem)
+  #pragma omp parallel for
+  for (size_t i = 0; i < n_total; i++)
+    afF[i] *= afH[i];
+
+  // We don't need the filter's transform any more.  Free up the memory now.
+  vector<complex<Scalar> >().swap(afH);
+
+  FFT3D(n_pad, &(afF[0]), true, nonzero, nonzero, pReportProgress);
+
+  Scalar inv_n_total = 1.0 / n_total;
+
+  #pragma omp parallel for collapse(2)
+  for (Integer iz = 0; iz < image_size[2]; iz++) {
+    for (Integer iy = 0; iy < image_size[1]; iy++) {
+      size_t offset = (static_cast<size_t>(iz)*n_pad[1] + iy) * n_pad[0];
+      for (Integer ix = 0; ix < image_size[0]; ix++) {
+        if (aaafMask && (aaafMask[iz][iy][ix] == 0.0)) {
+          // (Filter3D::Apply() ignores voxels outside the mask)
+          aaafDest[iz][iy][ix] = 0.0;
+          if (aaafDenominator)
+            aaafDenominator[iz][iy][ix] = 0.0;
+          continue;
+        }
+        complex<Scalar> gd = afF[offset + ix] * inv_n_total;
+        aaafDest[iz][iy][ix] = gd.real();
+        if (aaafDenominator)
+          aaafDenominator[iz][iy][ix] = gd.imag();
+      }
+    }
+  }
+} //ConvolveFFT3D()
+
+
+
+} //namespace visfd
+
+
+
+#endif //#ifndef _FFT_HPP
@@ -19,9 +19,11 @@ using namespace std;
 #include <err_visfd.hpp> // defines the "VisfdErr" exception type
 #include <alloc3d.hpp>    // defines Alloc3D() and Dealloc3D()
 #include <filter1d.hpp>   // defines "Filter1D" (used in ApplySeparable())
+#include <brick_occupancy.hpp> // defines "BrickOccupancy" (skips empty regions)
 #include <visfd_utils.hpp>    // defines invert_permutation(), AveArray(), ...
 #include <eigen3_simple.hpp>  // defines matrix diagonalizer (DiagonalizeSym3())
 #include <lin3_utils.hpp> // defines DotProduct3(),CrossProduct(),quaternions...
+#include <fft.hpp>        // defines ConvolveFFT3D() (used by Filter3D::Apply())
 
 
 
@@ -29,6 +31,30 @@ using namespace std;
 namespace visfd {
 
 
+/// @brief  Filter3D::Apply() can compute convolutions directly (by summing
+///         over the filter window for every voxel), or by using FFTs.
+///         CONVOLVE_AUTO chooses whichever method is expected to be faster.
+
+typedef enum eConvolveMethod {
+  CONVOLVE_AUTO,
+  CONVOLVE_DIRECT,
+  CONVOLVE_FFT
+} ConvolveMethod;
+
+
+
+/// @brief  The number of adjacent columns which ApplySeparable() filters
+///         simultaneously when filtering along the Y and Z directions.
+///         (16 floats fill one AVX-512 register, or two AVX2 registers.)
+///         Compile with -DDISABLE_TILED_FILTERS to process one column at a time.
+#ifndef DISABLE_TILED_FILTERS
+const int SEPARABLE_TILE_WIDTH = 16;
+#else
+const int SEPARABLE_TILE_WIDTH = 1;
+#endif
+
+
+
 /// @class Filter3D
 /// @brief A simple class for general linear (convolutional) filters in 3D
 ///
@@ -44,6 +70,7 @@ public:
   Scalar ***aaafH;     //!< the same array which can be indexed using [i][j][k] notation
   Integer halfwidth[3]; //!< num pixels from filter center to edge in x,y,z directions
   Integer array_size[3]; //!<size of the array in x,y,z directions (2*halfwidth+1)
+  ConvolveMethod convolve_method; //!< compute Apply() directly or using FFTs?
 
   /// @brief  Apply the filter to a 3D image (aaafSource[][][]).
   /// Save the results in the "aafDest" array.  (A "mask" is optional.)
@@ -164,7 +191,37 @@ public:
              Scalar ***aaafDenominator = nullptr,
              ostream *pReportProgress = nullptr) const
   {
+    // The direct method only visits voxels in the mask, so its cost
+    // is proportional to the fraction of the image occupied by the mask.
+    // (A rough estimate of this fraction is good enough to choose a method.)
+    int image_size[3] = {int(size_source[0]),
+                         int(size_source[1]),
+                         int(size_source[2])};
+    double occupied_fraction = 1.0;
+    if (aaafMask && (convolve_method == CONVOLVE_AUTO))
+      occupied_fraction = EstimateMaskFraction(image_size, aaafMask);
+
+    if (UseFFT(size_source, occupied_fraction)) {
+      ConvolveFFT3D(size_source,
+                    aaafSource,
+                    aaafDest,
+                    aaafMask,
+                    aaafDenominator,
+                    aaafH,
+                    halfwidth,
+                    pReportProgress);
+      return;
+    }
 
+    // If the mask is sparse, find the regions of the image it occupies,
+    // so that we can skip over the rows of voxels which lie outside it.
+    BrickOccupancy *pOccupancy = nullptr;
+    if (aaafMask) {
+      if (convolve_method != CONVOLVE_AUTO)
+        occupied_fraction = EstimateMaskFraction(image_size, aaafMask);
+      if (occupied_fraction < BRICK_OCCUPANCY_MAX_FRACTION)
+        pOccupancy = new BrickOccupancy(image_size, aaafMask);
+    }
 
     if (pReportProgress)
       *pReportProgress << "  progress: processing plane#" << endl;
@@ -180,9 +237,21 @@ public:
       if (pReportProgress)
         *pReportProgress << "  " << iz+1 << " / " << size_source[2] << "\n";
 
-      #pragma omp parallel for collapse(2)
+      #pragma omp parallel for
       for (Integer iy=0; iy<size_source[1]; iy++) {
 
+        // Skip rows which contain no voxels from the mask
+        if (pOccupancy && pOccupancy->Empty(0, size_source[0]-1,
+                                            iy, iy,
+                                            iz, iz)) {
+          for (Integer ix=0; ix<size_source[0]; ix++) {
+            aaafDest[iz][iy][ix] = 0.0;
+            if (aaafDenominator)
+              aaafDenominator[iz][iy][ix] = 0.0;
+          }
+          continue;
+        }
+
         for (Integer ix=0; ix<size_source[0]; ix++) {
 
           // Calculate the effect of the filter on
@@ -190,7 +259,7 @@ public:
 
           if ((aaafMask) && (aaafMask[iz][iy][ix] == 0.0)) {
             aaafDest[iz][iy][ix] = 0.0;
-            if (aaafDenominator[iz][iy][ix])
+            if (aaafDenominator)
               aaafDenominator[iz][iy][ix] = 0.0;
             continue;
           }
@@ -206,13 +275,52 @@ public:
         }
       }
     }
+
+    if (pOccupancy)
+      delete pOccupancy;
   } // Apply()
 
 
 
+  /// @brief  Decide whether Apply() should use FFTs to compute the convolution
+  ///         of this filter with an image of a given size.
+  /// @param size_source contains size of the source image (in the x,y,z directions)
+  /// @param occupied_fraction the fraction of the image which the direct
+  ///        method must visit (less than 1 when a sparse mask is used)
+  /// @return true if FFTs will be used, false if the sum is computed directly.
+  /// @note   When convolve_method == CONVOLVE_AUTO, the choice is made by
+  ///         comparing rough estimates of the cost of each method.
+  ///         The direct method costs ~N*K operations, where N and K are the
+  ///         number of voxels in the image and filter.  The FFT method costs
+  ///         ~c*P*log2(P), where P is the number of voxels in the (padded)
+  ///         image, and "c" was measured empirically (using g++ -O3 -fopenmp).
+
+  bool UseFFT(Integer const size_source[3],
+              double occupied_fraction = 1.0) const {
+    if (convolve_method == CONVOLVE_FFT)
+      return true;
+    else if (convolve_method == CONVOLVE_DIRECT)
+      return false;
+    double n_image = 1.0;
+    double n_filter = 1.0;
+    double n_pad = 1.0;
+    for (int d = 0; d < 3; d++) {
+      n_image *= size_source[d];
+      n_filter *= array_size[d];
+      n_pad *= NextFastFFTSize(size_source[d] + halfwidth[d]);
+    }
+    const double c = FFT_COST_PER_VOXEL_LOG2;
+    double cost_direct = n_image * n_filter * occupied_fraction;
+    double cost_fft = c * n_pad * log2(n_pad);
+    return cost_fft < cost_direct;
+  }
+
+
+
   Filter3D(const Filter3D<Scalar, Integer>& source) {
     Init();
     Resize(source.halfwidth); // allocates and initializes afH and aaafH
+    convolve_method = source.convolve_method;
     //for(Integer iz=-halfwidth[2]; iz<=halfwidth[2]; iz++)
     //  for(Integer iy=-halfwidth[1]; iy<=halfwidth[1]; iy++)
     //    for(Integer ix=-halfwidth[0]; ix<=halfwidth[0]; ix++)
@@ -245,6 +353,7 @@ public:
     std::swap(aaafH, other.aaafH);
     std::swap(halfwidth, other.halfwidth);
     std::swap(array_size, other.array_size);
+    std::swap(convolve_method, other.convolve_method);
   }
 
 
@@ -528,8 +637,13 @@ public:
     array_size[2] = -1;
     afH = nullptr;
     aaafH = nullptr;
+    convolve_method = CONVOLVE_AUTO;
   }
-  
+
+  // Empirical cost of FFT convolution (relative to the cost of one
+  // multiply-add in the direct method) per voxel per factor of log2(P).
+  static constexpr double FFT_COST_PER_VOXEL_LOG2 = 6.0;
+
 }; // class Filter3D
 
 
@@ -752,6 +866,10 @@ ApplySeparable(int const image_size[3],              //!<number of voxels in x,y
   //  store the result of each successive filter operation. 
   //  Instead just store the most recent filter operation in aaafDest,
   //  and perform each operation on whatever's currently in aaafDest.)
+  // (This loop, and the loops below, divide the image among the threads
+  //  in the same way (in z-slabs), so each thread re-uses the same memory.
+  //  See the comments in Alloc3D().)
+  #pragma omp parallel for collapse(2)
   for (int iz = 0; iz < image_size[2]; iz++)
     for (int iy = 0; iy < image_size[1]; iy++)
       for (int ix = 0; ix < image_size[0]; ix++)
@@ -774,6 +892,7 @@ ApplySeparable(int const image_size[3],              //!<number of voxels in x,y
   if (normalize) {
     if (aaafMask) {
       Alloc3D(image_size, &afDenom, &aaafDenom);
+      #pragma omp parallel for collapse(2)
       for (int iz = 0; iz < image_size[2]; iz++)
         for (int iy = 0; iy < image_size[1]; iy++)
           for (int ix = 0; ix < image_size[0]; ix++)
@@ -783,6 +902,29 @@ ApplySeparable(int const image_size[3],              //!<number of voxels in x,y
 
   int d; //direction where we are applying the filter (x<==>0, y<==>1, z<==>2)
 
+  // To filter along the Z and Y directions, we would normally have to copy
+  // each column of voxels into a temporary 1D array.  Unfortunately
+  // successive voxels in these columns are far apart in memory, which
+  // results in many cache misses.  Instead, process several adjacent
+  // columns (a "tile" of columns with consecutive ix values) together.
+  // This way we read (and write) contiguous blocks of memory, and the 1D
+  // filter can be applied to all of the columns in the tile simultaneously
+  // (using SIMD instructions).  See Filter1D::ApplyTile() for details.
+  const int tile_width = SEPARABLE_TILE_WIDTH;
+  int num_tiles = (image_size[0] + tile_width - 1) / tile_width;
+
+  // If there is a mask, then the filtered image (and the denominator) are
+  // exactly zero everywhere farther than one filter-width from the mask.
+  // Typically, most of the image lies outside the mask.  So we build a
+  // (coarse) index of the regions of the image occupied by the mask, and
+  // use it to skip over the columns (and rows) where the result is zero.
+  // (This way the cost scales with the volume of the mask, not the image.)
+  BrickOccupancy *pOccupancy = nullptr;
+  if (aaafMask)
+    pOccupancy = new BrickOccupancy(image_size, aaafMask);
+  int hz = aFilter[2].halfwidth;
+  int hy = aFilter[1].halfwidth;
+
   // First, apply the filter in the Z direction (d=2):
   d = 2;
   if (pReportProgress)
@@ -796,18 +938,19 @@ ApplySeparable(int const image_size[3],              //!<number of voxels in x,y
     // Instead use temporary arrays which store the image, (mask, denom, etc)
     // along the direction that we intend to apply the filter at this step.
     // Then use a simple 1-D filter on that array and copy the results back.
-    Scalar *afDest_tmp   = new Scalar [image_size[d]];
-    Scalar *afSource_tmp = new Scalar [image_size[d]];
+    // (Each temporary array stores a tile of "tile_width" columns.)
+    Scalar *afDest_tmp   = new Scalar [image_size[d] * tile_width];
+    Scalar *afSource_tmp = new Scalar [image_size[d] * tile_width];
     Scalar *afMask_tmp   = nullptr;
     if (aaafMask)
-      afMask_tmp = new Scalar [image_size[d]];
+      afMask_tmp = new Scalar [image_size[d] * tile_width];
     Scalar *afDenom_tmp = nullptr;
     if (normalize && aaafMask)
-      afDenom_tmp = new Scalar [image_size[d]];
+      afDenom_tmp = new Scalar [image_size[d] * tile_width];
 
     #pragma omp for collapse(2)
     for (int iy = 0; iy < image_size[1]; iy++) {
-      for (int ix = 0; ix < image_size[0]; ix++) {
+      for (int i_tile = 0; i_tile < num_tiles; i_tile++) {
 
 
         // --------------------------------------------
@@ -826,12 +969,33 @@ ApplySeparable(int const image_size[3],              //!<number of voxels in x,y
         //      Placing an "fprintf()" after this line had no effect.)
         // --------------------------------------------
 
+        int ix0 = i_tile * tile_width;
+        int w = tile_width; // the number of columns in this tile
+        if (ix0 + w > image_size[0])
+          w = image_size[0] - ix0;
+
+        // Skip this tile if the mask is zero everywhere in these columns.
+        // (The result, and the sum of the weights, are both zero there.)
+        if (pOccupancy && pOccupancy->Empty(ix0, ix0+w-1,
+                                            iy, iy,
+                                            0, image_size[2]-1)) {
+          for (int iz = 0; iz < image_size[2]; iz++) {
+            for (int t = 0; t < w; t++) {
+              aaafDest[iz][iy][ix0+t] = 0.0;
+              if (normalize)
+                aaafDenom[iz][iy][ix0+t] = 0.0;
+            }
+          }
+          continue;
+        }
 
         // Copy the data we need to the temporary arrays
         for (int iz = 0; iz < image_size[2]; iz++) {
-          afSource_tmp[iz] = aaafDest[iz][iy][ix];  //copy from prev aaafDest
-          if (aaafMask)
-            afMask_tmp[iz] = aaafMask[iz][iy][ix];
+          for (int t = 0; t < w; t++) {
+            afSource_tmp[iz*w + t] = aaafDest[iz][iy][ix0+t]; //from aaafDest
+            if (aaafMask)
+              afMask_tmp[iz*w + t] = aaafMask[iz][iy][ix0+t];
+          }
         }
 
         // Apply the filter to the 1-D temporary arrays which contain the source
@@ -841,20 +1005,23 @@ ApplySeparable(int const image_size[3],              //!<number of voxels in x,y
         // computational overhead required for filtering both signals is only 
         // slightly higher than the cost required for filtering only one of them
         // (Later this won't be true and we will have to filter them separately)
-        aFilter[d].Apply(image_size[d],
-                         afSource_tmp,
-                         afDest_tmp,  //<-store filtered result here
-                         afMask_tmp,
-                         afDenom_tmp);//<-store sum of weights considered here
+        aFilter[d].ApplyTile(image_size[d],
+                             w,
+                             afSource_tmp,
+                             afDest_tmp,  //<-store filtered result here
+                             afMask_tmp,
+                             afDenom_tmp);//<-store sum of weights considered
 
         // copy the results from the temporary filters back into the 3D arrays
         for (int iz = 0; iz < image_size[2]; iz++) {
-          aaafDest[iz][iy][ix] = afDest_tmp[iz];
-          if (normalize && aaafMask)
-            aaafDenom[iz][iy][ix] = afDenom_tmp[iz]; //copy back into aaafDenom
-            // (Note: if aaafMask==nullptr then we normalize using a faster method)
+          for (int t = 0; t < w; t++) {
+            aaafDest[iz][iy][ix0+t] = afDest_tmp[iz*w + t];
+            if (normalize && aaafMask)
+              aaafDenom[iz][iy][ix0+t] = afDenom_tmp[iz*w + t];
+              // (Note: if aaafMask==nullptr then we normalize using a faster method)
+          }
         }
-      } //for (int ix = 0; ix < image_size[0]; ix++)
+      } //for (int i_tile = 0; i_tile < num_tiles; i_tile++)
     } //for (int iy = 0; iy < image_size[1]; iy++)
 
     // delete the temporary arrays
@@ -881,64 +1048,76 @@ ApplySeparable(int const image_size[3],              //!<number of voxels in x,y
     // Instead use temporary arrays which store the image, (mask, denom, etc)
     // along the direction that we intend to apply the filter at this step.
     // Then use a simple 1-D filter on that array and copy the results back.
-    Scalar *afDest_tmp   = new Scalar [image_size[d]];
-    Scalar *afSource_tmp = new Scalar [image_size[d]];
-    //Scalar *afMask_tmp   = nullptr;
-    //if (aaafMask)
-    //  afMask_tmp = new Scalar [image_size[d]];
+    // (Each temporary array stores a tile of "tile_width" columns.)
+    Scalar *afDest_tmp   = new Scalar [image_size[d] * tile_width];
+    Scalar *afSource_tmp = new Scalar [image_size[d] * tile_width];
     Scalar *afDenom_src_tmp = nullptr;
     Scalar *afDenom_tmp = nullptr;
     if (normalize && aaafMask) {
-      afDenom_src_tmp = new Scalar [image_size[d]];
-      afDenom_tmp     = new Scalar [image_size[d]];
+      afDenom_src_tmp = new Scalar [image_size[d] * tile_width];
+      afDenom_tmp     = new Scalar [image_size[d] * tile_width];
     }
 
     #pragma omp for collapse(2)
     for (int iz = 0; iz < image_size[2]; iz++) {
-      for (int ix = 0; ix < image_size[0]; ix++) {
+      for (int i_tile = 0; i_tile < num_tiles; i_tile++) {
+
+        int ix0 = i_tile * tile_width;
+        int w = tile_width; // the number of columns in this tile
+        if (ix0 + w > image_size[0])
+          w = image_size[0] - ix0;
+
+        // If the mask is empty within "hz" voxels of this plane (in these
+        // columns), then the Z filter left zeros here.  Nothing to do.
+        if (pOccupancy && pOccupancy->Empty(ix0, ix0+w-1,
+                                            0, image_size[1]-1,
+                                            iz-hz, iz+hz))
+          continue;
 
         // copy the data we need to the temporary arrays
         for (int iy = 0; iy < image_size[1]; iy++) {
-          afSource_tmp[iy] = aaafDest[iz][iy][ix];  //copy from prev aaafDest
-          //if (aaafMask)
-          //  afMask_tmp[iy] = aaafMask[iz][iy][ix];
-          if (normalize && aaafMask)
-            afDenom_src_tmp[iy] = aaafDenom[iz][iy][ix];
+          for (int t = 0; t < w; t++) {
+            afSource_tmp[iy*w + t] = aaafDest[iz][iy][ix0+t]; //from aaafDest
+            if (normalize && aaafMask)
+              afDenom_src_tmp[iy*w + t] = aaafDenom[iz][iy][ix0+t];
+          }
         }
 
         // At this point, the convolution of the 1-D filter along
         // the Z direction on the afSource[][][] array is stored in both 
         // aaafDest[][][] and also afSource_tmp[].  Now we want to
         // apply the 1-D filter along the Y direction to that data.
-        aFilter[d].Apply(image_size[d],
-                         afSource_tmp,
-                         afDest_tmp); //<-store filtered result here
+        aFilter[d].ApplyTile(image_size[d],
+                             w,
+                             afSource_tmp,
+                             afDest_tmp); //<-store filtered result here
 
         if (normalize && aaafMask)
           // At this point, the convolution of the 1-D filter along
           // the Z direction on the aaafMask[][][] array is stored in both 
           // aaafDenom[][][] and also afDenom_src_tmp[].  Now we want to
           // apply the 1-D filter along the Y direction to that data
-          aFilter[d].Apply(image_size[d],
-                           afDenom_src_tmp, //<-weights so far (summed along z)
-                           afDenom_tmp);//<-store sum of weights considered here
+          aFilter[d].ApplyTile(image_size[d],
+                               w,
+                               afDenom_src_tmp, //<-weights so far (along z)
+                               afDenom_tmp);//<-store sum of weights considered
 
         // copy the results from the temporary filters back into the 3D arrays
         for (int iy = 0; iy < image_size[1]; iy++) {
-          aaafDest[iz][iy][ix] = afDest_tmp[iy];
-          if (normalize && aaafMask)
-            //copy the weights from afDenom_tmp[] into aaafDenom[][][]
-            // (Note: if aaafMask==nullptr then we normalize using a faster method)
-            aaafDenom[iz][iy][ix] = afDenom_tmp[iy];
+          for (int t = 0; t < w; t++) {
+            aaafDest[iz][iy][ix0+t] = afDest_tmp[iy*w + t];
+            if (normalize && aaafMask)
+              //copy the weights from afDenom_tmp[] into aaafDenom[][][]
+              // (Note: if aaafMask==nullptr then we normalize using a faster method)
+              aaafDenom[iz][iy][ix0+t] = afDenom_tmp[iy*w + t];
+          }
         }
-      } //for (int ix = 0; ix < image_size[0]; ix++)
+      } //for (int i_tile = 0; i_tile < num_tiles; i_tile++)
     } //for (int iz = 0; iz < image_size[2]; iz++)
 
     // delete the temporary arrays
     delete [] afSource_tmp;
     delete [] afDest_tmp;
-    //if (afMask_tmp)
-    //  delete [] afMask_tmp;
     if (afDenom_tmp)
       delete [] afDenom_tmp;
     if (afDenom_src_tmp)
@@ -977,6 +1156,12 @@ ApplySeparable(int const image_size[3],              //!<number of voxels in x,y
     for (int iz = 0; iz < image_size[2]; iz++) {
       for (int iy = 0; iy < image_size[1]; iy++) {
 
+        // Skip rows which are entirely zero after the Z and Y filters
+        if (pOccupancy && pOccupancy->Empty(0, image_size[0]-1,
+                                            iy-hy, iy+hy,
+                                            iz-hz, iz+hz))
+          continue;
+
         // copy the data we need to the temporary arrays
         for (int ix = 0; ix < image_size[0]; ix++) {
           afSource_tmp[ix] = aaafDest[iz][iy][ix];  //copy from prev aaafDest
@@ -1025,11 +1210,14 @@ ApplySeparable(int const image_size[3],              //!<number of voxels in x,y
       delete [] afDenom_src_tmp;
   } //#pragma omp parallel private(afDest_tmp, ...)
 
+  if (pOccupancy)
+    delete pOccupancy;
 
 
   if (normalize) {
     if (aaafMask) {
       assert(aaafDenom);
+      #pragma omp parallel for collapse(2)
       for (int iz = 0; iz < image_size[2]; iz++)
         for (int iy = 0; iy < image_size[1]; iy++)
           for (int ix = 0; ix < image_size[0]; ix++)
@@ -1054,6 +1242,7 @@ ApplySeparable(int const image_size[3],              //!<number of voxels in x,y
         aFilter[d].Apply(image_size[d], afAllOnes, aafDenom_precomputed[d]);
         delete [] afAllOnes;
       }
+      #pragma omp parallel for collapse(2)
       for (int iz = 0; iz < image_size[2]; iz++) {
         for (int iy = 0; iy < image_size[1]; iy++) {
           for (int ix = 0; ix < image_size[0]; ix++) {
@@ -1341,14 +1530,14 @@ ApplyGauss(int const image_size[3], //!< image size in x,y,z directions
            )
 {
   Scalar afSigma[3] = {sigma, sigma, sigma};
-  ApplyGauss(image_size,
-             aaafSource,
-             aaafDest,
-             aaafMask,
-             afSigma,
-             truncate_ratio,
-             normalize,
-             pReportProgress);
+  return ApplyGauss(image_size,
+                    aaafSource,
+                    aaafDest,
+                    aaafMask,
+                    afSigma,
+                    truncate_ratio,
+                    normalize,
+                    pReportProgress);
 }
 
 
@@ -0,0 +1,148 @@
+///   @file hierarchical_queue.hpp
+///   @brief a priority queue for voxels, sorted by brightness, which is
+///          faster than std::priority_queue when the queue is large.
+
+#ifndef _HIERARCHICAL_QUEUE_HPP
+#define _HIERARCHICAL_QUEUE_HPP
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+
+
+namespace visfd {
+
+
+
+/// @class  HierarchicalQueue
+/// @brief  A priority queue whose entries are sorted by "score" (lowest first).
+///         (Each entry must have a member named "score".)
+///         The range of scores is divided into a large number of "levels"
+///         (buckets).  Entries are stored in the bucket for their level.
+///         Adding an entry to a higher level requires O(1) time.  Only the
+///         bucket at the current (lowest) level is sorted.  It is stored as
+///         a binary heap.  Since each bucket typically contains only a few
+///         entries, push() and pop() are typically much faster than they
+///         would be using std::priority_queue (which is O(log N)).
+///
+///         The order in which entries are popped is exactly the same as it
+///         would be if std::priority_queue were used, using the same
+///         comparison function (as long as "compare" sorts entries by score
+///         before anything else).  The number of levels only affects speed.
+///
+/// @note   Entries whose score is lower than the current level are added to
+///         the current level (so they will be popped next).  This happens
+///         in flood-fill algorithms.  Entries whose scores lie outside the
+///         range of scores passed to the constructor are also allowed.
+///
+/// Example usage:
+/// @code
+/// HierarchicalQueue<Entry, Compare> q(score_min, score_max, 65536);
+/// q.push(entry);
+/// while (! q.empty()) {
+///   Entry e = q.top();
+///   q.pop();
+///   ...
+/// }
+/// @endcode
+
+template<typename Entry, typename Compare>
+
+class HierarchicalQueue {
+
+  vector<vector<Entry> > buckets; //!< the entries, sorted by level
+  size_t current_level; //!< the level of the next entry to be popped
+  size_t num_entries;   //!< the number of entries in the queue
+  double score_offset;  //!< the score corresponding to level 0
+  double level_per_score; //!< the number of levels per unit of score
+  Compare compare; //!< compare(a,b)==true means that b is popped before a
+
+public:
+
+  HierarchicalQueue(double score_min, //!< the expected range of scores
+                    double score_max, //!< the expected range of scores
+                    size_t num_levels=65536, //!< the number of buckets
+                    Compare set_compare=Compare() //!< see above
+                    ):
+    buckets(std::max(num_levels, static_cast<size_t>(1))),
+    compare(set_compare)
+  {
+    current_level = 0;
+    num_entries = 0;
+    score_offset = score_min;
+    level_per_score = 0.0;
+    if (score_max > score_min)
+      level_per_score = (buckets.size() - 1) / (score_max - score_min);
+  }
+
+  bool empty() const {
+    return num_entries == 0;
+  }
+
+  size_t size() const {
+    return num_entries;
+  }
+
+  void push(const Entry &entry) {
+    size_t level = Level(entry.score);
+    if (level <= current_level) {
+      // The current bucket is stored as a heap
+      vector<Entry> &bucket = buckets[current_level];
+      bucket.push_back(entry);
+      push_heap(bucket.begin(), bucket.end(), compare);
+    }
+    else
+      // The other buckets are not sorted (yet)
+      buckets[level].push_back(entry);
+    num_entries++;
+  }
+
+  const Entry &top() {
+    assert(! empty());
+    Advance();
+    return buckets[current_level].front();
+  }
+
+  void pop() {
+    assert(! empty());
+    Advance();
+    vector<Entry> &bucket = buckets[current_level];
+    pop_heap(bucket.begin(), bucket.end(), compare);
+    bucket.pop_back();
+    num_entries--;
+  }
+
+private:
+
+  size_t Level(double score) const {
+    double level = (score - score_offset) * level_per_score;
+    if (! (level > 0.0))  // (this also catches NaN)
+      return 0;
+    if (level >= buckets.size() - 1)
+      return buckets.size() - 1;
+    return static_cast<size_t>(level);
+  }
+
+  // Make sure the bucket at the current_level is not empty
+  void Advance() {
+    while (buckets[current_level].empty()) {
+      vector<Entry>().swap(buckets[current_level]); // free its memory
+      current_level++;
+      assert(current_level < buckets.size());
+      vector<Entry> &bucket = buckets[current_level];
+      make_heap(bucket.begin(), bucket.end(), compare);
+    }
+  }
+
+}; // class HierarchicalQueue
+
+
+
+} //namespace visfd
+
+
+
+#endif //#ifndef _HIERARCHICAL_QUEUE_HPP
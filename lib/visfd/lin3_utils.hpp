@@ -13,6 +13,7 @@
 
 #include <cmath>
 #include <cassert>
+#include <array>
 using namespace std;
 
 
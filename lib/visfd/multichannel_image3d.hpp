@@ -9,6 +9,8 @@
 #ifndef _MULTICHANNEL_IMAGE3D_HPP
 #define _MULTICHANNEL_IMAGE3D_HPP
 
+#include <cassert>
+#include <compact_scalar.hpp> // defines Half, SNorm16, ConvertArray(), ...
 
 
 namespace visfd {
@@ -35,23 +37,30 @@ namespace visfd {
 ///        regardless of the contents of the aaafMask[][][] array.
 ///        However for the 6-channel images used in Tensor-Voting, the space
 ///        savings can be substantial.
+///
+/// @note  The numbers in each channel are stored using the "Storage" type
+///        (which is the same as "Scalar" by default).  To save memory, a more
+///        compact type can be used, such as "Half" or "SNorm16".  (See
+///        compact_scalar.hpp.)  In that case, the numbers are converted
+///        automatically when they are read or written.  (Load() and Store()
+///        can also be used to convert all of the channels of a voxel at once.)
 
-template<typename Scalar>
+template<typename Scalar, typename Storage=Scalar>
 
 class CompactMultiChannelImage3D
 {
 
 private:
 
-  Scalar **aafI;
-  Scalar *afI;
+  Storage **aafI;
+  Storage *afI;
   size_t n_good_voxels;
   int n_channels_per_voxel;
   int image_size[3];
 
 public:
 
-  Scalar ****aaaafI; // Stores the image data
+  Storage ****aaaafI; // Stores the image data
 
 
   int
@@ -59,9 +68,27 @@ public:
     return n_channels_per_voxel;
   }
 
+  /// @brief  Copy the channels of voxel ix,iy,iz into aDest[]
+  ///         (converting them to Scalars)
+  void
+  Load(int ix, int iy, int iz, Scalar *aDest) const {
+    assert(aaaafI && aaaafI[iz][iy][ix]);
+    ConvertArray(n_channels_per_voxel, aaaafI[iz][iy][ix], aDest);
+  }
+
+  /// @brief  Copy aSource[] into the channels of voxel ix,iy,iz
+  ///         (converting them to the Storage type)
+  void
+  Store(int ix, int iy, int iz, Scalar const *aSource) {
+    assert(aaaafI && aaaafI[iz][iy][ix]);
+    ConvertArray(n_channels_per_voxel, aSource, aaaafI[iz][iy][ix]);
+  }
+
   CompactMultiChannelImage3D(int set_n_channels_per_voxel) {
     n_channels_per_voxel = set_n_channels_per_voxel;
     n_good_voxels = 0;
+    afI = nullptr;
+    aafI = nullptr;
     aaaafI = nullptr;
   }
 
@@ -73,8 +100,10 @@ public:
   {
     n_channels_per_voxel = set_n_channels_per_voxel;
     n_good_voxels = 0;
+    afI = nullptr;
+    aafI = nullptr;
     aaaafI = nullptr;
-    Resize(image_size, aaafMask, pReportProgress);
+    Resize(set_image_size, aaafMask, pReportProgress);
   }
 
   void
@@ -89,7 +118,8 @@ public:
   }
 
   ~CompactMultiChannelImage3D() {
-    Dealloc();
+    if (aaaafI)
+      Dealloc();
   }
 
 private:
@@ -107,7 +137,8 @@ private:
     if (pReportProgress)
       *pReportProgress
         << " -- Attempting to allocate space for a "
-        << n_channels_per_voxel << "-channel image\n"
+        << n_channels_per_voxel << "-channel image ("
+        << sizeof(Storage) << " bytes per channel)\n"
         << " -- (If this crashes your computer, find a computer with\n"
         << " --  more RAM and use \"ulimit\", OR use a smaller image.)\n";
     Alloc3D(image_size,
@@ -127,7 +158,7 @@ private:
         }
       }
     }
-    afI = new Scalar[n_good_voxels * n_channels_per_voxel];
+    afI = new Storage[n_good_voxels * n_channels_per_voxel];
     int n = 0;
     for (int iz = 0; iz < image_size[2]; iz++) {
       for (int iy = 0; iy < image_size[1]; iy++) {
@@ -159,6 +190,7 @@ private:
     afI = nullptr;
     aafI = nullptr;
     aaaafI = nullptr;
+    n_good_voxels = 0;
   }
 
 }; //class CompactMultiChannelImage3D
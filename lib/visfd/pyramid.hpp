@@ -0,0 +1,307 @@
+///   @file pyramid.hpp
+///   @brief a multi-resolution representation of an image (an image pyramid)
+///          created by repeated (anti-aliased) 2x binning.
+
+#ifndef _PYRAMID_HPP
+#define _PYRAMID_HPP
+
+#include <cassert>
+#include <cmath>
+#include <ostream>
+#include <vector>
+#include <array>
+using namespace std;
+#include <err_visfd.hpp> // defines the "VisfdErr" exception type
+#include <alloc3d.hpp>    // defines Alloc3D() and Dealloc3D()
+
+
+
+namespace visfd {
+
+
+
+/// @brief  Create a smaller version of an image, whose width (in every
+///         direction) is half as large (rounding up).  Each voxel in the new
+///         image is a weighted average of the 4x4x4 voxels surrounding the
+///         corresponding 2x2x2 block in the original image, using the
+///         (separable) weights 1/8, 3/8, 3/8, 1/8.  Compared to simple
+///         binning (averaging each 2x2x2 block), this reduces aliasing.
+///         Voxels outside the image boundaries (or where the mask is 0) are
+///         excluded from the average.
+///
+///         The center of voxel i in the new image corresponds to position
+///         2*i+0.5 in the original image.  The blur introduced by the
+///         weights has a variance of 0.75 (in units of the original voxels).
+///
+/// @note   The aaafDest (and aaafMaskDest) arrays must already be allocated
+///         by the caller.  (Use Downsample2xSize() to determine their size.)
+
+template<typename Scalar>
+
+void
+Downsample2x(int const image_size[3], //!< size of the source image
+             Scalar const *const *const *aaafSource, //!< source image
+             Scalar ***aaafDest, //!< store the downsampled image here
+             Scalar const *const *const *aaafMask=nullptr, //!< optional: ignore voxels where mask==0
+             Scalar ***aaafMaskDest=nullptr //!< optional: store the downsampled mask here (1 where more than half of the weights were inside the mask, 0 elsewhere)
+             )
+{
+  assert(aaafSource);
+  assert(aaafDest);
+  const Scalar w[4] = {0.125, 0.375, 0.375, 0.125};
+  int size_c[3]; // size of the destination image
+  for (int d = 0; d < 3; d++)
+    size_c[d] = (image_size[d] + 1) / 2;
+
+  // We bin the x and y directions first, one z-plane at a time.
+  // The weighted sums of the (masked) image and of the mask (ie. the
+  // numerator and denominator of the weighted average) are stored separately.
+  int size_xy[3] = {size_c[0], size_c[1], image_size[2]};
+  Scalar *afNumer;
+  Scalar ***aaafNumer;
+  Scalar *afDenom;
+  Scalar ***aaafDenom;
+  Alloc3D(size_xy, &afNumer, &aaafNumer);
+  Alloc3D(size_xy, &afDenom, &aaafDenom);
+
+  #pragma omp parallel
+  {
+    // (temporary arrays for binning one plane in the x direction)
+    vector<Scalar> vNumer(size_c[0] * image_size[1]);
+    vector<Scalar> vDenom(size_c[0] * image_size[1]);
+
+    #pragma omp for
+    for (int iz = 0; iz < image_size[2]; iz++) {
+      for (int iy = 0; iy < image_size[1]; iy++) {
+        for (int jx = 0; jx < size_c[0]; jx++) {
+          Scalar numer = 0.0;
+          Scalar denom = 0.0;
+          for (int k = 0; k < 4; k++) {
+            int ix = 2*jx - 1 + k;
+            if ((ix < 0) || (ix >= image_size[0]))
+              continue;
+            Scalar m = aaafMask ? aaafMask[iz][iy][ix] : 1.0;
+            numer += w[k] * m * aaafSource[iz][iy][ix];
+            denom += w[k] * m;
+          }
+          vNumer[iy*size_c[0] + jx] = numer;
+          vDenom[iy*size_c[0] + jx] = denom;
+        }
+      }
+      for (int jy = 0; jy < size_c[1]; jy++) {
+        for (int jx = 0; jx < size_c[0]; jx++) {
+          Scalar numer = 0.0;
+          Scalar denom = 0.0;
+          for (int k = 0; k < 4; k++) {
+            int iy = 2*jy - 1 + k;
+            if ((iy < 0) || (iy >= image_size[1]))
+              continue;
+            numer += w[k] * vNumer[iy*size_c[0] + jx];
+            denom += w[k] * vDenom[iy*size_c[0] + jx];
+          }
+          aaafNumer[iz][jy][jx] = numer;
+          aaafDenom[iz][jy][jx] = denom;
+        }
+      }
+    } //for (int iz = 0; iz < image_size[2]; iz++)
+  } //#pragma omp parallel
+
+  // Now bin the z direction
+  #pragma omp parallel for collapse(2)
+  for (int jz = 0; jz < size_c[2]; jz++) {
+    for (int jy = 0; jy < size_c[1]; jy++) {
+      for (int jx = 0; jx < size_c[0]; jx++) {
+        Scalar numer = 0.0;
+        Scalar denom = 0.0;
+        for (int k = 0; k < 4; k++) {
+          int iz = 2*jz - 1 + k;
+          if ((iz < 0) || (iz >= image_size[2]))
+            continue;
+          numer += w[k] * aaafNumer[iz][jy][jx];
+          denom += w[k] * aaafDenom[iz][jy][jx];
+        }
+        if (aaafMaskDest) {
+          // What would the denominator be if the mask were 1 everywhere?
+          Scalar wsum[3];
+          int j[3] = {jx, jy, jz};
+          for (int d = 0; d < 3; d++) {
+            wsum[d] = 0.0;
+            for (int k = 0; k < 4; k++) {
+              int i = 2*j[d] - 1 + k;
+              if ((i >= 0) && (i < image_size[d]))
+                wsum[d] += w[k];
+            }
+          }
+          Scalar denom_unmasked = wsum[0] * wsum[1] * wsum[2];
+          aaafMaskDest[jz][jy][jx] = ((denom > 0.5 * denom_unmasked)
+                                      ? 1.0 : 0.0);
+        }
+        if (denom > 0.0)
+          aaafDest[jz][jy][jx] = numer / denom;
+        else
+          aaafDest[jz][jy][jx] = 0.0;
+      }
+    }
+  }
+
+  Dealloc3D(size_xy, &afNumer, &aaafNumer);
+  Dealloc3D(size_xy, &afDenom, &aaafDenom);
+} //Downsample2x()
+
+
+
+/// @brief  Calculate the size of the image created by Downsample2x().
+
+inline void
+Downsample2xSize(int const image_size[3], //!< size of the original image
+                 int image_size_dest[3] //!< store the size of the result here
+                 )
+{
+  for (int d = 0; d < 3; d++)
+    image_size_dest[d] = (image_size[d] + 1) / 2;
+}
+
+
+
+/// @class  ImagePyramid
+/// @brief  A sequence of images, each one half as wide as the previous one,
+///         created using Downsample2x().  Level 0 is the original image.
+///         (It is not copied.)  Coordinates can be converted between levels
+///         using FineToCoarse() and CoarseToFine().
+///
+///         Detectors for large features (eg. large blobs) can be run on one
+///         of the coarse levels (requiring 8x less work per level), and then
+///         the locations of these features can be refined using the original
+///         image, only in small windows around each feature.
+///
+/// Example usage:
+/// @code
+/// ImagePyramid<float> pyramid(image_size, aaafSource, aaafMask, 2);
+/// Detect(pyramid.size(2), pyramid.image(2), pyramid.mask(2), ...);
+/// x0 = ImagePyramid<float>::CoarseToFine(x2, 2);
+/// @endcode
+
+template<typename Scalar>
+
+class ImagePyramid {
+
+  vector<array<int, 3> > vSizes;  //!< the size of the image at each level
+  vector<Scalar const *const *const *> vaaafImages; //!< the image at each level
+  vector<Scalar const *const *const *> vaaafMasks; //!< the mask at each level
+  vector<Scalar *> vafAlloc;     //!< (memory allocated for each level)
+  vector<Scalar ***> vaaafAlloc;
+  vector<Scalar *> vafAllocMask;
+  vector<Scalar ***> vaaafAllocMask;
+
+public:
+
+  ImagePyramid(int const image_size[3], //!< size of the original image
+               Scalar const *const *const *aaafSource, //!< original image
+               Scalar const *const *const *aaafMask, //!< ignore voxels where mask==0 (or nullptr)
+               int num_levels, //!< number of downsampled images to create
+               ostream *pReportProgress = nullptr //!< report progress?
+               )
+  {
+    array<int, 3> size0 = {image_size[0], image_size[1], image_size[2]};
+    vSizes.push_back(size0);
+    vaaafImages.push_back(aaafSource);
+    vaaafMasks.push_back(aaafMask);
+    vafAlloc.push_back(nullptr);
+    vaaafAlloc.push_back(nullptr);
+    vafAllocMask.push_back(nullptr);
+    vaaafAllocMask.push_back(nullptr);
+    for (int L = 1; L <= num_levels; L++) {
+      array<int, 3> size;
+      Downsample2xSize(vSizes[L-1].data(), size.data());
+      if (pReportProgress)
+        *pReportProgress << "  creating a downsampled image (level " << L
+                         << ", size: " << size[0] << " x "
+                         << size[1] << " x " << size[2] << ")\n";
+      Scalar *afI;
+      Scalar ***aaafI;
+      Scalar *afM = nullptr;
+      Scalar ***aaafM = nullptr;
+      Alloc3D(size.data(), &afI, &aaafI);
+      if (aaafMask)
+        Alloc3D(size.data(), &afM, &aaafM);
+      Downsample2x(vSizes[L-1].data(),
+                   vaaafImages[L-1],
+                   aaafI,
+                   vaaafMasks[L-1],
+                   aaafM);
+      vSizes.push_back(size);
+      vaaafImages.push_back(aaafI);
+      vaaafMasks.push_back(aaafM);
+      vafAlloc.push_back(afI);
+      vaaafAlloc.push_back(aaafI);
+      vafAllocMask.push_back(afM);
+      vaaafAllocMask.push_back(aaafM);
+    }
+  } //ImagePyramid()
+
+
+  ~ImagePyramid() {
+    for (size_t L = 1; L < vSizes.size(); L++) {
+      Dealloc3D(vSizes[L].data(), &vafAlloc[L], &vaaafAlloc[L]);
+      if (vaaafAllocMask[L])
+        Dealloc3D(vSizes[L].data(), &vafAllocMask[L], &vaaafAllocMask[L]);
+    }
+  }
+
+  /// @brief  The number of downsampled images (not counting the original)
+  int num_levels() const {
+    return vSizes.size() - 1;
+  }
+
+  /// @brief  The size of the image at this level
+  int const *size(int level) const {
+    return vSizes[level].data();
+  }
+
+  /// @brief  The image at this level
+  Scalar const *const *const *image(int level) const {
+    return vaaafImages[level];
+  }
+
+  /// @brief  The mask at this level (or nullptr if there is no mask)
+  Scalar const *const *const *mask(int level) const {
+    return vaaafMasks[level];
+  }
+
+  /// @brief  Convert a coordinate in the original image (level 0)
+  ///         to the corresponding coordinate at another level.
+  template<typename Coordinate>
+  static Coordinate FineToCoarse(Coordinate x, int level) {
+    return (x + 0.5) / (1 << level) - 0.5;
+  }
+
+  /// @brief  Convert a coordinate at one of the levels
+  ///         to the corresponding coordinate in the original image (level 0).
+  template<typename Coordinate>
+  static Coordinate CoarseToFine(Coordinate x, int level) {
+    return (x + 0.5) * (1 << level) - 0.5;
+  }
+
+  /// @brief  The variance of the blur introduced by downsampling the image
+  ///         this many times (in units of the original voxels).
+  ///         (Each level adds a blur of variance 0.75 in units of the previous
+  ///          level's voxels, so the total is 0.75*(1+4+...+4^(level-1)).)
+  static double BlurVariance(int level) {
+    return 0.25 * ((1 << (2*level)) - 1);
+  }
+
+private:
+
+  // Disable copying (this class owns several large arrays)
+  ImagePyramid(const ImagePyramid<Scalar>&);
+  ImagePyramid<Scalar>& operator = (const ImagePyramid<Scalar>&);
+
+}; // class ImagePyramid
+
+
+
+} //namespace visfd
+
+
+
+#endif //#ifndef _PYRAMID_HPP
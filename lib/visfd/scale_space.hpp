@@ -0,0 +1,490 @@
+///   @file scale_space.hpp
+///   @brief classes for computing Gaussian-blurred and LoG-filtered images
+///          at many scales (incrementally)
+
+#ifndef _SCALE_SPACE_HPP
+#define _SCALE_SPACE_HPP
+
+#include <cassert>
+#include <cmath>
+#include <ostream>
+#include <vector>
+using namespace std;
+#include <err_visfd.hpp> // defines the "VisfdErr" exception type
+#include <alloc3d.hpp>    // defines Alloc3D() and Dealloc3D()
+#include <filter1d.hpp>   // defines "Filter1D", GenFilterDiscreteGauss1D()
+#include <filter3d.hpp>   // defines ApplySeparable()
+
+
+
+namespace visfd {
+
+
+
+/// @brief  The fraction of the weight of each incremental blur kernel which
+///         may be discarded by truncating it.  (See BlurNumerDenom().)
+const double SCALE_SPACE_TAIL_TOLERANCE = 1.0e-6;
+
+
+
+/// @brief  Choose the half-width of a (discrete) Gaussian kernel of variance
+///         t, so that the weight lying outside the kernel is less than
+///         "tail_tolerance" (and so that it is at least truncate_ratio*σ wide).
+///         (The tails of the discrete analogue of the Gaussian are no heavier
+///          than those of the ordinary Gaussian, so erfc() is used to
+///          estimate the weight in the tails.)
+
+template<typename Scalar>
+
+int
+_IncrementalBlurHalfwidth(Scalar t,              //!< variance of the kernel (σ^2)
+                          Scalar truncate_ratio, //!< minimum width / σ
+                          double tail_tolerance = SCALE_SPACE_TAIL_TOLERANCE)
+{
+  if (t <= 0.0)
+    return 0;
+  double sigma = sqrt(static_cast<double>(t));
+  int halfwidth = ceil(truncate_ratio * sigma);
+  while (erfc((halfwidth + 0.5) / (sqrt(2.0) * sigma)) > tail_tolerance)
+    halfwidth++;
+  return halfwidth;
+}
+
+
+
+/// @brief  Blur the numerator and denominator of a (masked) weighted average
+///         using the discrete analogue of a Gaussian whose variance is dt.
+///         (See GenFilterDiscreteGauss1D().)  Both are blurred without
+///         normalization, so that blurs can be applied one after another.
+///         If there is no mask, the denominator is separable, and it is
+///         stored in three 1-D arrays (avDenomSrc, avDenomDest) instead.
+///         (The source and dest arrays may be the same.)
+///         This function is used by ScaleSpaceGauss and ScaleSpaceLoG.
+/// @note   When blurring the original image (t_prior == 0), the kernel is
+///         truncated at truncate_ratio*σ, as it would be by ApplyGauss().
+///         Incremental blurs (t_prior > 0) are instead truncated only where
+///         their tails are negligible (see SCALE_SPACE_TAIL_TOLERANCE).
+///         These blurs are often narrow (σ < 1 voxel), and truncating and
+///         renormalizing them at truncate_ratio*σ reduces their variance.
+///         Over many increments, this error accumulates and shifts the scale
+///         of the result.
+
+template<typename Scalar>
+
+void
+BlurNumerDenom(int const image_size[3], //!< image size
+               Scalar dt,               //!< variance of the blur (σ^2)
+               Scalar t_prior,          //!< variance already applied (or 0)
+               Scalar truncate_ratio,   //!< how many sigma before truncating?
+               bool masked,             //!< is the denominator a 3-D array?
+               Scalar const *const *const *aaafNumerSrc,
+               Scalar const *const *const *aaafDenomSrc,
+               vector<Scalar> const *avDenomSrc,
+               Scalar ***aaafNumerDest,
+               Scalar ***aaafDenomDest,
+               vector<Scalar> *avDenomDest,
+               ostream *pReportProgress = nullptr)
+{
+  int halfwidth = ((t_prior > 0.0)
+                   ? _IncrementalBlurHalfwidth(dt, truncate_ratio)
+                   : static_cast<int>(ceil(truncate_ratio * sqrt(dt))));
+  Filter1D<Scalar, int> aFilter[3];
+  for (int d = 0; d < 3; d++)
+    aFilter[d] = GenFilterDiscreteGauss1D(dt, halfwidth);
+
+  // The numerator (the masked image) and the denominator (the mask) are
+  // both blurred without normalization.  (We divide them later.)
+  ApplySeparable(image_size,
+                 aaafNumerSrc,
+                 aaafNumerDest,
+                 static_cast<Scalar const *const *const *>(nullptr),
+                 aFilter,
+                 false,
+                 pReportProgress);
+  if (masked)
+    ApplySeparable(image_size,
+                   aaafDenomSrc,
+                   aaafDenomDest,
+                   static_cast<Scalar const *const *const *>(nullptr),
+                   aFilter,
+                   false,
+                   pReportProgress);
+  else {
+    for (int d = 0; d < 3; d++) {
+      vector<Scalar> vTmp(avDenomSrc[d]); //(in case source and dest overlap)
+      avDenomDest[d].resize(image_size[d]);
+      aFilter[d].Apply(image_size[d],
+                       vTmp.data(),
+                       avDenomDest[d].data());
+    }
+  }
+} //BlurNumerDenom()
+
+
+
+/// @brief  "ScaleSpaceLoG" is used to apply a sequence of (scale-normalized)
+///         Laplacian-of-Gaussian filters to the same image, in order of
+///         increasing width (σ).  As with ApplyLog(), each LoG filter is
+///         approximated by a difference of two Gaussians whose widths are
+///         σ*(1-0.5*δ) and σ*(1+0.5*δ).
+///
+///  Rather than blurring the original image from scratch for every σ, the
+///  image is blurred incrementally:  The blurred image for σ_n is obtained
+///  from the blurred image for σ_{n-1} by applying a narrow blur whose
+///  variance is σ_n^2 - σ_{n-1}^2.  (The discrete analogue of the Gaussian
+///  is used, since it obeys the semi-group property needed to make this exact.
+///  See GenFilterDiscreteGauss1D().)  Since the incremental blurs are narrow,
+///  this is typically several times faster than calling ApplyLog() repeatedly.
+///
+///  Voxels outside the image boundaries (or outside the mask) are excluded
+///  from the averaging, as they are in ApplyLog().  In order to do this
+///  incrementally, the blurred (masked) image and the blurred mask (ie. the
+///  numerator and denominator of the weighted average) are stored separately.
+///  When there is no mask, the denominator is separable, and is stored using
+///  three 1-D arrays.  Otherwise two additional 3-D arrays are needed.
+///
+/// @note  The results differ from ApplyLog(), which uses Gaussians evaluated
+///        at evenly spaced intervals (instead of the discrete analogue of
+///        the Gaussian), truncated at truncate_ratio*σ.  Only the first blur
+///        (of the original image) is truncated this way.  The incremental
+///        blurs which follow are truncated only where their tails are
+///        negligible (see BlurNumerDenom()), so for larger σ the result
+///        resembles ApplyLog() with a larger truncate_ratio.  Since the DoG
+///        is multiplied by 1/δ^2, these differences are amplified, so the
+///        list of scale-space extrema (blobs) can differ, especially for
+///        noisy images.
+///
+/// Example usage:
+/// @code
+/// ScaleSpaceLoG<float> scale_space(image_size, aaafSource, aaafMask);
+/// for (int i = 0; i < sigmas.size(); i++)  // (sigmas must be increasing)
+///   scale_space.Apply(sigmas[i], aaafDest);
+/// @endcode
+
+template<typename Scalar>
+
+class ScaleSpaceLoG {
+
+  int image_size[3];
+  Scalar const *const *const *aaafMask; //!< ignore voxels where mask==0
+  Scalar delta_sigma_over_sigma; //!< δ parameter for approximating LoG with DoG
+  Scalar truncate_ratio; //!< width of each (incremental) blur / its σ
+  Scalar t_current; //!< variance (σ^2) of the blur applied to aaafNumer so far
+
+  Scalar ***aaafNumer; //!< the (masked) image after blurring
+  Scalar *afNumer;
+  Scalar ***aaafDenom; //!< the mask after blurring (if aaafMask != nullptr)
+  Scalar *afDenom;
+  vector<Scalar> avDenom[3]; //!< the denominator in the x,y,z directions
+                             //!< (used instead when aaafMask == nullptr)
+  Scalar ***aaafNumerTmp; //!< temporary arrays
+  Scalar *afNumerTmp;
+  Scalar ***aaafDenomTmp;
+  Scalar *afDenomTmp;
+  vector<Scalar> avDenomTmp[3];
+
+public:
+
+  ScaleSpaceLoG(int const set_image_size[3], //!< source image size
+                Scalar const *const *const *aaafSource, //!< source image
+                Scalar const *const *const *set_aaafMask=nullptr, //!< ignore voxels where mask==0
+                Scalar set_delta_sigma_over_sigma=0.02, //!< δ param for approximating LoG with DoG
+                Scalar set_truncate_ratio=2.5 //!< how many sigma before truncating?
+                )
+  {
+    assert(aaafSource);
+    for (int d = 0; d < 3; d++)
+      image_size[d] = set_image_size[d];
+    aaafMask = set_aaafMask;
+    delta_sigma_over_sigma = set_delta_sigma_over_sigma;
+    truncate_ratio = set_truncate_ratio;
+    t_current = 0.0;
+    aaafDenom = nullptr;
+    afDenom = nullptr;
+    aaafDenomTmp = nullptr;
+    afDenomTmp = nullptr;
+
+    Alloc3D(image_size, &afNumer, &aaafNumer);
+    Alloc3D(image_size, &afNumerTmp, &aaafNumerTmp);
+    if (aaafMask) {
+      Alloc3D(image_size, &afDenom, &aaafDenom);
+      Alloc3D(image_size, &afDenomTmp, &aaafDenomTmp);
+    }
+    else {
+      for (int d = 0; d < 3; d++) {
+        avDenom[d].assign(image_size[d], 1.0);
+        avDenomTmp[d].resize(image_size[d]);
+      }
+    }
+
+    #pragma omp parallel for collapse(2)
+    for (int iz = 0; iz < image_size[2]; iz++) {
+      for (int iy = 0; iy < image_size[1]; iy++) {
+        for (int ix = 0; ix < image_size[0]; ix++) {
+          aaafNumer[iz][iy][ix] = aaafSource[iz][iy][ix];
+          if (aaafMask) {
+            aaafNumer[iz][iy][ix] *= aaafMask[iz][iy][ix];
+            aaafDenom[iz][iy][ix] = aaafMask[iz][iy][ix];
+          }
+        }
+      }
+    }
+  } // ScaleSpaceLoG()
+
+
+  ~ScaleSpaceLoG() {
+    Dealloc3D(image_size, &afNumer, &aaafNumer);
+    Dealloc3D(image_size, &afNumerTmp, &aaafNumerTmp);
+    if (aaafDenom)
+      Dealloc3D(image_size, &afDenom, &aaafDenom);
+    if (aaafDenomTmp)
+      Dealloc3D(image_size, &afDenomTmp, &aaafDenomTmp);
+  }
+
+
+  /// @brief  Apply a (scale-normalized) LoG filter of width σ to the image.
+  ///         The result is equivalent to ApplyLog(image_size, aaafSource,
+  ///         aaafDest, aaafMask, sigma, delta_sigma_over_sigma, truncate_ratio)
+  ///         (See the note in the class description.)
+  /// @note   Successive invocations must use increasing values of σ.
+
+  void Apply(Scalar sigma,      //!< Gaussian width (must exceed previous σ)
+             Scalar ***aaafDest, //!< store the filtered image here
+             ostream *pReportProgress = nullptr //!< report progress?
+             )
+  {
+    assert(aaafDest);
+    Scalar sigma_a = sigma * (1.0 - 0.5*delta_sigma_over_sigma);
+    Scalar sigma_b = sigma * (1.0 + 0.5*delta_sigma_over_sigma);
+    Scalar t_a = sigma_a * sigma_a;
+    Scalar t_b = sigma_b * sigma_b;
+    if (t_a < t_current)
+      throw VisfdErr("Error: ScaleSpaceLoG::Apply() must be invoked using increasing sigma.\n");
+
+    // Blur the numerator and denominator until their width equals σ_a.
+    Blur(t_a - t_current,
+         t_current,
+         aaafNumer, aaafDenom, avDenom,
+         aaafNumer, aaafDenom, avDenom,
+         pReportProgress);
+    t_current = t_a;
+
+    // Make a copy of them blurred to σ_b.
+    Blur(t_b - t_a,
+         t_a,
+         aaafNumer, aaafDenom, avDenom,
+         aaafNumerTmp, aaafDenomTmp, avDenomTmp,
+         pReportProgress);
+
+    // Now calculate the difference between the two (normalized) Gaussians.
+    // (See ApplyLog() for an explanation of the "t_over_delta_t" factor.)
+    Scalar t_over_delta_t = 1.0 / (delta_sigma_over_sigma *
+                                   delta_sigma_over_sigma);
+
+    #pragma omp parallel for collapse(2)
+    for (int iz = 0; iz < image_size[2]; iz++) {
+      for (int iy = 0; iy < image_size[1]; iy++) {
+        for (int ix = 0; ix < image_size[0]; ix++) {
+          Scalar denom_a, denom_b;
+          if (aaafMask) {
+            denom_a = aaafDenom[iz][iy][ix];
+            denom_b = aaafDenomTmp[iz][iy][ix];
+          }
+          else {
+            denom_a = avDenom[0][ix] * avDenom[1][iy] * avDenom[2][iz];
+            denom_b = avDenomTmp[0][ix] * avDenomTmp[1][iy] * avDenomTmp[2][iz];
+          }
+          if ((denom_a > 0.0) && (denom_b > 0.0))
+            aaafDest[iz][iy][ix] = t_over_delta_t *
+              (aaafNumer[iz][iy][ix] / denom_a -
+               aaafNumerTmp[iz][iy][ix] / denom_b);
+          else
+            aaafDest[iz][iy][ix] = 0.0;
+        }
+      }
+    }
+  } // Apply()
+
+
+private:
+
+  /// @brief  Blur the numerator and denominator using a (discrete) Gaussian
+  ///         whose variance is dt.  (The source and dest may be the same.)
+  ///         t_prior is the variance of the blur already applied to the source.
+  void Blur(Scalar dt,
+            Scalar t_prior,
+            Scalar const *const *const *aaafNumerSrc,
+            Scalar const *const *const *aaafDenomSrc,
+            vector<Scalar> const *avDenomSrc,
+            Scalar ***aaafNumerDest,
+            Scalar ***aaafDenomDest,
+            vector<Scalar> *avDenomDest,
+            ostream *pReportProgress)
+  {
+    BlurNumerDenom(image_size, dt, t_prior, truncate_ratio,
+                   aaafMask != nullptr,
+                   aaafNumerSrc, aaafDenomSrc, avDenomSrc,
+                   aaafNumerDest, aaafDenomDest, avDenomDest,
+                   pReportProgress);
+  }
+
+
+  // Disable copying (this class owns several large arrays)
+  ScaleSpaceLoG(const ScaleSpaceLoG<Scalar>&);
+  ScaleSpaceLoG<Scalar>& operator = (const ScaleSpaceLoG<Scalar>&);
+
+}; // class ScaleSpaceLoG
+
+
+
+
+/// @brief  "ScaleSpaceGauss" is used to blur the same image using a sequence
+///         of (normalized) Gaussians of increasing width (σ), as ApplyGauss()
+///         would.  Like ScaleSpaceLoG, the blurred image for σ_n is obtained
+///         from the blurred image for σ_{n-1} by applying a narrow blur whose
+///         variance is σ_n^2 - σ_{n-1}^2, using the discrete analogue of the
+///         Gaussian.  Voxels outside the image (or outside the mask) are
+///         excluded from the average (see ScaleSpaceLoG for details).
+///
+/// @note  The results differ slightly from ApplyGauss(), which uses Gaussians
+///        evaluated at evenly spaced intervals.  (The difference is only
+///        noticeable when σ is not much larger than 1 voxel.)  Only the first
+///        blur is truncated at truncate_ratio*σ.  The incremental blurs which
+///        follow are truncated only where their tails are negligible (see
+///        BlurNumerDenom()), so later results resemble ApplyGauss() using a
+///        wider window.  Within a distance of roughly σ from the edge of the
+///        image, the differences are larger, because each of the incremental
+///        blurs discards the brightness which has spread beyond the edge of
+///        the image.  (Away from the image boundaries, the mask boundaries
+///        are handled exactly, since the blurred numerator and denominator are
+///        computed everywhere, not only inside the mask.)
+///
+/// Example usage:
+/// @code
+/// ScaleSpaceGauss<float> scale_space(image_size, aaafSource, aaafMask);
+/// for (int i = 0; i < sigmas.size(); i++)  // (sigmas must be increasing)
+///   scale_space.Apply(sigmas[i], aaafDest);
+/// @endcode
+
+template<typename Scalar>
+
+class ScaleSpaceGauss {
+
+  int image_size[3];
+  Scalar const *const *const *aaafMask; //!< ignore voxels where mask==0
+  Scalar truncate_ratio; //!< width of each (incremental) blur / its σ
+  Scalar t_current; //!< variance (σ^2) of the blur applied to aaafNumer so far
+
+  Scalar ***aaafNumer; //!< the (masked) image after blurring
+  Scalar *afNumer;
+  Scalar ***aaafDenom; //!< the mask after blurring (if aaafMask != nullptr)
+  Scalar *afDenom;
+  vector<Scalar> avDenom[3]; //!< the denominator in the x,y,z directions
+                             //!< (used instead when aaafMask == nullptr)
+
+public:
+
+  ScaleSpaceGauss(int const set_image_size[3], //!< source image size
+                  Scalar const *const *const *aaafSource, //!< source image
+                  Scalar const *const *const *set_aaafMask=nullptr, //!< ignore voxels where mask==0
+                  Scalar set_truncate_ratio=2.5 //!< how many sigma before truncating?
+                  )
+  {
+    assert(aaafSource);
+    for (int d = 0; d < 3; d++)
+      image_size[d] = set_image_size[d];
+    aaafMask = set_aaafMask;
+    truncate_ratio = set_truncate_ratio;
+    t_current = 0.0;
+    aaafDenom = nullptr;
+    afDenom = nullptr;
+
+    Alloc3D(image_size, &afNumer, &aaafNumer);
+    if (aaafMask)
+      Alloc3D(image_size, &afDenom, &aaafDenom);
+    else {
+      for (int d = 0; d < 3; d++)
+        avDenom[d].assign(image_size[d], 1.0);
+    }
+
+    #pragma omp parallel for collapse(2)
+    for (int iz = 0; iz < image_size[2]; iz++) {
+      for (int iy = 0; iy < image_size[1]; iy++) {
+        for (int ix = 0; ix < image_size[0]; ix++) {
+          aaafNumer[iz][iy][ix] = aaafSource[iz][iy][ix];
+          if (aaafMask) {
+            aaafNumer[iz][iy][ix] *= aaafMask[iz][iy][ix];
+            aaafDenom[iz][iy][ix] = aaafMask[iz][iy][ix];
+          }
+        }
+      }
+    }
+  } // ScaleSpaceGauss()
+
+
+  ~ScaleSpaceGauss() {
+    Dealloc3D(image_size, &afNumer, &aaafNumer);
+    if (aaafDenom)
+      Dealloc3D(image_size, &afDenom, &aaafDenom);
+  }
+
+
+  /// @brief  Blur the image using a (normalized) Gaussian of width σ.
+  ///         The result is equivalent to ApplyGauss(image_size, aaafSource,
+  ///         aaafDest, aaafMask, sigma, truncate_ratio)
+  ///         (See the note in the class description.)
+  ///         Voxels where the blurred mask is zero are assigned 0.
+  /// @note   Successive invocations must use increasing (or equal) σ.
+
+  void Apply(Scalar sigma,      //!< Gaussian width (must not be less than previous σ)
+             Scalar ***aaafDest, //!< store the blurred image here
+             ostream *pReportProgress = nullptr //!< report progress?
+             )
+  {
+    assert(aaafDest);
+    Scalar t = sigma * sigma;
+    if (t < t_current)
+      throw VisfdErr("Error: ScaleSpaceGauss::Apply() must be invoked using increasing sigma.\n");
+
+    if (t > t_current)
+      BlurNumerDenom(image_size, t - t_current, t_current, truncate_ratio,
+                     aaafMask != nullptr,
+                     aaafNumer, aaafDenom, avDenom,
+                     aaafNumer, aaafDenom, avDenom,
+                     pReportProgress);
+    t_current = t;
+
+    #pragma omp parallel for collapse(2)
+    for (int iz = 0; iz < image_size[2]; iz++) {
+      for (int iy = 0; iy < image_size[1]; iy++) {
+        for (int ix = 0; ix < image_size[0]; ix++) {
+          Scalar denom;
+          if (aaafMask)
+            denom = aaafDenom[iz][iy][ix];
+          else
+            denom = avDenom[0][ix] * avDenom[1][iy] * avDenom[2][iz];
+          if (denom > 0.0)
+            aaafDest[iz][iy][ix] = aaafNumer[iz][iy][ix] / denom;
+          else
+            aaafDest[iz][iy][ix] = 0.0;
+        }
+      }
+    }
+  } // Apply()
+
+
+private:
+
+  // Disable copying (this class owns large arrays)
+  ScaleSpaceGauss(const ScaleSpaceGauss<Scalar>&);
+  ScaleSpaceGauss<Scalar>& operator = (const ScaleSpaceGauss<Scalar>&);
+
+}; // class ScaleSpaceGauss
+
+
+
+} //namespace visfd
+
+
+
+#endif //#ifndef _SCALE_SPACE_HPP
@@ -15,6 +15,9 @@
 #include <tuple>
 #include <set>
 #include <queue>
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
 using namespace std;
 #include <err_visfd.hpp> // defines the "VisfdErr" exception type
 #include <eigen3_simple.hpp>  // defines matrix diagonalizer (DiagonalizeSym3())
@@ -24,6 +27,7 @@ using namespace std;
 #include <alloc3d.hpp>    // defines Alloc3D() and Dealloc3D()
 #include <filter1d.hpp>   // defines "Filter1D" (used in ApplySeparable())
 #include <filter3d.hpp>   // defines common 3D image filters
+#include <hierarchical_queue.hpp> // defines "HierarchicalQueue"
 
 
 
@@ -31,6 +35,427 @@ namespace visfd {
 
 
 
+/// @brief  The number of levels (buckets) used by the HierarchicalQueue in
+///         Watershed().  (This only affects speed, not the results.)
+const size_t WATERSHED_QUEUE_LEVELS = 65536;
+
+
+
+/// @brief  An entry in the queue of voxels used by Watershed()
+///         (This was a tuple<Scalar, ptrdiff_t, array<Coordinate, 3> >.
+///          The location of the voxel is now packed into a single integer.)
+template<typename Scalar>
+struct _WatershedEntry {
+  Scalar score;    //!< the "height" of that voxel (brightness * SIGN_FACTOR)
+  int32_t basin;   //!< the basin-ID to which the voxel belongs (tentatively)
+  uint64_t index;  //!< location of the voxel: ix + nx*(iy + ny*iz)
+};
+
+
+/// @brief  Decide which entry in the queue to process first.
+///         Entries are sorted by score (lowest first), then by basin-ID
+///         (highest first), and then by location (ix, then iy, then iz,
+///         highest first).  This is the same order used by earlier versions
+///         of Watershed(), so the results are unchanged.
+template<typename Scalar>
+struct _WatershedCompare {
+  uint64_t nx;
+  uint64_t ny;
+  _WatershedCompare(int const image_size[3]) {
+    nx = image_size[0];
+    ny = image_size[1];
+  }
+  // Returns true if entry "a" should be processed after entry "b"
+  bool operator () (const _WatershedEntry<Scalar> &a,
+                    const _WatershedEntry<Scalar> &b) const {
+    if (a.score != b.score)
+      return a.score > b.score;
+    if (a.basin != b.basin)
+      return a.basin < b.basin;
+    uint64_t a_ix = a.index % nx;
+    uint64_t b_ix = b.index % nx;
+    if (a_ix != b_ix)
+      return a_ix < b_ix;
+    uint64_t a_iy = (a.index / nx) % ny;
+    uint64_t b_iy = (b.index / nx) % ny;
+    if (a_iy != b_iy)
+      return a_iy < b_iy;
+    return a.index < b.index; // (the iz coordinates differ)
+  }
+};
+
+
+
+/// @brief  This function is used by Watershed() to flood the voxels in a
+///         range of z-planes (iz_begin <= iz < iz_end) beginning at the
+///         local minima (or maxima) in "seeds".  Voxels outside this range
+///         are not visited.  (See Watershed() for a description of the
+///         other arguments.)
+
+template<typename Scalar, typename Label>
+
+static void
+_WatershedFlood(int const image_size[3],
+                Scalar const *const *const *aaafSource,
+                Label ***aaaiDest,
+                Scalar const *const *const *aaafMask,
+                Scalar halt_threshold,
+                Scalar SIGN_FACTOR,
+                int iz_begin,
+                int iz_end,
+                vector<_WatershedEntry<Scalar> > const &seeds,
+                int const (*neighbors)[3],
+                int num_neighbors,
+                bool show_boundaries,
+                ptrdiff_t WATERSHED_BOUNDARY,
+                ptrdiff_t UNDEFINED,
+                ptrdiff_t QUEUED,
+                Scalar score_min,  //!< the range of scores (used by the queue)
+                Scalar score_max,  //!< the range of scores (used by the queue)
+                size_t n_voxels_image, //!< (used for reporting progress)
+                vector<pair<uint64_t, ptrdiff_t> > *pvBoundaryBasins, //!< optional: store the basin to which each WATERSHED_BOUNDARY voxel would otherwise belong
+                ostream *pReportProgress)
+{
+  // Define "q", the set of voxels which are adjacent to the voxels we have
+  // processed so far.  These are the voxels to be processed in the next
+  // iteration.  This is implemented as a priority-queue, sorted by intensity.
+  // Each voxel in "q" has an intensity, a basin-ID (Label), and a location.
+  // (A HierarchicalQueue is used instead of a std::priority_queue.
+  //  It produces identical results, but is faster for large images.)
+
+  HierarchicalQueue<_WatershedEntry<Scalar>, _WatershedCompare<Scalar> >
+    q(score_min,
+      score_max,
+      WATERSHED_QUEUE_LEVELS,
+      _WatershedCompare<Scalar>(image_size));
+
+  // Initialize the queue so that it only contains voxels which lie
+  // at the location of a local minima (or maxima).
+  for (auto p = seeds.begin(); p != seeds.end(); p++)
+    q.push(*p);
+
+  size_t n_voxels_processed = 0;
+  uint64_t nx = image_size[0];
+  uint64_t ny = image_size[1];
+
+  // Loop over all the voxels on the periphery
+  // of the voxels with lower intensity (brightness).
+  // This is a priority-queue of voxels which lie adjacent to 
+  // the voxels which have been already considered.
+  // As we consider new voxels, add their neighbors to this queue as well
+  // until we process all voxels in the image.
+
+  while (! q.empty())
+  {
+    _WatershedEntry<Scalar> p = q.top();
+    q.pop();
+
+    // Figure out the properties of that voxel (position, intensity/score,basin)
+    Scalar i_score = p.score; //abs(i_score) = voxel intensity = aaafSource[iz][iy][ix]
+    ptrdiff_t i_which_basin = p.basin; // the basin to which that voxel belongs (tentatively)
+    int ix = p.index % nx;        // voxel location
+    int iy = (p.index / nx) % ny; //   "      "
+    int iz = p.index / (nx * ny); //   "      "
+
+    // Should we ignore this voxel?
+
+    if (i_score > halt_threshold * SIGN_FACTOR) {
+      // stop when the voxel brightness(*SIGN_FACTOR) exceeds the halt_threshold
+      aaaiDest[iz][iy][ix] = UNDEFINED;
+      continue;
+    }
+
+    if (aaafMask && aaafMask[iz][iy][ix] == 0.0) {
+      // ignore voxel if the user specified a mask and the voxel does not belong
+      aaaiDest[iz][iy][ix] = UNDEFINED;
+      continue;
+    }
+
+    assert(aaaiDest[iz][iy][ix] == QUEUED);
+    // Now we assign this voxel to the basin
+    aaaiDest[iz][iy][ix] = i_which_basin + 1;
+    // (Note: This will prevent the voxel from being visited again.)
+
+
+    if (pReportProgress) {
+      // Every time the amount of progress increases by 1%, inform the user:
+      n_voxels_processed++;
+      size_t percentage = (n_voxels_processed*100) / n_voxels_image;
+      size_t percentage_previous = ((n_voxels_processed-1)*100)/n_voxels_image;
+      if (percentage != percentage_previous)
+        *pReportProgress << " percent complete: " << percentage << endl;
+    }
+
+
+    // ---------- Meyer (and Beucher's?) inter-pixel flood algorith: ---------
+    // Find all the local minima (or maxima) in the image.
+    // Each one of these minima (or maxima) is the center (seed) of a "basin"
+    // (a group of voxels that surround that minima or maxima).
+    // Initially these basins contain only the
+    // voxel(s) which are located at that local minima (or maxima).
+    // so we assign each of the voxels to the basin to which it belongs.
+    // Then we add nearby voxels (adjacent) voxels to each basin until
+    // a collision between basins occurs.
+    //
+    // Details:  Iterate over every voxel in the priority queue:
+    //
+    // Add each of the local minima (or maxima) voxels to a priority queue
+    // of voxels to be considered later.
+    //
+    // 1) Retrieve the next lowest (or highest) intensity voxel from this queue.
+    //    By definition, it will be adjacent to at least one basin.
+    //    (The basin to which the voxel belonged that added it to the queue.)
+    // 2) If that voxel is adjacent to only one basin assign it to that basin.
+    //    If it is adjacent to multiple basins, assign it to WATERSHED_BOUNDARY.
+    // 3) Search over that voxel's neighbors.  Add any neighboring voxels
+    //    which have not yet been assigned to a basin already to the queue.
+    // 4) Iterate until there are no more voxels left in the queue.
+
+
+    // ---- loop over neighbors ----
+    // Let (jx,jy,jz) denote the index offset for the neighbor voxels
+    // (located at ix+jx,iy+jy,iz+jz)
+
+    for (int j = 0; j < num_neighbors; j++) {
+      int jx = neighbors[j][0];
+      int jy = neighbors[j][1];
+      int jz = neighbors[j][2];
+      int iz_jz = iz + jz;
+      int iy_jy = iy + jy;
+      int ix_jx = ix + jx;
+      if ((iz_jz < iz_begin) || (iz_end <= iz_jz))
+        continue;
+      if ((iy_jy < 0) || (image_size[1] <= iy_jy))
+        continue;
+      if ((ix_jx < 0) || (image_size[0] <= ix_jx))
+        continue;
+
+      if (aaafMask && (aaafMask[iz_jz][iy_jy][ix_jx] == 0.0))
+        continue;
+
+      if (aaaiDest[iz_jz][iy_jy][ix_jx] == WATERSHED_BOUNDARY)
+        continue;
+
+      else if (aaaiDest[iz_jz][iy_jy][ix_jx] == QUEUED)
+        continue;
+
+      else if (aaaiDest[iz_jz][iy_jy][ix_jx] == UNDEFINED)
+      {
+
+        aaaiDest[iz_jz][iy_jy][ix_jx] = QUEUED;
+
+        // and push this neighboring voxels onto the queue.
+        // (...if they have not been assigned to a basin yet.  This
+        //  insures that the same voxel is never pushed more than once.)
+        _WatershedEntry<Scalar> neighbor;
+        neighbor.score = aaafSource[iz_jz][iy_jy][ix_jx]*SIGN_FACTOR;
+        neighbor.basin = i_which_basin;
+        neighbor.index = ix_jx + nx*(iy_jy + ny*iz_jz);
+        q.push(neighbor);
+      }
+      else {
+        if (aaaiDest[iz_jz][iy_jy][ix_jx] != aaaiDest[iz][iy][ix])
+        {
+          assert((aaaiDest[iz][iy][ix] == i_which_basin + 1) ||
+                 (aaaiDest[iz][iy][ix] == WATERSHED_BOUNDARY));
+
+          if (show_boundaries)
+          {
+            // If these two neighboring voxels already belong to different 
+            // basins, then we should assign the more SHALLOW voxel to 
+            // WATERSHED_BOUNDARY. Which of the two voxels is "more shallow"?
+            // This is the voxel with the higher intensity (*SIGN_FACTOR).
+            assert(SIGN_FACTOR * aaafSource[iz_jz][iy_jy][ix_jx]  <=
+                   SIGN_FACTOR * aaafSource[iz][iy][ix]);
+            if (pvBoundaryBasins && (aaaiDest[iz][iy][ix] != WATERSHED_BOUNDARY))
+              pvBoundaryBasins->push_back(make_pair(p.index, i_which_basin+1));
+            aaaiDest[iz][iy][ix] = WATERSHED_BOUNDARY;
+          }
+        } // if (aaaiDest[iz_jz][iy_jy][ix_jx] != aaaiDest[iz][iy][ix])
+      } // else clause for "if (aaaiDest[iz_jz][iy_jy][ix_jx] == UNDEFINED)"
+    } // for (int j = 0; j < num_neighbors; j++)
+  } //while (! q.empty())
+
+} //_WatershedFlood()
+
+
+
+
+/// @brief  This function is used by Watershed() to stitch together the
+///         results of _WatershedFlood() from adjacent blocks of z-planes.
+///         Each block was flooded independently, so basins were unable to
+///         cross the boundaries between blocks.  Here the voxels near these
+///         boundaries are visited again (in the same order they would have
+///         been visited by _WatershedFlood()).  Each voxel is assigned to the
+///         basin of the first of its neighbors to be visited (the neighbor
+///         which would have added it to the queue), and it is assigned to
+///         WATERSHED_BOUNDARY if any of its other (previously visited)
+///         neighbors belong to a different basin.  Whenever a voxel's
+///         basin changes, its neighbors that are visited later are
+///         reconsidered as well.  Typically only a small fraction of the
+///         image is visited, so this is much faster than _WatershedFlood().
+/// @note   The results are usually, but not always the same as the results
+///         obtained by flooding the entire image at once.  (Voxels with
+///         identical intensities are not always visited in the same order.)
+
+template<typename Scalar, typename Label>
+
+static void
+_WatershedMergeBlocks(int const image_size[3],
+                      Scalar const *const *const *aaafSource,
+                      Label ***aaaiDest,
+                      Scalar const *const *const *aaafMask,
+                      Scalar halt_threshold,
+                      Scalar SIGN_FACTOR,
+                      vector<int> const &block_iz_begin, //!< z-plane where each block begins
+                      unordered_set<uint64_t> const &seed_indices, //!< location of local minima (or maxima)
+                      unordered_map<uint64_t, ptrdiff_t> &boundary_basins, //!< basin to which each WATERSHED_BOUNDARY voxel would otherwise belong
+                      int const (*neighbors)[3],
+                      int num_neighbors,
+                      bool show_boundaries,
+                      ptrdiff_t WATERSHED_BOUNDARY,
+                      ptrdiff_t UNDEFINED,
+                      Scalar score_min,
+                      Scalar score_max)
+{
+  _WatershedCompare<Scalar> compare(image_size);
+  HierarchicalQueue<_WatershedEntry<Scalar>, _WatershedCompare<Scalar> >
+    q(score_min,
+      score_max,
+      WATERSHED_QUEUE_LEVELS,
+      compare);
+
+  uint64_t nx = image_size[0];
+  uint64_t ny = image_size[1];
+
+  // Keep track of which voxels have been added to the queue.
+  // (Typically only a small fraction of the image, so use a hash table.)
+  unordered_set<uint64_t> queued;
+
+  // Begin with the voxels on either side of the boundaries between blocks.
+  // (block_iz_begin.back() is the end of the last block, not a boundary)
+  for (size_t b = 1; b+1 < block_iz_begin.size(); b++) {
+    for (int iz = block_iz_begin[b]-1; iz <= block_iz_begin[b]; iz++) {
+      for (int iy = 0; iy < image_size[1]; iy++) {
+        for (int ix = 0; ix < image_size[0]; ix++) {
+          if (aaafMask && (aaafMask[iz][iy][ix] == 0.0))
+            continue;
+          Scalar score = aaafSource[iz][iy][ix] * SIGN_FACTOR;
+          if (score > halt_threshold * SIGN_FACTOR)
+            continue;
+          _WatershedEntry<Scalar> entry;
+          entry.score = score;
+          entry.basin = 0; // (all entries use the same basin-ID here)
+          entry.index = ix + nx*(iy + ny*iz);
+          q.push(entry);
+          queued.insert(entry.index);
+        }
+      }
+    }
+  }
+
+  while (! q.empty())
+  {
+    _WatershedEntry<Scalar> p = q.top();
+    q.pop();
+    int ix = p.index % nx;
+    int iy = (p.index / nx) % ny;
+    int iz = p.index / (nx * ny);
+
+    // The basin to which this voxel belongs (even if it is a boundary voxel)
+    ptrdiff_t i_basin = aaaiDest[iz][iy][ix];
+    if (i_basin == WATERSHED_BOUNDARY)
+      i_basin = boundary_basins[p.index];
+
+    // Find the neighbors that are visited before this voxel.
+    // Which of them is visited first?  Which basins do they belong to?
+    vector<ptrdiff_t> earlier_labels;
+    ptrdiff_t first_basin = UNDEFINED;
+    _WatershedEntry<Scalar> first{};
+    for (int j = 0; j < num_neighbors; j++) {
+      int iz_jz = iz + neighbors[j][2];
+      int iy_jy = iy + neighbors[j][1];
+      int ix_jx = ix + neighbors[j][0];
+      if ((iz_jz < 0) || (image_size[2] <= iz_jz))
+        continue;
+      if ((iy_jy < 0) || (image_size[1] <= iy_jy))
+        continue;
+      if ((ix_jx < 0) || (image_size[0] <= ix_jx))
+        continue;
+      if (aaafMask && (aaafMask[iz_jz][iy_jy][ix_jx] == 0.0))
+        continue;
+      ptrdiff_t neighbor_label = aaaiDest[iz_jz][iy_jy][ix_jx];
+      if (neighbor_label == UNDEFINED)
+        continue;
+      _WatershedEntry<Scalar> neighbor;
+      neighbor.score = aaafSource[iz_jz][iy_jy][ix_jx] * SIGN_FACTOR;
+      neighbor.basin = 0;
+      neighbor.index = ix_jx + nx*(iy_jy + ny*iz_jz);
+      if (! compare(p, neighbor)) // Is the neighbor visited after this voxel?
+        continue;
+      earlier_labels.push_back(neighbor_label);
+      if ((first_basin == UNDEFINED) || compare(first, neighbor)) {
+        first = neighbor;
+        first_basin = neighbor_label;
+        if (first_basin == WATERSHED_BOUNDARY)
+          first_basin = boundary_basins[neighbor.index];
+      }
+    } // for (int j = 0; j < num_neighbors; j++)
+
+    // (The basins of the local minima (or maxima) never change.)
+    ptrdiff_t new_basin = i_basin;
+    if ((first_basin != UNDEFINED) &&
+        (seed_indices.find(p.index) == seed_indices.end()))
+      new_basin = first_basin;
+
+    ptrdiff_t new_label = new_basin;
+    if (show_boundaries) {
+      for (auto pl = earlier_labels.begin(); pl != earlier_labels.end(); pl++)
+        if ((*pl != WATERSHED_BOUNDARY) && (*pl != new_basin))
+          new_label = WATERSHED_BOUNDARY;
+    }
+
+    if ((new_label == aaaiDest[iz][iy][ix]) && (new_basin == i_basin))
+      continue;
+
+    aaaiDest[iz][iy][ix] = new_label;
+    if (new_label == WATERSHED_BOUNDARY)
+      boundary_basins[p.index] = new_basin;
+
+    // Since this voxel has changed, the neighbors that are visited later
+    // must be reconsidered.
+    for (int j = 0; j < num_neighbors; j++) {
+      int iz_jz = iz + neighbors[j][2];
+      int iy_jy = iy + neighbors[j][1];
+      int ix_jx = ix + neighbors[j][0];
+      if ((iz_jz < 0) || (image_size[2] <= iz_jz))
+        continue;
+      if ((iy_jy < 0) || (image_size[1] <= iy_jy))
+        continue;
+      if ((ix_jx < 0) || (image_size[0] <= ix_jx))
+        continue;
+      if (aaafMask && (aaafMask[iz_jz][iy_jy][ix_jx] == 0.0))
+        continue;
+      _WatershedEntry<Scalar> neighbor;
+      neighbor.score = aaafSource[iz_jz][iy_jy][ix_jx] * SIGN_FACTOR;
+      neighbor.basin = 0;
+      neighbor.index = ix_jx + nx*(iy_jy + ny*iz_jz);
+      if (neighbor.score > halt_threshold * SIGN_FACTOR)
+        continue;
+      if (compare(p, neighbor)) // Was the neighbor visited before this voxel?
+        continue;
+      if (queued.find(neighbor.index) != queued.end())
+        continue;
+      q.push(neighbor);
+      queued.insert(neighbor.index);
+    }
+  } //while (! q.empty())
+
+} //_WatershedMergeBlocks()
+
+
+
+
 
 /// @brief  Perform the Meyer's flood-fill algorithm to segment a 3D image.
 ///         After this function has completed, every voxel in aaaiDest[][][]
@@ -47,6 +472,14 @@ namespace visfd {
 ///         then std::numeric_limits::infinity is used by default.
 /// @note  If aaafMask!=nullptr then voxels in aaaiDest are not modified if
 ///        their corresponding entry in aaafMask equals 0.
+/// @note  If num_blocks > 1, the image is divided into this many blocks
+///        of z-planes which are flooded independently (in parallel).
+///        Afterwards, the basins are merged across the boundaries between
+///        blocks by _WatershedMergeBlocks().  The results are usually
+///        identical to the results obtained when num_blocks==1.  However if
+///        many neighboring voxels have identical intensities (plateaus), then
+///        these voxels may be divided between basins differently.
+///        The search for local minima (or maxima) is not parallelized.
 
 template<typename Scalar, typename Label, typename Coordinate>
 
@@ -62,6 +495,7 @@ Watershed(int const image_size[3],                 //!< #voxels in xyz
           Scalar boundary_label=0,       //!< if so, what intensity (ie. label) should boundary voxels be assigned to?
           vector<array<Coordinate, 3> > *pv_extrema_locations=nullptr, //!< optional: the location of each minima or maxima
           vector<Scalar> *pv_extrema_scores=nullptr, //!< optional: the voxel intensities (brightnesses) at these locations
+          int num_blocks=1,              //!< flood this many blocks of z-planes in parallel? (see below)
           ostream *pReportProgress=nullptr)  //!< print progress to the user?
 {
   assert(image_size);
@@ -147,6 +581,7 @@ Watershed(int const image_size[3],                 //!< #voxels in xyz
   ptrdiff_t QUEUED = NBASINS + 2; //an impossible value
 
   //initialize aaaiDest[][][]
+  #pragma omp parallel for collapse(2)
   for (int iz=0; iz<image_size[2]; iz++) {
     for (int iy=0; iy<image_size[1]; iy++) {
       for (int ix=0; ix<image_size[0]; ix++) {
@@ -157,30 +592,29 @@ Watershed(int const image_size[3],                 //!< #voxels in xyz
     }
   }
 
-  // Define "q", the set of voxels which are adjacent to the voxels we have
-  // processed so far.  These are the voxels to be processed in the next
-  // iteration.  This is implemented as a priority-queue, sorted by intensity.
-  // Each voxel in "q" has an intensity, a basin-ID (Label), and a location.
-
-  priority_queue<tuple
-                  <
-                   Scalar,    // the "height" of that voxel (brightness)
-                   ptrdiff_t,     // the basin-ID to which the voxel belongs
-                   array<Coordinate, 3>  // location of the voxel
-                  >
-                > q;
-               
-
   if (pReportProgress)
     *pReportProgress <<
       " ---- Watershed segmentation algorithm ----\n"
       "starting from " << NBASINS << " different local "
                      << (start_from_minima ? "minima" : "maxima") << endl;
 
-  // Initialize the queue so that it only contains voxels which lie
-  // at the location of a local minima (or maxima).
-  // Also keep track of which minima (which "basin") they belong to.
-
+  if (NBASINS > std::numeric_limits<int32_t>::max())
+    throw VisfdErr("Error: Too many local minima (or maxima) in Watershed().\n");
+
+  // Divide the image into blocks of z-planes which will be flooded in parallel
+  if (num_blocks > image_size[2])
+    num_blocks = image_size[2];
+  if (num_blocks < 1)
+    num_blocks = 1;
+  vector<int> block_iz_begin(num_blocks+1);
+  for (int b = 0; b <= num_blocks; b++)
+    block_iz_begin[b] = (static_cast<size_t>(image_size[2]) * b) / num_blocks;
+
+  // Create a list of the voxels which lie at the location of a local minima
+  // (or maxima) in each block.  Each of them will be the first entry in the
+  // queue.  Also keep track of which minima (which "basin") they belong to.
+  vector<vector<_WatershedEntry<Scalar> > > vvSeeds(num_blocks);
+  int which_block = 0;
   for (size_t i=0; i < NBASINS; i++) {
     // Create an entry in q for each of the local minima (or maxima)
 
@@ -201,18 +635,18 @@ Watershed(int const image_size[3],                 //!< #voxels in xyz
     //     or maxima below the halt_threshold. We check for that with an assert:
     assert(score <= halt_threshold * SIGN_FACTOR);
 
-    // copy the ix,iy,iz coordinates into an array<Coordinate, 3>
-    array<Coordinate, 3> icrds;
-    // (It seems like there should be a way to do this in 1 line, but I'm
-    //  unfamiliar with the new C++ array initializer syntax and I'm on a plane 
-    //  without internet at the moment.  So I'll just do it the obvious way.)
-    icrds[0] = ix;
-    icrds[1] = iy;
-    icrds[2] = iz;
+    _WatershedEntry<Scalar> seed;
+    seed.score = score;
+    seed.basin = which_basin;
+    seed.index = ix + static_cast<uint64_t>(image_size[0])*
+      (iy + static_cast<uint64_t>(image_size[1])*iz);
 
-    q.push(make_tuple(-score, // <-- entries sorted lexicographically by -score
-                      which_basin,
-                      icrds));
+    // Which block does it belong to?
+    while (iz < block_iz_begin[which_block])
+      which_block--;
+    while (block_iz_begin[which_block+1] <= iz)
+      which_block++;
+    vvSeeds[which_block].push_back(seed);
 
     assert(aaaiDest[iz][iy][ix] == UNDEFINED);
     aaaiDest[iz][iy][ix] = QUEUED;
@@ -222,175 +656,111 @@ Watershed(int const image_size[3],                 //!< #voxels in xyz
 
   // Count the number of voxels in the image we will need to consider.
   // (This will be used for printing out progress estimates later.)
-  size_t n_voxels_processed = 0;
+  // Also find the range of scores (used by the HierarchicalQueue).
   //size_t n_voxels_image = image_size[0] * image_size[1] * image_size[2];
   size_t n_voxels_image = 0;
+  Scalar score_min = std::numeric_limits<Scalar>::infinity();
+  Scalar score_max = -std::numeric_limits<Scalar>::infinity();
+  #pragma omp parallel for collapse(2) reduction(+:n_voxels_image) reduction(min:score_min) reduction(max:score_max)
   for (int iz=0; iz<image_size[2]; iz++) {
     for (int iy=0; iy<image_size[1]; iy++) {
       for (int ix=0; ix<image_size[0]; ix++) {
         if (aaafMask && aaafMask[iz][iy][ix] == 0.0)
           continue;
-        if (aaafSource[iz][iy][ix]*SIGN_FACTOR > halt_threshold*SIGN_FACTOR)
+        Scalar score = aaafSource[iz][iy][ix]*SIGN_FACTOR;
+        if (score > halt_threshold*SIGN_FACTOR)
           continue;
         n_voxels_image++;
+        score_min = std::min(score_min, score);
+        score_max = std::max(score_max, score);
       }
     }
   }
 
+  if (num_blocks == 1)
+    _WatershedFlood(image_size,
+                    aaafSource,
+                    aaaiDest,
+                    aaafMask,
+                    halt_threshold,
+                    SIGN_FACTOR,
+                    0,
+                    image_size[2],
+                    vvSeeds[0],
+                    neighbors,
+                    num_neighbors,
+                    show_boundaries,
+                    WATERSHED_BOUNDARY,
+                    UNDEFINED,
+                    QUEUED,
+                    score_min,
+                    score_max,
+                    n_voxels_image,
+                    static_cast<vector<pair<uint64_t, ptrdiff_t> >*>(nullptr),
+                    pReportProgress);
+  else {
+    if (pReportProgress)
+      *pReportProgress << " (flooding " << num_blocks
+                       << " blocks in parallel)" << endl;
+
+    // Keep track of the basin that each WATERSHED_BOUNDARY voxel belongs to.
+    vector<vector<pair<uint64_t, ptrdiff_t> > > vvBoundaryBasins(num_blocks);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int b = 0; b < num_blocks; b++)
+      _WatershedFlood(image_size,
+                      aaafSource,
+                      aaaiDest,
+                      aaafMask,
+                      halt_threshold,
+                      SIGN_FACTOR,
+                      block_iz_begin[b],
+                      block_iz_begin[b+1],
+                      vvSeeds[b],
+                      neighbors,
+                      num_neighbors,
+                      show_boundaries,
+                      WATERSHED_BOUNDARY,
+                      UNDEFINED,
+                      QUEUED,
+                      score_min,
+                      score_max,
+                      n_voxels_image,
+                      &vvBoundaryBasins[b],
+                      static_cast<ostream*>(nullptr));
+
+    unordered_map<uint64_t, ptrdiff_t> boundary_basins;
+    for (int b = 0; b < num_blocks; b++)
+      boundary_basins.insert(vvBoundaryBasins[b].begin(),
+                             vvBoundaryBasins[b].end());
+
+    unordered_set<uint64_t> seed_indices;
+    for (int b = 0; b < num_blocks; b++)
+      for (auto p = vvSeeds[b].begin(); p != vvSeeds[b].end(); p++)
+        seed_indices.insert(p->index);
+
+    if (pReportProgress)
+      *pReportProgress << " merging basins across block boundaries" << endl;
+
+    _WatershedMergeBlocks(image_size,
+                          aaafSource,
+                          aaaiDest,
+                          aaafMask,
+                          halt_threshold,
+                          SIGN_FACTOR,
+                          block_iz_begin,
+                          seed_indices,
+                          boundary_basins,
+                          neighbors,
+                          num_neighbors,
+                          show_boundaries,
+                          WATERSHED_BOUNDARY,
+                          UNDEFINED,
+                          score_min,
+                          score_max);
+  }
 
-  // Loop over all the voxels on the periphery
-  // of the voxels with lower intensity (brightness).
-  // This is a priority-queue of voxels which lie adjacent to 
-  // the voxels which have been already considered.
-  // As we consider new voxels, add their neighbors to this queue as well
-  // until we process all voxels in the image.
-
-  //#ifndef NDEBUG
-  //set<array<Coordinate, 3> > visited;
-  //#endif
-
-  while (! q.empty())
-  {
-    tuple<Scalar, ptrdiff_t, array<Coordinate, 3> > p = q.top();
-    q.pop();
-
-    // Figure out the properties of that voxel (position, intensity/score,basin)
-    Scalar i_score = -std::get<0>(p); //abs(i_score) = voxel intensity = aaafSource[iz][iy][ix]
-    Scalar i_which_basin = std::get<1>(p); // the basin to which that voxel belongs (tentatively)
-    int ix = std::get<2>(p)[0]; // voxel location
-    int iy = std::get<2>(p)[1]; //   "      "
-    int iz = std::get<2>(p)[2]; //   "      "
-
-    // Should we ignore this voxel?
-
-    if (i_score > halt_threshold * SIGN_FACTOR) {
-      // stop when the voxel brightness(*SIGN_FACTOR) exceeds the halt_threshold
-      aaaiDest[iz][iy][ix] = UNDEFINED;
-      continue;
-    }
-
-    if (aaafMask && aaafMask[iz][iy][ix] == 0.0) {
-      // ignore voxel if the user specified a mask and the voxel does not belong
-      aaaiDest[iz][iy][ix] = UNDEFINED;
-      continue;
-    }
-
-    assert(aaaiDest[iz][iy][ix] == QUEUED);
-    // Now we assign this voxel to the basin
-    aaaiDest[iz][iy][ix] = i_which_basin + 1;
-    // (Note: This will prevent the voxel from being visited again.)
-
-
-    if (pReportProgress) {
-      // Every time the amount of progress increases by 1%, inform the user:
-      n_voxels_processed++;
-      size_t percentage = (n_voxels_processed*100) / n_voxels_image;
-      size_t percentage_previous = ((n_voxels_processed-1)*100)/n_voxels_image;
-      if (percentage != percentage_previous)
-        *pReportProgress << " percent complete: " << percentage << endl;
-    }
-
-
-    //#ifndef NDEBUG
-    //array<Coordinate, 3> ixiyiz;
-    //ixiyiz[0] = ix;
-    //ixiyiz[1] = iy;
-    //ixiyiz[2] = iz;
-    //assert(visited.find(ixiyiz) == visited.end());
-    //visited.insert(ixiyiz);
-    //#endif //#ifndef NDEBUG
-
-
-
-    // ---------- Meyer (and Beucher's?) inter-pixel flood algorith: ---------
-    // Find all the local minima (or maxima) in the image.
-    // Each one of these minima (or maxima) is the center (seed) of a "basin"
-    // (a group of voxels that surround that minima or maxima).
-    // Initially these basins contain only the
-    // voxel(s) which are located at that local minima (or maxima).
-    // so we assign each of the voxels to the basin to which it belongs.
-    // Then we add nearby voxels (adjacent) voxels to each basin until
-    // a collision between basins occurs.
-    //
-    // Details:  Iterate over every voxel in the priority queue:
-    //
-    // Add each of the local minima (or maxima) voxels to a priority queue
-    // of voxels to be considered later.
-    //
-    // 1) Retrieve the next lowest (or highest) intensity voxel from this queue.
-    //    By definition, it will be adjacent to at least one basin.
-    //    (The basin to which the voxel belonged that added it to the queue.)
-    // 2) If that voxel is adjacent to only one basin assign it to that basin.
-    //    If it is adjacent to multiple basins, assign it to WATERSHED_BOUNDARY.
-    // 3) Search over that voxel's neighbors.  Add any neighboring voxels
-    //    which have not yet been assigned to a basin already to the queue.
-    // 4) Iterate until there are no more voxels left in the queue.
-
-
-    // ---- loop over neighbors ----
-    // Let (jx,jy,jz) denote the index offset for the neighbor voxels
-    // (located at ix+jx,iy+jy,iz+jz)
-
-    for (int j = 0; j < num_neighbors; j++) {
-      int jx = neighbors[j][0];
-      int jy = neighbors[j][1];
-      int jz = neighbors[j][2];
-      int iz_jz = iz + jz;
-      int iy_jy = iy + jy;
-      int ix_jx = ix + jx;
-      if ((iz_jz < 0) || (image_size[2] <= iz_jz))
-        continue;
-      if ((iy_jy < 0) || (image_size[1] <= iy_jy))
-        continue;
-      if ((ix_jx < 0) || (image_size[0] <= ix_jx))
-        continue;
-
-      if (aaafMask && (aaafMask[iz_jz][iy_jy][ix_jx] == 0.0))
-        continue;
-
-      if (aaaiDest[iz_jz][iy_jy][ix_jx] == WATERSHED_BOUNDARY)
-        continue;
-
-      else if (aaaiDest[iz_jz][iy_jy][ix_jx] == QUEUED)
-        continue;
-
-      else if (aaaiDest[iz_jz][iy_jy][ix_jx] == UNDEFINED)
-      {
-
-        aaaiDest[iz_jz][iy_jy][ix_jx] = QUEUED;
-
-        // and push this neighboring voxels onto the queue.
-        // (...if they have not been assigned to a basin yet.  This
-        //  insures that the same voxel is never pushed more than once.)
-        array<Coordinate, 3> neighbor_crds;
-        neighbor_crds[0] = ix_jx;
-        neighbor_crds[1] = iy_jy;
-        neighbor_crds[2] = iz_jz;
-        Scalar neighbor_score = aaafSource[iz_jz][iy_jy][ix_jx]*SIGN_FACTOR;
-        q.push(make_tuple(-neighbor_score,
-                          i_which_basin,
-                          neighbor_crds));
-      }
-      else {
-        if (aaaiDest[iz_jz][iy_jy][ix_jx] != aaaiDest[iz][iy][ix])
-        {
-          assert((aaaiDest[iz][iy][ix] == i_which_basin + 1) ||
-                 (aaaiDest[iz][iy][ix] == WATERSHED_BOUNDARY));
-
-          if (show_boundaries)
-          {
-            // If these two neighboring voxels already belong to different 
-            // basins, then we should assign the more SHALLOW voxel to 
-            // WATERSHED_BOUNDARY. Which of the two voxels is "more shallow"?
-            // This is the voxel with the higher intensity (*SIGN_FACTOR).
-            assert(SIGN_FACTOR * aaafSource[iz_jz][iy_jy][ix_jx]  <=
-                   SIGN_FACTOR * aaafSource[iz][iy][ix]);
-            aaaiDest[iz][iy][ix] = WATERSHED_BOUNDARY;
-          }
-        } // if (aaaiDest[iz_jz][iy_jy][ix_jx] != aaaiDest[iz][iy][ix])
-      } // else clause for "if (aaaiDest[iz_jz][iy_jy][ix_jx] == UNDEFINED)"
-    } // for (int j = 0; j < num_neighbors; j++)
-  } //while (q.size() != 0)
+  delete [] neighbors;
 
   #ifndef NDEBUG
   // DEBUGGING
@@ -0,0 +1,222 @@
+///   @file sphere_index.hpp
+///   @brief a spatial index which can quickly find the sphere (from a list
+///          of spheres) which contains a given location
+
+#ifndef _SPHERE_INDEX_HPP
+#define _SPHERE_INDEX_HPP
+
+#include <cassert>
+#include <cmath>
+#include <array>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+
+
+namespace visfd {
+
+
+
+/// @class  SphereIndex
+/// @brief  This class finds the sphere (from a list of spheres) which
+///         contains a given location.  Spheres are treated the same way
+///         they are when drawn into an image:  Every sphere occupies a set of
+///         voxels, and a location belongs to a sphere if the voxel containing
+///         it does.  (Coordinates are truncated to integers to find the voxel.)
+///         If a location lies in more than one sphere, the sphere appearing
+///         later in the list is chosen.
+///
+///         Instead of drawing every sphere into an image the size of the
+///         original tomogram, the spheres are sorted into a uniform grid of
+///         cubic cells (once, in the constructor).  A sphere is stored in
+///         every cell its bounding box overlaps.  The cell width is chosen so
+///         that the number of cells does not exceed the number of spheres,
+///         so the memory required scales with the number of spheres (not the
+///         size of the image).  Each query only visits one cell.
+///
+/// Example usage:
+/// @code
+/// SphereIndex index(sphere_centers, sphere_diameters);
+/// size_t sphere_id = index.FindSphere(location); // (0 if not in any sphere)
+/// @endcode
+
+class SphereIndex {
+
+  struct Sphere {
+    int center[3]; //!< the voxel at the center of the sphere
+    int R;         //!< the sphere occupies voxels within R of the center
+    int Rsqr;      //!< (in each direction) whose distance squared <= Rsqr
+  };
+
+  vector<Sphere> aSpheres;
+  int cell_width;     //!< width of each (cubic) cell (in voxels)
+  int origin[3];      //!< the voxel at the corner of cell (0,0,0)
+  int num_cells[3];   //!< number of cells in the x,y,z directions
+  vector<size_t> cell_begin; //!< the spheres overlapping cell i are stored in
+                             //!< aSphereIds[cell_begin[i]...cell_begin[i+1]-1]
+  vector<size_t> aSphereIds; //!< indices into aSpheres (in increasing order
+                             //!< within each cell)
+
+public:
+
+  /// @brief  Build the index.
+  template<typename Scalar>
+  SphereIndex(const vector<array<Scalar,3> >& sphere_centers, //!< location of the center of each sphere (in voxels)
+              const vector<Scalar>& sphere_diameters, //!< diameter of each sphere (in voxels)
+              int set_cell_width=0 //!< cell width (0 = choose automatically)
+              )
+  {
+    assert(sphere_centers.size() == sphere_diameters.size());
+    size_t N = sphere_centers.size();
+    aSpheres.resize(N);
+    int lo[3] = {0, 0, 0};
+    int hi[3] = {0, 0, 0};
+    double sum_width = 0.0;
+    for (size_t i = 0; i < N; i++) {
+      Sphere &s = aSpheres[i];
+      for (int d = 0; d < 3; d++)
+        s.center[d] = sphere_centers[i][d];
+      Scalar radius = sphere_diameters[i] / 2;
+      s.R = ceil(radius-0.5);
+      if (s.R < 0) s.R = 0;
+      s.Rsqr = ceil(radius*radius-0.5);
+      if (s.Rsqr < 0) s.Rsqr = 0;
+      for (int d = 0; d < 3; d++) {
+        if ((i == 0) || (s.center[d] - s.R < lo[d]))
+          lo[d] = s.center[d] - s.R;
+        if ((i == 0) || (s.center[d] + s.R > hi[d]))
+          hi[d] = s.center[d] + s.R;
+      }
+      sum_width += 2*s.R + 1;
+    }
+
+    // Choose the cell width so that there are no more cells than spheres,
+    // and so that cells are at least as wide as a typical sphere.
+    // (Then most spheres overlap no more than 8 cells.)
+    cell_width = set_cell_width;
+    if (cell_width <= 0) {
+      double volume = 1.0;
+      for (int d = 0; d < 3; d++)
+        volume *= (hi[d] - lo[d] + 1);
+      double n = std::max(N, size_t(1));
+      cell_width = static_cast<int>(ceil(cbrt(volume / n)));
+      cell_width = std::max(cell_width,
+                            static_cast<int>(ceil(sum_width / n)));
+      cell_width = std::max(cell_width, 1);
+    }
+    for (int d = 0; d < 3; d++) {
+      origin[d] = lo[d];
+      num_cells[d] = (hi[d] - lo[d]) / cell_width + 1;
+    }
+    if (N == 0)
+      for (int d = 0; d < 3; d++)
+        num_cells[d] = 0;
+
+    // Sort the spheres into cells (counting sort, performed in two passes).
+    // (The spheres in each cell remain in the order they appear in the list.)
+    size_t num_cells_tot = (size_t(num_cells[0]) *
+                            size_t(num_cells[1]) *
+                            size_t(num_cells[2]));
+    cell_begin.assign(num_cells_tot + 1, 0);
+    for (int pass = 0; pass < 2; pass++) {
+      vector<size_t> cell_end;
+      if (pass == 1) {
+        for (size_t i = 0; i < num_cells_tot; i++)
+          cell_begin[i+1] += cell_begin[i];
+        aSphereIds.resize(cell_begin[num_cells_tot]);
+        cell_end.assign(cell_begin.begin(), cell_begin.end()-1);
+      }
+      for (size_t i = 0; i < N; i++) {
+        const Sphere &s = aSpheres[i];
+        int c_lo[3], c_hi[3];
+        for (int d = 0; d < 3; d++) {
+          c_lo[d] = (s.center[d] - s.R - origin[d]) / cell_width;
+          c_hi[d] = (s.center[d] + s.R - origin[d]) / cell_width;
+        }
+        for (int cz = c_lo[2]; cz <= c_hi[2]; cz++) {
+          for (int cy = c_lo[1]; cy <= c_hi[1]; cy++) {
+            for (int cx = c_lo[0]; cx <= c_hi[0]; cx++) {
+              if (pass == 0)
+                cell_begin[Cell(cx, cy, cz) + 1]++;
+              else
+                aSphereIds[cell_end[Cell(cx, cy, cz)]++] = i;
+            }
+          }
+        }
+      }
+    }
+  } //SphereIndex()
+
+
+  /// @brief  The number of spheres.
+  size_t size() const {
+    return aSpheres.size();
+  }
+
+
+  /// @brief  Find the sphere containing "location".
+  /// @return 1 + the index of that sphere in the list of spheres
+  ///         (ie. the "sphere_id"), or 0 if it lies outside all of them.
+  ///         (If there are several, the last sphere in the list is chosen.)
+
+  template<typename Coordinate>
+  size_t FindSphere(const array<Coordinate, 3> &location) const {
+    int ixiyiz[3];
+    int c[3];
+    for (int d = 0; d < 3; d++) {
+      ixiyiz[d] = location[d]; //(truncate, as we would when drawing spheres)
+      int offset = ixiyiz[d] - origin[d];
+      if (offset < 0)
+        return 0;
+      c[d] = offset / cell_width;
+      if (c[d] >= num_cells[d])
+        return 0;
+    }
+    size_t i_cell = Cell(c[0], c[1], c[2]);
+    // Search the spheres in this cell in order of decreasing priority.
+    for (size_t j = cell_begin[i_cell+1]; j > cell_begin[i_cell]; j--) {
+      size_t i = aSphereIds[j-1];
+      const Sphere &s = aSpheres[i];
+      int jx = ixiyiz[0] - s.center[0];
+      int jy = ixiyiz[1] - s.center[1];
+      int jz = ixiyiz[2] - s.center[2];
+      if ((abs(jx) > s.R) || (abs(jy) > s.R) || (abs(jz) > s.R))
+        continue;
+      if (jx*jx + jy*jy + jz*jz <= s.Rsqr)
+        return i + 1;
+    }
+    return 0;
+  } //FindSphere()
+
+
+  /// @brief  Find the sphere containing each location in the "locations"
+  ///         list.  (The queries are carried out in parallel.)
+
+  template<typename Coordinate, typename Integer>
+  void FindSphere(const vector<array<Coordinate, 3> > &locations, //!< find the spheres containing these locations
+                  vector<Integer> &sphere_ids //!< store 1+the index of each sphere here (or 0)
+                  ) const
+  {
+    sphere_ids.resize(locations.size());
+    #pragma omp parallel for
+    for (size_t i = 0; i < locations.size(); i++)
+      sphere_ids[i] = FindSphere(locations[i]);
+  }
+
+
+private:
+
+  size_t Cell(int cx, int cy, int cz) const {
+    return (size_t(cz)*num_cells[1] + cy)*num_cells[0] + cx;
+  }
+
+}; // class SphereIndex
+
+
+
+} //namespace visfd
+
+
+
+#endif //#ifndef _SPHERE_INDEX_HPP
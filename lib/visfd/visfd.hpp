@@ -25,9 +25,19 @@
 #include <visfd_utils.hpp>    // defines invert_permutation(), AveArray(), ...
 #include <alloc2d.hpp>        // defines Alloc2D() and Deallox2D()
 #include <alloc3d.hpp>        // defines Alloc3D() and Dealloc3D()
+#include <volume_arena.hpp>   // defines "VolumeArena" (used by Alloc3D())
 #include <filter1d.hpp>       // defines "Filter1D" (used in ApplySeparable())
+#include <brick_occupancy.hpp>  // defines "BrickOccupancy" (used in ApplySeparable())
 #include <filter2d.hpp>       // defines "Filter2D"
+#include <fft.hpp>            // defines FFT1D, FFT3D(), ConvolveFFT3D()
+#include <scale_space.hpp>    // defines "ScaleSpaceLoG", "ScaleSpaceGauss"
+#include <pyramid.hpp>        // defines "ImagePyramid" (used by BlobDog())
+#include <hierarchical_queue.hpp> // defines "HierarchicalQueue" (used by Watershed())
+#include <distance_transform.hpp> // defines DistanceTransform()
+#include <voxel_index.hpp>    // defines "NearestVoxelIndex"
+#include <sphere_index.hpp>   // defines "SphereIndex" (used by FindSpheres())
 #include <multichannel_image3d.hpp> // defines "CompactMultiChannelImage3D"
+#include <compact_scalar.hpp>   // defines "Half", "SNorm16", "SNorm8"
 
 
 #endif //#ifndef _VISFD_HPP
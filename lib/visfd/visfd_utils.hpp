@@ -11,8 +11,10 @@
 #include <cassert>
 #include <limits>
 #include <algorithm>
+#include <array>
 using namespace std;
 #include <alloc3d.hpp>
+#include <sphere_index.hpp> // defines "SphereIndex" (used by FindSpheres())
 
 
 #include <eigen3_simple.hpp>  //defines namespace selfadjoint_eigen3
@@ -90,6 +92,9 @@ apply_permutation(const vector<Integer>& p,
 /// @note   In this variant of the function, the "nearby_location" and
 ///         "location" arguments are both of type C++-style std::array
 ///         instead of C-style pointers.
+/// @note   This function scans the entire image.  If you need to find the
+///         voxels nearest to many different locations, use the
+///         "NearestVoxelIndex" class (defined in voxel_index.hpp) instead.
 
 template<typename Scalar, typename Label, typename Coordinate>
 
@@ -330,88 +335,18 @@ FindSpheres(const vector<array<Scalar,3> >& crds, //!< locations of blob-like th
              vector<Integer>& sphere_ids, //!< stores which sphere contains that position (beginning at 1), or 0 if none
              const vector<array<Scalar,3> >& sphere_center_crds, //!< location of the center of each sphere (sorted in order of increasing priority)
              const vector<Scalar>& sphere_diameters,  //!< diameger of each blob (sorted in increasing priority)
-             ostream *pReportProgress = nullptr //!< report progress back to the user?
+             ostream * /*pReportProgress*/ = nullptr //!< (unused. This is fast now, so there is no progress to report.)
              )
 {
   // The caller has supplied us with a list of locations within the image
   // corresponding to where they believe certain blobs are located.
   // We need to figure out which blobs they are referring to.
-  // One fast way to do that is to create a lookup table (aaaiWhichBlob).
-  // Assign each voxel to the blob that occupies it (if any).
-  // (If multiple overlapping blobs occupy this voxel, 
-  //  then give preference to the blob among them with the highest score.)
-  // Later we will use this lookup table to see which blob 
-  // each one of our training data voxel locations belongs to (if any).
-  if (pReportProgress)
-    *pReportProgress
-      << " -- Attempting to allocate space for one more image.       --\n"
-      << " -- (If this crashes your computer, find a computer with   --\n"
-      << " --  more RAM and use \"ulimit\", OR use a smaller image.)   --\n";
-
-  // We did not ask the caller to supply the size of the image from which
-  // these blobs were discovered.  We don't have to know the exact size of
-  // the image, but we do need to create a lookup table large enough to
-  // store the blobs associated with each of the voxel locations in the
-  // training data.  So we use the maximum coordinates in this data as our
-  // "image_size" (ie. our lookup table size).
-  int image_size[3] = {0, 0, 0};
-  for (size_t i = 0; i < crds.size(); i++)
-    for (int d = 0; d < 3; d++)
-      if (image_size[d] <= crds[i][d])
-        image_size[d] = crds[i][d] + 1;
-
-  // Now allocate the lookup table
-  Integer ***aaaiWhichBlob;
-  Integer *afWhichBlob;
-  Alloc3D(image_size,
-          &afWhichBlob,
-          &aaaiWhichBlob);
-  const Integer UNOCCUPIED = 0;
-
-  // Initialize the lookup table:
-  for (int iz = 0; iz < image_size[2]; iz++)
-    for (int iy = 0; iy < image_size[1]; iy++)
-      for (int ix = 0; ix < image_size[0]; ix++)
-        aaaiWhichBlob[iz][iy][ix] = UNOCCUPIED;
-
-  // Loop over blobs and fill the lookup table (aaaiWhichBlob)  (Note: This
-  // only works if the blobs have already been sorted in increasing priority.)
-  for (size_t i=0; i < sphere_center_crds.size(); i++) {
-    int ix = sphere_center_crds[i][0];
-    int iy = sphere_center_crds[i][1];
-    int iz = sphere_center_crds[i][2];
-    int R = ceil(sphere_diameters[i]/2-0.5);
-    if (R < 0) R = 0;
-    int Rsqr = ceil(SQR(sphere_diameters[i]/2)-0.5);
-    if (Rsqr < 0) Rsqr = 0;
-    for (int jz = -R; jz <= R; jz++) {
-      for (int jy = -R; jy <= R; jy++) {
-        for (int jx = -R; jx <= R; jx++) {
-          int rsqr = jx*jx + jy*jy + jz*jz;
-          if (rsqr > Rsqr)
-            continue;
-          else if ((ix+jx < 0) ||
-                   (ix+jx >= image_size[0]) ||
-                   (iy+jy < 0) ||
-                   (iy+jy >= image_size[1]) ||
-                   (iz+jz < 0) ||
-                   (iz+jz >= image_size[2]))
-            continue;
-          else
-            aaaiWhichBlob[iz+jz][iy+jy][ix+jx] = i+1;
-        }
-      }
-    }
-  } //for (size_t i=0; i < sphere_center_crds.size(); i++)
-
-  sphere_ids.clear();
-  for (size_t i = 0; i < crds.size(); i++) {
-    int ix = crds[i][0];
-    int iy = crds[i][1];
-    int iz = crds[i][2];
-    ptrdiff_t which_blob = aaaiWhichBlob[iz][iy][ix];
-    sphere_ids.push_back(which_blob);
-  }
+  // To do that, we use a spatial index (SphereIndex) whose size is
+  // proportional to the number of spheres (not the size of the image).
+  // (The results are the same as we would get by drawing every sphere
+  //  into an image, and looking up which sphere occupies each voxel.)
+  SphereIndex sphere_index(sphere_center_crds, sphere_diameters);
+  sphere_index.FindSphere(crds, sphere_ids);
 
 } // FindSpheres()
 
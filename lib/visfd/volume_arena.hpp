@@ -0,0 +1,279 @@
+///   @file volume_arena.hpp
+///   @brief a pool of (aligned) memory blocks which are recycled when the
+///          3D arrays created by Alloc3D() are deallocated
+
+#ifndef _VOLUME_ARENA_HPP
+#define _VOLUME_ARENA_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <algorithm>
+#include <map>
+#include <list>
+#include <mutex>
+#include <ostream>
+#include <iomanip>
+#if defined(__linux__) && !defined(DISABLE_HUGEPAGES)
+#include <sys/mman.h>   // defines madvise()
+#endif
+#include <err_visfd.hpp> // defines the "VisfdErr" exception type
+using namespace std;
+
+
+
+namespace visfd {
+
+
+
+/// @brief  Every block of memory handed out by VolumeArena is aligned to
+///         (at least) this many bytes (the width of a cache line).
+const size_t VOLUME_ARENA_ALIGNMENT = 64;
+
+/// @brief  Blocks at least this large are aligned to (and rounded up to
+///         a multiple of) the size of a "huge page" (2 MiB on x86-64).
+///         On linux, the kernel is also advised to back them with huge pages.
+const size_t VOLUME_ARENA_HUGE_PAGE = 2*1024*1024;
+
+/// @brief  The default limit on the amount of unused memory which is kept
+///         for later re-use (see VolumeArena::SetCacheLimit()).
+const size_t VOLUME_ARENA_CACHE_LIMIT = size_t(4)*1024*1024*1024;
+
+
+
+/// @class  VolumeArena
+/// @brief  Programs which process large images create (and destroy) many
+///         large temporary arrays of similar sizes (one for each filtered
+///         image, denominator, gradient, etc...).  Instead of returning these
+///         arrays to the operating system after each use, VolumeArena keeps
+///         them (up to a limit) and hands them out again when an array of
+///         a similar size is requested later.  This avoids the cost of asking
+///         the operating system for fresh pages (which must be zeroed and
+///         mapped one page-fault at a time), and keeps the memory footprint
+///         of the program predictable.  It also records the peak amount of
+///         memory that was in use, which can be printed using Report().
+///
+///         Alloc3D() and Dealloc3D() use the global arena (Global()).
+///         This class is thread-safe.
+///
+/// Example usage:
+/// @code
+/// void *p = VolumeArena::Global().Acquire(nbytes);
+/// ...
+/// VolumeArena::Global().Release(p);
+/// VolumeArena::Global().Report(cerr);
+/// @endcode
+
+class VolumeArena {
+
+  struct Block {
+    void *raw;       //!< the pointer returned by operator new
+    size_t capacity; //!< the (usable) size of the block in bytes
+  };
+
+  mutex lock;
+  map<void*, Block> blocks_in_use; //!< blocks handed out (by address)
+  multimap<size_t, void*> free_by_size; //!< unused blocks (by capacity)
+  map<void*, Block> blocks_free; //!< unused blocks (by address)
+  list<void*> free_order; //!< unused blocks (oldest first)
+
+  size_t bytes_in_use;
+  size_t bytes_in_use_peak;
+  size_t bytes_cached;
+  size_t cache_limit;
+  size_t num_acquired;
+  size_t num_reused;
+
+public:
+
+  VolumeArena():
+    bytes_in_use(0),
+    bytes_in_use_peak(0),
+    bytes_cached(0),
+    cache_limit(VOLUME_ARENA_CACHE_LIMIT),
+    num_acquired(0),
+    num_reused(0)
+  { }
+
+
+  ~VolumeArena() {
+    Trim(0);
+  }
+
+
+  /// @brief  The arena used by Alloc3D() and Dealloc3D().
+  ///         (It is never destroyed, so it remains usable while other
+  ///          global or static objects are being destroyed at exit.)
+  static VolumeArena &Global() {
+    static VolumeArena *pArena = new VolumeArena;
+    return *pArena;
+  }
+
+
+  /// @brief  Obtain a block of at least "nbytes" bytes of memory.
+  ///         The block is aligned to VOLUME_ARENA_ALIGNMENT bytes (or to
+  ///         VOLUME_ARENA_HUGE_PAGE bytes, if it is that large).
+  /// @param  pIsNew (optional) is set to true if the block was just
+  ///         obtained from the operating system (and has never been touched).
+  void *Acquire(size_t nbytes, bool *pIsNew = nullptr) {
+    size_t align = Alignment(nbytes);
+    size_t capacity = RoundUp(std::max(nbytes, size_t(1)), align);
+    lock_guard<mutex> guard(lock);
+    num_acquired++;
+    // Look for the smallest unused block which is large enough (but not
+    // wastefully large: no more than 1/8 larger than we need).
+    auto pFree = free_by_size.lower_bound(capacity);
+    if ((pFree != free_by_size.end()) &&
+        (pFree->first <= capacity + capacity/8)) {
+      void *p = pFree->second;
+      free_by_size.erase(pFree);
+      auto pBlock = blocks_free.find(p);
+      assert(pBlock != blocks_free.end());
+      Block block = pBlock->second;
+      blocks_free.erase(pBlock);
+      free_order.remove(p);
+      bytes_cached -= block.capacity;
+      blocks_in_use[p] = block;
+      AddInUse(block.capacity);
+      num_reused++;
+      if (pIsNew)
+        *pIsNew = false;
+      return p;
+    }
+    // Otherwise, ask the operating system for a new block.
+    Block block;
+    block.capacity = capacity;
+    block.raw = ::operator new(capacity + align);
+    void *p = reinterpret_cast<void*>
+      (RoundUp(reinterpret_cast<uintptr_t>(block.raw), align));
+    #if defined(__linux__) && defined(MADV_HUGEPAGE) && !defined(DISABLE_HUGEPAGES)
+    if (align == VOLUME_ARENA_HUGE_PAGE)
+      madvise(p, capacity, MADV_HUGEPAGE); // (This is only a hint.)
+    #endif
+    blocks_in_use[p] = block;
+    AddInUse(block.capacity);
+    if (pIsNew)
+      *pIsNew = true;
+    return p;
+  } //Acquire()
+
+
+  /// @brief  Return a block (obtained from Acquire()) to the arena.
+  ///         The block is kept for re-use, unless this would cause the
+  ///         amount of unused memory to exceed the cache limit, in which
+  ///         case the oldest unused blocks are returned to the system.
+  ///         (A VisfdErr exception is thrown if p did not come from Acquire().)
+  void Release(void *p) {
+    if (! p)
+      return;
+    lock_guard<mutex> guard(lock);
+    auto pBlock = blocks_in_use.find(p);
+    if (pBlock == blocks_in_use.end())
+      throw VisfdErr("Error: VolumeArena::Release() was passed a pointer which\n"
+                     "       was not allocated by this arena (or was released twice).\n");
+    Block block = pBlock->second;
+    blocks_in_use.erase(pBlock);
+    bytes_in_use -= block.capacity;
+    blocks_free[p] = block;
+    free_by_size.insert(pair<size_t, void*>(block.capacity, p));
+    free_order.push_back(p);
+    bytes_cached += block.capacity;
+    TrimUnlocked(cache_limit);
+  } //Release()
+
+
+  /// @brief  Set the maximum amount of unused memory (in bytes) kept by
+  ///         the arena for later re-use.  (0 disables caching.)
+  void SetCacheLimit(size_t max_bytes_cached) {
+    lock_guard<mutex> guard(lock);
+    cache_limit = max_bytes_cached;
+    TrimUnlocked(cache_limit);
+  }
+
+
+  /// @brief  Return unused blocks to the system until at most
+  ///         "max_bytes_cached" bytes remain in the cache.
+  void Trim(size_t max_bytes_cached = 0) {
+    lock_guard<mutex> guard(lock);
+    TrimUnlocked(max_bytes_cached);
+  }
+
+
+  /// @brief  The number of bytes currently handed out.
+  size_t BytesInUse() {
+    lock_guard<mutex> guard(lock);
+    return bytes_in_use;
+  }
+
+  /// @brief  The largest number of bytes which were handed out at once.
+  size_t BytesInUsePeak() {
+    lock_guard<mutex> guard(lock);
+    return bytes_in_use_peak;
+  }
+
+
+  /// @brief  Print a (one line) summary of the memory used.
+  void Report(ostream &out) {
+    lock_guard<mutex> guard(lock);
+    const double MiB = 1024.0 * 1024.0;
+    out << "  peak memory used by 3D arrays: "
+        << fixed << setprecision(1) << bytes_in_use_peak / MiB << " MiB"
+        << " (" << num_acquired << " allocations, "
+        << num_reused << " of them re-used)" << "\n";
+    out.unsetf(ios_base::floatfield);
+    out << setprecision(6);
+  }
+
+
+private:
+
+  static size_t Alignment(size_t nbytes) {
+    return ((nbytes >= VOLUME_ARENA_HUGE_PAGE)
+            ? VOLUME_ARENA_HUGE_PAGE
+            : VOLUME_ARENA_ALIGNMENT);
+  }
+
+  static size_t RoundUp(size_t n, size_t align) {
+    return ((n + align - 1) / align) * align;
+  }
+
+  void AddInUse(size_t capacity) {
+    bytes_in_use += capacity;
+    if (bytes_in_use > bytes_in_use_peak)
+      bytes_in_use_peak = bytes_in_use;
+  }
+
+  void TrimUnlocked(size_t max_bytes_cached) {
+    while ((bytes_cached > max_bytes_cached) && (! free_order.empty())) {
+      void *p = free_order.front();
+      free_order.pop_front();
+      auto pBlock = blocks_free.find(p);
+      assert(pBlock != blocks_free.end());
+      Block block = pBlock->second;
+      blocks_free.erase(pBlock);
+      auto range = free_by_size.equal_range(block.capacity);
+      for (auto q = range.first; q != range.second; q++) {
+        if (q->second == p) {
+          free_by_size.erase(q);
+          break;
+        }
+      }
+      bytes_cached -= block.capacity;
+      ::operator delete(block.raw);
+    }
+  }
+
+  // Disable copying
+  VolumeArena(const VolumeArena&);
+  VolumeArena& operator = (const VolumeArena&);
+
+}; // class VolumeArena
+
+
+
+} //namespace visfd
+
+
+
+#endif //#ifndef _VOLUME_ARENA_HPP
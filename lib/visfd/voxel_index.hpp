@@ -0,0 +1,266 @@
+///   @file voxel_index.hpp
+///   @brief a spatial index which can quickly find the voxel (from a
+///          selected set of voxels) which lies closest to a given location
+
+#ifndef _VOXEL_INDEX_HPP
+#define _VOXEL_INDEX_HPP
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <set>
+#include <array>
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+
+
+namespace visfd {
+
+
+
+/// @class  NearestVoxelIndex
+/// @brief  This class finds the voxel (from a set of selected voxels) which
+///         lies closest to a given location.  It answers the same question
+///         as FindNearestVoxel().  But instead of scanning the entire image
+///         for every query, the selected voxels are sorted into a uniform
+///         grid of cubic cells once (in the constructor).  Each query only
+///         visits the cells near the query location (in expanding shells),
+///         which typically requires O(1) time (or O(log N) in the worst
+///         case for reasonably distributed voxels).
+///
+///         The results are identical to FindNearestVoxel(), including ties.
+///         (When several voxels are equally close, the voxel which appears
+///         first in the image, in z,y,x order, is chosen.)
+///
+/// Example usage:
+/// @code
+/// set<int> ignore = {UNDEFINED};
+/// NearestVoxelIndex index(image_size, aaaiLabels, aaafMask, ignore, true);
+/// index.FindNearest(nearby_location, nearest_location);  // one query
+/// index.FindNearest(vNearbyLocations, vNearestLocations); // many queries
+/// @endcode
+
+class NearestVoxelIndex {
+
+  int image_size[3];
+  int cell_width;     //!< width of each (cubic) cell (in voxels)
+  int num_cells[3];   //!< number of cells in the x,y,z directions
+  vector<size_t> cell_begin; //!< the voxels in cell i are stored in
+                             //!< aVoxels[cell_begin[i]...cell_begin[i+1]-1]
+  vector<array<int, 3> > aVoxels; //!< locations of the selected voxels
+                                   //!< (in z,y,x order within each cell)
+
+public:
+
+  /// @brief  Build the index.  Only voxels whose corresponding entry in the
+  ///         aaaiVoxels[][][] array belong to "select_these_voxel_types"
+  ///         (AND whose corresponding entry in aaafMask[][][] is not zero)
+  ///         will be considered (unless "invert_selection" is true).
+  ///         These arguments have the same meaning they do in
+  ///         FindNearestVoxel().
+
+  template<typename Scalar, typename Label>
+  NearestVoxelIndex(int const set_image_size[3], //!< #voxels in xyz
+                    Label const *const *const *aaaiVoxels, //!< some property associated with each voxel
+                    Scalar const *const *const *aaafMask, //!< optional: Ignore voxels whose mask value is 0
+                    const set<Label> &select_these_voxel_types, //!< voxels must have one of these properties
+                    bool invert_selection=false, //!< (...or NOT one of these properties)
+                    int set_cell_width=0 //!< cell width (0 = choose automatically)
+                    )
+  {
+    assert(aaaiVoxels);
+    for (int d = 0; d < 3; d++)
+      image_size[d] = set_image_size[d];
+
+    // Decide which voxels are selected.
+    // (To avoid searching "select_these_voxel_types" for every voxel,
+    //  we handle the common case where it contains only one entry.)
+    bool single_type = (select_these_voxel_types.size() == 1);
+    Label the_type = Label();
+    if (single_type)
+      the_type = *select_these_voxel_types.begin();
+
+    vector<array<int, 3> > vSelected;
+    for (int iz=0; iz<image_size[2]; iz++) {
+      for (int iy=0; iy<image_size[1]; iy++) {
+        for (int ix=0; ix<image_size[0]; ix++) {
+          if (aaafMask && aaafMask[iz][iy][ix] == 0.0)
+            continue;
+          bool selected;
+          if (single_type)
+            selected = (aaaiVoxels[iz][iy][ix] == the_type);
+          else
+            selected = (select_these_voxel_types.find(aaaiVoxels[iz][iy][ix])
+                        != select_these_voxel_types.end());
+          if (invert_selection)
+            selected = !selected;
+          if (selected) {
+            array<int, 3> ixiyiz = {ix, iy, iz};
+            vSelected.push_back(ixiyiz);
+          }
+        }
+      }
+    }
+
+    // Choose a cell width so that each cell contains roughly 8 voxels.
+    cell_width = set_cell_width;
+    if (cell_width <= 0) {
+      double num_voxels = (double(image_size[0]) *
+                           double(image_size[1]) *
+                           double(image_size[2]));
+      double num_selected = std::max(vSelected.size(), size_t(1));
+      cell_width = static_cast<int>(ceil(cbrt(8.0*num_voxels/num_selected)));
+      cell_width = std::max(cell_width, 2);
+    }
+    for (int d = 0; d < 3; d++)
+      num_cells[d] = std::max((image_size[d] + cell_width - 1) / cell_width,
+                              1);
+
+    // Sort the voxels into cells (counting sort).
+    // (The voxels in each cell remain in the order they appear in the image.)
+    size_t num_cells_tot = (size_t(num_cells[0]) *
+                            size_t(num_cells[1]) *
+                            size_t(num_cells[2]));
+    cell_begin.assign(num_cells_tot + 1, 0);
+    for (auto p = vSelected.begin(); p != vSelected.end(); p++)
+      cell_begin[Cell((*p)[0]/cell_width,
+                      (*p)[1]/cell_width,
+                      (*p)[2]/cell_width) + 1]++;
+    for (size_t i = 0; i < num_cells_tot; i++)
+      cell_begin[i+1] += cell_begin[i];
+    aVoxels.resize(vSelected.size());
+    vector<size_t> cell_end(cell_begin.begin(), cell_begin.end()-1);
+    for (auto p = vSelected.begin(); p != vSelected.end(); p++)
+      aVoxels[cell_end[Cell((*p)[0]/cell_width,
+                            (*p)[1]/cell_width,
+                            (*p)[2]/cell_width)]++] = *p;
+  } //NearestVoxelIndex()
+
+
+  /// @brief  The number of selected voxels.
+  size_t size() const {
+    return aVoxels.size();
+  }
+
+
+  /// @brief  Find the selected voxel closest to "nearby_location".
+  ///         If there are no selected voxels, then the "nearest_location"
+  ///         will be set to (-1,-1,-1).  (This is what FindNearestVoxel()
+  ///         does as well.)
+
+  template<typename Coordinate>
+  void FindNearest(const array<Coordinate, 3> &nearby_location, //!< find the voxel closest to this
+                   array<Coordinate, 3> &nearest_location //!< and store the location of that voxel here.
+                   ) const
+  {
+    nearest_location[0] = -1; // an impossible initial value
+    nearest_location[1] = -1; // an impossible initial value
+    nearest_location[2] = -1; // an impossible initial value
+    if (aVoxels.size() == 0)
+      return;
+
+    // Find the cell containing nearby_location (or the closest cell,
+    // if nearby_location lies outside the image).
+    int c0[3];
+    for (int d = 0; d < 3; d++) {
+      double c = floor(nearby_location[d] / double(cell_width));
+      c = std::max(c, 0.0);
+      c = std::min(c, double(num_cells[d]-1));
+      c0[d] = static_cast<int>(c);
+    }
+    int max_shell = 0;
+    for (int d = 0; d < 3; d++)
+      max_shell = std::max(max_shell,
+                           std::max(c0[d], num_cells[d]-1-c0[d]));
+
+    double r_min_sq = -1.0; //special (uninitialized) impossible value
+    const array<int, 3> *pNearest = nullptr;
+
+    // Visit the cells in shells of increasing distance from cell c0.
+    // Every voxel in shell k lies at least (k-1)*cell_width away from
+    // nearby_location.  Once that exceeds the best distance found so far,
+    // we can stop looking.
+    for (int k = 0; k <= max_shell; k++) {
+      if (pNearest) {
+        double r_bound = (k-1) * cell_width;
+        if (r_bound*r_bound > r_min_sq)
+          break;
+      }
+      for (int cz = std::max(c0[2]-k, 0);
+           cz <= std::min(c0[2]+k, num_cells[2]-1); cz++) {
+        for (int cy = std::max(c0[1]-k, 0);
+             cy <= std::min(c0[1]+k, num_cells[1]-1); cy++) {
+          // If this row of cells is not on the surface of the shell,
+          // then we only need to visit the two cells at either end.
+          bool on_surface = ((abs(cz - c0[2]) == k) || (abs(cy - c0[1]) == k));
+          int cx_step = on_surface ? 1 : 2*k;
+          for (int cx = c0[0]-k; cx <= c0[0]+k; cx += cx_step) {
+            if ((cx < 0) || (cx >= num_cells[0]))
+              continue;
+            size_t i_cell = Cell(cx, cy, cz);
+            for (size_t i = cell_begin[i_cell]; i < cell_begin[i_cell+1]; i++){
+              const array<int, 3> &voxel = aVoxels[i];
+              double r_sq = 0.0;
+              for (int d = 0; d < 3; d++) {
+                double dx = nearby_location[d] - voxel[d];
+                r_sq += dx*dx;
+              }
+              if ((r_min_sq == -1.0) ||
+                  (r_sq < r_min_sq) ||
+                  ((r_sq == r_min_sq) && Precedes(voxel, *pNearest))) {
+                r_min_sq = r_sq;
+                pNearest = &voxel;
+              }
+            }
+          }
+        }
+      }
+    } //for (int k = 0; k <= max_shell; k++)
+
+    for (int d = 0; d < 3; d++)
+      nearest_location[d] = (*pNearest)[d];
+  } //FindNearest()
+
+
+  /// @brief  Find the selected voxels closest to each location in the
+  ///         "nearby_locations" list.  (The queries are carried out in
+  ///         parallel.)
+
+  template<typename Coordinate>
+  void FindNearest(const vector<array<Coordinate, 3> > &nearby_locations, //!< find the voxels closest to these locations
+                   vector<array<Coordinate, 3> > &nearest_locations //!< and store their locations here.
+                   ) const
+  {
+    nearest_locations.resize(nearby_locations.size());
+    #pragma omp parallel for schedule(dynamic)
+    for (size_t i = 0; i < nearby_locations.size(); i++)
+      FindNearest(nearby_locations[i], nearest_locations[i]);
+  }
+
+
+private:
+
+  size_t Cell(int cx, int cy, int cz) const {
+    return (size_t(cz)*num_cells[1] + cy)*num_cells[0] + cx;
+  }
+
+  // Does voxel a appear before voxel b in the image (in z,y,x order)?
+  static bool Precedes(const array<int, 3> &a, const array<int, 3> &b) {
+    if (a[2] != b[2])
+      return a[2] < b[2];
+    if (a[1] != b[1])
+      return a[1] < b[1];
+    return a[0] < b[0];
+  }
+
+}; // class NearestVoxelIndex
+
+
+
+} //namespace visfd
+
+
+
+#endif //#ifndef _VOXEL_INDEX_HPP
@@ -0,0 +1,33 @@
+#!/usr/bin/env bash
+
+VOXEL_WIDTH=19.2
+
+test_convolution() {
+    cd tests/
+
+    IN_FNAME_BASE="test_blob_detect"
+
+    # Filters which are not separable can be computed either directly or
+    # using FFTs.  Check that both methods produce the same image.
+    # (The padded image size for this file has factors of 3 and 5.)
+
+    for FILTER in "-dogg 60 120" "-ggauss 80 -exponent 1"; do
+        ../bin/filter_mrc/filter_mrc -w ${VOXEL_WIDTH} -mask ${IN_FNAME_BASE}_mask.rec -i ${IN_FNAME_BASE}.rec -o test_conv_fft.rec ${FILTER} -fft
+        assertTrue "Failure: \"${FILTER} -fft\" failed.  File \"test_conv_fft.rec\" not created" "[ -s test_conv_fft.rec ]"
+        ../bin/filter_mrc/filter_mrc -w ${VOXEL_WIDTH} -mask ${IN_FNAME_BASE}_mask.rec -i ${IN_FNAME_BASE}.rec -o test_conv_direct.rec ${FILTER} -no-fft
+        assertTrue "Failure: \"${FILTER} -no-fft\" failed.  File \"test_conv_direct.rec\" not created" "[ -s test_conv_direct.rec ]"
+        ../bin/combine_mrc/combine_mrc test_conv_fft.rec - test_conv_direct.rec test_conv_diff.rec
+
+        # Compare the largest difference with the largest brightness
+        MAX_DIFF=`../bin/print_mrc_stats/print_mrc_stats test_conv_diff.rec | awk '/(minimum|maximum) brightness/ {if ($3<0) $3=-$3; if ($3>m) m=$3} END {print m+0}'`
+        MAX_BRIGHT=`../bin/print_mrc_stats/print_mrc_stats test_conv_direct.rec | awk '/(minimum|maximum) brightness/ {if ($3<0) $3=-$3; if ($3>m) m=$3} END {print m+0}'`
+        assertTrue "Failure: \"${FILTER}\" results using -fft and -no-fft differ by ${MAX_DIFF} (max brightness ${MAX_BRIGHT})" "awk -v d=${MAX_DIFF} -v m=${MAX_BRIGHT} 'BEGIN {exit !((m > 0) && (d <= 1e-3*m))}'"
+    done
+
+    # Delete temporary files:
+    rm -rf test_conv_*
+
+  cd ../
+}
+
+. shunit2/shunit2
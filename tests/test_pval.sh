@@ -0,0 +1,35 @@
+#!/usr/bin/env bash
+
+test_pval_sparse_points() {
+  cd tests/
+    # Generate 40 points scattered (pseudo-randomly) throughout the image.
+    # The image is 22x32x27 voxels (voxel width 19.6).  When it is blurred
+    # using a narrow Gaussian, the density is 0 over most of the image.
+    awk 'BEGIN {
+      seed = 12345;
+      for (i = 0; i < 40; i++) {
+        seed = (seed * 1103515245 + 12345) % 2147483648;  x = (seed % 2200) / 100.0;
+        seed = (seed * 1103515245 + 12345) % 2147483648;  y = (seed % 3200) / 100.0;
+        seed = (seed * 1103515245 + 12345) % 2147483648;  z = (seed % 2700) / 100.0;
+        print x*19.6, y*19.6, z*19.6;
+      }
+    }' > test_pval_points.txt
+
+    ../bin/pval_mrc/pval_mrc -w 19.6 -i test_blob_detect.rec -crds test_pval_points.txt -scan 40 400 1.1 > test_pval_output.txt 2> test_log_e.txt
+    EXIT_STATUS=$?
+    assertTrue "Failure: pval_mrc did not exit normally for a sparse list of points" "[ $EXIT_STATUS -eq 0 ]"
+    # There should be one line of output for every sigma value (40*1.1^n<400)
+    N_LINES=`wc -l < test_pval_output.txt`
+    assertTrue "Failure: pval_mrc did not report results for every sigma value" "[ $N_LINES -eq 26 ]"
+
+    ../bin/pval_mrc/pval_mrc -w 19.6 -i test_blob_detect.rec -crds test_pval_points.txt -scan 100 400 1.1 > test_pval_output.txt 2> test_log_e.txt
+    EXIT_STATUS=$?
+    assertTrue "Failure: pval_mrc did not exit normally using large sigma values" "[ $EXIT_STATUS -eq 0 ]"
+    N_LINES=`wc -l < test_pval_output.txt`
+    assertTrue "Failure: pval_mrc did not report results for every sigma value" "[ $N_LINES -eq 16 ]"
+
+    rm -rf test_pval_points.txt test_pval_output.txt test_log_e.txt
+  cd ../
+}
+
+. shunit2/shunit2
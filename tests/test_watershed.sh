@@ -45,6 +45,17 @@ test_watershed() {
     assertTrue "Failure: The number of watershed basins in the image is not consistent with the message printed to the terminal." "[ $N_BASINS -eq $N_BASINS_IMAGE ]"
     assertTrue "Failure: The number of watershed basins does not equal the number of minima." "[ $N_BASINS -eq $N_MINIMA ]"
 
+    # Test "-watershed-blocks" (parallel).  On a (float) image without
+    # plateaus, the basins should be identical to the serial version.
+    ../bin/filter_mrc/filter_mrc -w ${VOXEL_WIDTH} -mask ${IN_FNAME_BASE}_mask.rec -i ${IN_FNAME_BASE}_gauss_${SIGMA}.rec -out ${OUT_FNAME_BASE}_blocks.rec -watershed minima -watershed-blocks 4 >& test_log_e.txt
+    assertTrue "Failure during watershed segmentation (-watershed-blocks):  File \"${OUT_FNAME_BASE}_blocks.rec\" not created" "[ -s ${OUT_FNAME_BASE}_blocks.rec ]"
+    N_BASINS_BLOCKS=`grep 'Number of basins found: ' < test_log_e.txt | awk '{print $5}'`
+    assertTrue "Failure: \"-watershed-blocks\" found a different number of basins." "[ $N_BASINS_BLOCKS -eq $N_BASINS ]"
+    ../bin/combine_mrc/combine_mrc ${OUT_FNAME_REC} - ${OUT_FNAME_BASE}_blocks.rec ${OUT_FNAME_BASE}_diff.rec
+    N_DIFF_MIN=`../bin/print_mrc_stats/print_mrc_stats ${OUT_FNAME_BASE}_diff.rec | grep "minimum brightness" | awk '{print $3}'`
+    N_DIFF_MAX=`../bin/print_mrc_stats/print_mrc_stats ${OUT_FNAME_BASE}_diff.rec | grep "maximum brightness" | awk '{print $3}'`
+    assertTrue "Failure: \"-watershed-blocks\" and serial watershed produced different basins." "[ $N_DIFF_MIN -eq 0 ] && [ $N_DIFF_MAX -eq 0 ]"
+
 
     # Now invert the image brightnesses (photo negative, dark <--> bright)
 
@@ -74,6 +85,15 @@ test_watershed() {
     N_BASINS_INV=`grep 'Number of clusters found: ' < test_log_e.txt | awk '{print $5}'`
     assertTrue "Failure: Either \"-connect\" argument or the \"-invert\" argument is behaving in an new and unnexpected way, or the extrema finding algorithm is failing" "[ $N_BASINS_INV -eq 2 ]"
 
+    # Test "-connect-blocks" (union-find).  The clusters should be identical.
+    ../bin/filter_mrc/filter_mrc -w ${VOXEL_WIDTH} -mask ${IN_FNAME_BASE}_mask.rec -i ${IN_FNAME_BASE}_gauss_${SIGMA}_inv.rec -out ${OUT_FNAME_BASE}_blocks.rec -connect 36.75 -connect-blocks 4 >& test_log_e.txt
+    N_CLUSTERS_BLOCKS=`grep 'Number of clusters found: ' < test_log_e.txt | awk '{print $5}'`
+    assertTrue "Failure: \"-connect-blocks\" found a different number of clusters than \"-connect\"." "[ $N_CLUSTERS_BLOCKS -eq $N_BASINS_INV ]"
+    ../bin/combine_mrc/combine_mrc ${OUT_FNAME_REC} - ${OUT_FNAME_BASE}_blocks.rec ${OUT_FNAME_BASE}_diff.rec
+    N_DIFF_MIN=`../bin/print_mrc_stats/print_mrc_stats ${OUT_FNAME_BASE}_diff.rec | grep "minimum brightness" | awk '{print $3}'`
+    N_DIFF_MAX=`../bin/print_mrc_stats/print_mrc_stats ${OUT_FNAME_BASE}_diff.rec | grep "maximum brightness" | awk '{print $3}'`
+    assertTrue "Failure: \"-connect-blocks\" and \"-connect\" produced different clusters." "[ $N_DIFF_MIN -eq 0 ] && [ $N_DIFF_MAX -eq 0 ]"
+
     # Create an image with two disconnected spheres (solid uniform brightness).
     # Check to make sure that -connect can detect both of them
 
@@ -86,8 +106,16 @@ test_watershed() {
     N_BASINS_UNIFORM=`grep 'Number of clusters found: ' < test_log_e.txt | awk '{print $5}'`
     assertTrue "Failure: Either \"-connect\" argument is failing to segment an image with identical adjacent voxel brightnesses" "[ $N_BASINS_UNIFORM -eq 2 ]"
 
+    ../bin/filter_mrc/filter_mrc -w ${VOXEL_WIDTH} -mask ${IN_FNAME_BASE}_mask.rec -i ${IN_FNAME_BASE}_spheres.rec -out ${OUT_FNAME_BASE}_blocks.rec -connect 0.5 -connect-blocks 4 >& test_log_e.txt
+    N_CLUSTERS_BLOCKS=`grep 'Number of clusters found: ' < test_log_e.txt | awk '{print $5}'`
+    assertTrue "Failure: \"-connect-blocks\" is failing to segment an image with identical adjacent voxel brightnesses" "[ $N_CLUSTERS_BLOCKS -eq 2 ]"
+    ../bin/combine_mrc/combine_mrc ${OUT_FNAME_REC} - ${OUT_FNAME_BASE}_blocks.rec ${OUT_FNAME_BASE}_diff.rec
+    N_DIFF_MIN=`../bin/print_mrc_stats/print_mrc_stats ${OUT_FNAME_BASE}_diff.rec | grep "minimum brightness" | awk '{print $3}'`
+    N_DIFF_MAX=`../bin/print_mrc_stats/print_mrc_stats ${OUT_FNAME_BASE}_diff.rec | grep "maximum brightness" | awk '{print $3}'`
+    assertTrue "Failure: \"-connect-blocks\" and \"-connect\" produced different clusters (uniform spheres)." "[ $N_DIFF_MIN -eq 0 ] && [ $N_DIFF_MAX -eq 0 ]"
+
     # Delete temporary files:
-    rm -rf "${OUT_FNAME_REC}" test_blob_detect_gauss_* test_log_e.txt test_1d_example_* test_spheres*
+    rm -rf "${OUT_FNAME_REC}" ${OUT_FNAME_BASE}_* "${IN_FNAME_BASE}_spheres.rec" test_blob_detect_gauss_* test_log_e.txt test_1d_example_* test_spheres*
     
   cd ../
 }